@@ -32,17 +32,28 @@ SOURCES += src/main.cpp\
     src/konfytPatchEngine.cpp \
     src/konfytPatch.cpp \
     src/konfytPatchLayer.cpp \
+    src/konfytLatencyHistogram.cpp \
     src/konfytLayerWidget.cpp \
     src/konfytFluidsynthEngine.cpp \
     src/konfytJackEngine.cpp \
+    src/konfytEffects.cpp \
     src/konfytDatabase.cpp \
     src/konfytProject.cpp \
     src/konfytDbTree.cpp \
     src/konfytMidiFilter.cpp \
     src/konfytProcess.cpp \
     src/konfytMidi.cpp \
-    src/konfytArrayList.cpp \
+    src/konfytMidiScheduler.cpp \
+    src/konfytRtMidiEvent.cpp \
+    src/konfytMidiTransform.cpp \
+    src/konfytRtList.cpp \
     src/konfytBridgeEngine.cpp \
+    src/konfytBridgeShm.cpp \
+    src/konfytSampleStreamer.cpp \
+    src/konfytSfLoader.cpp \
+    src/konfytSfz.cpp \
+    src/konfytSfzEngine.cpp \
+    src/konfytSfzInstrument.cpp \
     src/konfytBaseSoundEngine.cpp \
     src/konfytLscpEngine.cpp \
     src/menuEntryWidget.cpp \
@@ -66,10 +77,12 @@ HEADERS  += src/mainwindow.h \
     src/konfytPatchEngine.h \
     src/konfytPatch.h \
     src/konfytPatchLayer.h \
+    src/konfytLatencyHistogram.h \
     src/konfytLayerWidget.h \
     src/konfytFluidsynthEngine.h \
     src/konfytStructs.h \
     src/konfytJackEngine.h \
+    src/konfytEffects.h \
     src/konfytDatabase.h \
     src/konfytProject.h \
     src/konfytDbTree.h \
@@ -77,11 +90,21 @@ HEADERS  += src/mainwindow.h \
     src/konfytProcess.h \
     src/konfytJackStructs.h \
     src/konfytMidi.h \
-    src/konfytArrayList.h \
+    src/konfytMidiScheduler.h \
+    src/konfytRtMidiEvent.h \
+    src/konfytMidiTransform.h \
+    src/konfytRtList.h \
     src/konfytBridgeEngine.h \
+    src/konfytBridgeShm.h \
+    src/konfytSampleStreamer.h \
+    src/konfytSfLoader.h \
+    src/konfytSfz.h \
+    src/konfytSfzEngine.h \
+    src/konfytSfzInstrument.h \
     src/konfytBaseSoundEngine.h \
     src/konfytLscpEngine.h \
     src/konfytUtils.h \
+    src/lockfreeRingBuffer.h \
     src/menuEntryWidget.h \
     src/midiEventListWidgetAdapter.h \
     src/midiMapGraphWidget.h \
@@ -108,10 +131,12 @@ PKGCONFIG += lscp
 # or add it below.
 
 !KONFYT_NO_CARLA {
-    SOURCES += src/konfytCarlaEngine.cpp
-    HEADERS += src/konfytCarlaEngine.h
+    SOURCES += src/konfytCarlaEngine.cpp \
+        src/konfytBridgeClient.cpp
+    HEADERS += src/konfytCarlaEngine.h \
+        src/konfytBridgeClient.h
     DEFINES += KONFYT_USE_CARLA
-    PKGCONFIG += carla-standalone
+    PKGCONFIG += carla-standalone carla-native-plugin
 }
 
 # Fluidsynth
@@ -120,6 +145,9 @@ PKGCONFIG += fluidsynth
 # JACK
 PKGCONFIG += jack
 
+# POSIX shared memory (bridge mode)
+LIBS += -lrt
+
 # -fpermissive flags (making on Ubuntu Studio complains without this)
 QMAKE_CFLAGS += -fpermissive
 QMAKE_CXXFLAGS += -fpermissive
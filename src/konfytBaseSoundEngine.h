@@ -42,6 +42,15 @@ public:
     virtual QStringList audioOutJackPortNames(int id) = 0;
     virtual void removeSfz(int id) = 0;
     virtual void setGain(int id, float newGain) = 0;
+    /* Returns true if setGain() is applied by the engine itself. If false, the
+     * gain has to be applied to the audio received from the engine instead. */
+    virtual bool hasNativeGain() { return false; }
+    /* Returns the shared memory transport for the specified plugin if the
+     * engine does not use JACK ports for it, otherwise nullptr. */
+    virtual KonfytBridgeShm* bridgeTransport(int /*id*/) { return nullptr; }
+    /* Returns the instrument for the specified plugin if the engine renders it
+     * in the JACK process callback, otherwise nullptr. */
+    virtual KonfytSfzInstrument* nativeInstrument(int /*id*/) { return nullptr; }
 
 signals:
     void print(QString msg);
@@ -0,0 +1,242 @@
+/******************************************************************************
+ *
+ * Copyright 2026 Gideon van der Kolf
+ *
+ * This file is part of Konfyt.
+ *
+ *     Konfyt is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     Konfyt is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with Konfyt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include "konfytBridgeClient.h"
+
+#include <QFileInfo>
+
+#include <iostream>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+CARLA_BACKEND_USE_NAMESPACE
+
+#define KONFYT_BRIDGE_CLIENT_WAIT_MS 500
+
+KonfytBridgeClient::KonfytBridgeClient()
+{
+    memset(&host, 0, sizeof(host));
+    memset(&timeInfo, 0, sizeof(timeInfo));
+    memset(dummyIn, 0, sizeof(dummyIn));
+}
+
+KonfytBridgeClient::~KonfytBridgeClient()
+{
+    unloadPlugin();
+}
+
+/* Main loop of the bridge subprocess. Returns the process exit code. */
+int KonfytBridgeClient::run(QString shmName, QString sfzPath)
+{
+    if (!shm.open(shmName.toStdString())) {
+        print("Failed to open shared memory " + shmName);
+        return 1;
+    }
+    sampleRate = shm.sampleRate();
+
+    if (!loadPlugin(sfzPath)) {
+        return 2;
+    }
+
+    pid_t parent = getppid();
+    shm.childSetReady();
+
+    bool quit = false;
+    while (!quit) {
+        if (!shm.childWaitForCycle(KONFYT_BRIDGE_CLIENT_WAIT_MS)) {
+            // No cycle posted (JACK stopped or parent busy). Quit if the
+            // parent has died, otherwise keep waiting.
+            if (getppid() != parent) { break; }
+            quit = handleControlMessages();
+            continue;
+        }
+        quit = handleControlMessages();
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        renderCycle();
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        shm.childReportRenderTime( (end.tv_sec - start.tv_sec) * 1000000
+                                   + (end.tv_nsec - start.tv_nsec) / 1000 );
+
+        shm.childCycleDone();
+    }
+
+    unloadPlugin();
+    shm.close();
+    return 0;
+}
+
+bool KonfytBridgeClient::loadPlugin(QString sfzPath)
+{
+    desc = carla_get_native_rack_plugin();
+    if (!desc) {
+        print("Failed to get Carla rack plugin.");
+        return false;
+    }
+
+    host.handle = this;
+    host.resourceDir = "";
+    host.uiName = "Konfyt Bridge";
+    host.uiParentId = 0;
+    host.get_buffer_size = KonfytBridgeClient::hostGetBufferSize;
+    host.get_sample_rate = KonfytBridgeClient::hostGetSampleRate;
+    host.is_offline = KonfytBridgeClient::hostIsOffline;
+    host.get_time_info = KonfytBridgeClient::hostGetTimeInfo;
+    host.write_midi_event = KonfytBridgeClient::hostWriteMidiEvent;
+    host.dispatcher = KonfytBridgeClient::hostDispatcher;
+
+    pluginHandle = desc->instantiate(&host);
+    if (!pluginHandle) {
+        print("Failed to instantiate Carla rack plugin.");
+        return false;
+    }
+
+    carlaHandle = carla_create_native_plugin_host_handle(desc, pluginHandle);
+    if (!carlaHandle) {
+        print("Failed to create Carla host handle.");
+        return false;
+    }
+
+    QFileInfo info(sfzPath);
+    bool ok = carla_add_plugin(carlaHandle, BINARY_NATIVE, PLUGIN_SFZ,
+                               sfzPath.toLocal8Bit(),
+                               info.baseName().toLocal8Bit(),
+                               "", 0, nullptr, PLUGIN_OPTIONS_NULL);
+    if (!ok) {
+        print("Failed to load SFZ " + sfzPath + ": "
+              + QString(carla_get_last_error(carlaHandle)));
+        return false;
+    }
+    carla_set_active(carlaHandle, 0, true);
+
+    if (desc->activate) {
+        desc->activate(pluginHandle);
+    }
+
+    print("Bridge client loaded " + sfzPath);
+    return true;
+}
+
+void KonfytBridgeClient::unloadPlugin()
+{
+    if (!pluginHandle) { return; }
+
+    if (desc->deactivate) {
+        desc->deactivate(pluginHandle);
+    }
+    if (carlaHandle) {
+        carla_host_handle_free(carlaHandle);
+        carlaHandle = nullptr;
+    }
+    desc->cleanup(pluginHandle);
+    pluginHandle = nullptr;
+}
+
+/* Apply control messages from the parent. Returns true if the client should
+ * quit. */
+bool KonfytBridgeClient::handleControlMessages()
+{
+    bool quit = false;
+    KonfytBridgeControlMessage msg;
+    while (shm.childTakeControl(&msg)) {
+        switch (msg.type) {
+        case KonfytBridgeControlMessage::SetGain:
+            carla_set_volume(carlaHandle, 0, msg.value);
+            break;
+        case KonfytBridgeControlMessage::Quit:
+            quit = true;
+            break;
+        }
+    }
+    return quit;
+}
+
+void KonfytBridgeClient::renderCycle()
+{
+    uint32_t frames = shm.childFrames();
+    if (frames == 0) { return; }
+
+    if (frames != bufferSize) {
+        bufferSize = frames;
+        desc->dispatcher(pluginHandle, NATIVE_PLUGIN_OPCODE_BUFFER_SIZE_CHANGED,
+                         0, bufferSize, nullptr, 0);
+    }
+
+    uint32_t midiCount = shm.childMidiCount();
+    const KonfytBridgeMidiEvent* midi = shm.childMidi();
+    for (uint32_t i = 0; i < midiCount; i++) {
+        NativeMidiEvent& ev = midiEvents[i];
+        ev.time = (midi[i].time < frames) ? midi[i].time : frames - 1;
+        ev.port = 0;
+        ev.size = midi[i].size;
+        memcpy(ev.data, midi[i].data, KONFYT_BRIDGE_MIDI_DATA_MAX);
+        ev.data[3] = 0;
+    }
+
+    const float* inBuffers[2] = {dummyIn, dummyIn};
+    float* outBuffers[2] = {shm.childLeft(), shm.childRight()};
+    desc->process(pluginHandle, inBuffers, outBuffers, frames,
+                  midiEvents, midiCount);
+
+    timeInfo.frame += frames;
+}
+
+void KonfytBridgeClient::print(QString msg)
+{
+    std::cout << "Bridge client: " << msg.toStdString() << std::endl;
+}
+
+uint32_t KonfytBridgeClient::hostGetBufferSize(NativeHostHandle handle)
+{
+    return static_cast<KonfytBridgeClient*>(handle)->bufferSize;
+}
+
+double KonfytBridgeClient::hostGetSampleRate(NativeHostHandle handle)
+{
+    return static_cast<KonfytBridgeClient*>(handle)->sampleRate;
+}
+
+bool KonfytBridgeClient::hostIsOffline(NativeHostHandle /*handle*/)
+{
+    return false;
+}
+
+const NativeTimeInfo *KonfytBridgeClient::hostGetTimeInfo(NativeHostHandle handle)
+{
+    return &(static_cast<KonfytBridgeClient*>(handle)->timeInfo);
+}
+
+bool KonfytBridgeClient::hostWriteMidiEvent(NativeHostHandle /*handle*/,
+                                            const NativeMidiEvent* /*event*/)
+{
+    // MIDI output of the plugin is not used.
+    return false;
+}
+
+intptr_t KonfytBridgeClient::hostDispatcher(NativeHostHandle /*handle*/,
+                                            NativeHostDispatcherOpcode /*opcode*/,
+                                            int32_t /*index*/, intptr_t /*value*/,
+                                            void* /*ptr*/, float /*opt*/)
+{
+    return 0;
+}
@@ -0,0 +1,74 @@
+/******************************************************************************
+ *
+ * Copyright 2026 Gideon van der Kolf
+ *
+ * This file is part of Konfyt.
+ *
+ *     Konfyt is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     Konfyt is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with Konfyt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#ifndef KONFYT_BRIDGE_CLIENT_H
+#define KONFYT_BRIDGE_CLIENT_H
+
+#include "konfytBridgeShm.h"
+
+#include <carla/CarlaHost.h>
+#include <carla/CarlaNativePlugin.h>
+
+#include <QString>
+
+/* Runs in the bridge subprocess started by KonfytBridgeEngine. Loads an SFZ in
+ * a Carla rack plugin instance (without a JACK client) and renders it into the
+ * shared memory segment of the parent for each cycle the parent posts. */
+class KonfytBridgeClient
+{
+public:
+    KonfytBridgeClient();
+    ~KonfytBridgeClient();
+
+    int run(QString shmName, QString sfzPath);
+
+private:
+    KonfytBridgeShm shm;
+
+    const NativePluginDescriptor* desc = nullptr;
+    NativePluginHandle pluginHandle = nullptr;
+    NativeHostDescriptor host;
+    NativeTimeInfo timeInfo;
+    CarlaHostHandle carlaHandle = nullptr;
+    uint32_t bufferSize = 1024;
+    uint32_t sampleRate = 48000;
+    NativeMidiEvent midiEvents[KONFYT_BRIDGE_MIDI_MAX];
+    float dummyIn[KONFYT_BRIDGE_MAX_FRAMES];
+
+    bool loadPlugin(QString sfzPath);
+    void unloadPlugin();
+    bool handleControlMessages();
+    void renderCycle();
+    void print(QString msg);
+
+    // Carla native host callbacks
+    static uint32_t hostGetBufferSize(NativeHostHandle handle);
+    static double hostGetSampleRate(NativeHostHandle handle);
+    static bool hostIsOffline(NativeHostHandle handle);
+    static const NativeTimeInfo* hostGetTimeInfo(NativeHostHandle handle);
+    static bool hostWriteMidiEvent(NativeHostHandle handle, const NativeMidiEvent* event);
+    static intptr_t hostDispatcher(NativeHostHandle handle,
+                                   NativeHostDispatcherOpcode opcode,
+                                   int32_t index, intptr_t value, void* ptr,
+                                   float opt);
+};
+
+#endif // KONFYT_BRIDGE_CLIENT_H
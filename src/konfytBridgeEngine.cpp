@@ -20,21 +20,78 @@
  *****************************************************************************/
 
 #include "konfytBridgeEngine.h"
+#include "konfytSfzInstrument.h"
+
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QSaveFile>
+
+#include <atomic>
+#include <functional>
+#include <pthread.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+
+QJsonObject KonfytBridgeStatus::toJson() const
+{
+    QJsonObject o;
+    o["id"] = id;
+    o["state"] = state;
+    o["soundfile"] = soundfilePath;
+    o["pid"] = pid;
+    o["startCount"] = startCount;
+    o["crashes"] = crashes;
+    o["crashLoop"] = crashLoop;
+    o["restartDelayMs"] = restartDelayMs;
+    o["cpuTimeSecs"] = cpuTimeSecs;
+    o["cpuPercent"] = cpuPercent;
+    o["rssKb"] = rssKb;
+    o["dspLoad"] = dspLoad;
+    o["dspLoadMax"] = dspLoadMax;
+    o["lateCycles"] = (qint64)lateCycles;
+    o["droppedMidi"] = (qint64)droppedMidi;
+    return o;
+}
 
 KonfytBridgeEngine::KonfytBridgeEngine(QObject *parent) :
     KonfytBaseSoundEngine(parent)
 {
-
+    // Periodically sample health of subprocesses and update status info
+    statusTimer.setInterval(KONFYT_BRIDGE_STATUS_INTERVAL_MS);
+    connect(&statusTimer, &QTimer::timeout, this, [=](){
+        if (items.isEmpty()) { return; }
+        QList<int> ids = items.keys();
+        foreach (int id, ids) {
+            sampleHealth(items[id]);
+        }
+        sendAllStatusInfo();
+    });
 }
 
 KonfytBridgeEngine::~KonfytBridgeEngine()
 {
-    // Stop all processes
+    // Ask all processes to quit and kill those that haven't quit in time. The
+    // JACK client has been stopped before the engines are destroyed, so the
+    // shared memory is no longer used.
     foreach (int id, items.keys()) {
         KonfytBridgeItem &item = items[id];
+        item.quitRequested = true;
         item.process->blockSignals(true);
-        item.process->kill();
+        item.shm->sendControl(KonfytBridgeControlMessage::Quit);
+    }
+    QElapsedTimer quitTime;
+    quitTime.start();
+    foreach (int id, items.keys()) {
+        KonfytBridgeItem &item = items[id];
+        int timeout = qMax((qint64)0, KONFYT_BRIDGE_QUIT_TIMEOUT_MS - quitTime.elapsed());
+        if (!item.process->waitForFinished(timeout)) {
+            item.process->kill();
+            item.process->waitForFinished(100);
+        }
         delete item.process;
+        delete item.shm;
     }
 }
 
@@ -51,6 +108,8 @@ void KonfytBridgeEngine::setKonfytExePath(QString path)
 void KonfytBridgeEngine::initEngine(KonfytJackEngine *jackEngine)
 {
     jack = jackEngine;
+    statusTimer.start();
+    writeStatusFile();
     print("KonfytBridgeEngine initialised.");
 }
 
@@ -58,25 +117,39 @@ int KonfytBridgeEngine::addSfz(QString soundfilePath)
 {
     KonfytBridgeItem item;
 
-    item.soundfilePath = soundfilePath;
-
     int id = idCounter++;
-    item.jackname = jack->clientName() + "_subclient_" + n2s(id);
+    item.status.id = id;
+    item.status.soundfilePath = soundfilePath;
+
+    // Audio and MIDI is transported between this process and the bridge
+    // subprocess through shared memory (see KonfytBridgeShm).
+    item.shm = new KonfytBridgeShm();
+    std::string shmName = KonfytBridgeShm::nameForId(id);
+    if (!item.shm->create(shmName, jack->getSampleRate())) {
+        print("Failed to create shared memory for bridge client " + n2s(id));
+        delete item.shm;
+        return -1;
+    }
 
-    item.cmd = exePath + " -q -c -j " + item.jackname + " \"" + soundfilePath + "\"";
+    item.cmd = exePath + " --bridge-client " + QString::fromStdString(shmName)
+            + " \"" + soundfilePath + "\"";
 
     item.process = new QProcess();
     connect(item.process, &QProcess::started, this, [=](){
         KonfytBridgeItem &item = items[id];
-        item.state = "Started";
+        item.status.state = "Started";
+        item.status.pid = item.process->processId();
+        item.runTime.start();
+        item.lastCpuTicks = 0;
+        item.lastSampleTime.start();
+        // Gain is not retained by a restarted client
+        item.shm->sendControl(KonfytBridgeControlMessage::SetGain, item.gain);
         sendAllStatusInfo();
         print("Bridge client " + n2s(id) + " started.");
     });
     connect(item.process, static_cast<void (QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished),
-            this, [=](int returnCode, QProcess::ExitStatus /*exitStatus*/){
-        // Process has finished. Restart.
-        print("Bridge client " + n2s(id) + " stopped: " + n2s(returnCode) + ". Restarting...");
-        startProcess(id);
+            this, [=](int returnCode, QProcess::ExitStatus exitStatus){
+        onProcessFinished(id, returnCode, exitStatus);
     });
 
     items.insert(id, item);
@@ -90,53 +163,101 @@ QString KonfytBridgeEngine::pluginName(int id)
     return "bridge_" + n2s(id);
 }
 
-QString KonfytBridgeEngine::midiInJackPortName(int id)
+/* Bridge clients are not JACK clients and have no JACK ports. Audio and MIDI
+ * are transported through bridgeTransport(). */
+QString KonfytBridgeEngine::midiInJackPortName(int /*id*/)
 {
-    KONFYT_ASSERT_RETURN_VAL(items.contains(id), QString("Invalid id %1").arg(id));
-
-    KonfytBridgeItem &item = items[id];
-    return item.jackname + ":" + "midi_in_0"; // TODO BRIDGE Detect ports with less fragility
+    return "";
 }
 
-QStringList KonfytBridgeEngine::audioOutJackPortNames(int id)
+QStringList KonfytBridgeEngine::audioOutJackPortNames(int /*id*/)
 {
-    QStringList ret;
-
-    KONFYT_ASSERT_RETURN_VAL(items.contains(id), ret);
+    return QStringList();
+}
 
-    KonfytBridgeItem &item = items[id];
-    ret.append( item.jackname + ":" + "bus_0_L" ); // TODO BRIDGE Detect ports with less fragility
-    ret.append( item.jackname + ":" + "bus_0_R" ); // TODO BRIDGE Detect ports with less fragility
+KonfytBridgeShm *KonfytBridgeEngine::bridgeTransport(int id)
+{
+    KONFYT_ASSERT_RETURN_VAL(items.contains(id), nullptr);
 
-    return ret;
+    return items[id].shm;
 }
 
+/* The plugin must already have been removed from the JACK engine. */
 void KonfytBridgeEngine::removeSfz(int id)
 {
-    // TODO BRIDGE
-    print("TODO BRIDGE: removeSfz " + n2s(id));
+    KONFYT_ASSERT_RETURN(items.contains(id));
+
+    KonfytBridgeItem item = items.take(id);
+
+    QProcess* process = item.process;
+    disconnect(process, nullptr, this, nullptr);
+    if (process->state() == QProcess::NotRunning) {
+        // Client already exited (crash loop or waiting to be restarted), so
+        // finished will not be emitted again. A pending restart is skipped
+        // since the id is no longer in items and ids are never reused.
+        process->deleteLater();
+    } else {
+        // Ask the client to quit and kill it if it has not quit after a while.
+        item.shm->sendControl(KonfytBridgeControlMessage::Quit);
+        connect(process, static_cast<void (QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished),
+                process, &QObject::deleteLater);
+        // A client that is still starting and fails to start emits no finished
+        connect(process, &QProcess::errorOccurred, process, [=](){
+            if (process->state() == QProcess::NotRunning) { process->deleteLater(); }
+        });
+        QTimer::singleShot(KONFYT_BRIDGE_QUIT_TIMEOUT_MS, process, [=](){
+            process->kill();
+        });
+    }
+
+    // The client keeps its own mapping of the shared memory until it exits.
+    // The JACK thread may still be using the shared memory from an earlier
+    // graph, so it is unmapped once the JACK engine is done with it.
+    KonfytBridgeShm* shm = item.shm;
+    jack->deleteWhenUnused([shm]() { delete shm; });
+
+    print("Bridge client " + n2s(id) + " removed.");
+    sendAllStatusInfo();
 }
 
 void KonfytBridgeEngine::setGain(int id, float newGain)
 {
-    // TODO BRIDGE
-    print("TODO BRIDGE: setGain of " + n2s(id) + " to " + n2s(newGain));
+    KONFYT_ASSERT_RETURN(items.contains(id));
+
+    KonfytBridgeItem &item = items[id];
+    item.gain = newGain;
+    if (!item.shm->sendControl(KonfytBridgeControlMessage::SetGain, newGain)) {
+        print("Bridge client " + n2s(id) + " control queue full, gain not set.");
+    }
+}
+
+bool KonfytBridgeEngine::hasNativeGain()
+{
+    return true;
 }
 
 QString KonfytBridgeEngine::getAllStatusInfo()
 {
+    QList<KonfytBridgeStatus> all = getAllStatus();
+
     int crashes = 0;
-    QList<int> ids = items.keys();
-    for (int i=0; i < ids.count(); i++) {
-        KonfytBridgeItem &item = items[ids[i]];
-        if (item.startCount > 1) {
-            crashes += item.startCount-1;
-        }
+    uint32_t lateCycles = 0;
+    uint32_t droppedMidi = 0;
+    foreach (const KonfytBridgeStatus& status, all) {
+        crashes += status.crashes;
+        lateCycles += status.lateCycles;
+        droppedMidi += status.droppedMidi;
     }
 
     QString ret;
-    ret += "Subclients: " + n2s(ids.count()) + "\n";
+    ret += "Subclients: " + n2s(all.count()) + "\n";
     ret += "Crashes: " + n2s(crashes) + "\n";
+    ret += "Late cycles: " + n2s(lateCycles) + "\n";
+    ret += "Dropped MIDI events: " + n2s(droppedMidi) + "\n";
+    ret += "JACK DSP load: " + QString::number(jack->getDspLoad(), 'f', 1) + "%\n";
+    foreach (const KonfytBridgeStatus& status, all) {
+        ret += "\n" + getStatusInfo(status);
+    }
     return ret;
 }
 
@@ -147,28 +268,343 @@ void KonfytBridgeEngine::startProcess(int id)
     print("Bridge client " + n2s(id) + " starting:");
     print(   item.cmd);
 
-    item.startCount++;
-    item.state = "Starting...";
+    item.status.startCount++;
+    item.status.state = "Starting...";
+    item.status.restartDelayMs = 0;
     sendAllStatusInfo();
 
     item.process->start(item.cmd);
 }
 
-QString KonfytBridgeEngine::getStatusInfo(int id)
+/* Restart a subprocess that has crashed, with exponential backoff for repeated
+ * crashes. Restarting stops after KONFYT_BRIDGE_CRASH_LOOP_COUNT consecutive
+ * crashes without a stable run in between. A subprocess that was asked to quit
+ * or exited cleanly is not counted as a crash and not restarted. */
+void KonfytBridgeEngine::onProcessFinished(int id, int returnCode,
+                                           QProcess::ExitStatus exitStatus)
 {
-    if (!items.contains(id)) { return "Invalid id " + n2s(id); }
+    KONFYT_ASSERT_RETURN(items.contains(id));
     KonfytBridgeItem &item = items[id];
 
+    item.status.pid = 0;
+    if ( item.quitRequested
+         || ((exitStatus == QProcess::NormalExit) && (returnCode == 0)) ) {
+        item.status.state = "Stopped";
+        print("Bridge client " + n2s(id) + " exited.");
+        sendAllStatusInfo();
+        return;
+    }
+
+    item.status.crashes++;
+    if (item.runTime.isValid() && (item.runTime.elapsed() >= KONFYT_BRIDGE_STABLE_RUN_MS)) {
+        item.consecutiveCrashes = 0;
+    }
+    item.consecutiveCrashes++;
+
+    if (item.consecutiveCrashes >= KONFYT_BRIDGE_CRASH_LOOP_COUNT) {
+        item.status.crashLoop = true;
+        item.status.state = "Stopped (crash loop)";
+        print("Bridge client " + n2s(id) + " stopped: " + n2s(returnCode)
+              + ". Crashed " + n2s(item.consecutiveCrashes)
+              + " times in a row, not restarting.");
+        sendAllStatusInfo();
+        return;
+    }
+
+    int delay = KONFYT_BRIDGE_RESTART_DELAY_MIN_MS << (item.consecutiveCrashes - 1);
+    if (delay > KONFYT_BRIDGE_RESTART_DELAY_MAX_MS) {
+        delay = KONFYT_BRIDGE_RESTART_DELAY_MAX_MS;
+    }
+    item.status.restartDelayMs = delay;
+    item.status.state = "Restarting...";
+    print("Bridge client " + n2s(id) + " stopped: " + n2s(returnCode)
+          + ". Restarting in " + n2s(delay) + " ms...");
+    sendAllStatusInfo();
+
+    QTimer::singleShot(delay, this, [=](){
+        // Item may have been removed in the meantime. Ids are never reused, so
+        // a removed item can't be mistaken for a newer one.
+        if (!items.contains(id)) { return; }
+        startProcess(id);
+    });
+}
+
+/* Sample CPU time and memory usage of the subprocess from /proc, and DSP load
+ * and counters from the shared memory. */
+void KonfytBridgeEngine::sampleHealth(KonfytBridgeItem &item)
+{
+    KonfytBridgeStatus& status = item.status;
+
+    status.dspLoad = item.shm->childDspLoad();
+    status.dspLoadMax = item.shm->takeChildDspLoadMax();
+    status.lateCycles = item.shm->lateCycleCount();
+    status.droppedMidi = item.shm->droppedMidiCount();
+
+    if (status.pid <= 0) {
+        status.cpuPercent = 0;
+        status.rssKb = 0;
+        return;
+    }
+
+    // CPU time: utime and stime are fields 14 and 15 of /proc/<pid>/stat.
+    // Fields are counted after the command name, which may contain spaces.
+    QFile statFile(QString("/proc/%1/stat").arg(status.pid));
+    if (statFile.open(QIODevice::ReadOnly)) {
+        QString stat = QString(statFile.readAll());
+        QStringList fields = stat.mid(stat.lastIndexOf(')') + 2)
+                .split(' ', QString::SkipEmptyParts);
+        // fields[0] is field 3 (state)
+        qint64 ticks = fields.value(11).toLongLong() + fields.value(12).toLongLong();
+        long ticksPerSec = sysconf(_SC_CLK_TCK);
+        if (ticksPerSec > 0) {
+            status.cpuTimeSecs = (double)ticks / ticksPerSec;
+            qint64 ms = item.lastSampleTime.restart();
+            if ( (ms > 0) && (item.lastCpuTicks > 0) ) {
+                status.cpuPercent = 100.0 * (ticks - item.lastCpuTicks)
+                                    * 1000 / ticksPerSec / ms;
+            }
+        }
+        item.lastCpuTicks = ticks;
+    }
+
+    // Resident memory: second field of /proc/<pid>/statm, in pages.
+    QFile statmFile(QString("/proc/%1/statm").arg(status.pid));
+    if (statmFile.open(QIODevice::ReadOnly)) {
+        QStringList fields = QString(statmFile.readAll()).split(' ');
+        status.rssKb = fields.value(1).toLongLong() * sysconf(_SC_PAGESIZE) / 1024;
+    }
+}
+
+QString KonfytBridgeEngine::getStatusInfo(const KonfytBridgeStatus &status)
+{
     QString ret;
-    ret += "Subclient " + n2s(id) + "\n";
-    ret += "   State: " + item.state + "\n";
-    ret += "   StartCount: " + n2s(item.startCount) + "\n";
-    ret += "   Soundfile: " + item.soundfilePath + "\n";
+    ret += "Subclient " + n2s(status.id) + "\n";
+    ret += "   State: " + status.state + "\n";
+    ret += "   Soundfile: " + status.soundfilePath + "\n";
+    ret += "   PID: " + n2s(status.pid) + "\n";
+    ret += "   StartCount: " + n2s(status.startCount) + "\n";
+    ret += "   CPU: " + QString::number(status.cpuPercent, 'f', 1) + "% ("
+            + QString::number(status.cpuTimeSecs, 'f', 1) + " s)\n";
+    ret += "   RSS: " + n2s(status.rssKb / 1024) + " MB\n";
+    ret += "   DSP load: " + QString::number(status.dspLoad * 100, 'f', 1) + "% (max "
+            + QString::number(status.dspLoadMax * 100, 'f', 1) + "%)\n";
+    ret += "   Late cycles: " + n2s(status.lateCycles) + "\n";
+
+    return ret;
+}
 
+/* Structured status of all subprocesses, as sampled at the last status
+ * interval. */
+QList<KonfytBridgeStatus> KonfytBridgeEngine::getAllStatus()
+{
+    QList<KonfytBridgeStatus> ret;
+    foreach (const KonfytBridgeItem& item, items) {
+        ret.append(item.status);
+    }
     return ret;
 }
 
+QJsonObject KonfytBridgeEngine::getAllStatusJson()
+{
+    QJsonArray clients;
+    foreach (const KonfytBridgeStatus& status, getAllStatus()) {
+        clients.append(status.toJson());
+    }
+    QJsonObject o;
+    o["jackDspLoad"] = jack->getDspLoad();
+    o["clients"] = clients;
+    return o;
+}
+
+/* If set, the status is written as JSON to the specified file at every status
+ * interval, e.g. for monitoring when running headless. */
+void KonfytBridgeEngine::setStatusFilePath(QString path)
+{
+    statusFilePath = path;
+}
+
+/* If set, the object returned by the hook is added to the status file under
+ * "engine", e.g. the status of the JACK engine. */
+void KonfytBridgeEngine::setStatusFileHook(std::function<QJsonObject()> hook)
+{
+    statusFileHook = hook;
+}
+
 void KonfytBridgeEngine::sendAllStatusInfo()
 {
     emit statusInfo( getAllStatusInfo() );
+    writeStatusFile();
+}
+
+void KonfytBridgeEngine::writeStatusFile()
+{
+    if (statusFilePath.isEmpty()) { return; }
+
+    QSaveFile f(statusFilePath);
+    if (!f.open(QIODevice::WriteOnly)) { return; }
+    QJsonObject o = getAllStatusJson();
+    if (statusFileHook) {
+        o["engine"] = statusFileHook();
+    }
+    f.write(QJsonDocument(o).toJson());
+    f.commit();
+}
+
+/* Plays the sfz in the built-in sampler in real time at the specified period,
+ * first rendered in the cycle thread as an in-process instrument and then in a
+ * separate thread through the shared memory transport, and returns the number
+ * of cycles that missed their deadline for each. The cycle thread stands in for
+ * the JACK thread and is given realtime priority if permitted. The bridge
+ * client thread stands in for the subprocess, which is not run with realtime
+ * priority. For the transport, a cycle is late when the client has not
+ * finished the previous cycle in time (see KonfytBridgeShm). */
+QStringList KonfytBridgeEngine::runTransportBenchmark(QString sfzPath, int nframes,
+                                                      double sampleRate, int seconds)
+{
+    QStringList ret;
+
+    KonfytSampleStreamer streamer;
+    streamer.start();
+    KonfytSfzInstrument* instrument = new KonfytSfzInstrument(&streamer);
+    QString error;
+    if (!instrument->load(sfzPath, sampleRate, &error)) {
+        ret.append("Error: " + error);
+        delete instrument;
+        streamer.stop();
+        return ret;
+    }
+
+    const int cycles = qMax(1, (int)(sampleRate * seconds / nframes));
+    const int64_t periodNs = (int64_t)(nframes * 1e9 / sampleRate);
+    std::vector<float> left(nframes);
+    std::vector<float> right(nframes);
+
+    ret.append(QString("%1: %2 frames per cycle, %3 Hz, %4 cycles")
+               .arg(sfzPath).arg(nframes).arg(sampleRate).arg(cycles));
+
+    // Events of a cycle: a note-on every 4 cycles, released 96 cycles later
+    auto cycleMidi = [](int cycle, std::function<void(const unsigned char*, int)> write)
+    {
+        if (cycle % 4) { return; }
+        int n = cycle / 4;
+        unsigned char data[3];
+        KonfytRtMidiEvent ev;
+        ev.setNoteOn(36 + n % 48, 100);
+        write(data, ev.toBuffer(data));
+        if (n >= 24) {
+            ev.setNoteOff(36 + (n - 24) % 48, 0);
+            write(data, ev.toBuffer(data));
+        }
+    };
+
+    auto nowNs = []()
+    {
+        struct timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        return (int64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+    };
+
+    // Runs process() once per period in a thread and returns the number of
+    // cycles that finished after the start of the next period.
+    bool realtime = false;
+    auto runCycles = [&](std::function<void(int)> process)
+    {
+        int missed = 0;
+        std::thread t([&]()
+        {
+            struct sched_param param;
+            param.sched_priority = 70;
+            realtime = (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0);
+
+            int64_t next = nowNs();
+            for (int cycle = 0; cycle < cycles; cycle++) {
+                struct timespec ts;
+                ts.tv_sec = next / 1000000000;
+                ts.tv_nsec = next % 1000000000;
+                clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+                process(cycle);
+                next += periodNs;
+                int64_t end = nowNs();
+                if (end > next) {
+                    // Missed the deadline. Skip ahead like JACK.
+                    missed++;
+                    next = end;
+                }
+            }
+        });
+        t.join();
+        return missed;
+    };
+
+    // In-process: render in the cycle thread
+    int inProcessMissed = runCycles([&](int cycle)
+    {
+        cycleMidi(cycle, [&](const unsigned char* data, int size)
+        {
+            instrument->processMidi(KonfytRtMidiEvent(data, size), 0);
+        });
+        instrument->render(left.data(), right.data(), nframes);
+    });
+    ret.append(QString("in-process  missed cycles: %1").arg(inProcessMissed));
+
+    // Release all voices before the transport run
+    for (int c = 0; c < 16; c++) {
+        KonfytRtMidiEvent ev;
+        ev.channel = c;
+        ev.setCC(120, 0);
+        instrument->processMidi(ev, 0);
+    }
+    instrument->render(left.data(), right.data(), nframes);
+
+    // Transport: render in the client thread through shared memory
+    KonfytBridgeShm shm;
+    std::string shmName = KonfytBridgeShm::nameForId(0);
+    if (!shm.create(shmName, sampleRate)) {
+        ret.append("Error: Failed to create shared memory");
+        delete instrument;
+        streamer.stop();
+        return ret;
+    }
+    std::atomic<bool> stop {false};
+    std::thread client([&]()
+    {
+        KonfytBridgeShm clientShm;
+        if (!clientShm.open(shmName)) { return; }
+        clientShm.childSetReady();
+        while (!stop.load()) {
+            if (!clientShm.childWaitForCycle(100)) { continue; }
+            uint32_t frames = clientShm.childFrames();
+            const KonfytBridgeMidiEvent* midi = clientShm.childMidi();
+            for (uint32_t i = 0; i < clientShm.childMidiCount(); i++) {
+                instrument->processMidi(KonfytRtMidiEvent(midi[i].data, midi[i].size),
+                                       qMin(midi[i].time, frames - 1));
+            }
+            instrument->render(clientShm.childLeft(), clientShm.childRight(), frames);
+            clientShm.childCycleDone();
+        }
+        clientShm.close();
+    });
+
+    int transportMissed = runCycles([&](int cycle)
+    {
+        shm.parentReadAudio(left.data(), right.data(), nframes);
+        cycleMidi(cycle, [&](const unsigned char* data, int size)
+        {
+            shm.parentWriteMidi(data, size, 0);
+        });
+        shm.parentPostCycle(nframes);
+    });
+    stop.store(true);
+    client.join();
+    ret.append(QString("transport   missed cycles: %1, late client cycles: %2")
+               .arg(transportMissed).arg(shm.lateCycleCount()));
+    if (!realtime) {
+        ret.append("Note: No realtime priority for the cycle thread.");
+    }
+
+    shm.close();
+    delete instrument;
+    streamer.stop();
+
+    return ret;
 }
@@ -24,9 +24,42 @@
 
 #include "konfytBaseSoundEngine.h"
 
+#include <QElapsedTimer>
+#include <QJsonObject>
 #include <QObject>
 #include <QProcess>
+#include <QTimer>
 
+#include <functional>
+
+#define KONFYT_BRIDGE_STATUS_INTERVAL_MS 1000
+#define KONFYT_BRIDGE_RESTART_DELAY_MIN_MS 250
+#define KONFYT_BRIDGE_RESTART_DELAY_MAX_MS 16000
+#define KONFYT_BRIDGE_CRASH_LOOP_COUNT 5   // Consecutive crashes before giving up
+#define KONFYT_BRIDGE_STABLE_RUN_MS 30000  // Run time after which crash count is reset
+#define KONFYT_BRIDGE_QUIT_TIMEOUT_MS 2000 // Before a client asked to quit is killed
+
+/* Health of a bridge subprocess, sampled every KONFYT_BRIDGE_STATUS_INTERVAL_MS. */
+struct KonfytBridgeStatus
+{
+    int id = -1;
+    QString state;
+    QString soundfilePath;
+    qint64 pid = 0;
+    int startCount = 0;
+    int crashes = 0;
+    bool crashLoop = false;   // Stopped restarting due to repeated crashes
+    int restartDelayMs = 0;   // Delay of pending restart
+    double cpuTimeSecs = 0;   // Total CPU time of the current process
+    double cpuPercent = 0;    // CPU usage since the previous sample
+    qint64 rssKb = 0;         // Resident memory
+    float dspLoad = 0;        // Render time of last cycle as fraction of period
+    float dspLoadMax = 0;     // Max since the previous sample
+    uint32_t lateCycles = 0;
+    uint32_t droppedMidi = 0;
+
+    QJsonObject toJson() const;
+};
 
 class KonfytBridgeEngine : public KonfytBaseSoundEngine
 {
@@ -35,15 +68,20 @@ public:
 
     struct KonfytBridgeItem
     {
-        QString state;
-        int startCount;
+        KonfytBridgeStatus status;
 
         QProcess* process;
-        QString soundfilePath;
-        QString jackname;
+        KonfytBridgeShm* shm;
         QString cmd;
+        float gain = 1.0;
+        bool quitRequested = false; // Exit is expected, don't restart
+
+        int consecutiveCrashes = 0;
+        QElapsedTimer runTime;
+        qint64 lastCpuTicks = 0;
+        QElapsedTimer lastSampleTime;
 
-        KonfytBridgeItem() : startCount(0) {}
+        KonfytBridgeItem() : process(nullptr), shm(nullptr) {}
     };
 
     explicit KonfytBridgeEngine(QObject *parent = 0);
@@ -58,17 +96,33 @@ public:
     QStringList audioOutJackPortNames(int id);
     void removeSfz(int id);
     void setGain(int id, float newGain);
+    bool hasNativeGain();
+    KonfytBridgeShm* bridgeTransport(int id);
+    void setStatusFilePath(QString path);
+    void setStatusFileHook(std::function<QJsonObject()> hook);
+
+    QList<KonfytBridgeStatus> getAllStatus();
+    QJsonObject getAllStatusJson();
     QString getAllStatusInfo();
 
+    static QStringList runTransportBenchmark(QString sfzPath, int nframes,
+                                             double sampleRate, int seconds);
+
 private:
     KonfytJackEngine* jack = nullptr;
     QString exePath;
+    QString statusFilePath;
+    std::function<QJsonObject()> statusFileHook;
     int idCounter = 300;
     QMap<int, KonfytBridgeItem> items;
+    QTimer statusTimer;
 
     void startProcess(int id);
-    QString getStatusInfo(int id);
+    void onProcessFinished(int id, int returnCode, QProcess::ExitStatus exitStatus);
+    void sampleHealth(KonfytBridgeItem& item);
+    QString getStatusInfo(const KonfytBridgeStatus& status);
     void sendAllStatusInfo();
+    void writeStatusFile();
 };
 
 #endif // KONFYTBRIDGEENGINE_H
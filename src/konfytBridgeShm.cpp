@@ -0,0 +1,343 @@
+/******************************************************************************
+ *
+ * Copyright 2026 Gideon van der Kolf
+ *
+ * This file is part of Konfyt.
+ *
+ *     Konfyt is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     Konfyt is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with Konfyt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include "konfytBridgeShm.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <new>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+              "Futex words must be 32 bits");
+
+KonfytBridgeShm::~KonfytBridgeShm()
+{
+    close();
+}
+
+std::string KonfytBridgeShm::nameForId(int id)
+{
+    return "/konfyt_bridge_" + std::to_string(getpid()) + "_" + std::to_string(id);
+}
+
+/* Parent: create and map the shared memory segment. */
+bool KonfytBridgeShm::create(const std::string &name, uint32_t sampleRate)
+{
+    close();
+
+    int fd = shm_open(name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0600);
+    if (fd < 0) { return false; }
+    if (ftruncate(fd, sizeof(KonfytBridgeShmData)) != 0) {
+        ::close(fd);
+        shm_unlink(name.c_str());
+        return false;
+    }
+    void* mem = mmap(nullptr, sizeof(KonfytBridgeShmData),
+                     PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mem == MAP_FAILED) {
+        shm_unlink(name.c_str());
+        return false;
+    }
+    // Keep the segment resident so the JACK thread does not page fault.
+    mlock(mem, sizeof(KonfytBridgeShmData));
+
+    d = new (mem) KonfytBridgeShmData();
+    d->magic = KONFYT_BRIDGE_SHM_MAGIC;
+    d->version = KONFYT_BRIDGE_SHM_VERSION;
+    d->sampleRate = sampleRate;
+    // Child not ready until it has started (childSeq != parentSeq)
+    d->parentSeq.store(0);
+    d->childSeq.store(UINT32_MAX);
+    d->readySeq.store(UINT32_MAX);
+
+    mName = name;
+    mOwner = true;
+    mChildWasReady = false;
+    mPosted = 0;
+    return true;
+}
+
+/* Child: map an existing shared memory segment. */
+bool KonfytBridgeShm::open(const std::string &name)
+{
+    close();
+
+    int fd = shm_open(name.c_str(), O_RDWR, 0600);
+    if (fd < 0) { return false; }
+    void* mem = mmap(nullptr, sizeof(KonfytBridgeShmData),
+                     PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mem == MAP_FAILED) { return false; }
+
+    KonfytBridgeShmData* data = static_cast<KonfytBridgeShmData*>(mem);
+    if ( (data->magic != KONFYT_BRIDGE_SHM_MAGIC)
+         || (data->version != KONFYT_BRIDGE_SHM_VERSION) ) {
+        munmap(mem, sizeof(KonfytBridgeShmData));
+        return false;
+    }
+    mlock(mem, sizeof(KonfytBridgeShmData));
+
+    d = data;
+    mName = name;
+    mOwner = false;
+    return true;
+}
+
+void KonfytBridgeShm::close()
+{
+    if (!d) { return; }
+    munmap(d, sizeof(KonfytBridgeShmData));
+    d = nullptr;
+    if (mOwner) {
+        shm_unlink(mName.c_str());
+    }
+    mName.clear();
+    mOwner = false;
+}
+
+bool KonfytBridgeShm::isOpen() const
+{
+    return d != nullptr;
+}
+
+std::string KonfytBridgeShm::name() const
+{
+    return mName;
+}
+
+uint32_t KonfytBridgeShm::sampleRate() const
+{
+    if (!d) { return 0; }
+    return d->sampleRate;
+}
+
+/* Parent JACK thread: called at the start of a cycle. Copies the audio of the
+ * previously posted cycle if the child has completed it, otherwise outputs
+ * silence. Silence is also output if the child did not render the cycle but
+ * only marked itself ready after a (re)start. Never blocks. */
+void KonfytBridgeShm::parentReadAudio(float *left, float *right, uint32_t nframes)
+{
+    mChildWasReady = (d->childSeq.load(std::memory_order_acquire) == mPosted);
+    bool rendered = mChildWasReady
+            && (d->readySeq.load(std::memory_order_relaxed) != mPosted);
+    if (rendered && (mPosted != 0) && (nframes <= KONFYT_BRIDGE_MAX_FRAMES)) {
+        memcpy(left, d->audioLeft, sizeof(float) * nframes);
+        memcpy(right, d->audioRight, sizeof(float) * nframes);
+    } else {
+        memset(left, 0, sizeof(float) * nframes);
+        memset(right, 0, sizeof(float) * nframes);
+        if (!mChildWasReady && (mPosted != 0)) {
+            mLateCycles.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+}
+
+/* Parent JACK thread: add a MIDI event to the pending cycle. Events longer
+ * than KONFYT_BRIDGE_MIDI_DATA_MAX (e.g. SysEx) are not transported. */
+bool KonfytBridgeShm::parentWriteMidi(const unsigned char *data, int size, uint32_t time)
+{
+    if ( (size <= 0) || (size > KONFYT_BRIDGE_MIDI_DATA_MAX) ) {
+        mDroppedMidi.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    uint32_t slot = (mPosted + 1) & 1;
+    uint32_t n = d->midiCount[slot];
+    if (n >= KONFYT_BRIDGE_MIDI_MAX) {
+        mDroppedMidi.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    KonfytBridgeMidiEvent& ev = d->midi[slot][n];
+    // Events left pending from a late cycle keep their order but are moved
+    // to the start of the next cycle, so time must be non-decreasing.
+    ev.time = (n > 0 && d->midi[slot][n-1].time > time) ? d->midi[slot][n-1].time : time;
+    ev.size = size;
+    memcpy(ev.data, data, size);
+    d->midiCount[slot] = n + 1;
+    return true;
+}
+
+/* Parent JACK thread: called at the end of a cycle. Posts the pending cycle
+ * to the child if it has completed the previous one. */
+void KonfytBridgeShm::parentPostCycle(uint32_t nframes)
+{
+    if (!mChildWasReady) {
+        // Child is late. Pending MIDI is kept and posted with the next cycle,
+        // with timestamps moved to the start of the cycle.
+        uint32_t slot = (mPosted + 1) & 1;
+        for (uint32_t i = 0; i < d->midiCount[slot]; i++) {
+            d->midi[slot][i].time = 0;
+        }
+        return;
+    }
+    uint32_t next = mPosted + 1;
+    d->nframes[next & 1] = nframes;
+    d->parentSeq.store(next, std::memory_order_release);
+    futexWake(&d->parentSeq);
+    mPosted = next;
+    // The slot the child has finished with is the new pending slot.
+    d->midiCount[(next + 1) & 1] = 0;
+    mChildWasReady = false;
+}
+
+/* Parent: queue a control message for the child. Not for use in the JACK
+ * thread together with other threads (single producer). */
+bool KonfytBridgeShm::sendControl(KonfytBridgeControlMessage::Type type, float value)
+{
+    if (!d) { return false; }
+    uint32_t w = d->controlWrite.load(std::memory_order_relaxed);
+    uint32_t r = d->controlRead.load(std::memory_order_acquire);
+    if (w - r >= KONFYT_BRIDGE_CONTROL_MAX) { return false; }
+    KonfytBridgeControlMessage& msg = d->control[w % KONFYT_BRIDGE_CONTROL_MAX];
+    msg.type = type;
+    msg.value = value;
+    d->controlWrite.store(w + 1, std::memory_order_release);
+    return true;
+}
+
+uint32_t KonfytBridgeShm::lateCycleCount() const
+{
+    return mLateCycles.load(std::memory_order_relaxed);
+}
+
+uint32_t KonfytBridgeShm::droppedMidiCount() const
+{
+    return mDroppedMidi.load(std::memory_order_relaxed);
+}
+
+/* Parent: DSP load of the child for the last rendered cycle (1.0 = 100%). */
+float KonfytBridgeShm::childDspLoad() const
+{
+    if (!d) { return 0; }
+    return d->dspLoad.load(std::memory_order_relaxed) / 1000.0f;
+}
+
+/* Parent: maximum DSP load of the child since the previous call. */
+float KonfytBridgeShm::takeChildDspLoadMax()
+{
+    if (!d) { return 0; }
+    return d->dspLoadMax.exchange(0, std::memory_order_relaxed) / 1000.0f;
+}
+
+/* Child: mark as ready to receive the next cycle. Any cycle that was posted
+ * before the child started (e.g. to a crashed previous child) is skipped and
+ * not output by the parent (see parentReadAudio()). */
+void KonfytBridgeShm::childSetReady()
+{
+    mSeen = d->parentSeq.load(std::memory_order_acquire);
+    d->readySeq.store(mSeen, std::memory_order_relaxed);
+    d->childSeq.store(mSeen, std::memory_order_release);
+}
+
+/* Child: wait until the parent posts a new cycle. Returns false on timeout. */
+bool KonfytBridgeShm::childWaitForCycle(int timeoutMs)
+{
+    while (d->parentSeq.load(std::memory_order_acquire) == mSeen) {
+        if (!futexWait(&d->parentSeq, mSeen, timeoutMs)) {
+            return d->parentSeq.load(std::memory_order_acquire) != mSeen;
+        }
+    }
+    mSeen = d->parentSeq.load(std::memory_order_acquire);
+    return true;
+}
+
+uint32_t KonfytBridgeShm::childFrames() const
+{
+    uint32_t n = d->nframes[mSeen & 1];
+    return (n > KONFYT_BRIDGE_MAX_FRAMES) ? KONFYT_BRIDGE_MAX_FRAMES : n;
+}
+
+uint32_t KonfytBridgeShm::childMidiCount() const
+{
+    uint32_t n = d->midiCount[mSeen & 1];
+    return (n > KONFYT_BRIDGE_MIDI_MAX) ? KONFYT_BRIDGE_MIDI_MAX : n;
+}
+
+const KonfytBridgeMidiEvent *KonfytBridgeShm::childMidi() const
+{
+    return d->midi[mSeen & 1];
+}
+
+float *KonfytBridgeShm::childLeft()
+{
+    return d->audioLeft;
+}
+
+float *KonfytBridgeShm::childRight()
+{
+    return d->audioRight;
+}
+
+/* Child: mark the current cycle as rendered. */
+void KonfytBridgeShm::childCycleDone()
+{
+    d->childSeq.store(mSeen, std::memory_order_release);
+}
+
+/* Child: report the time taken to render the current cycle. */
+void KonfytBridgeShm::childReportRenderTime(uint64_t usecs)
+{
+    uint32_t frames = childFrames();
+    if ( (frames == 0) || (d->sampleRate == 0) ) { return; }
+    uint64_t periodUsecs = (uint64_t)frames * 1000000 / d->sampleRate;
+    if (periodUsecs == 0) { return; }
+    uint32_t load = usecs * 1000 / periodUsecs;
+    d->dspLoad.store(load, std::memory_order_relaxed);
+    uint32_t max = d->dspLoadMax.load(std::memory_order_relaxed);
+    while ( (load > max)
+            && !d->dspLoadMax.compare_exchange_weak(max, load,
+                                                    std::memory_order_relaxed) ) {}
+}
+
+bool KonfytBridgeShm::childTakeControl(KonfytBridgeControlMessage *msg)
+{
+    uint32_t r = d->controlRead.load(std::memory_order_relaxed);
+    uint32_t w = d->controlWrite.load(std::memory_order_acquire);
+    if (r == w) { return false; }
+    *msg = d->control[r % KONFYT_BRIDGE_CONTROL_MAX];
+    d->controlRead.store(r + 1, std::memory_order_release);
+    return true;
+}
+
+void KonfytBridgeShm::futexWake(std::atomic<uint32_t> *addr)
+{
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAKE, 1,
+            nullptr, nullptr, 0);
+}
+
+/* Returns false on timeout. */
+bool KonfytBridgeShm::futexWait(std::atomic<uint32_t> *addr, uint32_t val, int timeoutMs)
+{
+    struct timespec ts;
+    ts.tv_sec = timeoutMs / 1000;
+    ts.tv_nsec = (timeoutMs % 1000) * 1000000L;
+    long ret = syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAIT,
+                       val, &ts, nullptr, 0);
+    if ( (ret != 0) && (errno == ETIMEDOUT) ) { return false; }
+    return true;
+}
@@ -0,0 +1,171 @@
+/******************************************************************************
+ *
+ * Copyright 2026 Gideon van der Kolf
+ *
+ * This file is part of Konfyt.
+ *
+ *     Konfyt is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     Konfyt is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with Konfyt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#ifndef KONFYT_BRIDGE_SHM_H
+#define KONFYT_BRIDGE_SHM_H
+
+#include <atomic>
+#include <stdint.h>
+#include <string>
+
+/* Shared memory audio transport between Konfyt and a bridge subprocess.
+ *
+ * The parent (Konfyt with JACK client) creates a shared memory segment per
+ * bridged plugin and starts a subprocess with the segment name. The
+ * subprocess maps the segment and renders audio into it, so it does not need
+ * to be a JACK client itself.
+ *
+ * Cycle handshake:
+ * - At the start of its JACK cycle, the parent checks if the child has
+ *   finished the previously posted cycle (childSeq == parentSeq). If so, the
+ *   rendered audio is copied out. If not, silence is output and the cycle is
+ *   counted as late. The JACK thread never waits for the child.
+ * - During the cycle, the parent writes MIDI events to the pending MIDI slot.
+ * - At the end of the cycle, if the child was ready, the parent increments
+ *   parentSeq and wakes the child with a futex. If the child was late, the
+ *   MIDI events remain pending and are posted with the next cycle.
+ * - The child waits on the parentSeq futex, renders the posted cycle, and
+ *   stores parentSeq in childSeq when done.
+ * Audio is therefore delivered one period later than with a direct JACK
+ * connection, in exchange for never blocking the JACK thread on the child.
+ *
+ * The child may crash and be restarted at any time. A restarted child maps the
+ * existing segment and marks itself ready by setting readySeq and childSeq to
+ * parentSeq. The audio buffers may then still hold a cycle that the crashed
+ * child was halfway through, so the parent outputs silence when the completed
+ * cycle is the one the child marked itself ready at. */
+
+#define KONFYT_BRIDGE_SHM_MAGIC 0x4B464252 // "KFBR"
+#define KONFYT_BRIDGE_SHM_VERSION 3
+#define KONFYT_BRIDGE_MAX_FRAMES 8192
+#define KONFYT_BRIDGE_MIDI_MAX 512
+#define KONFYT_BRIDGE_MIDI_DATA_MAX 3
+#define KONFYT_BRIDGE_CONTROL_MAX 32
+
+struct KonfytBridgeMidiEvent
+{
+    uint32_t time;
+    uint8_t size;
+    uint8_t data[KONFYT_BRIDGE_MIDI_DATA_MAX];
+};
+
+struct KonfytBridgeControlMessage
+{
+    enum Type : uint32_t {
+        SetGain = 1,
+        Quit = 2
+    };
+    uint32_t type;
+    float value;
+};
+
+/* Layout of the shared memory segment. Only lock-free atomics and POD types
+ * may be used as it is shared between processes. */
+struct KonfytBridgeShmData
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t sampleRate;
+
+    // Futex words. Must be 32 bits wide.
+    std::atomic<uint32_t> parentSeq;
+    std::atomic<uint32_t> childSeq;
+    // parentSeq when the child marked itself ready, without rendering
+    std::atomic<uint32_t> readySeq;
+
+    // Cycle data, indexed by sequence number parity
+    uint32_t nframes[2];
+    uint32_t midiCount[2];
+    KonfytBridgeMidiEvent midi[2][KONFYT_BRIDGE_MIDI_MAX];
+
+    // Control messages from parent to child (single producer, single consumer)
+    std::atomic<uint32_t> controlWrite;
+    std::atomic<uint32_t> controlRead;
+    KonfytBridgeControlMessage control[KONFYT_BRIDGE_CONTROL_MAX];
+
+    // Render time of the child as fraction of the cycle period, in permille.
+    // Max is reset by the parent when read.
+    std::atomic<uint32_t> dspLoad;
+    std::atomic<uint32_t> dspLoadMax;
+
+    // Rendered audio from child
+    float audioLeft[KONFYT_BRIDGE_MAX_FRAMES];
+    float audioRight[KONFYT_BRIDGE_MAX_FRAMES];
+};
+
+class KonfytBridgeShm
+{
+public:
+    KonfytBridgeShm() {}
+    ~KonfytBridgeShm();
+
+    static std::string nameForId(int id);
+
+    bool create(const std::string& name, uint32_t sampleRate); // Parent
+    bool open(const std::string& name); // Child
+    void close();
+    bool isOpen() const;
+    std::string name() const;
+    uint32_t sampleRate() const;
+
+    // Parent: JACK thread
+    void parentReadAudio(float* left, float* right, uint32_t nframes);
+    bool parentWriteMidi(const unsigned char* data, int size, uint32_t time);
+    void parentPostCycle(uint32_t nframes);
+
+    // Parent: any other thread
+    bool sendControl(KonfytBridgeControlMessage::Type type, float value = 0);
+    uint32_t lateCycleCount() const;
+    uint32_t droppedMidiCount() const;
+    float childDspLoad() const;
+    float takeChildDspLoadMax();
+
+    // Child
+    void childSetReady();
+    bool childWaitForCycle(int timeoutMs);
+    uint32_t childFrames() const;
+    uint32_t childMidiCount() const;
+    const KonfytBridgeMidiEvent* childMidi() const;
+    float* childLeft();
+    float* childRight();
+    void childCycleDone();
+    void childReportRenderTime(uint64_t usecs);
+    bool childTakeControl(KonfytBridgeControlMessage* msg);
+
+private:
+    KonfytBridgeShmData* d = nullptr;
+    std::string mName;
+    bool mOwner = false;
+
+    // Parent JACK thread state
+    bool mChildWasReady = false;
+    uint32_t mPosted = 0;
+    std::atomic<uint32_t> mLateCycles {0};
+    std::atomic<uint32_t> mDroppedMidi {0};
+
+    // Child state
+    uint32_t mSeen = 0;
+
+    static void futexWake(std::atomic<uint32_t>* addr);
+    static bool futexWait(std::atomic<uint32_t>* addr, uint32_t val, int timeoutMs);
+};
+
+#endif // KONFYT_BRIDGE_SHM_H
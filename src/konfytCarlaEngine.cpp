@@ -204,3 +204,8 @@ void KonfytCarlaEngine::setGain(int ID, float newGain)
     CARLA_FUNC(carla_set_volume, pluginIdInCarla, newGain);
 }
 
+
+bool KonfytCarlaEngine::hasNativeGain()
+{
+    return true;
+}
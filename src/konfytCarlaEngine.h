@@ -65,6 +65,7 @@ public:
     QStringList audioOutJackPortNames(int id);
     void removeSfz(int id);
     void setGain(int ID, float newGain);
+    bool hasNativeGain();
     QString pluginName(int ID);
 
 private:
@@ -0,0 +1,227 @@
+/******************************************************************************
+ *
+ * Copyright 2026 Gideon van der Kolf
+ *
+ * This file is part of Konfyt.
+ *
+ *     Konfyt is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     Konfyt is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with Konfyt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include "konfytEffects.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Freeverb tuning, in frames at 44100 Hz
+static const double FREEVERB_SAMPLE_RATE = 44100;
+static const int FREEVERB_COMB_TUNING[] = {1116, 1188, 1277, 1356, 1422, 1491, 1557, 1617};
+static const int FREEVERB_ALLPASS_TUNING[] = {556, 441, 341, 225};
+static const int FREEVERB_STEREO_SPREAD = 23;
+static const float FREEVERB_FIXED_GAIN = 0.015f;
+static const float FREEVERB_SCALE_WET = 3;
+static const float FREEVERB_SCALE_DAMP = 0.4f;
+static const float FREEVERB_SCALE_ROOM = 0.28f;
+static const float FREEVERB_OFFSET_ROOM = 0.7f;
+static const float FREEVERB_ALLPASS_FEEDBACK = 0.5f;
+
+// Values decaying below this are flushed to zero to avoid denormals
+static const float EFFECTS_DENORMAL_THRESH = 1e-20f;
+
+static inline float flushDenormal(float value)
+{
+    return (std::fabs(value) < EFFECTS_DENORMAL_THRESH) ? 0 : value;
+}
+
+// ============================================================================
+// KonfytReverb
+// ============================================================================
+
+float KonfytReverb::Comb::process(float in, float feedback, float damp1, float damp2)
+{
+    float out = buffer[index];
+    store = flushDenormal(out * damp2 + store * damp1);
+    buffer[index] = in + store * feedback;
+    if (++index >= buffer.size()) { index = 0; }
+    return out;
+}
+
+float KonfytReverb::Allpass::process(float in)
+{
+    float bufOut = buffer[index];
+    buffer[index] = flushDenormal(in + bufOut * FREEVERB_ALLPASS_FEEDBACK);
+    if (++index >= buffer.size()) { index = 0; }
+    return bufOut - in;
+}
+
+/* Allocates the delay lines for the sample rate. Not realtime safe. */
+void KonfytReverb::init(double sampleRate)
+{
+    double scale = sampleRate / FREEVERB_SAMPLE_RATE;
+    for (int i = 0; i < COMBS; i++) {
+        size_t size = std::lround(FREEVERB_COMB_TUNING[i] * scale);
+        combL[i].buffer.assign(size, 0);
+        combR[i].buffer.assign(size + std::lround(FREEVERB_STEREO_SPREAD * scale), 0);
+    }
+    for (int i = 0; i < ALLPASSES; i++) {
+        size_t size = std::lround(FREEVERB_ALLPASS_TUNING[i] * scale);
+        allpassL[i].buffer.assign(size, 0);
+        allpassR[i].buffer.assign(size + std::lround(FREEVERB_STEREO_SPREAD * scale), 0);
+    }
+    reset();
+
+    feedback = KONFYT_REVERB_ROOMSIZE * FREEVERB_SCALE_ROOM + FREEVERB_OFFSET_ROOM;
+    damp1 = KONFYT_REVERB_DAMP * FREEVERB_SCALE_DAMP;
+    damp2 = 1 - damp1;
+    float wet = KONFYT_REVERB_LEVEL * FREEVERB_SCALE_WET;
+    wet1 = wet * (KONFYT_REVERB_WIDTH / 2 + 0.5f);
+    wet2 = wet * ((1 - KONFYT_REVERB_WIDTH) / 2);
+
+    mTailFrames = KONFYT_REVERB_TAIL_SECS * sampleRate;
+}
+
+/* Clears the delay lines. Not to be called while process() may run. */
+void KonfytReverb::reset()
+{
+    for (int i = 0; i < COMBS; i++) {
+        std::fill(combL[i].buffer.begin(), combL[i].buffer.end(), 0);
+        std::fill(combR[i].buffer.begin(), combR[i].buffer.end(), 0);
+        combL[i].store = 0;
+        combR[i].store = 0;
+    }
+    for (int i = 0; i < ALLPASSES; i++) {
+        std::fill(allpassL[i].buffer.begin(), allpassL[i].buffer.end(), 0);
+        std::fill(allpassR[i].buffer.begin(), allpassR[i].buffer.end(), 0);
+    }
+}
+
+/* Number of frames after the input has become silent for the output to decay
+ * to silence. */
+uint32_t KonfytReverb::tailFrames() const
+{
+    return mTailFrames;
+}
+
+void KonfytReverb::process(const float *inL, const float *inR,
+                           float *outL, float *outR, uint32_t nframes)
+{
+    if (combL[0].buffer.empty()) { return; } // Not initialised
+
+    for (uint32_t i = 0; i < nframes; i++) {
+        float in = (inL[i] + inR[i]) * FREEVERB_FIXED_GAIN;
+        float l = 0;
+        float r = 0;
+        for (int c = 0; c < COMBS; c++) {
+            l += combL[c].process(in, feedback, damp1, damp2);
+            r += combR[c].process(in, feedback, damp1, damp2);
+        }
+        for (int a = 0; a < ALLPASSES; a++) {
+            l = allpassL[a].process(l);
+            r = allpassR[a].process(r);
+        }
+        outL[i] += l * wet1 + r * wet2;
+        outR[i] += r * wet1 + l * wet2;
+    }
+}
+
+// ============================================================================
+// KonfytChorus
+// ============================================================================
+
+/* Allocates the delay line for the sample rate. Not realtime safe. */
+void KonfytChorus::init(double sampleRate)
+{
+    centreDelay = KONFYT_CHORUS_DELAY_MS * sampleRate / 1000.0;
+    depth = KONFYT_CHORUS_DEPTH_MS * sampleRate / 1000.0 / 2;
+    buffer.assign(std::ceil(centreDelay + depth) + 2, 0);
+
+    double w = 2 * M_PI * KONFYT_CHORUS_SPEED_HZ / sampleRate;
+    lfoSin = std::sin(w);
+    lfoCos = std::cos(w);
+
+    reset();
+
+    mTailFrames = buffer.size();
+}
+
+/* Clears the delay line and restarts the LFOs. Not to be called while
+ * process() may run. */
+void KonfytChorus::reset()
+{
+    std::fill(buffer.begin(), buffer.end(), 0);
+    index = 0;
+    for (int v = 0; v < KONFYT_CHORUS_VOICES; v++) {
+        Voice& voice = voices[v];
+        double phase = 2 * M_PI * v / KONFYT_CHORUS_VOICES;
+        voice.sin = std::sin(phase);
+        voice.cos = std::cos(phase);
+        // Spread the voices from left to right
+        float pan = (KONFYT_CHORUS_VOICES > 1)
+                ? (float)v / (KONFYT_CHORUS_VOICES - 1) : 0.5f;
+        voice.panL = 1 - pan;
+        voice.panR = pan;
+    }
+}
+
+/* Number of frames after the input has become silent for the output to decay
+ * to silence. */
+uint32_t KonfytChorus::tailFrames() const
+{
+    return mTailFrames;
+}
+
+void KonfytChorus::process(const float *inL, const float *inR,
+                           float *outL, float *outR, uint32_t nframes)
+{
+    if (buffer.empty()) { return; } // Not initialised
+
+    const size_t size = buffer.size();
+    const float gain = KONFYT_CHORUS_LEVEL / KONFYT_CHORUS_VOICES;
+
+    for (uint32_t i = 0; i < nframes; i++) {
+        buffer[index] = (inL[i] + inR[i]) * 0.5f;
+
+        float l = 0;
+        float r = 0;
+        for (int v = 0; v < KONFYT_CHORUS_VOICES; v++) {
+            Voice& voice = voices[v];
+            // Read the delay line with linear interpolation
+            float delay = centreDelay + depth * (float)voice.sin;
+            float readPos = (float)index - delay;
+            if (readPos < 0) { readPos += size; }
+            size_t i0 = (size_t)readPos;
+            size_t i1 = (i0 + 1 < size) ? i0 + 1 : 0;
+            float frac = readPos - i0;
+            float value = buffer[i0] + (buffer[i1] - buffer[i0]) * frac;
+            l += value * voice.panL;
+            r += value * voice.panR;
+            // Advance the LFO
+            double s = voice.sin * lfoCos + voice.cos * lfoSin;
+            voice.cos = voice.cos * lfoCos - voice.sin * lfoSin;
+            voice.sin = s;
+        }
+        outL[i] += l * gain;
+        outR[i] += r * gain;
+
+        if (++index >= size) { index = 0; }
+    }
+
+    // Keep the LFO amplitudes from drifting
+    for (int v = 0; v < KONFYT_CHORUS_VOICES; v++) {
+        Voice& voice = voices[v];
+        double norm = 1.0 / std::sqrt(voice.sin * voice.sin + voice.cos * voice.cos);
+        voice.sin *= norm;
+        voice.cos *= norm;
+    }
+}
@@ -0,0 +1,129 @@
+/******************************************************************************
+ *
+ * Copyright 2026 Gideon van der Kolf
+ *
+ * This file is part of Konfyt.
+ *
+ *     Konfyt is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     Konfyt is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with Konfyt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#ifndef KONFYT_EFFECTS_H
+#define KONFYT_EFFECTS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Reverb defaults, as for the Fluidsynth reverb
+#define KONFYT_REVERB_ROOMSIZE 0.2f
+#define KONFYT_REVERB_DAMP 0.0f
+#define KONFYT_REVERB_WIDTH 0.5f
+#define KONFYT_REVERB_LEVEL 0.9f
+#define KONFYT_REVERB_TAIL_SECS 2.0
+
+// Chorus defaults, as for the Fluidsynth chorus
+#define KONFYT_CHORUS_VOICES 3
+#define KONFYT_CHORUS_LEVEL 2.0f
+#define KONFYT_CHORUS_SPEED_HZ 0.3
+#define KONFYT_CHORUS_DEPTH_MS 8.0
+#define KONFYT_CHORUS_DELAY_MS 10.0 // Centre delay of the modulated voices
+
+/* Stereo reverb (Freeverb: 8 parallel lowpass-feedback comb filters followed
+ * by 4 series allpass filters per channel, with the right channel's delays
+ * spread for stereo width).
+ *
+ * Buffers are allocated in init(). process() does not allocate or lock and may
+ * be called from the JACK thread. */
+class KonfytReverb
+{
+public:
+    void init(double sampleRate);
+    void reset();
+    uint32_t tailFrames() const;
+
+    // JACK thread. Adds the reverb of the input to the outputs.
+    void process(const float* inL, const float* inR, float* outL, float* outR,
+                 uint32_t nframes);
+
+private:
+    struct Comb
+    {
+        std::vector<float> buffer;
+        size_t index = 0;
+        float store = 0;
+        inline float process(float in, float feedback, float damp1, float damp2);
+    };
+
+    struct Allpass
+    {
+        std::vector<float> buffer;
+        size_t index = 0;
+        inline float process(float in);
+    };
+
+    static const int COMBS = 8;
+    static const int ALLPASSES = 4;
+
+    Comb combL[COMBS];
+    Comb combR[COMBS];
+    Allpass allpassL[ALLPASSES];
+    Allpass allpassR[ALLPASSES];
+
+    float feedback = 0;
+    float damp1 = 0;
+    float damp2 = 1;
+    float wet1 = 0;
+    float wet2 = 0;
+    uint32_t mTailFrames = 0;
+};
+
+/* Stereo chorus of a number of delayed copies of the input, each with its
+ * delay modulated by a sine LFO at a different phase. The copies are panned
+ * across the stereo field.
+ *
+ * Buffers are allocated in init(). process() does not allocate or lock and may
+ * be called from the JACK thread. */
+class KonfytChorus
+{
+public:
+    void init(double sampleRate);
+    void reset();
+    uint32_t tailFrames() const;
+
+    // JACK thread. Adds the chorus of the input to the outputs.
+    void process(const float* inL, const float* inR, float* outL, float* outR,
+                 uint32_t nframes);
+
+private:
+    struct Voice
+    {
+        // Quadrature LFO
+        double sin = 0;
+        double cos = 1;
+        float panL = 1;
+        float panR = 1;
+    };
+
+    std::vector<float> buffer;
+    size_t index = 0;
+    Voice voices[KONFYT_CHORUS_VOICES];
+    double lfoSin = 0;  // LFO rotation per frame
+    double lfoCos = 1;
+    float centreDelay = 0; // Frames
+    float depth = 0;       // Frames
+    uint32_t mTailFrames = 0;
+};
+
+#endif // KONFYT_EFFECTS_H
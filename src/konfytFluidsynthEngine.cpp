@@ -20,12 +20,89 @@
  *****************************************************************************/
 
 #include "konfytFluidsynthEngine.h"
+#include "konfytSfLoader.h"
 
+#include <QElapsedTimer>
 #include <QFileInfo>
+#include <QThread>
 
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
 #include <iostream>
 
-#define MIDI_CHANNEL_0 0 // Used to easily see where channel 0 is forced.
+KfFluidsynthSettings KfFluidsynthSettings::inheritFrom(
+        const KfFluidsynthSettings &defaults) const
+{
+    KfFluidsynthSettings ret = *this;
+    if (ret.polyphony < 0) { ret.polyphony = defaults.polyphony; }
+    if (ret.effects < 0) { ret.effects = defaults.effects; }
+    if (ret.interpolation < 0) { ret.interpolation = defaults.interpolation; }
+    if (ret.cpuCores < 0) { ret.cpuCores = defaults.cpuCores; }
+    if (ret.priority < 0) { ret.priority = defaults.priority; }
+    return ret;
+}
+
+bool KfFluidsynthSettings::operator==(const KfFluidsynthSettings &other) const
+{
+    return (polyphony == other.polyphony)
+            && (effects == other.effects)
+            && (interpolation == other.interpolation)
+            && (cpuCores == other.cpuCores)
+            && (priority == other.priority);
+}
+
+bool KfFluidsynthSettings::operator!=(const KfFluidsynthSettings &other) const
+{
+    return !(*this == other);
+}
+
+Xml KfFluidsynthSettings::toXml() const
+{
+    Xml xml(XML_FS_SETTINGS);
+    xml.addTextChild(XML_FS_POLYPHONY, n2s(polyphony));
+    xml.addTextChild(XML_FS_EFFECTS, n2s(effects));
+    xml.addTextChild(XML_FS_INTERPOLATION, n2s(interpolation));
+    xml.addTextChild(XML_FS_CPU_CORES, n2s(cpuCores));
+    xml.addTextChild(XML_FS_PRIORITY, n2s(priority));
+    return xml;
+}
+
+void KfFluidsynthSettings::readFromXml(Xml xml)
+{
+    xml.setIntFromChild(XML_FS_POLYPHONY, &polyphony);
+    xml.setIntFromChild(XML_FS_EFFECTS, &effects);
+    xml.setIntFromChild(XML_FS_INTERPOLATION, &interpolation);
+    xml.setIntFromChild(XML_FS_CPU_CORES, &cpuCores);
+    xml.setIntFromChild(XML_FS_PRIORITY, &priority);
+}
+
+bool KfFluidsynthVoiceBudget::operator==(const KfFluidsynthVoiceBudget &other) const
+{
+    return (voices == other.voices) && (dspLoadPercent == other.dspLoadPercent);
+}
+
+bool KfFluidsynthVoiceBudget::operator!=(const KfFluidsynthVoiceBudget &other) const
+{
+    return !(*this == other);
+}
+
+Xml KfFluidsynthVoiceBudget::toXml() const
+{
+    Xml xml(XML_FS_VOICE_BUDGET);
+    xml.addTextChild(XML_FS_BUDGET_VOICES, n2s(voices));
+    xml.addTextChild(XML_FS_BUDGET_DSP_LOAD, n2s(dspLoadPercent));
+    return xml;
+}
+
+void KfFluidsynthVoiceBudget::readFromXml(Xml xml)
+{
+    xml.setIntFromChild(XML_FS_BUDGET_VOICES, &voices);
+    xml.setFloatFromChild(XML_FS_BUDGET_DSP_LOAD, &dspLoadPercent);
+}
+
+// ============================================================================
 
 KonfytFluidsynthEngine::KonfytFluidsynthEngine(QObject *parent) :
     QObject(parent)
@@ -34,97 +111,595 @@ KonfytFluidsynthEngine::KonfytFluidsynthEngine(QObject *parent) :
 
 KonfytFluidsynthEngine::~KonfytFluidsynthEngine()
 {
-    while (!synths.isEmpty()) {
-        removeSoundfontProgram(synths[0]);
+    // JACK is no longer rendering at this point
+    qDeleteAll(synths);
+    synths.clear();
+    qDeleteAll(hosts);
+    hosts.clear();
+}
+
+void KonfytFluidsynthEngine::setDeferredDelete(
+        std::function<void (std::function<void ()>)> deleteWhenUnused)
+{
+    mDeleteWhenUnused = deleteWhenUnused;
+}
+
+void KonfytFluidsynthEngine::setSharedSynths(bool shared)
+{
+    KONFYT_ASSERT_RETURN(synths.isEmpty());
+
+    mSharedSynths = shared;
+}
+
+bool KonfytFluidsynthEngine::sharedSynths() const
+{
+    return mSharedSynths;
+}
+
+/* Applies the settings to existing layers that do not set them themselves.
+ * The number of CPU cores only applies to synths created afterwards. */
+void KonfytFluidsynthEngine::setDefaultSettings(KfFluidsynthSettings settings)
+{
+    if (settings == mDefaultSettings) { return; }
+    mDefaultSettings = settings;
+
+    foreach (KfFluidSynthHost* host, hosts) {
+        if (host->channels > 1) {
+            lockHost(host);
+            applyHostSettings(host, sharedHostSettings());
+            unlockHost(host);
+        }
+    }
+    foreach (KfFluidSynth* synth, synths) {
+        applySettings(synth);
+    }
+}
+
+KfFluidsynthSettings KonfytFluidsynthEngine::defaultSettings() const
+{
+    return mDefaultSettings;
+}
+
+/* The voice budget is a no-op with Fluidsynth 1, which doesn't expose the
+ * state of voices. */
+void KonfytFluidsynthEngine::setVoiceBudget(KfFluidsynthVoiceBudget budget)
+{
+#if FLUIDSYNTH_VERSION_MAJOR >= 2
+    mBudgetVoices.store(qMax(0, budget.voices));
+#endif
+    mBudgetDspLoad.store(budget.dspLoadPercent);
+}
+
+/* Sets the settings of the layer. Settings that are not set are inherited
+ * from the project-wide settings (see setDefaultSettings()). */
+void KonfytFluidsynthEngine::setSettings(KfFluidSynth *synth, KfFluidsynthSettings settings)
+{
+    KONFYT_ASSERT_RETURN(synth);
+
+    synth->settings = settings;
+    applySettings(synth);
+}
+
+/* Applies the layer settings to the layer's channel and, in per-synth mode,
+ * to its synth. In shared mode polyphony and effects are project-wide
+ * settings of the shared synths. */
+void KonfytFluidsynthEngine::applySettings(KfFluidSynth *synth)
+{
+    KfFluidsynthSettings s = synth->settings.inheritFrom(mDefaultSettings);
+    KfFluidSynthHost* host = synth->host;
+
+    lockHost(host);
+    if (host->channels == 1) {
+        applyHostSettings(host, s);
+    }
+    int interpolation = s.interpolation;
+    if (interpolation < 0) { interpolation = FLUID_INTERP_DEFAULT; }
+    fluid_synth_set_interp_method(host->synth, synth->channel, interpolation);
+    unlockHost(host);
+
+    synth->priority.store(qMax(0, s.priority));
+}
+
+/* Applies the polyphony and effects settings to the synth. The host must be
+ * locked with lockHost(). Fluidsynth may resize its voice list when the
+ * polyphony changes, so it is only set when changed. */
+void KonfytFluidsynthEngine::applyHostSettings(KfFluidSynthHost *host, KfFluidsynthSettings s)
+{
+    int polyphony = s.polyphony;
+    if (polyphony < 1) {
+#if FLUIDSYNTH_VERSION_MAJOR == 1
+        polyphony = fluid_settings_getint_default(host->settings, "synth.polyphony");
+#else
+        fluid_settings_getint_default(host->settings, "synth.polyphony", &polyphony);
+#endif
     }
+    if (polyphony != host->polyphony) {
+        fluid_synth_set_polyphony(host->synth, polyphony);
+        host->polyphony = fluid_synth_get_polyphony(host->synth);
+        host->voiceList.resize(host->polyphony + 1);
+    }
+
+    int effects = qMax(0, s.effects);
+    fluid_synth_set_reverb_on(host->synth, effects);
+    fluid_synth_set_chorus_on(host->synth, effects);
 }
 
-/* Generate Fluidsynth MIDI events based on buffer from JACK MIDI input. */
-void KonfytFluidsynthEngine::processJackMidi(KfFluidSynth *synth, const KonfytMidiEvent *ev)
+/* Project-wide settings applied to shared synths. Effects of a shared synth
+ * would be mixed into all its layers, so they are always disabled. */
+KfFluidsynthSettings KonfytFluidsynthEngine::sharedHostSettings() const
 {
-    // TODO NB: handle case where we are in panic mode, and all-note-off etc. messages are
-    // received, but the mutex is already locked. We have to queue it somehow for until the
-    // mutex is unlocked, othewise the events are thrown away and panic mode doesn't do what
-    // it's supposed to.
+    KfFluidsynthSettings ret = mDefaultSettings;
+    ret.effects = 0;
+    return ret;
+}
 
-    // If we don't get the mutex immediately, don't block and wait for it.
-    if ( !mutex.tryLock() ) {
+/* JACK thread: queue a MIDI event from JACK MIDI input to be applied at the
+ * specified frame offset when the synth's host is rendered in this cycle with
+ * fluidsynthWriteFloat(). */
+void KonfytFluidsynthEngine::processJackMidi(KfFluidSynth *synth,
+                                             const KonfytRtMidiEvent *ev,
+                                             uint32_t time)
+{
+    int type = ev->type();
+    if ( (type != MIDI_EVENT_TYPE_NOTEON) && (type != MIDI_EVENT_TYPE_NOTEOFF)
+         && (type != MIDI_EVENT_TYPE_CC) && (type != MIDI_EVENT_TYPE_PITCHBEND) ) {
+        return;
+    }
+    if ( mRtBlockingNotes && (type == MIDI_EVENT_TYPE_NOTEON) && (ev->data2() > 0)
+         && (synth->priority.load(std::memory_order_relaxed) <= mRtBlockPriority) ) {
+        // Over the voice budget, see applyVoiceBudget()
         return;
     }
+    KfFluidSynthHost* host = synth->host;
+    if (host->eventCount >= (int)host->events.size()) {
+        synth->droppedEvents.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    KfFluidSynthHost::TimedEvent e;
+    e.time = time;
+    e.channel = synth->channel;
+    e.type = type;
+    if (type == MIDI_EVENT_TYPE_PITCHBEND) {
+        // Fluidsynth expects a positive pitchbend value, i.e. centered around 8192, not zero.
+        e.data1 = ev->pitchbendValueSigned() + 8192;
+        e.data2 = 0;
+    } else {
+        e.data1 = ev->data1();
+        e.data2 = ev->data2();
+    }
+    if ( (type == MIDI_EVENT_TYPE_CC) && (e.data1 == MIDI_CC_VOLUME)
+         && (host->channels > 1) ) {
+        // In shared mode the channel volume also applies the layer gain.
+        synth->midiVolume = e.data2;
+        e.data2 = sharedVolume(synth);
+    }
+
+    // Keep events sorted by time (stable). Events mostly arrive in order.
+    int i = host->eventCount;
+    while ( (i > 0) && (host->events[i-1].time > time) ) {
+        host->events[i] = host->events[i-1];
+        i--;
+    }
+    host->events[i] = e;
+    host->eventCount++;
+}
+
+/* Apply queued MIDI event to the synth on the channel of its layer. All MIDI
+ * events of a layer are sent on that channel, regardless of their channel. */
+void KonfytFluidsynthEngine::applyEvent(KfFluidSynthHost *host,
+                                        const KfFluidSynthHost::TimedEvent &ev)
+{
+    switch (ev.type) {
+    case MIDI_EVENT_TYPE_NOTEON:
+        fluid_synth_noteon( host->synth, ev.channel, ev.data1, ev.data2 );
+        break;
+    case MIDI_EVENT_TYPE_NOTEOFF:
+        fluid_synth_noteoff( host->synth, ev.channel, ev.data1 );
+        break;
+    case MIDI_EVENT_TYPE_CC:
+        fluid_synth_cc( host->synth, ev.channel, ev.data1, ev.data2 );
+        // If we have received an all notes off, sommer kill all the sound also. This is probably a panic.
+        if (ev.data1 == MIDI_CC_ALL_NOTES_OFF) {
+            fluid_synth_all_sounds_off( host->synth, ev.channel );
+        }
+        break;
+    case MIDI_EVENT_TYPE_PITCHBEND:
+        fluid_synth_pitch_bend( host->synth, ev.channel, ev.data1 );
+        break;
+    }
+}
+
+/* Channel volume (CC7) of a layer in a shared synth, combining the last
+ * received volume and the layer gain. Fluidsynth's default volume curve is
+ * proportional to the square of the CC value. */
+int KonfytFluidsynthEngine::sharedVolume(const KfFluidSynth *synth)
+{
+    int v = qRound(synth->midiVolume * std::sqrt(synth->rtGain));
+    return qBound(0, v, 127);
+}
+
+/* JACK thread: apply queued commands from the GUI thread. */
+void KonfytFluidsynthEngine::applyCommands(KfFluidSynth *synth)
+{
+    KfFluidSynthHost* host = synth->host;
+    KfFluidSynth::Command cmd;
+    while (synth->commands.read(&cmd)) {
+        switch (cmd.type) {
+        case KfFluidSynth::Command::SetGain:
+            synth->rtGain = cmd.value;
+            if (host->channels > 1) {
+                fluid_synth_cc( host->synth, synth->channel, MIDI_CC_VOLUME,
+                                sharedVolume(synth) );
+            } else {
+                fluid_synth_set_gain( host->synth, cmd.value );
+            }
+            break;
+        }
+    }
+}
 
-    if ( (ev->type() != MIDI_EVENT_TYPE_PROGRAM) || (ev->type() != MIDI_EVENT_TYPE_SYSTEM) ) {
+/* JACK thread: start rendering a new cycle. Call setJackRenderBuffers() for
+ * all synths to be rendered and then fluidsynthWriteFloat() for each.
+ * dspLoadPercent is the load of the previous JACK cycle, which determines
+ * whether the voice budget is enforced. */
+void KonfytFluidsynthEngine::startJackRender(float dspLoadPercent)
+{
+    mRenderCycle++;
 
-        // All MIDI events are sent to Fluidsynth on channel 0
+    mRtBudgetActive = (mBudgetVoices.load(std::memory_order_relaxed) > 0)
+            && (dspLoadPercent > mBudgetDspLoad.load(std::memory_order_relaxed));
+    if (!mRtBudgetActive) { mRtBlockingNotes = false; }
+    mRtVoices = 0;
+    mRtReleasedVoices = 0;
+    mRtStealLayer = nullptr;
+    mRtStealVoices = 0;
+    mRtStealPriority = 0;
+    mRtMaxPriority = 0;
+}
+
+/* JACK thread: set the buffers the synth is rendered to in this cycle. */
+void KonfytFluidsynthEngine::setJackRenderBuffers(KfFluidSynth *synth,
+                                                  void *leftBuffer,
+                                                  void *rightBuffer)
+{
+    synth->outLeft = (float*)leftBuffer;
+    synth->outRight = (float*)rightBuffer;
+    synth->preparedCycle = mRenderCycle;
 
-        if (ev->type() == MIDI_EVENT_TYPE_NOTEON) {
-            fluid_synth_noteon( synth->synth, MIDI_CHANNEL_0, ev->note(), ev->velocity() );
-        } else if (ev->type() == MIDI_EVENT_TYPE_NOTEOFF) {
-            fluid_synth_noteoff( synth->synth, MIDI_CHANNEL_0, ev->note() );
-        } else if (ev->type() == MIDI_EVENT_TYPE_CC) {
-            fluid_synth_cc( synth->synth, MIDI_CHANNEL_0, ev->data1(), ev->data2() );
-            // If we have received an all notes off, sommer kill all the sound also. This is probably a panic.
-            if (ev->data1() == MIDI_CC_ALL_NOTES_OFF) {
-                fluid_synth_all_sounds_off( synth->synth, MIDI_CHANNEL_0 );
+    if (mRtBudgetActive) { countVoices(synth); }
+}
+
+/* JACK thread: count the sounding voices of the layer for the voice budget and
+ * keep track of the layer to steal from: the one with the lowest priority
+ * and, of those, the most voices that are still on. */
+void KonfytFluidsynthEngine::countVoices(KfFluidSynth *synth)
+{
+    KfFluidSynthHost* host = synth->host;
+    if (host->countedCycle != mRenderCycle) {
+        host->countedCycle = mRenderCycle;
+        for (int c = 0; c < host->channels; c++) {
+            host->channelVoices[c] = 0;
+            host->channelOnVoices[c] = 0;
+            host->channelReleasedVoices[c] = 0;
+        }
+#if FLUIDSYNTH_VERSION_MAJOR >= 2
+        host->rendering.store(true);
+        if (!host->busy.load()) { // Else GUI thread is changing the synth
+            // List is terminated with nullptr if not full
+            int size = host->voiceList.size();
+            fluid_synth_get_voicelist(host->synth, host->voiceList.data(), size, -1);
+            for (int i = 0; (i < size) && host->voiceList[i]; i++) {
+                fluid_voice_t* voice = host->voiceList[i];
+                int c = fluid_voice_get_channel(voice);
+                if (!fluid_voice_is_playing(voice) || (c < 0) || (c >= host->channels)) {
+                    continue;
+                }
+                host->channelVoices[c]++;
+                if (fluid_voice_is_on(voice)) {
+                    host->channelOnVoices[c]++;
+                } else if ( !fluid_voice_is_sustained(voice)
+                            && !fluid_voice_is_sostenuto(voice) ) {
+                    host->channelReleasedVoices[c]++;
+                }
             }
-        } else if (ev->type() == MIDI_EVENT_TYPE_PITCHBEND) {
-            // Fluidsynth expects a positive pitchbend value, i.e. centered around 8192, not zero.
-            fluid_synth_pitch_bend( synth->synth, MIDI_CHANNEL_0, ev->pitchbendValueSigned()+8192 );
         }
+        host->rendering.store(false);
+#endif
     }
 
-    mutex.unlock();
+    int voices = host->channelVoices[synth->channel];
+    if (voices == 0) { return; }
+    mRtVoices += voices;
+    mRtReleasedVoices += host->channelReleasedVoices[synth->channel];
+
+    int priority = synth->priority.load(std::memory_order_relaxed);
+    mRtMaxPriority = qMax(mRtMaxPriority, priority);
+    int onVoices = host->channelOnVoices[synth->channel];
+    if (onVoices == 0) { return; }
+    if ( !mRtStealLayer || (priority < mRtStealPriority)
+         || ((priority == mRtStealPriority) && (onVoices > mRtStealVoices)) ) {
+        mRtStealLayer = synth;
+        mRtStealPriority = priority;
+        mRtStealVoices = onVoices;
+    }
 }
 
-/* Calls fluid_synth_write_float for specified synth, fills specified buffers
- * and returns Fluidsynth's return value. */
-int KonfytFluidsynthEngine::fluidsynthWriteFloat(KfFluidSynth *synth, void *leftBuffer, void *rightBuffer, int len)
+/* JACK thread: if the voice budget is enforced and exceeded, release the
+ * oldest voices of the lowest priority layer so that they fade out with their
+ * release envelopes. Voices already in release are expected to end soon, so
+ * only the excess beyond those is released. While over the budget, layers of
+ * the lowest priority may not start new voices, unless all sounding layers
+ * have the same priority. */
+void KonfytFluidsynthEngine::applyVoiceBudget()
 {
-    // If we don't get the mutex immediately, don't block and wait for it.
-    if ( !mutex.tryLock() ) {
-        return 0;
+    if (mRtBudgetCycle == mRenderCycle) { return; }
+    mRtBudgetCycle = mRenderCycle;
+    if (!mRtBudgetActive) { return; }
+
+    int excess = mRtVoices - mBudgetVoices.load(std::memory_order_relaxed);
+    if (excess <= 0) {
+        mRtBlockingNotes = false;
+        return;
     }
 
-    int ret =  fluid_synth_write_float( synth->synth, len,
-                                    leftBuffer, 0, 1,
-                                    rightBuffer, 0, 1);
+    int toRelease = excess - mRtReleasedVoices;
+    if (mRtStealLayer && (toRelease > 0)) {
+        int released = releaseOldestVoices(mRtStealLayer, toRelease);
+        mStolenVoices.fetch_add(released, std::memory_order_relaxed);
+    }
 
-    mutex.unlock();
-    return ret;
+    if (mRtStealLayer) {
+        mRtBlockingNotes = (mRtStealPriority < mRtMaxPriority);
+        mRtBlockPriority = mRtStealPriority;
+    }
 }
 
-/* Adds a new soundfont engine and returns a pointer to the synth. Returns nullptr on error. */
-KfFluidSynth* KonfytFluidsynthEngine::addSoundfontProgram(QString soundfontFilename, KonfytSoundPreset p)
+/* JACK thread: release at least count of the oldest voices of the layer that
+ * are still on, as with note-offs. Voices started by the same note share an ID
+ * and are released together. Released voices held by the sustain or sostenuto
+ * pedal keep sounding until the pedal is lifted. Returns the number of voices
+ * released. */
+int KonfytFluidsynthEngine::releaseOldestVoices(KfFluidSynth *synth, int count)
 {
-    KfFluidSynth* s = newSynth();
-    if (!s) { return nullptr; }
+    int released = 0;
+#if FLUIDSYNTH_VERSION_MAJOR >= 2
+    KfFluidSynthHost* host = synth->host;
 
-    // Load soundfont file
-    int sfID = fluid_synth_sfload(s->synth, soundfontFilename.toLocal8Bit().data(), 0);
-    if (sfID == -1) {
+    host->rendering.store(true);
+    if (!host->busy.load()) { // Else GUI thread is changing the synth
+        // Voices of the layer that are still on, oldest (lowest ID) first
+        int size = host->voiceList.size();
+        fluid_synth_get_voicelist(host->synth, host->voiceList.data(), size, -1);
+        int n = 0;
+        for (int i = 0; (i < size) && host->voiceList[i]; i++) {
+            fluid_voice_t* voice = host->voiceList[i];
+            if ( fluid_voice_is_on(voice)
+                 && (fluid_voice_get_channel(voice) == synth->channel) ) {
+                host->voiceList[n++] = voice;
+            }
+        }
+        std::sort(host->voiceList.begin(), host->voiceList.begin() + n,
+                  [](fluid_voice_t* a, fluid_voice_t* b) {
+            return fluid_voice_get_id(a) < fluid_voice_get_id(b);
+        });
+
+        unsigned int releasedId = 0;
+        for (int i = 0; i < n; i++) {
+            unsigned int id = fluid_voice_get_id(host->voiceList[i]);
+            if ( (released == 0) || (id != releasedId) ) {
+                if (released >= count) { break; }
+                fluid_synth_stop(host->synth, id);
+                releasedId = id;
+            }
+            released++;
+        }
+    }
+    host->rendering.store(false);
+#else
+    (void)synth;
+    (void)count;
+#endif
+
+    return released;
+}
+
+/* JACK thread: render len frames of the synth into the buffers set with
+ * setJackRenderBuffers(). The synth's host is rendered once per cycle, with
+ * the output of all its layers, when the first of its layers is rendered.
+ * Returns Fluidsynth's return value. */
+int KonfytFluidsynthEngine::fluidsynthWriteFloat(KfFluidSynth *synth, int len)
+{
+    applyVoiceBudget();
+
+    KfFluidSynthHost* host = synth->host;
+    if (host->renderedCycle != mRenderCycle) {
+        host->renderedCycle = mRenderCycle;
+        renderHost(host, len);
+    }
+    return FLUID_OK;
+}
+
+/* JACK thread: render len frames of all the layers of the host. Commands from
+ * the GUI thread are applied first. The block is rendered in sub-blocks split
+ * at the frame offsets of the queued MIDI events, with the events applied in
+ * between. Channels without a layer prepared for this cycle are rendered to a
+ * scratch buffer.
+ * Note that Fluidsynth renders internally in blocks of 64 frames, which
+ * limits the timing resolution to 64 frames. */
+void KonfytFluidsynthEngine::renderHost(KfFluidSynthHost *host, int len)
+{
+    float* left[KONFYT_FLUIDSYNTH_SHARED_CHANNELS];
+    float* right[KONFYT_FLUIDSYNTH_SHARED_CHANNELS];
+    bool prepared[KONFYT_FLUIDSYNTH_SHARED_CHANNELS];
+
+    host->rendering.store(true);
+    bool busy = host->busy.load();
+
+    for (int c = 0; c < host->channels; c++) {
+        KfFluidSynth* layer = host->layers[c].load(std::memory_order_acquire);
+        prepared[c] = layer && (layer->preparedCycle == mRenderCycle);
+        left[c] = prepared[c] ? layer->outLeft : nullptr;
+        right[c] = prepared[c] ? layer->outRight : nullptr;
+        if (busy) {
+            if (prepared[c]) {
+                memset(left[c], 0, sizeof(float) * len);
+                memset(right[c], 0, sizeof(float) * len);
+            }
+        } else if (layer) {
+            applyCommands(layer);
+        }
+    }
+
+    if (busy) {
+        // The GUI thread is changing the synth. Keep the events for the next
+        // cycle.
+        for (int i = 0; i < host->eventCount; i++) {
+            host->events[i].time = 0;
+        }
+        host->rendering.store(false);
+        return;
+    }
+
+    int pos = 0;
+    for (int i = 0; i <= host->eventCount; i++) {
+        int until = len;
+        if (i < host->eventCount) {
+            until = qMin((int)host->events[i].time, len);
+        }
+        while (until > pos) {
+            int n = until - pos;
+            float* l[KONFYT_FLUIDSYNTH_SHARED_CHANNELS];
+            float* r[KONFYT_FLUIDSYNTH_SHARED_CHANNELS];
+            for (int c = 0; c < host->channels; c++) {
+                if (prepared[c]) {
+                    l[c] = left[c] + pos;
+                    r[c] = right[c] + pos;
+                } else {
+                    l[c] = host->scratch;
+                    r[c] = host->scratch;
+                    n = qMin(n, KONFYT_FLUIDSYNTH_SCRATCH_FRAMES);
+                }
+            }
+            if (host->channels == 1) {
+                fluid_synth_write_float( host->synth, n, l[0], 0, 1, r[0], 0, 1 );
+            } else {
+                fluid_synth_nwrite_float( host->synth, n, l, r, NULL, NULL );
+            }
+            pos += n;
+        }
+        if (i < host->eventCount) {
+            // Skip stale events of a layer removed from the channel
+            const KfFluidSynthHost::TimedEvent& ev = host->events[i];
+            if (host->layers[ev.channel].load(std::memory_order_acquire)) {
+                applyEvent(host, ev);
+            }
+        }
+    }
+    host->eventCount = 0;
+
+    host->rendering.store(false);
+}
+
+/* Adds a new soundfont layer and returns a pointer to the synth. Returns
+ * nullptr on error. */
+KfFluidSynth* KonfytFluidsynthEngine::addSoundfontProgram(QString soundfontFilename,
+                                                          KonfytSoundPreset p,
+                                                          KfFluidsynthSettings settings)
+{
+    KfFluidSynthHost* host = nullptr;
+    bool newlyCreated = false;
+    if (mSharedSynths) {
+        host = sharedHostFor(soundfontFilename);
+    }
+    if (!host) {
+        if (mSharedSynths) {
+            host = newHost(KONFYT_FLUIDSYNTH_SHARED_CHANNELS, sharedHostSettings());
+        } else {
+            host = newHost(1, settings.inheritFrom(mDefaultSettings));
+        }
+        if (!host) { return nullptr; }
+        newlyCreated = true;
+    }
+
+    // Load soundfont file if not yet loaded in the synth. Only new hosts load
+    // soundfonts (see sharedHostFor()). The JACK thread doesn't render them
+    // yet, so the file is loaded without locking the host.
+    KfFluidSynthHost::Soundfont sf = host->soundfonts.value(soundfontFilename, {-1, 0});
+    if (sf.id == -1) {
+        KONFYT_ASSERT(newlyCreated);
+        sf.id = fluid_synth_sfload(host->synth, soundfontFilename.toLocal8Bit().data(), 0);
+    }
+    if (sf.id == -1) {
         emit print("Failed to load soundfont " + soundfontFilename);
-        delete s;
+        if (newlyCreated) { delete host; }
         return nullptr;
     }
+    sf.refs++;
+    host->soundfonts.insert(soundfontFilename, sf);
 
-    // Set the program
-    fluid_synth_program_select(s->synth, 0, sfID, p.bank, p.program);
+    // Set the program. Shared hosts have all samples loaded, so this does not
+    // read the file while the other layers of the host are kept silent.
+    lockHost(host);
+    int channel = freeChannel(host);
+    fluid_synth_program_select(host->synth, channel, sf.id, p.bank, p.program);
+    unlockHost(host);
 
+    KfFluidSynth* s = new KfFluidSynth();
+    s->host = host;
+    s->channel = channel;
     s->program = p;
-    s->soundfontIDinSynth = sfID;
+    s->soundfontFilename = soundfontFilename;
+    s->settings = settings;
+    s->gain = fluid_synth_get_gain(host->synth);
+    if (host->channels > 1) { s->gain = 1; }
+    applySettings(s);
 
+    host->layers[channel].store(s, std::memory_order_release);
+    host->layerCount++;
+    if (newlyCreated) { hosts.append(host); }
     synths.append(s);
 
     return s;
 }
 
+/* The synth must already have been removed from the JACK engine. It is
+ * deleted once the JACK thread can no longer be rendering it, as is its host
+ * once it has no more layers. */
 void KonfytFluidsynthEngine::removeSoundfontProgram(KfFluidSynth *synth)
 {
-    mutex.lock();
+    KONFYT_ASSERT_RETURN(synth);
 
     synths.removeAll(synth);
-    delete synth;
+    mDroppedByRemoved += synth->droppedEvents.load();
 
-    mutex.unlock();
+    KfFluidSynthHost* host = synth->host;
+    host->layers[synth->channel].store(nullptr, std::memory_order_release);
+    host->layerCount--;
+
+    if (host->layerCount > 0) {
+        // Shared synth: silence and reset the channel and unload the soundfont
+        // if no other layers use it.
+        lockHost(host);
+        fluid_synth_all_sounds_off(host->synth, synth->channel);
+        fluid_synth_cc(host->synth, synth->channel, MIDI_CC_RESET_ALL_CONTROLLERS, 0);
+        fluid_synth_cc(host->synth, synth->channel, MIDI_CC_VOLUME, 100);
+        fluid_synth_pitch_bend(host->synth, synth->channel, MIDI_PITCHBEND_ZERO);
+        KfFluidSynthHost::Soundfont sf = host->soundfonts.value(synth->soundfontFilename);
+        sf.refs--;
+        if (sf.refs > 0) {
+            host->soundfonts.insert(synth->soundfontFilename, sf);
+        } else {
+            host->soundfonts.remove(synth->soundfontFilename);
+            fluid_synth_sfunload(host->synth, sf.id, 1);
+        }
+        unlockHost(host);
+    } else {
+        hosts.removeAll(host);
+        deleteWhenUnused([host]() { delete host; });
+    }
+
+    deleteWhenUnused([synth]() { delete synth; });
 }
 
 void KonfytFluidsynthEngine::initFluidsynth(double sampleRate)
@@ -136,12 +711,36 @@ void KonfytFluidsynthEngine::initFluidsynth(double sampleRate)
 
 float KonfytFluidsynthEngine::getGain(KfFluidSynth *synth)
 {
-    return fluid_synth_get_gain( synth->synth );
+    return synth->gain;
 }
 
+/* Applied in the JACK thread before the synth is rendered next. */
 void KonfytFluidsynthEngine::setGain(KfFluidSynth *synth, float newGain)
 {
-    fluid_synth_set_gain( synth->synth, newGain );
+    synth->gain = newGain;
+    KfFluidSynth::Command cmd;
+    cmd.type = KfFluidSynth::Command::SetGain;
+    cmd.value = newGain;
+    if (!synth->commands.write(cmd)) {
+        synth->droppedEvents.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+/* Returns the number of MIDI events and commands that could not be queued for
+ * synths, which should be zero. */
+uint32_t KonfytFluidsynthEngine::droppedEventCount() const
+{
+    uint32_t ret = mDroppedByRemoved;
+    foreach (KfFluidSynth* synth, synths) {
+        ret += synth->droppedEvents.load(std::memory_order_relaxed);
+    }
+    return ret;
+}
+
+/* Returns the number of voices released to keep to the voice budget. */
+uint32_t KonfytFluidsynthEngine::stolenVoiceCount() const
+{
+    return mStolenVoices.load(std::memory_order_relaxed);
 }
 
 KfSoundPtr KonfytFluidsynthEngine::soundfontFromFile(QString filename)
@@ -149,7 +748,7 @@ KfSoundPtr KonfytFluidsynthEngine::soundfontFromFile(QString filename)
     KfSoundPtr ret;
 
     if (!infoSynth) {
-        KfFluidSynth* s = newSynth();
+        KfFluidSynthHost* s = newHost(1, KfFluidsynthSettings());
         if (!s) { return ret; }
 
         infoSynth.reset(s);
@@ -209,9 +808,17 @@ KfSoundPtr KonfytFluidsynthEngine::soundfontFromFile(QString filename)
     return ret;
 }
 
-KfFluidSynth *KonfytFluidsynthEngine::newSynth()
+/* Creates a synth with the specified number of channels, each rendered to a
+ * separate stereo output. */
+KfFluidSynthHost *KonfytFluidsynthEngine::newHost(int channels,
+                                                  KfFluidsynthSettings settings)
 {
-    KfFluidSynth* s = new KfFluidSynth();
+    KfFluidSynthHost* s = new KfFluidSynthHost();
+    s->channels = channels;
+    for (int c = 0; c < KONFYT_FLUIDSYNTH_SHARED_CHANNELS; c++) {
+        s->layers[c].store(nullptr);
+    }
+    s->events.resize(KONFYT_FLUIDSYNTH_MAX_EVENTS * channels);
 
     // Create settings object
     s->settings = new_fluid_settings();
@@ -223,6 +830,31 @@ KfFluidSynth *KonfytFluidsynthEngine::newSynth()
 
     // Set settings
     fluid_settings_setnum(s->settings, "synth.sample-rate", mSampleRate);
+    // Only load sample data of the selected preset instead of the whole
+    // soundfont (Fluidsynth >= 2.0.7). Shared hosts load all samples with the
+    // soundfont, since selecting a preset for a new layer would otherwise read
+    // the file while the host is locked and its other layers are silent.
+    fluid_settings_setint(s->settings, "synth.dynamic-sample-loading",
+                          (channels > 1) ? 0 : 1);
+    if (channels > 1) {
+        // One audio output per channel. Layer gain is applied with the
+        // channel volume, so the synth gain is unity.
+        fluid_settings_setint(s->settings, "synth.midi-channels", channels);
+        fluid_settings_setint(s->settings, "synth.audio-channels", channels);
+        fluid_settings_setint(s->settings, "synth.audio-groups", channels);
+        fluid_settings_setnum(s->settings, "synth.gain", 1.0);
+    }
+    if (settings.polyphony > 0) {
+        fluid_settings_setint(s->settings, "synth.polyphony", settings.polyphony);
+    }
+    // Effects are off unless enabled, so synths don't render reverb and chorus
+    // per layer. See the bus send effects in KonfytJackEngine.
+    int effects = qMax(0, settings.effects);
+    fluid_settings_setint(s->settings, "synth.reverb.active", effects);
+    fluid_settings_setint(s->settings, "synth.chorus.active", effects);
+    if (settings.cpuCores > 0) {
+        fluid_settings_setint(s->settings, "synth.cpu-cores", settings.cpuCores);
+    }
 
     // Create the synthesizer
     s->synth = new_fluid_synth(s->settings);
@@ -231,7 +863,258 @@ KfFluidSynth *KonfytFluidsynthEngine::newSynth()
         delete s;
         return nullptr;
     }
+    s->polyphony = fluid_synth_get_polyphony(s->synth);
+    s->voiceList.resize(s->polyphony + 1);
+
+    // Read soundfonts through memory map (see KonfytSfLoader). Added loaders
+    // are tried before the default loader.
+    fluid_sfloader_t* loader = KonfytSfLoader::create(s->settings);
+    if (loader) {
+        fluid_synth_add_sfloader(s->synth, loader);
+    }
 
     return s;
 }
 
+/* Returns a shared synth with a free channel that already has the soundfont
+ * loaded, or nullptr if there is none. Soundfonts are not loaded into synths
+ * that are being rendered, since the host would have to be locked for the
+ * whole file load, silencing its other layers. */
+KfFluidSynthHost *KonfytFluidsynthEngine::sharedHostFor(QString soundfontFilename)
+{
+    foreach (KfFluidSynthHost* host, hosts) {
+        if (host->layerCount >= host->channels) { continue; }
+        if (host->soundfonts.contains(soundfontFilename)) { return host; }
+    }
+    return nullptr;
+}
+
+int KonfytFluidsynthEngine::freeChannel(KfFluidSynthHost *host)
+{
+    for (int c = 0; c < host->channels; c++) {
+        if (host->layers[c].load() == nullptr) { return c; }
+    }
+    return -1;
+}
+
+/* Keeps the JACK thread from rendering the host while the GUI thread changes
+ * the synth, so that the JACK thread never waits on Fluidsynth's API lock
+ * while e.g. a soundfont is being loaded. */
+void KonfytFluidsynthEngine::lockHost(KfFluidSynthHost *host)
+{
+    host->busy.store(true);
+    while (host->rendering.load()) {
+        QThread::yieldCurrentThread();
+    }
+}
+
+void KonfytFluidsynthEngine::unlockHost(KfFluidSynthHost *host)
+{
+    host->busy.store(false);
+}
+
+void KonfytFluidsynthEngine::deleteWhenUnused(std::function<void ()> free)
+{
+    if (mDeleteWhenUnused) {
+        mDeleteWhenUnused(free);
+    } else {
+        free();
+    }
+}
+
+/* Renders increasing numbers of layers of the first preset of the soundfont
+ * offline, each holding a chord, in per-synth and in shared mode, and returns
+ * the render time as a percentage of the audio time. Also returns the onset
+ * jitter of notes played at known frame offsets, see measureOnsetJitter(). */
+QStringList KonfytFluidsynthEngine::runLayerBenchmark(QString soundfontPath,
+                                                      int nframes,
+                                                      double sampleRate)
+{
+    QStringList ret;
+
+    ret.append(QString("%1: %2 frames per block, %3 Hz")
+               .arg(soundfontPath).arg(nframes).arg(sampleRate));
+    ret.append("mode        layers  synths  voices  load%   load%/layer");
+
+    int blocksPerLevel = qMax(1, (int)(sampleRate * 2 / nframes));
+    int blocksPerChord = qMax(1, (int)(sampleRate / 2 / nframes));
+    const int chord[] = {48, 52, 55, 60};
+    QList<int> layerCounts({1, 8, 32, 64});
+    QElapsedTimer timer;
+    KonfytSoundPreset preset;
+
+    for (int shared = 0; shared < 2; shared++) {
+        foreach (int layers, layerCounts) {
+
+            KonfytFluidsynthEngine engine;
+            engine.initFluidsynth(sampleRate);
+            engine.setSharedSynths(shared);
+
+            KfSoundPtr sound = engine.soundfontFromFile(soundfontPath);
+            if (!sound || sound->presets.isEmpty()) {
+                ret.append("Error: Failed to load soundfont " + soundfontPath);
+                return ret;
+            }
+            preset = sound->presets.first();
+
+            QList<KfFluidSynth*> synths;
+            for (int i = 0; i < layers; i++) {
+                KfFluidSynth* s = engine.addSoundfontProgram(
+                            soundfontPath, preset);
+                if (!s) {
+                    ret.append("Error: Failed to add layer");
+                    return ret;
+                }
+                synths.append(s);
+            }
+            std::vector<float> buffers(layers * 2 * nframes);
+
+            qint64 renderNsecs = 0;
+            qint64 voiceSum = 0;
+            for (int block = 0; block < blocksPerLevel; block++) {
+                // Restrike the chord in all layers regularly
+                if (block % blocksPerChord == 0) {
+                    foreach (KfFluidSynth* s, synths) {
+                        for (int note : chord) {
+                            KonfytRtMidiEvent ev;
+                            ev.setNoteOff(note, 0);
+                            engine.processJackMidi(s, &ev);
+                            ev.setNoteOn(note, 100);
+                            engine.processJackMidi(s, &ev);
+                        }
+                    }
+                }
+
+                timer.start();
+                engine.startJackRender(0);
+                for (int i = 0; i < layers; i++) {
+                    engine.setJackRenderBuffers(
+                                synths[i],
+                                &buffers[(i * 2) * nframes],
+                                &buffers[(i * 2 + 1) * nframes]);
+                }
+                foreach (KfFluidSynth* s, synths) {
+                    engine.fluidsynthWriteFloat(s, nframes);
+                }
+                renderNsecs += timer.nsecsElapsed();
+
+                foreach (KfFluidSynthHost* host, engine.hosts) {
+                    voiceSum += fluid_synth_get_active_voice_count(host->synth);
+                }
+            }
+
+            double audioNsecs = blocksPerLevel * (double)nframes / sampleRate * 1e9;
+            double load = renderNsecs / audioNsecs;
+            ret.append(QString("%1  %2  %3  %4  %5  %6")
+                       .arg(shared ? "shared    " : "per-synth ")
+                       .arg(layers, 6)
+                       .arg(engine.hosts.count(), 6)
+                       .arg((double)voiceSum / blocksPerLevel, 6, 'f', 1)
+                       .arg(load * 100, 6, 'f', 2)
+                       .arg(load * 100 / layers, 11, 'f', 3));
+        }
+    }
+
+    ret.append("");
+    ret.append("onset latency      min   max  jitter  jitter ms  (frames)");
+    ret.append(measureOnsetJitter(soundfontPath, preset, nframes, sampleRate, false));
+    ret.append(measureOnsetJitter(soundfontPath, preset, nframes, sampleRate, true));
+
+    return ret;
+}
+
+/* Plays notes at known frame offsets within the block in a single layer and
+ * detects the first output frame of each note. Returns the minimum and maximum
+ * latency from the note-on to the output and their difference, the jitter.
+ * With blockQuantized, each note-on is only applied at the start of the next
+ * block, as when MIDI was processed after rendering, for comparison.
+ * Fluidsynth renders internally in blocks of 64 frames, so a jitter of up to
+ * 63 frames is expected without blockQuantized. */
+QString KonfytFluidsynthEngine::measureOnsetJitter(QString soundfontPath,
+                                                   KonfytSoundPreset preset,
+                                                   int nframes,
+                                                   double sampleRate,
+                                                   bool blockQuantized)
+{
+    const int trials = 64;
+    const int maxBlocks = 64; // To wait for an onset or silence
+    const float threshold = 1e-5;
+    const int note = 60;
+
+    KonfytFluidsynthEngine engine;
+    engine.initFluidsynth(sampleRate);
+    KfFluidSynth* synth = engine.addSoundfontProgram(soundfontPath, preset);
+    if (!synth) {
+        return "Error: Failed to add layer";
+    }
+    std::vector<float> left(nframes);
+    std::vector<float> right(nframes);
+
+    // Renders a block and returns the first frame above the threshold, or -1.
+    auto renderBlock = [&]()
+    {
+        engine.startJackRender(0);
+        engine.setJackRenderBuffers(synth, left.data(), right.data());
+        engine.fluidsynthWriteFloat(synth, nframes);
+        for (int i = 0; i < nframes; i++) {
+            if ( (fabs(left[i]) > threshold) || (fabs(right[i]) > threshold) ) {
+                return i;
+            }
+        }
+        return -1;
+    };
+
+    int minLatency = INT_MAX;
+    int maxLatency = 0;
+    int missed = 0;
+    for (int trial = 0; trial < trials; trial++) {
+        // Wait for silence from the previous note
+        int blocks = 0;
+        while ( (renderBlock() >= 0) && (blocks < maxBlocks) ) {
+            blocks++;
+        }
+
+        int offset = (trial * 37) % nframes;
+        KonfytRtMidiEvent ev;
+        ev.setNoteOn(note, 127);
+        int latency = -1;
+        if (blockQuantized) {
+            // Missed this block, applied at the start of the next one
+            if (renderBlock() >= 0) { missed++; continue; }
+            engine.processJackMidi(synth, &ev, 0);
+            latency = nframes - offset;
+        } else {
+            engine.processJackMidi(synth, &ev, offset);
+            latency = -offset;
+        }
+        int onset = -1;
+        for (blocks = 0; (onset < 0) && (blocks < maxBlocks); blocks++) {
+            onset = renderBlock();
+            latency += (onset < 0) ? nframes : onset;
+        }
+        if (onset < 0) {
+            missed++;
+        } else {
+            minLatency = qMin(minLatency, latency);
+            maxLatency = qMax(maxLatency, latency);
+        }
+
+        ev.setNoteOff(note, 0);
+        engine.processJackMidi(synth, &ev, 0);
+        fluid_synth_all_sounds_off(synth->host->synth, synth->channel);
+    }
+
+    if (missed == trials) {
+        return "Error: No onsets detected";
+    }
+    QString ret = QString("%1  %2  %3  %4  %5")
+            .arg(blockQuantized ? "block-quantized " : "sample-accurate ")
+            .arg(minLatency, 4)
+            .arg(maxLatency, 4)
+            .arg(maxLatency - minLatency, 6)
+            .arg((maxLatency - minLatency) * 1000.0 / sampleRate, 9, 'f', 2);
+    if (missed) {
+        ret += QString("  (%1 of %2 notes not detected)").arg(missed).arg(trials);
+    }
+    return ret;
+}
@@ -23,21 +23,90 @@
 #define KONFYT_FLUIDSYNTH_ENGINE_H
 
 #include "konfytUtils.h"
-#include "konfytMidi.h"
+#include "konfytRtMidiEvent.h"
 #include "konfytStructs.h"
+#include "lockfreeRingBuffer.h"
+#include "xml.h"
 
 #include <fluidsynth.h>
 
+#include <QMap>
 #include <QObject>
-#include <QMutex>
+
+#include <atomic>
+#include <functional>
+#include <vector>
+
+#define KONFYT_FLUIDSYNTH_MAX_EVENTS 256 // Events per layer per JACK cycle
+#define KONFYT_FLUIDSYNTH_MAX_COMMANDS 64 // Queued commands from the GUI thread
+#define KONFYT_FLUIDSYNTH_SHARED_CHANNELS 16 // Layers per synth in shared mode
+#define KONFYT_FLUIDSYNTH_SCRATCH_FRAMES 1024 // Output of channels without a layer
+
+struct KfFluidSynth;
 
 // ============================================================================
 
-struct KfFluidSynth
+/* Fluidsynth settings of soundfont layers, set per layer and project-wide.
+ * Values of -1 are not set: layer settings inherit the project-wide settings,
+ * which fall back to the Fluidsynth defaults. Reverb and chorus are off unless
+ * enabled, since layers normally use the shared send effects of the buses. */
+struct KfFluidsynthSettings
+{
+    int polyphony = -1;     // Maximum number of voices
+    int effects = -1;       // Reverb and chorus: 0 = off, 1 = on
+    int interpolation = -1; // FLUID_INTERP_NONE, _LINEAR, _4THORDER or _7THORDER
+    int cpuCores = -1;      // Rendering threads, only applied to new synths
+    int priority = -1;      // Voice budget priority, lowest is stolen first (0)
+
+    KfFluidsynthSettings inheritFrom(const KfFluidsynthSettings& defaults) const;
+    bool operator==(const KfFluidsynthSettings& other) const;
+    bool operator!=(const KfFluidsynthSettings& other) const;
+
+    Xml toXml() const;
+    void readFromXml(Xml xml);
+
+    static constexpr const char* XML_FS_SETTINGS = "fluidsynthSettings";
+    static constexpr const char* XML_FS_POLYPHONY = "polyphony";
+    static constexpr const char* XML_FS_EFFECTS = "effects";
+    static constexpr const char* XML_FS_INTERPOLATION = "interpolation";
+    static constexpr const char* XML_FS_CPU_CORES = "cpuCores";
+    static constexpr const char* XML_FS_PRIORITY = "priority";
+};
+
+// ============================================================================
+
+/* Engine-wide limit on the number of Fluidsynth voices, enforced while the
+ * DSP load of the JACK process callback exceeds dspLoadPercent. The oldest
+ * voices of the layers with the lowest priority are released first.
+ * Requires Fluidsynth 2 for the voice state; not enforced with Fluidsynth 1. */
+struct KfFluidsynthVoiceBudget
+{
+    int voices = 0; // No budget if zero
+    float dspLoadPercent = 80;
+
+    bool operator==(const KfFluidsynthVoiceBudget& other) const;
+    bool operator!=(const KfFluidsynthVoiceBudget& other) const;
+
+    Xml toXml() const;
+    void readFromXml(Xml xml);
+
+    static constexpr const char* XML_FS_VOICE_BUDGET = "fluidsynthVoiceBudget";
+    static constexpr const char* XML_FS_BUDGET_VOICES = "voices";
+    static constexpr const char* XML_FS_BUDGET_DSP_LOAD = "dspLoad";
+};
+
+// ============================================================================
+
+/* A Fluidsynth synthesizer hosting one or more layers, each on its own MIDI
+ * channel and rendered to its own audio output. In per-synth mode a host has
+ * a single layer on channel 0. In shared mode layers are mapped onto the
+ * channels of a few shared hosts, so that all the layers of a host are
+ * rendered with one Fluidsynth call. */
+struct KfFluidSynthHost
 {
     friend class KonfytFluidsynthEngine;
 
-    ~KfFluidSynth()
+    ~KfFluidSynthHost()
     {
         if (synth) { delete_fluid_synth(synth); }
         if (settings) { delete_fluid_settings(settings); }
@@ -46,8 +115,89 @@ struct KfFluidSynth
 protected:
     fluid_synth_t* synth = nullptr;
     fluid_settings_t* settings = nullptr;
+    int channels = 1;
+    int polyphony = 0;
+
+    // Layer on each channel, or nullptr if the channel is free. Set by the
+    // GUI thread, read by the JACK thread.
+    std::atomic<KfFluidSynth*> layers[KONFYT_FLUIDSYNTH_SHARED_CHANNELS];
+    int layerCount = 0;
+
+    // Soundfonts loaded in the synth with the number of layers using them.
+    // GUI thread only.
+    struct Soundfont
+    {
+        int id;
+        int refs;
+    };
+    QMap<QString, Soundfont> soundfonts;
+
+    // The GUI thread sets busy while it changes the synth (e.g. loading a
+    // soundfont for a new layer). The JACK thread skips rendering the host
+    // while busy instead of blocking on Fluidsynth's API lock.
+    std::atomic<bool> busy {false};
+    std::atomic<bool> rendering {false};
+
+    // MIDI events of all the layers to be applied at their frame offsets
+    // when the host is rendered. JACK thread only.
+    struct TimedEvent
+    {
+        uint32_t time;
+        int channel;
+        int type;
+        int data1;
+        int data2;
+    };
+    std::vector<TimedEvent> events;
+    int eventCount = 0;
+    uint32_t renderedCycle = 0;
+    float scratch[KONFYT_FLUIDSYNTH_SCRATCH_FRAMES];
+
+    // Voices per channel counted for the voice budget: all sounding voices,
+    // those still on (key held) and those already in their release phase.
+    // JACK thread only.
+    std::vector<fluid_voice_t*> voiceList;
+    int channelVoices[KONFYT_FLUIDSYNTH_SHARED_CHANNELS];
+    int channelOnVoices[KONFYT_FLUIDSYNTH_SHARED_CHANNELS];
+    int channelReleasedVoices[KONFYT_FLUIDSYNTH_SHARED_CHANNELS];
+    uint32_t countedCycle = 0;
+};
+
+// ============================================================================
+
+/* A soundfont layer, rendered on a channel of a KfFluidSynthHost. */
+struct KfFluidSynth
+{
+    friend class KonfytFluidsynthEngine;
+
+protected:
+    KfFluidSynthHost* host = nullptr;
+    int channel = 0;
     KonfytSoundPreset program;
-    int soundfontIDinSynth;
+    QString soundfontFilename;
+    KfFluidsynthSettings settings; // As set for the layer, not inherited
+    std::atomic<int> priority {0};
+
+    // Changes from the GUI thread, applied in the JACK thread before the
+    // host is rendered.
+    struct Command
+    {
+        enum Type { SetGain };
+        Type type;
+        float value;
+    };
+    LockfreeRingBuffer<Command> commands{KONFYT_FLUIDSYNTH_MAX_COMMANDS};
+    float gain = 0; // GUI thread
+
+    // MIDI events and commands that could not be queued
+    std::atomic<uint32_t> droppedEvents {0};
+
+    // JACK thread
+    float rtGain = 1;
+    int midiVolume = 100; // Last received CC7 value (shared mode)
+    float* outLeft = nullptr;
+    float* outRight = nullptr;
+    uint32_t preparedCycle = 0;
 };
 
 // ============================================================================
@@ -61,28 +211,99 @@ public:
 
     void initFluidsynth(double sampleRate);
 
-    QMutex mutex;
-    void processJackMidi(KfFluidSynth *synth, const KonfytMidiEvent* ev);
-    int fluidsynthWriteFloat(KfFluidSynth *synth, void* leftBuffer, void* rightBuffer, int len);
+    /* Synths removed while JACK may still be rendering them are passed to
+     * deleteWhenUnused to be deleted once the JACK thread is done with them. */
+    void setDeferredDelete(std::function<void(std::function<void()>)> deleteWhenUnused);
+
+    /* In shared mode, layers added with addSoundfontProgram() are mapped onto
+     * the channels of shared synths instead of each getting its own synth.
+     * The gain of a layer is then applied with its channel volume (CC7).
+     * Layers only share a synth with layers of the same soundfont.
+     * Reverb and chorus of shared synths are disabled. Must be set before
+     * any layers are added. */
+    void setSharedSynths(bool shared);
+    bool sharedSynths() const;
+
+    /* Project-wide settings, inherited by layers for settings not set in the
+     * layer settings. */
+    void setDefaultSettings(KfFluidsynthSettings settings);
+    KfFluidsynthSettings defaultSettings() const;
+    void setVoiceBudget(KfFluidsynthVoiceBudget budget);
 
-    KfFluidSynth* addSoundfontProgram(QString soundfontFilename, KonfytSoundPreset p);
+    // JACK thread
+    void processJackMidi(KfFluidSynth *synth, const KonfytRtMidiEvent* ev, uint32_t time = 0);
+    void startJackRender(float dspLoadPercent);
+    void setJackRenderBuffers(KfFluidSynth *synth, void* leftBuffer, void* rightBuffer);
+    int fluidsynthWriteFloat(KfFluidSynth *synth, int len);
+
+    KfFluidSynth* addSoundfontProgram(QString soundfontFilename, KonfytSoundPreset p,
+                                      KfFluidsynthSettings settings = KfFluidsynthSettings());
     void removeSoundfontProgram(KfFluidSynth *synth);
+    void setSettings(KfFluidSynth *synth, KfFluidsynthSettings settings);
 
     float getGain(KfFluidSynth *synth);
     void setGain(KfFluidSynth *synth, float newGain);
 
+    uint32_t droppedEventCount() const;
+    uint32_t stolenVoiceCount() const;
+
     KfSoundPtr soundfontFromFile(QString filename);
 
+    static QStringList runLayerBenchmark(QString soundfontPath, int nframes,
+                                         double sampleRate);
+
 signals:
     void print(QString msg);
 
 private:
     QList<KfFluidSynth*> synths;
+    QList<KfFluidSynthHost*> hosts;
+    bool mSharedSynths = false;
     double mSampleRate = 44100;
+    std::function<void(std::function<void()>)> mDeleteWhenUnused;
+    uint32_t mDroppedByRemoved = 0; // Dropped events of removed synths
+    uint32_t mRenderCycle = 0; // JACK thread
+    KfFluidsynthSettings mDefaultSettings;
+
+    // Voice budget
+    std::atomic<int> mBudgetVoices {0};
+    std::atomic<float> mBudgetDspLoad {80};
+    std::atomic<uint32_t> mStolenVoices {0};
+    // JACK thread
+    bool mRtBudgetActive = false;
+    int mRtVoices = 0;
+    int mRtReleasedVoices = 0; // Sounding voices already in release
+    KfFluidSynth* mRtStealLayer = nullptr;
+    int mRtStealVoices = 0;
+    int mRtStealPriority = 0;
+    int mRtMaxPriority = 0;
+    bool mRtBlockingNotes = false; // Note-ons of lowest priority layers are dropped
+    int mRtBlockPriority = 0;
+    uint32_t mRtBudgetCycle = 0;
+
+    KfFluidSynthHost* newHost(int channels, KfFluidsynthSettings settings);
+    KfFluidSynthHost* sharedHostFor(QString soundfontFilename);
+    int freeChannel(KfFluidSynthHost* host);
+    void lockHost(KfFluidSynthHost* host);
+    void unlockHost(KfFluidSynthHost* host);
+    void deleteWhenUnused(std::function<void()> free);
+
+    QScopedPointer<KfFluidSynthHost> infoSynth;
 
-    KfFluidSynth* newSynth();
+    void applySettings(KfFluidSynth* synth);
+    void applyHostSettings(KfFluidSynthHost* host, KfFluidsynthSettings s);
+    KfFluidsynthSettings sharedHostSettings() const;
+    void countVoices(KfFluidSynth* synth);
+    void applyVoiceBudget();
+    int releaseOldestVoices(KfFluidSynth* synth, int count);
+    void renderHost(KfFluidSynthHost* host, int len);
+    void applyCommands(KfFluidSynth* synth);
+    void applyEvent(KfFluidSynthHost* host, const KfFluidSynthHost::TimedEvent& ev);
 
-    QScopedPointer<KfFluidSynth> infoSynth;
+    static QString measureOnsetJitter(QString soundfontPath, KonfytSoundPreset preset,
+                                      int nframes, double sampleRate,
+                                      bool blockQuantized);
+    static int sharedVolume(const KfFluidSynth* synth);
 };
 
 #endif // KONFYT_FLUIDSYNTH_ENGINE_H
@@ -22,17 +22,29 @@
 #include "konfytJackEngine.h"
 
 #include <QDebug> // todo regex
+#include <QElapsedTimer>
+#include <QJsonArray>
 #include <QRegularExpression>
 
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
 
 KonfytJackEngine::KonfytJackEngine(QObject *parent) :
     QObject(parent)
 {
     initMidiClosureEvents();
+    for (int i = 0; i < KONFYT_JACK_MIRRORED_VALUES; i++) {
+        mirroredValues[i] = 0;
+    }
+    midiRxSysex.allocate(KONFYT_RT_SYSEX_RING_BYTES);
 }
 
 KonfytJackEngine::~KonfytJackEngine()
 {
+    reclaimRetired(true);
+    delete mGraph.load();
     free(fadeOutValues);
 }
 
@@ -59,11 +71,20 @@ void KonfytJackEngine::timerEvent(QTimerEvent* /*event*/)
         print(QString("Buffer size changed to: %1").arg(mJackBufferSize));
     }
 
+    // Free graphs, ports and routes the JACK thread is done with
+    reclaimRetired();
+
     // Transfer events that were received in JACK tread from ringbuffers to lists
     // that will be retrieved later by the GUI thread.
 
     // Received MIDI data
-    extractedMidiRx.append(midiRxBuffer.readAll());
+    midiRxBuffer.startRead();
+    while (midiRxBuffer.hasNext()) {
+        KfJackRtMidiRxEvent ev = midiRxBuffer.readNext();
+        extractedMidiRx.append(ev.toMidiRxEvent());
+        midiRxSysex.release(ev.midiEvent);
+    }
+    midiRxBuffer.endRead();
     if (!extractedMidiRx.isEmpty()) {
         emit midiEventsReceived();
     }
@@ -73,11 +94,24 @@ void KonfytJackEngine::timerEvent(QTimerEvent* /*event*/)
     if (!extractedAudioRx.isEmpty()) {
         emit audioEventsReceived();
     }
+
+    // Engine statistics
+    if (statisticsTimer.elapsed() >= KONFYT_JACK_STATISTICS_INTERVAL_MS) {
+        statisticsTimer.start();
+        emit statisticsInfo(getStatisticsInfo());
+    }
+    quint64 dropped = (quint64)droppedMidiOutEventCount()
+            + droppedScheduledEventCount() + droppedSysexEventCount();
+    if (dropped != mReportedDroppedEvents) {
+        mReportedDroppedEvents = dropped;
+        emit midiEventsDropped(getDroppedEventsInfo());
+    }
 }
 
 void KonfytJackEngine::startTimer()
 {
     this->timer.start(20, this);
+    statisticsTimer.start();
 }
 
 void KonfytJackEngine::refreshAllPortsConnections()
@@ -175,8 +209,6 @@ void KonfytJackEngine::disconnectClientsFromPort(KfJackPort* port, QStringList c
 
     const char* portName = jack_port_name(port->jackPointer);
 
-    pauseJackProcessing(true);
-
     // Disconnect clients from port in JACK
     foreach (QString client, clients) {
         int err = 0;
@@ -189,8 +221,6 @@ void KonfytJackEngine::disconnectClientsFromPort(KfJackPort* port, QStringList c
             print("Failed to disconnect JACK port client.");
         }
     }
-
-    pauseJackProcessing(false);
 }
 
 /* Add new soundfont ports. Also assigns MIDI filter. */
@@ -213,6 +243,8 @@ KfJackPluginPorts* KonfytJackEngine::addSoundfont(KfFluidSynth *fluidSynth)
     p->midi = new KfJackMidiPort(KfJackPort::INPUT); // Dummy port for note records, etc.
     p->fluidSynthInEngine = fluidSynth;
 
+    beginGraphUpdate();
+
     p->midiRoute = addMidiRoute();
     p->audioLeftRoute = addAudioRoute();
     p->audioRightRoute = addAudioRoute();
@@ -223,15 +255,17 @@ KfJackPluginPorts* KonfytJackEngine::addSoundfont(KfFluidSynth *fluidSynth)
     setAudioRouteActive(p->audioRightRoute, true);
 
     // Pre-set audio route sources and MIDI route destination
-    p->audioLeftRoute->source = p->audioInLeft;
-    p->audioRightRoute->source = p->audioInRight;
+    p->audioLeftRoute->config.source = p->audioInLeft;
+    p->audioRightRoute->config.source = p->audioInRight;
 
-    p->midiRoute->destFluidsynthID = p->fluidSynthInEngine;
-    p->midiRoute->destIsJackPort = false;
-    p->midiRoute->destPort = p->midi;
+    p->midiRoute->config.destFluidsynthID = p->fluidSynthInEngine;
+    p->midiRoute->config.destIsJackPort = false;
+    p->midiRoute->config.destPort = p->midi;
 
     fluidsynthPorts.append(p);
 
+    endGraphUpdate();
+
     return p;
 }
 
@@ -239,22 +273,25 @@ void KonfytJackEngine::removeSoundfont(KfJackPluginPorts *p)
 {
     KONFYT_ASSERT_RETURN(p);
 
-    pauseJackProcessing(true);
-
-    // Delete all objects created in addSoundfont()
+    beginGraphUpdate();
 
     fluidsynthPorts.removeAll(p);
-    free(p->audioInLeft->buffer);
-    free(p->audioInRight->buffer);
     removeMidiRoute(p->midiRoute);
     removeAudioRoute(p->audioLeftRoute);
     removeAudioRoute(p->audioRightRoute);
-    delete p->audioInLeft;
-    delete p->audioInRight;
-    delete p->midi;
-    delete p;
 
-    pauseJackProcessing(false);
+    // Delete all objects created in addSoundfont()
+    retire([p]()
+    {
+        free(p->audioInLeft->buffer);
+        free(p->audioInRight->buffer);
+        delete p->audioInLeft;
+        delete p->audioInRight;
+        delete p->midi;
+        delete p;
+    });
+
+    endGraphUpdate();
 }
 
 /* For the specified ports spec, create a new MIDI output port and left and
@@ -265,6 +302,7 @@ void KonfytJackEngine::removeSoundfont(KfJackPluginPorts *p)
 KfJackPluginPorts* KonfytJackEngine::addPluginPortsAndConnect(const KonfytJackPortsSpec &spec)
 {
     KfJackMidiPort* midiPort = new KfJackMidiPort(KfJackPort::OUTPUT);
+    midiPort->outQueue.allocate();
     KfJackAudioPort* alPort = new KfJackAudioPort(KfJackPort::INPUT);
     KfJackAudioPort* arPort = new KfJackAudioPort(KfJackPort::INPUT);
 
@@ -297,6 +335,8 @@ KfJackPluginPorts* KonfytJackEngine::addPluginPortsAndConnect(const KonfytJackPo
     p->audioInLeft = alPort;
     p->audioInRight = arPort;
 
+    beginGraphUpdate();
+
     // Add routes
     p->midiRoute = addMidiRoute();
     p->audioLeftRoute = addAudioRoute();
@@ -308,16 +348,16 @@ KfJackPluginPorts* KonfytJackEngine::addPluginPortsAndConnect(const KonfytJackPo
     setAudioRouteActive(p->audioRightRoute, true);
 
     // Pre-set route sources/dests
-    p->midiRoute->destIsJackPort = true;
-    p->midiRoute->destPort = midiPort;
-    p->midiRoute->filter = spec.midiFilter;
+    p->midiRoute->config.destIsJackPort = true;
+    p->midiRoute->config.destPort = midiPort;
+    setRouteConfigFilter(&p->midiRoute->config, spec.midiFilter);
 
-    p->audioLeftRoute->source = p->audioInLeft;
-    p->audioRightRoute->source = p->audioInRight;
+    p->audioLeftRoute->config.source = p->audioInLeft;
+    p->audioRightRoute->config.source = p->audioInRight;
 
-    pauseJackProcessing(true);
     pluginPorts.append(p);
-    pauseJackProcessing(false);
+
+    endGraphUpdate();
 
     return p;
 }
@@ -326,7 +366,7 @@ void KonfytJackEngine::removePlugin(KfJackPluginPorts *p)
 {
     KONFYT_ASSERT_RETURN(p);
 
-    pauseJackProcessing(true);
+    beginGraphUpdate();
 
     // Remove everything created in addPluginPortsAndConnect()
 
@@ -335,44 +375,62 @@ void KonfytJackEngine::removePlugin(KfJackPluginPorts *p)
     removeAudioRoute(p->audioLeftRoute);
     removeAudioRoute(p->audioRightRoute);
 
-    pluginPorts.removeAll(p);
-
-    if (jack_port_unregister(mJackClient, p->midi->jackPointer)) {
-        print("Failed to unregister JACK MIDI out port for plugin.");
-    }
-    delete p->midi;
-
-    if (jack_port_unregister(mJackClient, p->audioInLeft->jackPointer)) {
-        print("Failed to unregister JACK left audio in port for plugin.");
+    if (p->bridge || p->sfzInstrument) {
+        // Bridge plugin or native SFZ instrument, added with addBridgePlugin()
+        // or addSfzInstrument()
+        bridgePorts.removeAll(p);
+        sfzInstrumentPorts.removeAll(p);
+        retire([p]()
+        {
+            free(p->audioInLeft->buffer);
+            free(p->audioInRight->buffer);
+            delete p->midi;
+            delete p->audioInLeft;
+            delete p->audioInRight;
+            delete p;
+        });
+
+        endGraphUpdate();
+        return;
     }
-    delete p->audioInLeft;
 
-    if (jack_port_unregister(mJackClient, p->audioInRight->jackPointer)) {
-        print("Failed to unregister JACK left audio in port for plugin.");
-    }
-    delete p->audioInRight;
+    pluginPorts.removeAll(p);
 
-    delete p;
+    retire([this, p]()
+    {
+        // Ports have already been removed if the client was closed
+        if (mJackClient) {
+            if (jack_port_unregister(mJackClient, p->midi->jackPointer)) {
+                print("Failed to unregister JACK MIDI out port for plugin.");
+            }
+            if (jack_port_unregister(mJackClient, p->audioInLeft->jackPointer)) {
+                print("Failed to unregister JACK left audio in port for plugin.");
+            }
+            if (jack_port_unregister(mJackClient, p->audioInRight->jackPointer)) {
+                print("Failed to unregister JACK left audio in port for plugin.");
+            }
+        }
+        delete p->midi;
+        delete p->audioInLeft;
+        delete p->audioInRight;
+        delete p;
+    });
 
-    pauseJackProcessing(false);
+    endGraphUpdate();
 }
 
 void KonfytJackEngine::setSoundfontMidiFilter(KfJackPluginPorts *p, MidiFilter filter)
 {
     KONFYT_ASSERT_RETURN(p);
 
-    pauseJackProcessing(true);
-    p->midiRoute->filter = filter;
-    pauseJackProcessing(false);
+    setRouteMidiFilter(p->midiRoute, filter);
 }
 
 void KonfytJackEngine::setSoundfontMidiPreFilter(KfJackPluginPorts *p, MidiFilter filter)
 {
     KONFYT_ASSERT_RETURN(p);
 
-    pauseJackProcessing(true);
-    p->midiRoute->preFilter = filter;
-    pauseJackProcessing(false);
+    setRouteMidiPreFilter(p->midiRoute, filter);
 }
 
 void KonfytJackEngine::setSoundfontActive(KfJackPluginPorts *p, bool active)
@@ -386,18 +444,14 @@ void KonfytJackEngine::setPluginMidiFilter(KfJackPluginPorts *p, MidiFilter filt
 {
     KONFYT_ASSERT_RETURN(p);
 
-    pauseJackProcessing(true);
-    p->midiRoute->filter = filter;
-    pauseJackProcessing(false);
+    setRouteMidiFilter(p->midiRoute, filter);
 }
 
 void KonfytJackEngine::setPluginMidiPreFilter(KfJackPluginPorts *p, MidiFilter filter)
 {
     KONFYT_ASSERT_RETURN(p);
 
-    pauseJackProcessing(true);
-    p->midiRoute->preFilter = filter;
-    pauseJackProcessing(false);
+    setRouteMidiPreFilter(p->midiRoute, filter);
 }
 
 void KonfytJackEngine::setPluginActive(KfJackPluginPorts *p, bool active)
@@ -421,25 +475,25 @@ void KonfytJackEngine::setSoundfontRouting(KfJackPluginPorts *p, KfJackMidiPort
 
     if (!clientIsActive()) { return; }
 
-    pauseJackProcessing(true);
+    beginGraphUpdate();
 
     // MIDI route destination has already been set in addSoundfont().
-    p->midiRoute->source = midiInPort;
+    p->midiRoute->config.source = midiInPort;
 
     // Audio route sources have already been set in addSoundfont().
     // Set left audio route destination
-    p->audioLeftRoute->dest = leftPort;
+    p->audioLeftRoute->config.dest = leftPort;
     // Right audio route destination
-    p->audioRightRoute->dest = rightPort;
+    p->audioRightRoute->config.dest = rightPort;
 
-    pauseJackProcessing(false);
+    endGraphUpdate();
 }
 
 void KonfytJackEngine::setSoundfontBlockMidiDirectThrough(KfJackPluginPorts *p, bool block)
 {
     KONFYT_ASSERT_RETURN(p);
 
-    p->midiRoute->blockDirectThrough = block;
+    setRouteBlockMidiDirectThrough(p->midiRoute, block);
 }
 
 void KonfytJackEngine::setPluginRouting(KfJackPluginPorts *p, KfJackMidiPort *midiInPort, KfJackAudioPort *leftPort, KfJackAudioPort *rightPort)
@@ -448,13 +502,13 @@ void KonfytJackEngine::setPluginRouting(KfJackPluginPorts *p, KfJackMidiPort *mi
 
     if (!clientIsActive()) { return; }
 
-    pauseJackProcessing(true);
+    beginGraphUpdate();
 
-    p->midiRoute->source = midiInPort;
-    p->audioLeftRoute->dest = leftPort;
-    p->audioRightRoute->dest = rightPort;
+    p->midiRoute->config.source = midiInPort;
+    p->audioLeftRoute->config.dest = leftPort;
+    p->audioRightRoute->config.dest = rightPort;
 
-    pauseJackProcessing(false);
+    endGraphUpdate();
 }
 
 KfJackMidiRoute *KonfytJackEngine::getPluginMidiRoute(KfJackPluginPorts *p)
@@ -478,12 +532,99 @@ void KonfytJackEngine::setPluginBlockMidiDirectThrough(KfJackPluginPorts *p, boo
 {
     KONFYT_ASSERT_RETURN(p);
 
-    p->midiRoute->blockDirectThrough = block;
+    setRouteBlockMidiDirectThrough(p->midiRoute, block);
+}
+
+/* Add plugin ports for a bridge plugin. Similar to soundfonts, MIDI is written
+ * to and audio is read from the bridge shared memory in the JACK process
+ * callback without external JACK connections. Removed with removePlugin(). */
+KfJackPluginPorts *KonfytJackEngine::addBridgePlugin(KonfytBridgeShm *bridge,
+                                                     MidiFilter filter)
+{
+    KONFYT_ASSERT_RETURN_VAL(bridge, nullptr);
+
+    KfJackPluginPorts* p = new KfJackPluginPorts();
+    p->audioInLeft = new KfJackAudioPort(KfJackPort::INPUT);
+    p->audioInRight = new KfJackAudioPort(KfJackPort::INPUT);
+
+    // Audio is not received from JACK audio ports, so allocate the buffers now
+    // so the bridge audio can be copied to them in the JACK process callback.
+    p->audioInLeft->buffer = malloc(sizeof(jack_default_audio_sample_t)*mJackBufferSize);
+    p->audioInRight->buffer = malloc(sizeof(jack_default_audio_sample_t)*mJackBufferSize);
+
+    p->midi = new KfJackMidiPort(KfJackPort::INPUT); // Dummy port for note records, etc.
+    p->bridge = bridge;
+
+    beginGraphUpdate();
+
+    p->midiRoute = addMidiRoute();
+    p->audioLeftRoute = addAudioRoute();
+    p->audioRightRoute = addAudioRoute();
+
+    // Only MIDI route is used to set plugin active/inactive. Audio routes are
+    // always active.
+    setAudioRouteActive(p->audioLeftRoute, true);
+    setAudioRouteActive(p->audioRightRoute, true);
+
+    p->audioLeftRoute->config.source = p->audioInLeft;
+    p->audioRightRoute->config.source = p->audioInRight;
+
+    p->midiRoute->config.destBridge = bridge;
+    p->midiRoute->config.destIsJackPort = false;
+    p->midiRoute->config.destPort = p->midi;
+    setRouteConfigFilter(&p->midiRoute->config, filter);
+
+    bridgePorts.append(p);
+
+    endGraphUpdate();
+
+    return p;
+}
+
+/* Add plugin ports for a native SFZ instrument. MIDI is given to and audio is
+ * rendered by the instrument in the JACK process callback. Removed with
+ * removePlugin(). */
+KfJackPluginPorts *KonfytJackEngine::addSfzInstrument(KonfytSfzInstrument *instrument,
+                                                      MidiFilter filter)
+{
+    KONFYT_ASSERT_RETURN_VAL(instrument, nullptr);
+
+    KfJackPluginPorts* p = new KfJackPluginPorts();
+    p->audioInLeft = new KfJackAudioPort(KfJackPort::INPUT);
+    p->audioInRight = new KfJackAudioPort(KfJackPort::INPUT);
+    p->audioInLeft->buffer = malloc(sizeof(jack_default_audio_sample_t)*mJackBufferSize);
+    p->audioInRight->buffer = malloc(sizeof(jack_default_audio_sample_t)*mJackBufferSize);
+
+    p->midi = new KfJackMidiPort(KfJackPort::INPUT); // Dummy port for note records, etc.
+    p->sfzInstrument = instrument;
+
+    beginGraphUpdate();
+
+    p->midiRoute = addMidiRoute();
+    p->audioLeftRoute = addAudioRoute();
+    p->audioRightRoute = addAudioRoute();
+
+    setAudioRouteActive(p->audioLeftRoute, true);
+    setAudioRouteActive(p->audioRightRoute, true);
+
+    p->audioLeftRoute->config.source = p->audioInLeft;
+    p->audioRightRoute->config.source = p->audioInRight;
+
+    p->midiRoute->config.destSfzInstrument = instrument;
+    p->midiRoute->config.destIsJackPort = false;
+    p->midiRoute->config.destPort = p->midi;
+    setRouteConfigFilter(&p->midiRoute->config, filter);
+
+    sfzInstrumentPorts.append(p);
+
+    endGraphUpdate();
+
+    return p;
 }
 
 void KonfytJackEngine::removeAllAudioInAndOutPorts()
 {
-    pauseJackProcessing(true);
+    beginGraphUpdate();
 
     foreach (KfJackAudioPort* port, audioOutPorts) {
         removeAudioPort(port);
@@ -492,12 +633,12 @@ void KonfytJackEngine::removeAllAudioInAndOutPorts()
         removeAudioPort(port);
     }
 
-    pauseJackProcessing(false);
+    endGraphUpdate();
 }
 
 void KonfytJackEngine::removeAllMidiInAndOutPorts()
 {
-    pauseJackProcessing(true);
+    beginGraphUpdate();
 
     foreach (KfJackMidiPort* port, midiInPorts) {
         removeMidiPort(port);
@@ -506,7 +647,7 @@ void KonfytJackEngine::removeAllMidiInAndOutPorts()
         removeMidiPort(port);
     }
 
-    pauseJackProcessing(false);
+    endGraphUpdate();
 }
 
 void KonfytJackEngine::clearPortClients(KfJackMidiPort *port)
@@ -532,26 +673,28 @@ void KonfytJackEngine::clearPortClients(KfJackAudioPort *port)
  * port. */
 void KonfytJackEngine::removePortFromAllRoutes(KfJackMidiPort *port)
 {
-    pauseJackProcessing(true);
+    beginGraphUpdate();
 
     for (int i=0; i < midiRoutes.count(); i++) {
-        if (midiRoutes[i]->source == port) { midiRoutes[i]->source = NULL; }
-        if (midiRoutes[i]->destPort == port) { midiRoutes[i]->destPort = NULL; }
+        KfJackMidiRouteConfig& config = midiRoutes[i]->config;
+        if (config.source == port) { config.source = NULL; }
+        if (config.destPort == port) { config.destPort = NULL; }
     }
 
-    pauseJackProcessing(false);
+    endGraphUpdate();
 }
 
 void KonfytJackEngine::removePortFromAllRoutes(KfJackAudioPort *port)
 {
-    pauseJackProcessing(true);
+    beginGraphUpdate();
 
     for (int i=0; i < audioRoutes.count(); i++) {
-        if (audioRoutes[i]->source == port) { audioRoutes[i]->source = NULL; }
-        if (audioRoutes[i]->dest == port) { audioRoutes[i]->dest = NULL; }
+        KfJackAudioRouteConfig& config = audioRoutes[i]->config;
+        if (config.source == port) { config.source = NULL; }
+        if (config.dest == port) { config.dest = NULL; }
     }
 
-    pauseJackProcessing(false);
+    endGraphUpdate();
 }
 
 void KonfytJackEngine::addPortClient(KfJackPort* port, QString newClient)
@@ -631,7 +774,10 @@ void KonfytJackEngine::setPortFilter(KfJackMidiPort *port, MidiFilter filter)
 
     if (!clientIsActive()) { return; }
 
-    port->filter = filter;
+    beginGraphUpdate();
+    port->config.filter.compile(filter);
+    port->config.transform = filter.transform.program();
+    endGraphUpdate();
 }
 
 void KonfytJackEngine::setPortGain(KfJackAudioPort *port, float gain)
@@ -643,13 +789,27 @@ void KonfytJackEngine::setPortGain(KfJackAudioPort *port, float gain)
     port->gain = gain;
 }
 
+/* Send MIDI events on the port as soon as possible. */
 bool KonfytJackEngine::sendMidiEventsOnPort(KfJackMidiPort* port, QList<KonfytMidiEvent> events)
+{
+    QList<KfJackMidiTxEvent> txEvents;
+    foreach (const KonfytMidiEvent& event, events) {
+        KfJackMidiTxEvent tx;
+        tx.midiEvent = event;
+        txEvents.append(tx);
+    }
+    return sendMidiEventsOnPort(port, txEvents);
+}
+
+/* Send MIDI events on the port, each either as soon as possible or scheduled
+ * at a JACK frame time. */
+bool KonfytJackEngine::sendMidiEventsOnPort(KfJackMidiPort *port, QList<KfJackMidiTxEvent> events)
 {
     KONFYT_ASSERT_RETURN_VAL(port, false);
 
     bool success = true;
-    foreach (KonfytMidiEvent event, events) {
-        success = port->eventsTxBuffer.stash(event);
+    foreach (const KfJackMidiTxEvent& event, events) {
+        success = stashTxEvent(&port->eventsTxBuffer, &port->txSysex, event);
         if (!success) { break; }
     }
     port->eventsTxBuffer.commit();
@@ -663,7 +823,21 @@ void KonfytJackEngine::setMidiPortBlockMidiDirectThrough(KfJackMidiPort* port, b
 {
     KONFYT_ASSERT_RETURN(port);
 
-    port->blockDirectThrough = block;
+    beginGraphUpdate();
+    port->config.blockDirectThrough = block;
+    endGraphUpdate();
+}
+
+/* Set the transform pipeline declared by the port script. Ignored if the port
+ * has since been removed. */
+void KonfytJackEngine::setMidiPortScriptTransform(KfJackMidiPort *port,
+                                                  KonfytMidiTransformProgram program)
+{
+    if (!midiInPorts.contains(port)) { return; }
+
+    beginGraphUpdate();
+    port->config.scriptTransform = program;
+    endGraphUpdate();
 }
 
 KfJackAudioRoute *KonfytJackEngine::addAudioRoute(KfJackAudioPort *sourcePort, KfJackAudioPort *destPort)
@@ -677,13 +851,13 @@ KfJackAudioRoute* KonfytJackEngine::addAudioRoute()
 {
     if (!clientIsActive()) { return nullptr; }
 
-    pauseJackProcessing(true);
+    beginGraphUpdate();
 
     KfJackAudioRoute* route = new KfJackAudioRoute();
 
     audioRoutes.append(route);
 
-    pauseJackProcessing(false);
+    endGraphUpdate();
 
     return route;
 }
@@ -696,12 +870,12 @@ void KonfytJackEngine::setAudioRoute(KfJackAudioRoute *route,
 
     if (!clientIsActive()) { return; }
 
-    pauseJackProcessing(true);
+    beginGraphUpdate();
 
-    route->source = sourcePort;
-    route->dest = destPort;
+    route->config.source = sourcePort;
+    route->config.dest = destPort;
 
-    pauseJackProcessing(false);
+    endGraphUpdate();
 }
 
 void KonfytJackEngine::removeAudioRoute(KfJackAudioRoute* route)
@@ -710,12 +884,12 @@ void KonfytJackEngine::removeAudioRoute(KfJackAudioRoute* route)
 
     if (!clientIsActive()) { return; }
 
-    pauseJackProcessing(true);
+    beginGraphUpdate();
 
     audioRoutes.removeAll(route);
-    delete route;
+    retire([route]() { delete route; });
 
-    pauseJackProcessing(false);
+    endGraphUpdate();
 }
 
 void KonfytJackEngine::setAudioRouteActive(KfJackAudioRoute *route, bool active)
@@ -736,6 +910,82 @@ void KonfytJackEngine::setAudioRouteGain(KfJackAudioRoute *route, float gain)
     route->gain = gain;
 }
 
+/* Set the levels at which the route is sent to the send effects of the
+ * destination bus (see addFxBus()). Sends are taken after the route gain. */
+void KonfytJackEngine::setAudioRouteSends(KfJackAudioRoute *route, float reverb,
+                                          float chorus)
+{
+    KONFYT_ASSERT_RETURN(route);
+
+    if (!clientIsActive()) { return; }
+
+    route->reverbSend = reverb;
+    route->chorusSend = chorus;
+}
+
+/* Adds shared send effects (one reverb and one chorus) to the bus with the
+ * specified output ports. Audio routes to the ports feed the effects at their
+ * send levels, so the effect processing scales with the number of buses, not
+ * the number of layers. The send effects are removed with the ports. */
+KfJackFxBus *KonfytJackEngine::addFxBus(KfJackAudioPort *left, KfJackAudioPort *right)
+{
+    KONFYT_ASSERT_RETURN_VAL(left, nullptr);
+    KONFYT_ASSERT_RETURN_VAL(right, nullptr);
+
+    if (!clientIsActive()) { return nullptr; }
+
+    beginGraphUpdate();
+
+    KfJackFxBus* bus = new KfJackFxBus();
+    bus->left = left;
+    bus->right = right;
+    bus->reverb.init(mJackSampleRate);
+    bus->chorus.init(mJackSampleRate);
+    allocateFxBusBuffers(bus);
+    fxBuses.append(bus);
+
+    endGraphUpdate();
+
+    return bus;
+}
+
+void KonfytJackEngine::removeFxBus(KfJackFxBus *bus)
+{
+    KONFYT_ASSERT_RETURN(bus);
+
+    beginGraphUpdate();
+
+    fxBuses.removeAll(bus);
+    retire([bus]() { delete bus; });
+
+    endGraphUpdate();
+}
+
+/* Allocates the send buffers of the bus for the JACK buffer size. */
+void KonfytJackEngine::allocateFxBusBuffers(KfJackFxBus *bus)
+{
+    for (int side = 0; side < 2; side++) {
+        bus->reverbIn[side].assign(mJackBufferSize, 0);
+        bus->chorusIn[side].assign(mJackBufferSize, 0);
+    }
+}
+
+/* Returns the recent average load of the send effects of each bus. */
+QList<KfJackFxLoad> KonfytJackEngine::getFxLoads()
+{
+    QList<KfJackFxLoad> ret;
+    foreach (KfJackFxBus* bus, fxBuses) {
+        KfJackFxLoad load;
+        if (bus->left->jackPointer) {
+            load.bus = jack_port_short_name(bus->left->jackPointer);
+        }
+        load.reverbPercent = bus->reverbLoad.load(std::memory_order_relaxed);
+        load.chorusPercent = bus->chorusLoad.load(std::memory_order_relaxed);
+        ret.append(load);
+    }
+    return ret;
+}
+
 KfJackMidiRoute *KonfytJackEngine::addMidiRoute(KfJackMidiPort *sourcePort, KfJackMidiPort *destPort)
 {
     KfJackMidiRoute* route = addMidiRoute();
@@ -747,13 +997,14 @@ KfJackMidiRoute* KonfytJackEngine::addMidiRoute()
 {
     if (!clientIsActive()) { return nullptr; }
 
-    pauseJackProcessing(true);
+    beginGraphUpdate();
 
     KfJackMidiRoute* route = new KfJackMidiRoute();
+    route->scheduler.setCapacity(KONFYT_MIDI_SCHEDULER_SIZE);
 
     midiRoutes.append(route);
 
-    pauseJackProcessing(false);
+    endGraphUpdate();
 
     return route;
 }
@@ -764,12 +1015,12 @@ void KonfytJackEngine::setMidiRoute(KfJackMidiRoute *route, KfJackMidiPort *sour
 
     if (!clientIsActive()) { return; }
 
-    pauseJackProcessing(true);
+    beginGraphUpdate();
 
-    route->source = sourcePort;
-    route->destPort = destPort;
+    route->config.source = sourcePort;
+    route->config.destPort = destPort;
 
-    pauseJackProcessing(false);
+    endGraphUpdate();
 }
 
 void KonfytJackEngine::removeMidiRoute(KfJackMidiRoute *route)
@@ -778,12 +1029,12 @@ void KonfytJackEngine::removeMidiRoute(KfJackMidiRoute *route)
 
     if (!clientIsActive()) { return; }
 
-    pauseJackProcessing(true);
+    beginGraphUpdate();
 
     midiRoutes.removeAll(route);
-    delete route;
+    retire([route]() { delete route; });
 
-    pauseJackProcessing(false);
+    endGraphUpdate();
 }
 
 void KonfytJackEngine::setMidiRouteActive(KfJackMidiRoute *route, bool active)
@@ -799,27 +1050,42 @@ void KonfytJackEngine::setRouteMidiFilter(KfJackMidiRoute *route, MidiFilter fil
 {
     KONFYT_ASSERT_RETURN(route);
 
-    pauseJackProcessing(true);
-    route->filter = filter;
-    pauseJackProcessing(false);
+    beginGraphUpdate();
+    setRouteConfigFilter(&route->config, filter);
+    endGraphUpdate();
 }
 
 void KonfytJackEngine::setRouteMidiPreFilter(KfJackMidiRoute *route, MidiFilter filter)
 {
     KONFYT_ASSERT_RETURN(route);
 
-    pauseJackProcessing(true);
-    route->preFilter = filter;
-    pauseJackProcessing(false);
+    beginGraphUpdate();
+    route->config.preFilter.compile(filter);
+    route->config.preTransform = filter.transform.program();
+    endGraphUpdate();
 }
 
+/* Send MIDI events on the route as soon as possible. */
 bool KonfytJackEngine::sendMidiEventsOnRoute(KfJackMidiRoute *route, QList<KonfytMidiEvent> events)
+{
+    QList<KfJackMidiTxEvent> txEvents;
+    foreach (const KonfytMidiEvent& event, events) {
+        KfJackMidiTxEvent tx;
+        tx.midiEvent = event;
+        txEvents.append(tx);
+    }
+    return sendMidiEventsOnRoute(route, txEvents);
+}
+
+/* Send MIDI events on the route, each either as soon as possible or scheduled
+ * at a JACK frame time. */
+bool KonfytJackEngine::sendMidiEventsOnRoute(KfJackMidiRoute *route, QList<KfJackMidiTxEvent> events)
 {
     KONFYT_ASSERT_RETURN_VAL(route, false);
 
     bool success = true;
-    foreach (KonfytMidiEvent event, events) {
-        success = route->eventsTxBuffer.stash(event);
+    foreach (const KfJackMidiTxEvent& event, events) {
+        success = stashTxEvent(&route->eventsTxBuffer, &route->txSysex, event);
         if (!success) { break; }
     }
     route->eventsTxBuffer.commit();
@@ -829,11 +1095,46 @@ bool KonfytJackEngine::sendMidiEventsOnRoute(KfJackMidiRoute *route, QList<Konfy
     return success;
 }
 
+/* Convert the event for the JACK thread and stash it in the tx buffer (of a
+ * port or route), with long data in the tx SysEx ring which is allocated on
+ * first use. Returns false if the buffer or ring is full. */
+bool KonfytJackEngine::stashTxEvent(RingbufferQMutex<KfJackRtMidiTxEvent> *buffer,
+                                    KonfytRtSysexRing *sysex,
+                                    const KfJackMidiTxEvent &event)
+{
+    if ( (event.midiEvent.dataSize() > 2) && !sysex->isAllocated() ) {
+        sysex->allocate(KONFYT_RT_SYSEX_RING_BYTES);
+    }
+    KfJackRtMidiTxEvent tx;
+    tx.scheduled = event.scheduled;
+    tx.frame = event.frame;
+    if (!tx.midiEvent.setFromMidiEvent(event.midiEvent, sysex)) { return false; }
+    if (!buffer->stash(tx)) {
+        if (tx.midiEvent.longData()) { sysex->unstore(); }
+        return false;
+    }
+    return true;
+}
+
 void KonfytJackEngine::setRouteBlockMidiDirectThrough(KfJackMidiRoute *route, bool block)
 {
     KONFYT_ASSERT_RETURN(route);
 
-    route->blockDirectThrough = block;
+    beginGraphUpdate();
+    route->config.blockDirectThrough = block;
+    endGraphUpdate();
+}
+
+/* Set the transform pipeline declared by the layer script. Ignored if the
+ * route has since been removed. */
+void KonfytJackEngine::setRouteScriptTransform(KfJackMidiRoute *route,
+                                               KonfytMidiTransformProgram program)
+{
+    if (!midiRoutes.contains(route)) { return; }
+
+    beginGraphUpdate();
+    route->config.scriptTransform = program;
+    endGraphUpdate();
 }
 
 /* This indicates whether we are connected to JACK or failed to create/activate
@@ -853,28 +1154,215 @@ QString KonfytJackEngine::clientBaseName()
     return mJackClientBaseName;
 }
 
-/* Pauses (pause=true) or unpauses (pause=false) the Jack process callback function.
- * When pause=true, the Jack process callback is disabled and this function blocks
- * until the current execution of the process callback (if any) competes, before
- * returning, thus ensuring that the process callback will not execute until this
- * function is called again with pause=false. */
-void KonfytJackEngine::pauseJackProcessing(bool pause)
+/* Start a batch of changes to ports, routes and their configurations. Changes
+ * are published to the JACK thread as a new graph when the outermost batch
+ * ends with endGraphUpdate(). Updates may be nested. The JACK thread is never
+ * paused; it continues processing with the previous graph until the new one is
+ * published. */
+void KonfytJackEngine::beginGraphUpdate()
 {
-    if (pause) {
-        if (jackProcessLocks == 0) {
-            jackProcessMutex.lock(); // Blocks
+    mGraphUpdateDepth++;
+}
+
+void KonfytJackEngine::endGraphUpdate()
+{
+    mGraphUpdateDepth--;
+    if (mGraphUpdateDepth < 0) {
+        KONFYT_ASSERT_FAIL("mGraphUpdateDepth less than 0");
+        mGraphUpdateDepth = 0;
+    }
+    if (mGraphUpdateDepth == 0) {
+        publishGraph();
+    }
+}
+
+/* Build a new graph from the ports, routes and configurations and swap it in
+ * for the JACK thread. The previous graph, and anything retired with it, is
+ * freed once the JACK thread is done with it. */
+void KonfytJackEngine::publishGraph()
+{
+    KfJackGraph* g = new KfJackGraph();
+    g->midiInPorts = midiInPorts;
+    g->midiOutPorts = midiOutPorts;
+    g->audioInPorts = audioInPorts;
+    g->audioOutPorts = audioOutPorts;
+    g->pluginPorts = pluginPorts;
+    g->fluidsynthPorts = fluidsynthPorts;
+    g->bridgePorts = bridgePorts;
+    g->sfzInstrumentPorts = sfzInstrumentPorts;
+    g->midiRoutes = midiRoutes;
+    g->audioRoutes = audioRoutes;
+
+    foreach (KfJackMidiPort* port, midiInPorts) {
+        g->midiInPortConfigs.append(new KfJackMidiPortConfig(port->config));
+        g->midiInPortRoutes.append(midiRoutesFromSource(port));
+    }
+    foreach (KfJackMidiRoute* route, midiRoutes) {
+        g->midiRouteConfigs.append(new KfJackMidiRouteConfig(route->config));
+        g->midiRouteById.insert(route->id, route);
+    }
+    foreach (KfJackAudioRoute* route, audioRoutes) {
+        KfJackAudioRouteConfig* config = new KfJackAudioRouteConfig(route->config);
+        setRouteConfigFxBus(config);
+        g->audioRouteConfigs.append(config);
+        g->audioRouteById.insert(route->id, route);
+    }
+    foreach (KfJackAudioPort* port, audioOutPorts) {
+        g->audioOutPortById.insert(port->id, port);
+    }
+    g->fxBuses = fxBuses;
+
+    KfJackGraph* old = mGraph.exchange(g);
+    if (old) {
+        retire([old]() { delete old; });
+    }
+
+    // Graph reads started up to now may still use the previous graph. Items
+    // retired since the last publish are freed once these have finished.
+    quint64 ticket = mGraphReadsStarted.load();
+    for (int i = 0; i < retiredList.count(); i++) {
+        KfJackRetired& r = retiredList[i];
+        if (!r.published) {
+            r.ticket = ticket;
+            r.published = true;
         }
-        jackProcessLocks++;
-    } else {
-        jackProcessLocks--;
-        if (jackProcessLocks <= 0) {
-            jackProcessMutex.unlock();
+    }
+
+    reclaimRetired();
+}
+
+/* Point the configuration to the send effects of its destination bus, if
+ * any. */
+void KonfytJackEngine::setRouteConfigFxBus(KfJackAudioRouteConfig *config)
+{
+    config->fxBus = nullptr;
+    config->fxSide = 0;
+    if (config->dest == nullptr) { return; }
+    foreach (KfJackFxBus* bus, fxBuses) {
+        if (bus->left == config->dest) {
+            config->fxBus = bus;
+            config->fxSide = 0;
+            return;
+        } else if (bus->right == config->dest) {
+            config->fxBus = bus;
+            config->fxSide = 1;
+            return;
         }
-        if (jackProcessLocks < 0) {
-            KONFYT_ASSERT_FAIL("jackProcessLocks less than 0");
-            jackProcessLocks = 0;
+    }
+}
+
+/* Returns the MIDI routes with the port as source, grouped by destination so
+ * the routes to a destination are processed together. The order of routes to
+ * the same destination is kept. */
+QList<KfJackMidiRoute*> KonfytJackEngine::midiRoutesFromSource(KfJackMidiPort *port)
+{
+    QList<const void*> dests;
+    QList<QList<KfJackMidiRoute*>> groups;
+    foreach (KfJackMidiRoute* route, midiRoutes) {
+        const KfJackMidiRouteConfig& c = route->config;
+        if (c.source != port) { continue; }
+        const void* dest = c.destPort;
+        if (!c.destIsJackPort) {
+            if (c.destBridge) { dest = c.destBridge; }
+            else if (c.destSfzInstrument) { dest = c.destSfzInstrument; }
+            else { dest = c.destFluidsynthID; }
         }
+        int i = dests.indexOf(dest);
+        if (i < 0) {
+            i = dests.count();
+            dests.append(dest);
+            groups.append(QList<KfJackMidiRoute*>());
+        }
+        groups[i].append(route);
+    }
+
+    QList<KfJackMidiRoute*> ret;
+    foreach (const QList<KfJackMidiRoute*>& group, groups) {
+        ret.append(group);
     }
+    return ret;
+}
+
+/* Compile the filter into the route configuration. This replaces zone values
+ * set by scripts, see rebindScriptZone(). */
+void KonfytJackEngine::setRouteConfigFilter(KfJackMidiRouteConfig *config,
+                                            const MidiFilter &filter)
+{
+    config->filter.compile(filter);
+    config->transform = filter.transform.program();
+    config->filterVersion = ++mFilterVersion;
+}
+
+/* Free something the JACK thread may still be using, once it no longer can.
+ * Must be called before the graph without it is published. */
+void KonfytJackEngine::retire(std::function<void()> free)
+{
+    KfJackRetired r;
+    r.free = free;
+    retiredList.append(r);
+}
+
+/* Free something that graphs published up to now no longer contain, once the
+ * JACK thread can no longer be using it from earlier graphs. */
+void KonfytJackEngine::retirePublished(std::function<void()> free)
+{
+    KfJackRetired r;
+    r.free = free;
+    r.ticket = mGraphReadsStarted.load();
+    r.published = true;
+    retiredList.append(r);
+}
+
+/* Free retired items the JACK thread is done with, or all retired items if
+ * all is true (only when the JACK thread is not running). */
+void KonfytJackEngine::reclaimRetired(bool all)
+{
+    quint64 finished = mGraphReadsFinished.load();
+    int i = 0;
+    while (i < retiredList.count()) {
+        const KfJackRetired& r = retiredList.at(i);
+        if (all || (r.published && (finished >= r.ticket))) {
+            std::function<void()> free = r.free;
+            retiredList.removeAt(i);
+            free();
+        } else {
+            i++;
+        }
+    }
+}
+
+/* JACK thread. Get the current graph, which remains valid until
+ * endGraphRead(). Reads may not be nested or run concurrently. */
+const KfJackGraph *KonfytJackEngine::beginGraphRead()
+{
+    mGraphReadsStarted.fetch_add(1);
+    return mGraph.load();
+}
+
+void KonfytJackEngine::endGraphRead()
+{
+    mGraphReadsFinished.fetch_add(1);
+}
+
+/* JACK thread. Point ports and routes to their configurations in a newly
+ * published graph. */
+void KonfytJackEngine::bindGraph(const KfJackGraph *g)
+{
+    for (int i = 0; i < g->midiInPorts.count(); i++) {
+        g->midiInPorts.at(i)->rtConfig = g->midiInPortConfigs.at(i);
+        g->midiInPorts.at(i)->rtRoutes = &g->midiInPortRoutes.at(i);
+    }
+    mScriptSoloCount = 0;
+    for (int i = 0; i < g->midiRoutes.count(); i++) {
+        KfJackMidiRoute* route = g->midiRoutes.at(i);
+        route->rtConfig = g->midiRouteConfigs.at(i);
+        rebindScriptZone(route);
+        if (route->scriptSolo) { mScriptSoloCount++; }
+    }
+    for (int i = 0; i < g->audioRoutes.count(); i++) {
+        g->audioRoutes.at(i)->rtConfig = g->audioRouteConfigs.at(i);
+    }
+    rtBoundGraph = g;
 }
 
 void KonfytJackEngine::jackPortConnectCallback(jack_port_id_t /*a*/, jack_port_id_t /*b*/, int /*connect*/, void* arg)
@@ -914,9 +1402,18 @@ int KonfytJackEngine::jackBufferSizeCallback(jack_nframes_t nframes, void* arg)
 /* Non-static class instance-specific JACK process callback. */
 int KonfytJackEngine::jackProcessCallback(jack_nframes_t nframes)
 {
-    if (!jackProcessMutex.tryLock()) { return 0; }
+    // The graph is never waited for; changes take effect from the first cycle
+    // after they are published.
+    jack_time_t callbackStart = jack_get_time();
 
-    mLastSentMidiEventTime = 0;
+    rtGraph = beginGraphRead();
+    if (rtGraph != rtBoundGraph) { bindGraph(rtGraph); }
+
+    mCycleStartFrame = jack_last_frame_time(mJackClient);
+    sysexArena.reset();
+
+    // Parameter changes (e.g. from scripts) take effect from this cycle
+    jackProcess_applyParamCommands();
 
     // panicCmd is the panic command received from the outside.
     if (panicCmd) {
@@ -929,17 +1426,10 @@ int KonfytJackEngine::jackProcessCallback(jack_nframes_t nframes)
         panicState = NoPanic;
     }
 
-    // Audio processing
-
-    jackProcess_prepareAudioPortBuffers(nframes);
-
-    // Process (mix and gain) audio routes if not in panic state.
-    // (If in panic state, no audio is mixed and output buses stay zeroed.)
-    if (panicState == NoPanic) {
-        jackProcess_processAudioRoutes(nframes);
-    }
-
     // MIDI processing
+    // This is done before audio processing so that in-process synths
+    // (Fluidsynth and native SFZ) can be rendered with this cycle's events at
+    // their frame offsets.
 
     jackProcess_prepareMidiOutBuffers(nframes);
 
@@ -959,6 +1449,19 @@ int KonfytJackEngine::jackProcessCallback(jack_nframes_t nframes)
     // Route MIDI tx events
     jackProcess_sendMidiRouteTxEvents(nframes);
 
+    // Write all MIDI events to JACK output buffers, sorted per port.
+    jackProcess_flushMidiOutQueues(nframes);
+
+    // Audio processing
+
+    jackProcess_prepareAudioPortBuffers(nframes);
+
+    // Process (mix and gain) audio routes if not in panic state.
+    // (If in panic state, no audio is mixed and output buses stay zeroed.)
+    if (panicState == NoPanic) {
+        jackProcess_processAudioRoutes(nframes);
+    }
+
     // Commit received events to buffer so they can be read in the GUI thread.
     audioRxBuffer.commit();
     midiRxBuffer.commit();
@@ -968,7 +1471,20 @@ int KonfytJackEngine::jackProcessCallback(jack_nframes_t nframes)
         midiForJsWritten = false;
     }
 
-    jackProcessMutex.unlock();
+    // Post this cycle's MIDI to bridge subprocesses so they can start rendering.
+    for (int prt = 0; prt < rtGraph->bridgePorts.count(); prt++) {
+        rtGraph->bridgePorts.at(prt)->bridge->parentPostCycle(nframes);
+    }
+
+    endGraphRead();
+
+    // Time spent in this callback as percentage of the cycle period. Rises
+    // immediately and decays slowly.
+    float load = (jack_get_time() - callbackStart) * 100.0f * mJackSampleRate
+            / (nframes * 1000000.0f);
+    mRtProcessLoad = qMax(load, mRtProcessLoad * KONFYT_JACK_PROCESS_LOAD_DECAY);
+    mProcessLoad.store(mRtProcessLoad, std::memory_order_relaxed);
+
     return 0;
 }
 
@@ -988,8 +1504,12 @@ void KonfytJackEngine::jackBufferSizeCallback(jack_nframes_t nframes)
 
     updateAudioBufferSumCycleCount();
 
-    // Re-allocate buffers for Fluidsynth ports to match the new buffer size.
-    foreach (KfJackPluginPorts* p, fluidsynthPorts) {
+    // Re-allocate buffers for Fluidsynth, bridge and native SFZ ports to match
+    // the new buffer size.
+    const KfJackGraph* g = beginGraphRead();
+    QList<KfJackPluginPorts*> ports = g->fluidsynthPorts + g->bridgePorts
+                                      + g->sfzInstrumentPorts;
+    foreach (KfJackPluginPorts* p, ports) {
         free(p->audioInLeft->buffer);
         p->audioInLeft->buffer = malloc(sizeof(jack_default_audio_sample_t)
                                         * mJackBufferSize);
@@ -997,6 +1517,10 @@ void KonfytJackEngine::jackBufferSizeCallback(jack_nframes_t nframes)
         p->audioInRight->buffer = malloc(sizeof(jack_default_audio_sample_t)
                                          * mJackBufferSize);
     }
+    foreach (KfJackFxBus* bus, g->fxBuses) {
+        allocateFxBusBuffers(bus);
+    }
+    endGraphRead();
 
     mBufferSizeCallback = true;
 }
@@ -1004,6 +1528,18 @@ void KonfytJackEngine::jackBufferSizeCallback(jack_nframes_t nframes)
 void KonfytJackEngine::setFluidsynthEngine(KonfytFluidsynthEngine *e)
 {
     fluidsynthEngine = e;
+    e->setDeferredDelete([this](std::function<void()> free)
+    {
+        retirePublished(free);
+    });
+}
+
+/* Free something used by the JACK thread through plugins that have already
+ * been removed (e.g. the instrument or bridge transport of a plugin removed with
+ * removePlugin()), once the JACK thread can no longer be using it. */
+void KonfytJackEngine::deleteWhenUnused(std::function<void()> free)
+{
+    retirePublished(free);
 }
 
 /* Return list of MIDI events that were buffered during JACK process callback(s). */
@@ -1022,30 +1558,54 @@ QList<KfJackAudioRxEvent> KonfytJackEngine::getAudioRxEvents()
 }
 
 /* Helper function for Jack process callback.
- * Send noteoffs to all corresponding recorded noteon events.
+ * Send noteoffs for the noteons held by the route for the note and channel of
+ * the (filtered) noteoff event. A noteoff is sent to each channel and note the
+ * transform pipelines output a noteon to for the held noteons, as recorded in
+ * the route's active notes, so changes to the pipelines while the key is held
+ * don't leave notes hanging. Only if not all outputs could be recorded, the
+ * noteoff is transposed by the global transpose used for the noteons and
+ * passed through the current pipelines.
  * Return true if at least one noteoff was sent, or false if nothing was sent. */
-bool KonfytJackEngine::handleNoteoffEvent(const KonfytMidiEvent &ev,
+bool KonfytJackEngine::handleNoteoffEvent(const KonfytRtMidiEvent &ev,
                                           KfJackMidiRoute *route,
                                           jack_nframes_t time)
 {
-    bool noteoffSent = false;
-
-    for (int i=0; i < route->noteOnList.count(); i++) {
-        KonfytJackNoteOnRecord* rec = route->noteOnList.at_ptr(i);
-        if ( (rec->note == ev.note() + rec->globalTranspose)
-             && (rec->channel == ev.channel) ) {
-            // Match! Send noteoff
-            noteoffSent = true;
-            KonfytMidiEvent toSend = ev;
-            toSend.setNote(rec->note);
-            writeRouteMidi(route, toSend, time);
-            // Remove noteon from list
-            route->noteOnList.remove(i);
-            i--; // Due to removal, have to stay at same index after for loop i++
+    KfJackActiveNotes& notes = route->activeNotes;
+    KfJackActiveNotes::Entry& held = notes.at(ev.channel, ev.note());
+    if (held.count == 0) { return false; }
+
+    // One noteoff for each recorded noteon output
+    KonfytRtMidiEvent noteoff;
+    uint16_t i = held.outputs;
+    while (i != KfJackActiveNotes::NoOutput) {
+        const KfJackActiveNotes::Output& out = notes.output(i);
+        noteoff.channel = out.channel;
+        noteoff.setNoteOff(out.note, ev.velocity());
+        writeRouteMidi(route, noteoff, time);
+        i = out.next;
+    }
+
+    if (held.overflow) {
+        const KfJackMidiRouteConfig* config = route->rtConfig;
+        KonfytRtMidiEvent transformed[KONFYT_TRANSFORM_MAX_EVENTS];
+        transformed[0] = ev;
+        transformed[0].setNote(ev.note() + held.transpose);
+        int count = 1;
+        if (!config->preTransform.isEmpty()
+                || !config->transform.isEmpty()
+                || !config->scriptTransform.isEmpty()) {
+            int max = KONFYT_TRANSFORM_MAX_EVENTS;
+            count = config->preTransform.process(transformed, count, max);
+            count = config->transform.process(transformed, count, max);
+            count = config->scriptTransform.process(transformed, count, max);
+        }
+        for (int t = 0; t < count; t++) {
+            writeRouteMidi(route, transformed[t], time);
         }
     }
 
-    return noteoffSent;
+    notes.release(ev.channel, ev.note());
+    return true;
 }
 
 /* Helper function for JACK process callback */
@@ -1053,28 +1613,53 @@ void KonfytJackEngine::mixBufferToDestinationPort(KfJackAudioRoute *route,
                                                   jack_nframes_t nframes,
                                                   bool applyGain)
 {
-    if (route->source == NULL) { return; }
-    if (route->dest == NULL) { return; }
+    const KfJackAudioRouteConfig* config = route->rtConfig;
+    if (config->source == NULL) { return; }
+    if (config->dest == NULL) { return; }
 
     float gain = 1;
+    float scriptTarget = 1;
     if (applyGain) {
         gain = route->gain;
+        scriptTarget = route->scriptGainTarget;
+        if (isScriptMuted(route->scriptMute, route->scriptSolo)) { scriptTarget = 0; }
+    }
+
+    // Post-gain sends to the send effects of the destination bus
+    float* reverbIn = nullptr;
+    float* chorusIn = nullptr;
+    float reverbSend = route->reverbSend;
+    float chorusSend = route->chorusSend;
+    KfJackFxBus* fxBus = config->fxBus;
+    if (fxBus && (fxBus->reverbIn[0].size() >= nframes)) {
+        if (reverbSend > 0) {
+            reverbIn = fxBus->reverbIn[config->fxSide].data();
+            fxBus->reverbSent = true;
+        }
+        if (chorusSend > 0) {
+            chorusIn = fxBus->chorusIn[config->fxSide].data();
+            fxBus->chorusSent = true;
+        }
     }
 
     // For each frame: destination_buffer[frame] += source_buffer[frame]
     for (jack_nframes_t i = 0;  i < nframes; i++) {
 
         float frame = 0;
-        if (route->source->buffer) {
-            frame = ((jack_default_audio_sample_t*)(route->source->buffer))[i];
+        if (config->source->buffer) {
+            frame = ((jack_default_audio_sample_t*)(config->source->buffer))[i];
         }
-        frame = frame  * gain * fadeOutValues[route->fadeoutCounter];
+        // Smooth script gain changes to prevent clicks
+        route->scriptGain += (scriptTarget - route->scriptGain) * mParamSmoothingCoeff;
+        frame = frame  * gain * route->scriptGain * fadeOutValues[route->fadeoutCounter];
 
         route->rxBufferSum += qAbs(frame);
-        if (route->dest->buffer) {
-            ( (jack_default_audio_sample_t*)(route->dest->buffer) )[i] += frame;
+        if (config->dest->buffer) {
+            ( (jack_default_audio_sample_t*)(config->dest->buffer) )[i] += frame;
         }
         // TODO Give some sort of error indication to user when buffer is null.
+        if (reverbIn) { reverbIn[i] += frame * reverbSend; }
+        if (chorusIn) { chorusIn[i] += frame * chorusSend; }
 
         if (route->fadingOut) {
             if (route->fadeoutCounter < (fadeOutValuesCount-1) ) {
@@ -1087,6 +1672,10 @@ void KonfytJackEngine::mixBufferToDestinationPort(KfJackAudioRoute *route,
         }
     }
 
+    if (qAbs(scriptTarget - route->scriptGain) < 1e-6f) {
+        route->scriptGain = scriptTarget;
+    }
+
     // Maintain a sum of the audio buffer and preiodically add it to a ringbuffer
     // so it can be given to the GUI thread later for display purposes.
     route->rxCycleCount++;
@@ -1154,19 +1743,19 @@ void KonfytJackEngine::sendMidiClosureEvents(KfJackMidiPort *port, int channel)
     unsigned char* out_buffer;
 
     // All notes off
-    out_buffer = reserveJackMidiEvent(port->buffer, 0, 3);
+    out_buffer = reserveJackMidiEvent(port, 0, 3);
     if (out_buffer) {
         evAllNotesOff.channel = channel;
         evAllNotesOff.toBuffer(out_buffer);
     }
     // Also send sustain off message
-    out_buffer = reserveJackMidiEvent(port->buffer, 0, 3);
+    out_buffer = reserveJackMidiEvent(port, 0, 3);
     if (out_buffer) {
         evSustainZero.channel = channel;
         evSustainZero.toBuffer(out_buffer);
     }
     // And also pitchbend zero
-    out_buffer = reserveJackMidiEvent(port->buffer, 0, 3);
+    out_buffer = reserveJackMidiEvent(port, 0, 3);
     if (out_buffer) {
         evPitchbendZero.channel = channel;
         evPitchbendZero.toBuffer(out_buffer);
@@ -1194,7 +1783,8 @@ void KonfytJackEngine::sendMidiClosureEvents_allChannels(KfJackMidiPort *port)
  * MSB and LSB are cleared.
  * If the MIDI event is a bank MSB or LSB, it is stored. Otherwise, stored bank
  * selects are cleared. */
-void KonfytJackEngine::handleBankSelect(int bankMSB[], int bankLSB[], KonfytMidiEvent *ev)
+template<typename Event>
+void KonfytJackEngine::handleBankSelect(int bankMSB[], int bankLSB[], Event *ev)
 {
     // Modify MIDI event with stored bank select, or clear.
     if (ev->type() == MIDI_EVENT_TYPE_PROGRAM) {
@@ -1240,43 +1830,56 @@ void *KonfytJackEngine::getJackPortBuffer(jack_port_t *port, jack_nframes_t nfra
     }
 }
 
-jack_midi_data_t *KonfytJackEngine::reserveJackMidiEvent(void *portBuffer,
+/* Reserve space for a MIDI event in the output queue of the port. The event is
+ * written to the JACK port buffer in jackProcess_flushMidiOutQueues().
+ *
+ * Events are kept sorted by time per port, since JACK requires events in a
+ * port buffer to be written in order. Events from different sources
+ * (passthrough with exact times, script and closure events at time 0) can
+ * thus be written in any order and are interleaved at their frame offsets.
+ * Events with the same time keep the order in which they were written. */
+jack_midi_data_t *KonfytJackEngine::reserveJackMidiEvent(KfJackMidiPort *port,
                                                          jack_nframes_t time,
                                                          size_t size)
 {
-    /* Ensure event time is not less than previous event.
-     *
-     * According to jack_midi_event_reserve() documentation, events need to be
-     * sorted by the user, i.e. the time argument may not be less than previous
-     * calls within this process cycle. If this happens, events will go lost.
-     * Some MIDI events which are generated in Konfyt are sent without exact
-     * regard for time. For these events, 0 is typically used for time.
-     * Below, the last MIDI event time is kept track of and when an event is
-     * encountered with an earlier time, the time is rectified to be the same
-     * as the last event.
-     * This should have no effect on events received from outside Konfyt and
-     * passed through, as those events already have appropriate times and are
-     * sorted when coming into Konfyt. */
-
-    if (time < mLastSentMidiEventTime) {
-        time = mLastSentMidiEventTime;
-    } else {
-        mLastSentMidiEventTime = time;
+    if (!port || !port->buffer) { return NULL; }
+
+    jack_midi_data_t* ret = port->outQueue.reserve(time, size);
+    if (ret == NULL) {
+        mDroppedMidiOutEvents.fetch_add(1, std::memory_order_relaxed);
     }
+    return ret;
+}
 
+/* Write queued events of the port to its JACK buffer and clear the queue. */
+void KonfytJackEngine::flushMidiOutQueue(KfJackMidiPort *port, jack_nframes_t nframes)
+{
+    KfJackMidiOutQueue& q = port->outQueue;
+    if (port->buffer) {
+        for (int i = 0; i < q.events.count(); i++) {
+            const KfJackMidiOutQueue::Event& ev = q.events[i];
+            jack_nframes_t time = qMin(ev.time, nframes - 1);
+            jack_midi_event_write(port->buffer, time, &q.data[ev.offset], ev.size);
+        }
+    }
+    q.clear();
+}
 
-    if (portBuffer) {
-        return jack_midi_event_reserve(portBuffer, time, size);
-    } else {
-        return NULL;
+void KonfytJackEngine::jackProcess_flushMidiOutQueues(jack_nframes_t nframes)
+{
+    for (int p = 0; p < rtGraph->midiOutPorts.count(); p++) {
+        flushMidiOutQueue(rtGraph->midiOutPorts.at(p), nframes);
+    }
+    for (int p = 0; p < rtGraph->pluginPorts.count(); p++) {
+        flushMidiOutQueue(rtGraph->pluginPorts[p]->midi, nframes);
     }
 }
 
 void KonfytJackEngine::jackProcess_prepareAudioPortBuffers(jack_nframes_t nframes)
 {
     // Get all audio out ports (bus) buffers
-    for (int prt = 0; prt < audioOutPorts.count(); prt++) {
-        KfJackAudioPort* port = audioOutPorts.at(prt);
+    for (int prt = 0; prt < rtGraph->audioOutPorts.count(); prt++) {
+        KfJackAudioPort* port = rtGraph->audioOutPorts.at(prt);
         port->buffer = getJackPortBuffer(port->jackPointer, nframes);
         if (port->buffer) {
             // Reset buffer
@@ -1285,32 +1888,54 @@ void KonfytJackEngine::jackProcess_prepareAudioPortBuffers(jack_nframes_t nframe
     }
 
     // Get all audio in ports buffers
-    for (int prt = 0; prt < audioInPorts.count(); prt++) {
-        KfJackAudioPort* port = audioInPorts.at(prt);
+    for (int prt = 0; prt < rtGraph->audioInPorts.count(); prt++) {
+        KfJackAudioPort* port = rtGraph->audioInPorts.at(prt);
         port->buffer = getJackPortBuffer(port->jackPointer, nframes );
     }
 
     // Get all Fluidsynth audio in port buffers
     if (fluidsynthEngine != nullptr) {
-        for (int prt = 0; prt < fluidsynthPorts.count(); prt++) {
-            KfJackPluginPorts* fluidsynthPort = fluidsynthPorts.at(prt);
-            KfJackAudioPort* port1 = fluidsynthPort->audioInLeft; // Left
-            KfJackAudioPort* port2 = fluidsynthPort->audioInRight; // Right
-
-            // We are not getting our audio from Jack audio ports, but from Fluidsynth.
-            // The buffers have already been allocated when we added the soundfont layer to the engine.
-            // Get data from Fluidsynth
-            fluidsynthEngine->fluidsynthWriteFloat(
+        // We are not getting our audio from Jack audio ports, but from Fluidsynth.
+        // The buffers have already been allocated when we added the soundfont layer
+        // to the engine. All buffers are set before rendering, since layers
+        // sharing a synth are rendered together.
+        fluidsynthEngine->startJackRender(mRtProcessLoad);
+        for (int prt = 0; prt < rtGraph->fluidsynthPorts.count(); prt++) {
+            KfJackPluginPorts* fluidsynthPort = rtGraph->fluidsynthPorts.at(prt);
+            fluidsynthEngine->setJackRenderBuffers(
                         fluidsynthPort->fluidSynthInEngine,
-                        ((jack_default_audio_sample_t*)port1->buffer),
-                        ((jack_default_audio_sample_t*)port2->buffer),
+                        fluidsynthPort->audioInLeft->buffer,
+                        fluidsynthPort->audioInRight->buffer );
+        }
+        // Get data from Fluidsynth
+        for (int prt = 0; prt < rtGraph->fluidsynthPorts.count(); prt++) {
+            fluidsynthEngine->fluidsynthWriteFloat(
+                        rtGraph->fluidsynthPorts.at(prt)->fluidSynthInEngine,
                         nframes );
         }
     }
 
+    // Get audio rendered by bridge subprocesses in the previous cycle
+    for (int prt = 0; prt < rtGraph->bridgePorts.count(); prt++) {
+        KfJackPluginPorts* bridgePort = rtGraph->bridgePorts.at(prt);
+        bridgePort->bridge->parentReadAudio(
+                    (jack_default_audio_sample_t*)bridgePort->audioInLeft->buffer,
+                    (jack_default_audio_sample_t*)bridgePort->audioInRight->buffer,
+                    nframes);
+    }
+
+    // Render native SFZ instruments
+    for (int prt = 0; prt < rtGraph->sfzInstrumentPorts.count(); prt++) {
+        KfJackPluginPorts* sfzPort = rtGraph->sfzInstrumentPorts.at(prt);
+        sfzPort->sfzInstrument->render(
+                    (jack_default_audio_sample_t*)sfzPort->audioInLeft->buffer,
+                    (jack_default_audio_sample_t*)sfzPort->audioInRight->buffer,
+                    nframes);
+    }
+
     // Get all plugin audio in port buffers
-    for (int prt = 0; prt < pluginPorts.count(); prt++) {
-        KfJackPluginPorts* pluginPort = pluginPorts.at(prt);
+    for (int prt = 0; prt < rtGraph->pluginPorts.count(); prt++) {
+        KfJackPluginPorts* pluginPort = rtGraph->pluginPorts.at(prt);
         // Left
         KfJackAudioPort* port1 = pluginPort->audioInLeft;
         port1->buffer = getJackPortBuffer( port1->jackPointer, nframes );
@@ -1320,11 +1945,34 @@ void KonfytJackEngine::jackProcess_prepareAudioPortBuffers(jack_nframes_t nframe
     }
 }
 
+void KonfytJackEngine::jackProcess_applyParamCommands()
+{
+    KfJackParamCommand cmd;
+    while (paramCommands.read(&cmd)) {
+        applyParamCommand(cmd);
+    }
+}
+
 void KonfytJackEngine::jackProcess_processAudioRoutes(jack_nframes_t nframes)
 {
+    // Clear send buffers used in the previous cycle
+    for (int b = 0; b < rtGraph->fxBuses.count(); b++) {
+        KfJackFxBus* bus = rtGraph->fxBuses.at(b);
+        for (int side = 0; side < 2; side++) {
+            if (bus->reverbSent) {
+                std::fill(bus->reverbIn[side].begin(), bus->reverbIn[side].end(), 0);
+            }
+            if (bus->chorusSent) {
+                std::fill(bus->chorusIn[side].begin(), bus->chorusIn[side].end(), 0);
+            }
+        }
+        bus->reverbSent = false;
+        bus->chorusSent = false;
+    }
+
     // For each audio route, if active, mix source buffer to destination buffer
-    for (int r = 0; r < audioRoutes.count(); r++) {
-        KfJackAudioRoute* route = audioRoutes[r];
+    for (int r = 0; r < rtGraph->audioRoutes.count(); r++) {
+        KfJackAudioRoute* route = rtGraph->audioRoutes[r];
         bool outputFlag = false;
         if (route->active) {
             route->fadingOut = false;
@@ -1340,30 +1988,78 @@ void KonfytJackEngine::jackProcess_processAudioRoutes(jack_nframes_t nframes)
         }
     }
 
+    // Mix the send effects into the buses
+    jackProcess_processFxBuses(nframes);
+
     // Finally, apply the gain of each active bus
-    for (int prt = 0; prt < audioOutPorts.count(); prt++) {
-        KfJackAudioPort* port = audioOutPorts.at(prt);
+    for (int prt = 0; prt < rtGraph->audioOutPorts.count(); prt++) {
+        KfJackAudioPort* port = rtGraph->audioOutPorts.at(prt);
         if (!port->buffer) { continue; }
+        float scriptTarget = port->scriptGainTarget;
         // Do for each frame
         for (jack_nframes_t i = 0;  i < nframes; i++) {
-            ( (jack_default_audio_sample_t*)( port->buffer ) )[i] *= port->gain;
+            port->scriptGain += (scriptTarget - port->scriptGain) * mParamSmoothingCoeff;
+            ( (jack_default_audio_sample_t*)( port->buffer ) )[i] *= port->gain * port->scriptGain;
+        }
+        if (qAbs(scriptTarget - port->scriptGain) < 1e-6f) {
+            port->scriptGain = scriptTarget;
         }
     }
 }
 
+/* Process the send effects of each bus and add their outputs to the bus ports.
+ * An effect is processed while it receives input and for its tail after that.
+ * The time spent per effect is averaged into its load. */
+void KonfytJackEngine::jackProcess_processFxBuses(jack_nframes_t nframes)
+{
+    // Converts microseconds to percent of the cycle period
+    float loadScale = 100.0f * mJackSampleRate / (nframes * 1000000.0f);
+
+    for (int b = 0; b < rtGraph->fxBuses.count(); b++) {
+        KfJackFxBus* bus = rtGraph->fxBuses.at(b);
+        float* outL = (float*)bus->left->buffer;
+        float* outR = (float*)bus->right->buffer;
+        bool ready = outL && outR && (bus->reverbIn[0].size() >= nframes);
+
+        float reverbLoad = 0;
+        if (bus->reverbSent) { bus->reverbTailLeft = bus->reverb.tailFrames(); }
+        if (ready && bus->reverbTailLeft) {
+            jack_time_t start = jack_get_time();
+            bus->reverb.process(bus->reverbIn[0].data(), bus->reverbIn[1].data(),
+                                outL, outR, nframes);
+            bus->reverbTailLeft -= qMin(bus->reverbTailLeft, (uint32_t)nframes);
+            reverbLoad = (jack_get_time() - start) * loadScale;
+        }
+        bus->rtReverbLoad += (reverbLoad - bus->rtReverbLoad) * KONFYT_JACK_FX_LOAD_SMOOTHING;
+        bus->reverbLoad.store(bus->rtReverbLoad, std::memory_order_relaxed);
+
+        float chorusLoad = 0;
+        if (bus->chorusSent) { bus->chorusTailLeft = bus->chorus.tailFrames(); }
+        if (ready && bus->chorusTailLeft) {
+            jack_time_t start = jack_get_time();
+            bus->chorus.process(bus->chorusIn[0].data(), bus->chorusIn[1].data(),
+                                outL, outR, nframes);
+            bus->chorusTailLeft -= qMin(bus->chorusTailLeft, (uint32_t)nframes);
+            chorusLoad = (jack_get_time() - start) * loadScale;
+        }
+        bus->rtChorusLoad += (chorusLoad - bus->rtChorusLoad) * KONFYT_JACK_FX_LOAD_SMOOTHING;
+        bus->chorusLoad.store(bus->rtChorusLoad, std::memory_order_relaxed);
+    }
+}
+
 void KonfytJackEngine::jackProcess_prepareMidiOutBuffers(jack_nframes_t nframes)
 {
     // Get buffers for midi output ports to external apps
-    for (int p = 0; p < midiOutPorts.count(); p++) {
-        KfJackMidiPort* port = midiOutPorts.at(p);
+    for (int p = 0; p < rtGraph->midiOutPorts.count(); p++) {
+        KfJackMidiPort* port = rtGraph->midiOutPorts.at(p);
         port->buffer = getJackPortBuffer(port->jackPointer, nframes);
         if (port->buffer) {
             jack_midi_clear_buffer(port->buffer);
         }
     }
     // Get buffers for midi output ports to plugins
-    for (int p = 0; p < pluginPorts.count(); p++) {
-        KfJackMidiPort* port = pluginPorts[p]->midi;
+    for (int p = 0; p < rtGraph->pluginPorts.count(); p++) {
+        KfJackMidiPort* port = rtGraph->pluginPorts[p]->midi;
         port->buffer = getJackPortBuffer(port->jackPointer, nframes);
         if (port->buffer) {
             jack_midi_clear_buffer(port->buffer);
@@ -1373,33 +2069,68 @@ void KonfytJackEngine::jackProcess_prepareMidiOutBuffers(jack_nframes_t nframes)
 
 void KonfytJackEngine::jackProcess_midiPanicOutput()
 {
+    // Discard scheduled events so no notes are started after the panic
+    for (int r = 0; r < rtGraph->midiRoutes.count(); r++) {
+        rtGraph->midiRoutes[r]->scheduler.clear();
+        // All notes off is sent below
+        rtGraph->midiRoutes[r]->activeNotes.clear();
+    }
+    for (int p = 0; p < rtGraph->midiInPorts.count(); p++) {
+        rtGraph->midiInPorts[p]->scheduler.clear();
+    }
+
     // Send to fluidsynth
-    for (int p = 0; p < fluidsynthPorts.count(); p++) {
-        KfFluidSynth* synth = fluidsynthPorts.at(p)->fluidSynthInEngine;
-        // Fluidsynthengine will force event channel to zero
+    for (int p = 0; p < rtGraph->fluidsynthPorts.count(); p++) {
+        KfFluidSynth* synth = rtGraph->fluidsynthPorts.at(p)->fluidSynthInEngine;
+        // Fluidsynthengine will force event channel to that of the layer
         fluidsynthEngine->processJackMidi( synth, &(evAllNotesOff) );
         fluidsynthEngine->processJackMidi( synth, &(evSustainZero) );
         fluidsynthEngine->processJackMidi( synth, &(evPitchbendZero) );
     }
 
     // Give to all output ports to external apps
-    for (int p = 0; p < midiOutPorts.count(); p++) {
-        KfJackMidiPort* port = midiOutPorts.at(p);
+    for (int p = 0; p < rtGraph->midiOutPorts.count(); p++) {
+        KfJackMidiPort* port = rtGraph->midiOutPorts.at(p);
         sendMidiClosureEvents_allChannels( port ); // Send to all MIDI channels
     }
 
     // Also give to all plugin ports
-    for (int p = 0; p < pluginPorts.count(); p++) {
-        KfJackMidiPort* port = pluginPorts[p]->midi;
+    for (int p = 0; p < rtGraph->pluginPorts.count(); p++) {
+        KfJackMidiPort* port = rtGraph->pluginPorts[p]->midi;
         sendMidiClosureEvents_chanZeroOnly( port ); // Only on channel zero
     }
+
+    // And to bridge plugins
+    for (int p = 0; p < rtGraph->bridgePorts.count(); p++) {
+        KonfytBridgeShm* bridge = rtGraph->bridgePorts[p]->bridge;
+        writeBridgeMidi(bridge, evAllNotesOff, 0);
+        writeBridgeMidi(bridge, evSustainZero, 0);
+        writeBridgeMidi(bridge, evPitchbendZero, 0);
+    }
+
+    // And to native SFZ instruments (all MIDI channels)
+    for (int p = 0; p < rtGraph->sfzInstrumentPorts.count(); p++) {
+        KonfytSfzInstrument* instrument = rtGraph->sfzInstrumentPorts[p]->sfzInstrument;
+        for (int channel = 0; channel < 16; channel++) {
+            KonfytRtMidiEvent ev = evAllNotesOff;
+            ev.channel = channel;
+            instrument->processMidi(ev, 0);
+            ev = evSustainZero;
+            ev.channel = channel;
+            instrument->processMidi(ev, 0);
+            ev = evPitchbendZero;
+            ev.channel = channel;
+            instrument->processMidi(ev, 0);
+        }
+    }
 }
 
 void KonfytJackEngine::jackProcess_processMidiInPorts(jack_nframes_t nframes)
 {
-    for (int p = 0; p < midiInPorts.count(); p++) {
+    for (int p = 0; p < rtGraph->midiInPorts.count(); p++) {
 
-        KfJackMidiPort* sourcePort = midiInPorts[p];
+        KfJackMidiPort* sourcePort = rtGraph->midiInPorts[p];
+        KfJackMidiPortConfig* config = sourcePort->rtConfig;
         sourcePort->buffer = getJackPortBuffer(sourcePort->jackPointer, nframes);
         jack_nframes_t nevents = 0;
         if (sourcePort->buffer) {
@@ -1413,33 +2144,48 @@ void KonfytJackEngine::jackProcess_processMidiInPorts(jack_nframes_t nframes)
             // Get input event
             jack_midi_event_t inEvent_jack;
             jack_midi_event_get(&inEvent_jack, sourcePort->buffer, i);
-            KonfytMidiEvent ev( inEvent_jack.buffer, inEvent_jack.size );
+            // Data is referenced in the JACK port buffer, which stays valid
+            // for this cycle.
+            KonfytRtMidiEvent ev( inEvent_jack.buffer, inEvent_jack.size );
+            if (!ev.isValid()) { continue; }
 
-            // Apply input MIDI port filter
-            if (sourcePort->filter.passFilter(&ev)) {
-                ev = sourcePort->filter.modify(&ev);
-            } else {
-                // Event doesn't pass filter. Skip.
-                continue;
-            }
+            // Apply input MIDI port filter. Skip if event doesn't pass.
+            if (!config->filter.process(&ev)) { continue; }
 
             // Send to scripting
-            KfJackMidiRxEvent portRxEv = { .sourcePort = sourcePort,
-                                           .midiRoute = nullptr,
-                                           .midiEvent = ev};
+            KfJackRtMidiRxEvent portRxEv = { .sourcePort = sourcePort,
+                                             .midiRoute = nullptr,
+                                             .midiEvent = ev,
+                                             .frame = mCycleStartFrame + inEvent_jack.time };
             if (midiRxBufferForJs->tryWrite(portRxEv)) {
                 midiForJsWritten = true;
             }
 
             // blockDirectThrough blocks events from going through so they
-            // are only processed by scripts.
-            if (sourcePort->blockDirectThrough) { continue; }
+            // are only processed by scripts, unless the script declared a
+            // transform pipeline.
+            if (config->blockDirectThrough
+                    && config->scriptTransform.isEmpty()) { continue; }
 
             // Handle bank select: modify event and store bank select
             handleBankSelect(sourcePort->bankMSB, sourcePort->bankLSB, &ev);
 
-            jackProcess_processMidiInPortEvent(sourcePort, ev, inEvent_jack.time);
             lastEventTime = inEvent_jack.time;
+            if (config->transform.isEmpty()
+                    && config->scriptTransform.isEmpty()) {
+                jackProcess_processMidiInPortEvent(sourcePort, ev, inEvent_jack.time);
+                continue;
+            }
+            KonfytRtMidiEvent transformed[KONFYT_TRANSFORM_MAX_EVENTS];
+            transformed[0] = ev;
+            int count = config->transform.process(
+                        transformed, 1, KONFYT_TRANSFORM_MAX_EVENTS);
+            count = config->scriptTransform.process(
+                        transformed, count, KONFYT_TRANSFORM_MAX_EVENTS);
+            for (int t = 0; t < count; t++) {
+                jackProcess_processMidiInPortEvent(sourcePort, transformed[t],
+                                                   inEvent_jack.time);
+            }
 
         } // end for each midi input event
 
@@ -1447,48 +2193,75 @@ void KonfytJackEngine::jackProcess_processMidiInPorts(jack_nframes_t nframes)
         // (and not from JACK input)
         sourcePort->eventsTxBuffer.startRead();
         while (sourcePort->eventsTxBuffer.hasNext()) {
-            KonfytMidiEvent event = sourcePort->eventsTxBuffer.readNext();
-            jackProcess_processMidiInPortEvent(sourcePort, event, lastEventTime);
+            KfJackRtMidiTxEvent tx = sourcePort->eventsTxBuffer.readNext();
+            int32_t offset = tx.frame - mCycleStartFrame;
+            if (!tx.scheduled || (offset < (int32_t)nframes)) {
+                // Due in this cycle (or already passed). Long data is copied to
+                // the arena before releasing it from the tx ring.
+                KonfytRtMidiEvent ev = tx.midiEvent;
+                if (ev.storeLongData(&sysexArena)) {
+                    jackProcess_processMidiInPortEvent(
+                                sourcePort, ev,
+                                tx.scheduled ? qMax(offset, 0) : lastEventTime);
+                }
+            } else if (!sourcePort->scheduler.push(tx.midiEvent, tx.frame)) {
+                mDroppedScheduledEvents.fetch_add(1, std::memory_order_relaxed);
+            }
+            sourcePort->txSysex.release(tx.midiEvent);
         }
         sourcePort->eventsTxBuffer.endRead();
 
+        // Handle previously scheduled tx events that are due in this cycle
+        KonfytRtMidiEvent ev;
+        uint32_t frame;
+        while (sourcePort->scheduler.popDue(mCycleStartFrame + nframes,
+                                            &ev, &frame, &sysexArena)) {
+            if (!ev.isValid()) { continue; }
+            jackProcess_processMidiInPortEvent(
+                        sourcePort, ev,
+                        qMax((int32_t)(frame - mCycleStartFrame), 0));
+        }
+
 
     } // end for each midi input port
 }
 
 void KonfytJackEngine::jackProcess_processMidiInPortEvent(
-        KfJackMidiPort* sourcePort, KonfytMidiEvent ev, jack_nframes_t time)
+        KfJackMidiPort* sourcePort, const KonfytRtMidiEvent& ev, jack_nframes_t time)
 {
     // Send to GUI
-    KfJackMidiRxEvent portRxEv = { .sourcePort = sourcePort,
-                                   .midiRoute = nullptr,
-                                   .midiEvent = ev};
-    midiRxBuffer.stash(portRxEv);
+    KfJackRtMidiRxEvent portRxEv = { .sourcePort = sourcePort,
+                                     .midiRoute = nullptr,
+                                     .midiEvent = ev,
+                                     .frame = mCycleStartFrame + time };
+    stashMidiRx(portRxEv);
 
     if (panicState != NoPanic) { return; }
 
-    // For each MIDI route...
-    for (int iRoute = 0; iRoute < midiRoutes.count(); iRoute++) {
-
-        KfJackMidiRoute* route = midiRoutes[iRoute];
+    // For each MIDI route from the source port...
+    const QList<KfJackMidiRoute*>& routes = *sourcePort->rtRoutes;
+    for (int iRoute = 0; iRoute < routes.count(); iRoute++) {
 
-        if (route->source != sourcePort) { continue; }
-        if (route->destIsJackPort && route->destPort == nullptr) { continue; }
+        KfJackMidiRoute* route = routes[iRoute];
+        KfJackMidiRouteConfig* config = route->rtConfig;
 
-        if (!route->preFilter.passFilter(&ev)) { continue; }
-        KonfytMidiEvent preEvent = route->preFilter.modify(&ev);
+        if (config->destIsJackPort && config->destPort == nullptr) { continue; }
 
-        if (!route->filter.passFilter(&preEvent)) { continue; }
-        KonfytMidiEvent evToSend = route->filter.modify(&preEvent);
+        KonfytRtMidiEvent evToSend = ev;
+        if (!config->preFilter.process(&evToSend)) { continue; }
+        if (!config->filter.process(&evToSend)) { continue; }
 
         // Handle bank select: modify event and store bank select
         handleBankSelect(route->bankMSB, route->bankLSB, &evToSend);
 
-        bool passEvent = route->active;
+        bool passEvent = route->active
+                         && !isScriptMuted(route->scriptMute, route->scriptSolo);
         bool guiOnly = false;
         bool recordNoteon = false;
         bool recordSustain = false;
         bool recordPitchbend = false;
+        int srcNote = 0; // Noteon note before global transpose
+        int transpose = config->filter.ignoreGlobalTranspose ? 0 : mGlobalTranspose;
 
         if (evToSend.type() == MIDI_EVENT_TYPE_NOTEOFF) {
             // Note-offs are handled here and not passed.
@@ -1519,10 +2292,8 @@ void KonfytJackEngine::jackProcess_processMidiInPortEvent(
                 recordPitchbend = true;
             }
         } else if ( evToSend.type() == MIDI_EVENT_TYPE_NOTEON ) {
-            int note = evToSend.note();
-            if (!route->filter.ignoreGlobalTranspose) {
-                note += mGlobalTranspose;
-            }
+            srcNote = evToSend.note();
+            int note = srcNote + transpose;
             evToSend.setNote(note);
             if ( (note < 0) || (note > 127) ) {
                 passEvent = false;
@@ -1530,12 +2301,13 @@ void KonfytJackEngine::jackProcess_processMidiInPortEvent(
             recordNoteon = true;
         }
 
-        KfJackMidiRxEvent routeRxEv = { .sourcePort = nullptr,
-                                        .midiRoute = route,
-                                        .midiEvent = evToSend };
+        KfJackRtMidiRxEvent routeRxEv = { .sourcePort = nullptr,
+                                          .midiRoute = route,
+                                          .midiEvent = evToSend,
+                                          .frame = mCycleStartFrame + time };
         if (passEvent || guiOnly) {
             // Give to GUI
-            midiRxBuffer.stash(routeRxEv);
+            stashMidiRx(routeRxEv);
         }
 
         // Send to Scripting. Send all events as long as route is active.
@@ -1546,25 +2318,60 @@ void KonfytJackEngine::jackProcess_processMidiInPortEvent(
         }
 
         // blockDirectThrough blocks events from going through so they
-        // are only processed by scripts.
-        if (route->blockDirectThrough) { continue; }
+        // are only processed by scripts, unless the script declared a
+        // transform pipeline.
+        if (config->blockDirectThrough && config->scriptTransform.isEmpty()) { continue; }
         if (!passEvent) { continue; }
 
-        // Write MIDI output
-        writeRouteMidi(route, evToSend, time);
-
-        // Record noteon, sustain or pitchbend for off events later.
         if (recordNoteon) {
-            KonfytJackNoteOnRecord rec;
-            if (route->filter.ignoreGlobalTranspose) {
-                rec.globalTranspose = 0;
-            } else {
-                rec.globalTranspose = mGlobalTranspose;
+            KfJackActiveNotes::Entry& held = route->activeNotes.at(
+                        evToSend.channel, srcNote);
+            if (held.count && (held.transpose != transpose)) {
+                // Still held with a different global transpose. Release the
+                // previous notes so they don't hang.
+                KonfytRtMidiEvent noteoff;
+                noteoff.channel = evToSend.channel;
+                noteoff.setNoteOff(srcNote, 0);
+                handleNoteoffEvent(noteoff, route, time);
             }
-            rec.note = evToSend.note();
-            rec.channel = evToSend.channel;
-            route->noteOnList.add(rec);
-        } else if (recordPitchbend) {
+        }
+
+        // Apply transform pipelines (patch filter, layer filter and script).
+        // Note-offs don't get here; they follow the recorded note-ons.
+        KonfytRtMidiEvent transformed[KONFYT_TRANSFORM_MAX_EVENTS];
+        transformed[0] = evToSend;
+        int count = 1;
+        if (!config->preTransform.isEmpty()
+                || !config->transform.isEmpty()
+                || !config->scriptTransform.isEmpty()) {
+            int max = KONFYT_TRANSFORM_MAX_EVENTS;
+            count = config->preTransform.process(transformed, count, max);
+            count = config->transform.process(transformed, count, max);
+            count = config->scriptTransform.process(transformed, count, max);
+        }
+
+        bool noteonSent = false;
+        for (int t = 0; t < count; t++) {
+            // Write MIDI output
+            writeRouteMidi(route, transformed[t], time);
+            noteonSent |= (transformed[t].type() == MIDI_EVENT_TYPE_NOTEON);
+        }
+
+        // Record noteon and the notes it was output to for note-offs later.
+        if (recordNoteon && noteonSent) {
+            KfJackActiveNotes& notes = route->activeNotes;
+            notes.noteOn(evToSend.channel, srcNote, transpose);
+            KfJackActiveNotes::Entry& held = notes.at(evToSend.channel, srcNote);
+            for (int t = 0; t < count; t++) {
+                if (transformed[t].type() == MIDI_EVENT_TYPE_NOTEON) {
+                    notes.addOutput(held, transformed[t].channel,
+                                    transformed[t].note());
+                }
+            }
+        }
+
+        // Record sustain or pitchbend for zero events later.
+        if (recordPitchbend) {
             route->pitchbend |= 1 << evToSend.channel;
         } else if (recordSustain) {
             route->sustain |= 1 << evToSend.channel;
@@ -1573,50 +2380,98 @@ void KonfytJackEngine::jackProcess_processMidiInPortEvent(
     } // end of for midi route
 }
 
-void KonfytJackEngine::jackProcess_sendMidiRouteTxEvents(jack_nframes_t /*nframes*/)
+void KonfytJackEngine::jackProcess_sendMidiRouteTxEvents(jack_nframes_t nframes)
 {
-    for (int r = 0; r < midiRoutes.count(); r++) {
+    for (int r = 0; r < rtGraph->midiRoutes.count(); r++) {
 
-        KfJackMidiRoute* route = midiRoutes[r];
+        KfJackMidiRoute* route = rtGraph->midiRoutes[r];
         if (!route->active) { continue; }
-        if (route->destIsJackPort && route->destPort == NULL) { continue; }
+        const KfJackMidiRouteConfig* config = route->rtConfig;
+        if (config->destIsJackPort && config->destPort == NULL) { continue; }
 
         route->eventsTxBuffer.startRead();
         while (route->eventsTxBuffer.hasNext()) {
-            KonfytMidiEvent event = route->eventsTxBuffer.readNext();
-
-            // Apply only the route MIDI filter output channel (if any)
-            if (route->filter.outChan >= 0) {
-                event.channel = route->filter.outChan;
+            KfJackRtMidiTxEvent tx = route->eventsTxBuffer.readNext();
+            int32_t offset = tx.frame - mCycleStartFrame;
+            if (!tx.scheduled || (offset < (int32_t)nframes)) {
+                // Due in this cycle (or already passed). Written (copied)
+                // before releasing the long data from the tx ring.
+                writeRouteTxEvent(route, tx.midiEvent,
+                                  tx.scheduled ? qMax(offset, 0) : 0);
+            } else if (!route->scheduler.push(tx.midiEvent, tx.frame)) {
+                mDroppedScheduledEvents.fetch_add(1, std::memory_order_relaxed);
             }
+            route->txSysex.release(tx.midiEvent);
+        }
+        route->eventsTxBuffer.endRead();
 
-            if (route->destIsJackPort) {
-                // Destination is JACK port
+        // Previously scheduled events that are due in this cycle
+        KonfytRtMidiEvent event;
+        uint32_t frame;
+        while (route->scheduler.popDue(mCycleStartFrame + nframes, &event,
+                                       &frame, &sysexArena)) {
+            if (!event.isValid()) { continue; }
+            writeRouteTxEvent(route, event,
+                              qMax((int32_t)(frame - mCycleStartFrame), 0));
+        }
+    }
+}
 
-                unsigned char* outBuffer = 0;
+/* Write MIDI tx event (i.e. originating from this app and not JACK input) to
+ * the route destination, including bank select if set in the event. */
+void KonfytJackEngine::writeRouteTxEvent(KfJackMidiRoute *route,
+                                         const KonfytRtMidiEvent &txEvent,
+                                         jack_nframes_t time)
+{
+    const KfJackMidiRouteConfig* config = route->rtConfig;
 
-                // If bank MSB/LSB not -1, send them before the event
-                if (event.bankMSB >= 0) {
-                    outBuffer = reserveJackMidiEvent(route->destPort->buffer, 0, 3);
-                    if (outBuffer) { event.msbToBuffer(outBuffer); }
-                }
-                if (event.bankLSB >= 0) {
-                    outBuffer = reserveJackMidiEvent(route->destPort->buffer, 0, 3);
-                    if (outBuffer) { event.lsbToBuffer(outBuffer); }
-                }
-                // Send event
-                outBuffer = reserveJackMidiEvent(route->destPort->buffer, 0,
-                                                 event.bufferSizeRequired());
-                if (outBuffer) { event.toBuffer(outBuffer); }
+    KonfytRtMidiEvent event = txEvent;
 
-            } else {
-                // Destination is Fluidsynth port
-                fluidsynthEngine->processJackMidi(route->destFluidsynthID,
-                                                  &event);
-            }
+    // Apply only the route MIDI filter output channel (if any)
+    if (config->filter.outChan >= 0) {
+        event.channel = config->filter.outChan;
+    }
+
+    if (config->destIsJackPort) {
+        // Destination is JACK port
 
+        unsigned char* outBuffer = 0;
+
+        // If bank MSB/LSB not -1, send them before the event
+        if (event.bankMSB >= 0) {
+            outBuffer = reserveJackMidiEvent(config->destPort, time, 3);
+            if (outBuffer) { event.msbToBuffer(outBuffer); }
         }
-        route->eventsTxBuffer.endRead();
+        if (event.bankLSB >= 0) {
+            outBuffer = reserveJackMidiEvent(config->destPort, time, 3);
+            if (outBuffer) { event.lsbToBuffer(outBuffer); }
+        }
+        // Send event
+        outBuffer = reserveJackMidiEvent(config->destPort, time,
+                                         event.bufferSizeRequired());
+        if (outBuffer) { event.toBuffer(outBuffer); }
+
+    } else if (config->destBridge) {
+        // Destination is bridge plugin
+        if (event.bankMSB >= 0) {
+            unsigned char buf[3];
+            event.msbToBuffer(buf);
+            config->destBridge->parentWriteMidi(buf, 3, time);
+        }
+        if (event.bankLSB >= 0) {
+            unsigned char buf[3];
+            event.lsbToBuffer(buf);
+            config->destBridge->parentWriteMidi(buf, 3, time);
+        }
+        writeBridgeMidi(config->destBridge, event, time);
+
+    } else if (config->destSfzInstrument) {
+        // Destination is native SFZ instrument (no bank select)
+        config->destSfzInstrument->processMidi(event, time);
+
+    } else {
+        // Destination is Fluidsynth port
+        fluidsynthEngine->processJackMidi(config->destFluidsynthID, &event, time);
     }
 }
 
@@ -1653,6 +2508,9 @@ bool KonfytJackEngine::initJackClient(QString name)
     mJackBufferSize = jack_get_buffer_size(mJackClient);
     print(QString("Buffer size: %1").arg(mJackBufferSize));
 
+    // Initial graph for the process callback
+    publishGraph();
+
     // Activate the client
     if (jack_activate(mJackClient)) {
         print("Cannot activate client.");
@@ -1677,6 +2535,9 @@ bool KonfytJackEngine::initJackClient(QString name)
         fadeOutValues[i] = 1 - ((float)i/(float)fadeOutValuesCount);
     }
 
+    mParamSmoothingCoeff = 1 - std::exp( -1.0 / (KONFYT_JACK_PARAM_SMOOTHING_SECS
+                                                 * mJackSampleRate) );
+
     // Timer that will take care of communicating JACK process data to rest of
     // app, as well as restoring JACK port connections.
     startTimer();
@@ -1687,11 +2548,12 @@ bool KonfytJackEngine::initJackClient(QString name)
 void KonfytJackEngine::stopJackClient()
 {
     if (clientIsActive()) {
-        pauseJackProcessing(true);
         jack_client_close(mJackClient);
         mJackClient = nullptr;
         mClientActive = false;
-        pauseJackProcessing(false);
+        // The process callback no longer runs, so everything retired can be
+        // freed.
+        reclaimRetired(true);
     }
 }
 
@@ -1722,23 +2584,42 @@ QStringList KonfytJackEngine::getJackPorts(QString typePattern, unsigned long fl
 }
 
 void KonfytJackEngine::writeRouteMidi(KfJackMidiRoute *route,
-                                      KonfytMidiEvent &ev, jack_nframes_t time)
+                                      const KonfytRtMidiEvent &ev, jack_nframes_t time)
 {
-    if (route->destIsJackPort) {
+    const KfJackMidiRouteConfig* config = route->rtConfig;
+    if (config->destIsJackPort) {
         // Destination is JACK port
         unsigned char* outBuffer = reserveJackMidiEvent(
-                    route->destPort->buffer, time, ev.bufferSizeRequired());
+                    config->destPort, time, ev.bufferSizeRequired());
 
         if (outBuffer == 0) { return; }
 
         // Copy event to output buffer
         ev.toBuffer(outBuffer);
+    } else if (config->destBridge) {
+        // Destination is bridge plugin
+        writeBridgeMidi(config->destBridge, ev, time);
+    } else if (config->destSfzInstrument) {
+        // Destination is native SFZ instrument
+        config->destSfzInstrument->processMidi(ev, time);
     } else {
         // Destination is Fluidsynth port
-        fluidsynthEngine->processJackMidi(route->destFluidsynthID, &ev);
+        fluidsynthEngine->processJackMidi(config->destFluidsynthID, &ev, time);
     }
 }
 
+void KonfytJackEngine::writeBridgeMidi(KonfytBridgeShm *bridge,
+                                       const KonfytRtMidiEvent &ev, jack_nframes_t time)
+{
+    // Only short messages are transported to bridge plugins (no SysEx).
+    int size = ev.bufferSizeRequired();
+    if (size > KONFYT_BRIDGE_MIDI_DATA_MAX) { return; }
+
+    unsigned char buf[KONFYT_BRIDGE_MIDI_DATA_MAX];
+    ev.toBuffer(buf);
+    bridge->parentWriteMidi(buf, size, time);
+}
+
 /* Returns list of JACK midi input ports from the JACK server. */
 QStringList KonfytJackEngine::getMidiInputPortsList()
 {
@@ -1796,17 +2677,19 @@ KfJackMidiPort *KonfytJackEngine::addMidiPort(QString name,
                                               KfJackPort::Direction direction)
 {
     if (!clientIsActive()) { return nullptr; }
-    pauseJackProcessing(true);
+    beginGraphUpdate();
 
     KfJackMidiPort* port = new KfJackMidiPort(direction);
     port->jackPointer = registerJackMidiPort(name, direction);
     if (direction == KfJackPort::INPUT) {
+        port->scheduler.setCapacity(KONFYT_MIDI_SCHEDULER_SIZE);
         midiInPorts.append(port);
     } else {
+        port->outQueue.allocate();
         midiOutPorts.append(port);
     }
 
-    pauseJackProcessing(false);
+    endGraphUpdate();
     return port;
 }
 
@@ -1814,7 +2697,7 @@ KfJackAudioPort *KonfytJackEngine::addAudioPort(QString name,
                                                 KfJackPort::Direction direction)
 {
     if (!clientIsActive()) { return nullptr; }
-    pauseJackProcessing(true);
+    beginGraphUpdate();
 
     KfJackAudioPort* port = new KfJackAudioPort(direction);
     port->jackPointer = registerJackAudioPort(name, direction);
@@ -1824,7 +2707,7 @@ KfJackAudioPort *KonfytJackEngine::addAudioPort(QString name,
         audioOutPorts.append(port);
     }
 
-    pauseJackProcessing(false);
+    endGraphUpdate();
     return port;
 }
 
@@ -1832,7 +2715,7 @@ void KonfytJackEngine::removeMidiPort(KfJackMidiPort *port)
 {
     KONFYT_ASSERT_RETURN(port);
 
-    pauseJackProcessing(true);
+    beginGraphUpdate();
 
     midiInPorts.removeAll(port);
     midiOutPorts.removeAll(port);
@@ -1840,17 +2723,20 @@ void KonfytJackEngine::removeMidiPort(KfJackMidiPort *port)
     // Remove this port from any routes.
     removePortFromAllRoutes(port);
 
-    jack_port_unregister(mJackClient, port->jackPointer);
-    delete port;
+    retire([this, port]()
+    {
+        if (mJackClient) { jack_port_unregister(mJackClient, port->jackPointer); }
+        delete port;
+    });
 
-    pauseJackProcessing(false);
+    endGraphUpdate();
 }
 
 void KonfytJackEngine::removeAudioPort(KfJackAudioPort *port)
 {
     KONFYT_ASSERT_RETURN(port);
 
-    pauseJackProcessing(true);
+    beginGraphUpdate();
 
     audioInPorts.removeAll(port);
     audioOutPorts.removeAll(port);
@@ -1858,10 +2744,20 @@ void KonfytJackEngine::removeAudioPort(KfJackAudioPort *port)
     // Remove this port from any routes.
     removePortFromAllRoutes(port);
 
-    jack_port_unregister(mJackClient, port->jackPointer);
-    delete port;
+    // Remove the send effects of the bus the port belongs to
+    foreach (KfJackFxBus* bus, fxBuses) {
+        if ((bus->left == port) || (bus->right == port)) {
+            removeFxBus(bus);
+        }
+    }
+
+    retire([this, port]()
+    {
+        if (mJackClient) { jack_port_unregister(mJackClient, port->jackPointer); }
+        delete port;
+    });
 
-    pauseJackProcessing(false);
+    endGraphUpdate();
 }
 
 uint32_t KonfytJackEngine::getSampleRate()
@@ -1869,12 +2765,132 @@ uint32_t KonfytJackEngine::getSampleRate()
     return this->mJackSampleRate;
 }
 
+/* Returns the estimated current JACK frame time, used to schedule MIDI events
+ * with sendMidiEventsOnRoute() and sendMidiEventsOnPort(). */
+uint32_t KonfytJackEngine::getFrameTime()
+{
+    if (!clientIsActive()) { return 0; }
+    return jack_frame_time(mJackClient);
+}
+
 /* Returns the JACK nframes size (passed to process callback). */
 uint32_t KonfytJackEngine::getBufferSize()
 {
     return this->mJackBufferSize;
 }
 
+/* Returns the JACK DSP load in percent. */
+float KonfytJackEngine::getDspLoad()
+{
+    if (!clientIsActive()) { return 0; }
+    return jack_cpu_load(mJackClient);
+}
+
+/* Returns the recent peak time spent in our process callback, in percent of
+ * the JACK cycle period. */
+float KonfytJackEngine::getProcessLoad()
+{
+    return mProcessLoad.load(std::memory_order_relaxed);
+}
+
+/* Process load, dropped MIDI events and the load of the send effects of each
+ * bus. */
+QString KonfytJackEngine::getStatisticsInfo()
+{
+    QString ret;
+    ret += "Process load: " + QString::number(getProcessLoad(), 'f', 1) + "%\n";
+    ret += "JACK DSP load: " + QString::number(getDspLoad(), 'f', 1) + "%\n";
+    ret += "Dropped MIDI out events: " + n2s(droppedMidiOutEventCount()) + "\n";
+    ret += "Dropped scheduled MIDI events: " + n2s(droppedScheduledEventCount()) + "\n";
+    ret += "Dropped SysEx events: " + n2s(droppedSysexEventCount()) + "\n";
+    foreach (const KfJackFxLoad& load, getFxLoads()) {
+        ret += "Send effects " + load.bus + ": reverb "
+                + QString::number(load.reverbPercent, 'f', 2) + "%, chorus "
+                + QString::number(load.chorusPercent, 'f', 2) + "%\n";
+    }
+    return ret;
+}
+
+/* The statistics of getStatisticsInfo() as JSON, e.g. for a status file. */
+QJsonObject KonfytJackEngine::getStatusJson()
+{
+    QJsonArray effects;
+    foreach (const KfJackFxLoad& load, getFxLoads()) {
+        QJsonObject e;
+        e["bus"] = load.bus;
+        e["reverbLoad"] = load.reverbPercent;
+        e["chorusLoad"] = load.chorusPercent;
+        effects.append(e);
+    }
+    QJsonObject o;
+    o["processLoad"] = getProcessLoad();
+    o["jackDspLoad"] = getDspLoad();
+    o["droppedMidiOutEvents"] = (qint64)droppedMidiOutEventCount();
+    o["droppedScheduledEvents"] = (qint64)droppedScheduledEventCount();
+    o["droppedSysexEvents"] = (qint64)droppedSysexEventCount();
+    o["sendEffects"] = effects;
+    return o;
+}
+
+/* Returns the number of events dropped since the engine was created because
+ * the output queue of a MIDI port was full (see reserveJackMidiEvent()). */
+uint32_t KonfytJackEngine::droppedMidiOutEventCount()
+{
+    return mDroppedMidiOutEvents.load(std::memory_order_relaxed);
+}
+
+/* Returns the number of delayed events (e.g. sent by scripts) dropped since the
+ * engine was created because the scheduler of a route or port was full. */
+uint32_t KonfytJackEngine::droppedScheduledEventCount()
+{
+    return mDroppedScheduledEvents.load(std::memory_order_relaxed);
+}
+
+/* Returns the number of delayed events dropped by the scheduler of the route. */
+uint32_t KonfytJackEngine::droppedScheduledEventCount(KfJackMidiRoute *route)
+{
+    KONFYT_ASSERT_RETURN_VAL(route, 0);
+    return route->scheduler.droppedCount();
+}
+
+/* Returns the number of delayed events dropped by the scheduler of the port. */
+uint32_t KonfytJackEngine::droppedScheduledEventCount(KfJackMidiPort *port)
+{
+    KONFYT_ASSERT_RETURN_VAL(port, 0);
+    return port->scheduler.droppedCount();
+}
+
+/* Returns the number of SysEx events dropped since the engine was created
+ * because there was no space for their data: in the JACK cycle's arena or in
+ * the buffers to the GUI and scripts. */
+uint32_t KonfytJackEngine::droppedSysexEventCount()
+{
+    return sysexArena.droppedCount() + midiRxSysex.droppedCount()
+            + midiRxBufferForJs->droppedSysexCount();
+}
+
+/* Describes the non-zero dropped MIDI event counts, one per line. Returns an
+ * empty string if no events were dropped. */
+QString KonfytJackEngine::getDroppedEventsInfo()
+{
+    QStringList ret;
+    uint32_t outQueue = droppedMidiOutEventCount();
+    if (outQueue) {
+        ret.append(n2s(outQueue) + " MIDI out events dropped (output queue full)");
+    }
+    uint32_t scheduled = droppedScheduledEventCount();
+    if (scheduled) {
+        ret.append(n2s(scheduled) + " scheduled MIDI events dropped (more than "
+                   + n2s(KONFYT_MIDI_SCHEDULER_SIZE) + " events or "
+                   + n2s(KONFYT_MIDI_SCHEDULER_SYSEX_BYTES) + " SysEx bytes pending)");
+    }
+    uint32_t sysex = droppedSysexEventCount();
+    if (sysex) {
+        ret.append(n2s(sysex) + " SysEx events dropped (SysEx buffer full)");
+    }
+    return ret.join("\n");
+}
+
 void KonfytJackEngine::addOtherJackConPair(KonfytJackConPair p)
 {
     // Ignore if already in the list
@@ -1891,8 +2907,6 @@ void KonfytJackEngine::addOtherJackConPair(KonfytJackConPair p)
 
 void KonfytJackEngine::removeOtherJackConPair(KonfytJackConPair p)
 {
-    pauseJackProcessing(true);
-
     for (int i=0; i<otherConsList.count(); i++) {
         if (p.equals(otherConsList[i])) {
             otherConsList.removeAt(i);
@@ -1906,17 +2920,12 @@ void KonfytJackEngine::removeOtherJackConPair(KonfytJackConPair p)
         }
     }
 
-    pauseJackProcessing(false);
     refreshAllPortsConnections();
 }
 
 void KonfytJackEngine::clearOtherJackConPair()
 {
-    pauseJackProcessing(true);
-
     otherConsList.clear();
-
-    pauseJackProcessing(false);
 }
 
 void KonfytJackEngine::setGlobalTranspose(int transpose)
@@ -1924,11 +2933,408 @@ void KonfytJackEngine::setGlobalTranspose(int transpose)
     this->mGlobalTranspose = transpose;
 }
 
-QSharedPointer<SleepyRingBuffer<KfJackMidiRxEvent> > KonfytJackEngine::getMidiRxBufferForJs()
+/* Stash event for the GUI, with long data copied to midiRxSysex. JACK thread. */
+void KonfytJackEngine::stashMidiRx(const KfJackRtMidiRxEvent &ev)
+{
+    KfJackRtMidiRxEvent rxEv = ev;
+    if (!rxEv.midiEvent.storeLongData(&midiRxSysex)) { return; }
+    if (!midiRxBuffer.stash(rxEv)) {
+        if (rxEv.midiEvent.longData()) { midiRxSysex.unstore(); }
+    }
+}
+
+QSharedPointer<KfJackMidiRxBufferForJs> KonfytJackEngine::getMidiRxBufferForJs()
 {
     return midiRxBufferForJs;
 }
 
+void KonfytJackEngine::setMirroredValue(int slot, float value)
+{
+    KONFYT_ASSERT_RETURN( (slot >= 0) && (slot < KONFYT_JACK_MIRRORED_VALUES) );
+
+    mirroredValues[slot].store(value, std::memory_order_relaxed);
+}
+
+/* May be used from the JACK thread. Returns 0 for an invalid slot. */
+float KonfytJackEngine::mirroredValue(int slot) const
+{
+    if ( (slot < 0) || (slot >= KONFYT_JACK_MIRRORED_VALUES) ) { return 0; }
+    return mirroredValues[slot].load(std::memory_order_relaxed);
+}
+
+/* Queue parameter changes to be applied at the start of the next JACK cycle.
+ * Returns false if the queue is full, in which case the remaining commands are
+ * dropped. */
+bool KonfytJackEngine::sendParamCommands(const QList<KfJackParamCommand> &commands)
+{
+    QMutexLocker locker(&paramCommandsWriteMutex);
+    foreach (const KfJackParamCommand& cmd, commands) {
+        if (!paramCommands.write(cmd)) { return false; }
+    }
+    return true;
+}
+
+/* Returns the id of the route to target with a KfJackParamCommand, or zero if
+ * route is null. */
+uint32_t KonfytJackEngine::objectId(KfJackMidiRoute *route)
+{
+    return route ? route->id : 0;
+}
+
+uint32_t KonfytJackEngine::objectId(KfJackAudioRoute *route)
+{
+    return route ? route->id : 0;
+}
+
+uint32_t KonfytJackEngine::objectId(KfJackPort *port)
+{
+    return port ? port->id : 0;
+}
+
+/* JACK thread. Targets are looked up by id in the current graph since they may
+ * have been removed after the command was queued. */
+void KonfytJackEngine::applyParamCommand(const KfJackParamCommand &cmd)
+{
+    const KfJackGraph* g = rtGraph;
+    KfJackMidiRoute* route = g->midiRouteById.value(cmd.midiRoute);
+    KfJackAudioRoute* audio[2] = { g->audioRouteById.value(cmd.audioLeftRoute),
+                                   g->audioRouteById.value(cmd.audioRightRoute) };
+    KfJackAudioPort* bus[2] = { g->audioOutPortById.value(cmd.busLeft),
+                                g->audioOutPortById.value(cmd.busRight) };
+
+    bool on = (cmd.value != 0);
+
+    switch (cmd.type) {
+    case KfJackParamCommand::LayerGain:
+        for (int i = 0; i < 2; i++) {
+            if (audio[i]) { audio[i]->scriptGainTarget = qMax(0.0f, cmd.value); }
+        }
+        break;
+    case KfJackParamCommand::LayerMute:
+        if (route) { route->scriptMute = on; }
+        for (int i = 0; i < 2; i++) {
+            if (audio[i]) { audio[i]->scriptMute = on; }
+        }
+        break;
+    case KfJackParamCommand::LayerSolo:
+        if (route) { setScriptSolo(route, on); }
+        for (int i = 0; i < 2; i++) {
+            if (audio[i]) { audio[i]->scriptSolo = on; }
+        }
+        break;
+    case KfJackParamCommand::LayerZone:
+        if (route) { applyScriptZone(route, cmd.zoneField, (int)cmd.value); }
+        break;
+    case KfJackParamCommand::LayerReset:
+        if (route) {
+            route->scriptMute = false;
+            setScriptSolo(route, false);
+            resetScriptZone(route);
+        }
+        for (int i = 0; i < 2; i++) {
+            if (!audio[i]) { continue; }
+            audio[i]->scriptGainTarget = 1;
+            audio[i]->scriptMute = false;
+            audio[i]->scriptSolo = false;
+        }
+        break;
+    case KfJackParamCommand::BusGain:
+        for (int i = 0; i < 2; i++) {
+            if (bus[i]) { bus[i]->scriptGainTarget = qMax(0.0f, cmd.value); }
+        }
+        break;
+    }
+}
+
+/* Returns a pointer to the zone value corresponding to a
+ * KfJackParamCommand::ZoneField, or null if invalid. */
+int *KonfytJackEngine::zoneFieldValue(MidiFilterCompiled *filter, int field)
+{
+    switch (field) {
+    case KfJackParamCommand::ZoneLowNote: return &filter->lowNote;
+    case KfJackParamCommand::ZoneHighNote: return &filter->highNote;
+    case KfJackParamCommand::ZoneAdd: return &filter->add;
+    case KfJackParamCommand::ZoneLowVel: return &filter->lowVel;
+    case KfJackParamCommand::ZoneHighVel: return &filter->highVel;
+    case KfJackParamCommand::ZonePitchDownMax: return &filter->pitchDownMax;
+    case KfJackParamCommand::ZonePitchUpMax: return &filter->pitchUpMax;
+    }
+    return nullptr;
+}
+
+/* JACK thread. Override a value of the route filter zone. The original value
+ * is saved so it can be restored with resetScriptZone(). */
+void KonfytJackEngine::applyScriptZone(KfJackMidiRoute *route, int field, int value)
+{
+    MidiFilterCompiled* filter = &route->rtConfig->filter;
+    int* v = zoneFieldValue(filter, field);
+    if (!v) { return; }
+
+    int bit = 1 << field;
+    if (!(route->scriptZoneOverrides & bit)) {
+        route->scriptZoneSaved[field] = *v;
+        route->scriptZoneOverrides |= bit;
+    }
+    route->scriptZoneValues[field] = value;
+    *v = value;
+    filter->updateZone();
+}
+
+void KonfytJackEngine::resetScriptZone(KfJackMidiRoute *route)
+{
+    if (!route->scriptZoneOverrides) { return; }
+    MidiFilterCompiled* filter = &route->rtConfig->filter;
+    for (int field = 0; field < KfJackParamCommand::ZoneFieldCount; field++) {
+        if (route->scriptZoneOverrides & (1 << field)) {
+            *zoneFieldValue(filter, field) = route->scriptZoneSaved[field];
+        }
+    }
+    route->scriptZoneOverrides = 0;
+    filter->updateZone();
+}
+
+/* JACK thread. Zone overrides are kept when the route is bound to the
+ * configuration copy of a new graph, unless the filter has since been set from
+ * the GUI, which replaces them. */
+void KonfytJackEngine::rebindScriptZone(KfJackMidiRoute *route)
+{
+    MidiFilterCompiled* filter = &route->rtConfig->filter;
+    if (route->rtConfig->filterVersion != route->scriptZoneFilterVersion) {
+        route->scriptZoneOverrides = 0;
+        route->scriptZoneFilterVersion = route->rtConfig->filterVersion;
+        return;
+    }
+    if (!route->scriptZoneOverrides) { return; }
+    for (int field = 0; field < KfJackParamCommand::ZoneFieldCount; field++) {
+        if (route->scriptZoneOverrides & (1 << field)) {
+            int* v = zoneFieldValue(filter, field);
+            route->scriptZoneSaved[field] = *v;
+            *v = route->scriptZoneValues[field];
+        }
+    }
+    filter->updateZone();
+}
+
+void KonfytJackEngine::setScriptSolo(KfJackMidiRoute *route, bool solo)
+{
+    if (route->scriptSolo == solo) { return; }
+    route->scriptSolo = solo;
+    mScriptSoloCount += solo ? 1 : -1;
+}
+
+/* While any layer is soloed by a script, layers not soloed are muted. */
+bool KonfytJackEngine::isScriptMuted(bool mute, bool solo) const
+{
+    return mute || ( (mScriptSoloCount > 0) && !solo );
+}
+
+/* Measure the MIDI event rate through the prefilter, filter and bank select
+ * chain of a number of routes, as in the JACK thread: each event is read from a
+ * raw buffer and copied for each route. Compares MidiFilter with
+ * KonfytMidiEvent to MidiFilterCompiled with KonfytRtMidiEvent. */
+QStringList KonfytJackEngine::runFilterBenchmark(int eventCount)
+{
+    QStringList ret;
+    const int routeCount = 4;
+
+    // Patch filter and a split layer filter with transpose and velocity curve
+    MidiFilter preFilter = MidiFilter::allPassFilter();
+    preFilter.blockCC << 1 << 11;
+    MidiFilter filter;
+    filter.passCC << 0 << 7 << 10 << 32 << 74;
+    filter.passProg = true;
+    filter.zone.lowNote = 36;
+    filter.zone.highNote = 84;
+    filter.zone.add = 12;
+    filter.zone.velocityMap.fromString("0 64 127; 0 90 127");
+    filter.outChan = 1;
+
+    MidiFilterCompiled preCompiled;
+    preCompiled.compile(preFilter);
+    MidiFilterCompiled compiled;
+    compiled.compile(filter);
+
+    // Raw buffers with a mix of notes, controllers, pitchbend and bank/program
+    // changes
+    const int bufferCount = 1024;
+    std::vector<unsigned char> buffers(bufferCount * 3);
+    std::vector<int> sizes(bufferCount);
+    for (int i = 0; i < bufferCount; i++) {
+        KonfytRtMidiEvent ev;
+        ev.channel = i % 2;
+        int note = (i * 7) % 128;
+        switch (i % 8) {
+        case 0: case 1: ev.setNoteOn(note, 1 + (i * 13) % 127); break;
+        case 2: case 3: ev.setNoteOff(note, 0); break;
+        case 4: ev.setCC((i / 8) % 128, i % 128); break;
+        case 5: ev.setPitchbend((i * 97) % 16384 - 8192); break;
+        case 6: ev.setCC((i / 8) % 2 ? 0 : 32, 1); break;
+        case 7: ev.setProgram(i % 128); break;
+        }
+        sizes[i] = ev.toBuffer(&buffers[i * 3]);
+    }
+
+    int bankMSB[16];
+    int bankLSB[16];
+    QElapsedTimer timer;
+
+    for (int pass = 0; pass < 2; pass++) {
+        bool useCompiled = (pass == 1);
+        for (int c = 0; c < 16; c++) {
+            bankMSB[c] = -1;
+            bankLSB[c] = -1;
+        }
+        int passed = 0;
+        int checksum = 0;
+
+        timer.start();
+        for (int i = 0; i < eventCount; i++) {
+            int b = i % bufferCount;
+            if (useCompiled) {
+                KonfytRtMidiEvent ev(&buffers[b * 3], sizes[b]);
+                for (int r = 0; r < routeCount; r++) {
+                    KonfytRtMidiEvent out = ev;
+                    if (!preCompiled.process(&out)) { continue; }
+                    if (!compiled.process(&out)) { continue; }
+                    handleBankSelect(bankMSB, bankLSB, &out);
+                    passed++;
+                    checksum += out.data1() + out.data2() + out.channel + out.bankMSB;
+                }
+            } else {
+                KonfytMidiEvent ev(&buffers[b * 3], sizes[b]);
+                for (int r = 0; r < routeCount; r++) {
+                    KonfytMidiEvent in = ev;
+                    if (!preFilter.passFilter(&in)) { continue; }
+                    KonfytMidiEvent pre = preFilter.modify(&in);
+                    if (!filter.passFilter(&pre)) { continue; }
+                    KonfytMidiEvent out = filter.modify(&pre);
+                    handleBankSelect(bankMSB, bankLSB, &out);
+                    passed++;
+                    checksum += out.data1() + out.data2() + out.channel + out.bankMSB;
+                }
+            }
+        }
+        qint64 nsecs = qMax(timer.nsecsElapsed(), (qint64)1);
+
+        ret.append(QString("%1 (%2 byte events)  %3 events/us  (%4 passed, checksum %5)")
+                   .arg(useCompiled ? "MidiFilterCompiled" : "MidiFilter        ")
+                   .arg(useCompiled ? sizeof(KonfytRtMidiEvent) : sizeof(KonfytMidiEvent), 3)
+                   .arg(eventCount * 1000.0 / nsecs, 8, 'f', 2)
+                   .arg(passed)
+                   .arg(checksum));
+    }
+
+    return ret;
+}
+
+/* Write generated events to a MIDI output queue the way the process callback
+ * does (passthrough events in order, then script events at random times and
+ * closure events at time 0), check that each cycle is output in frame order,
+ * with events of the same frame in the order they were written, and print the
+ * event rate. Every 16th cycle overflows the queue to check that the excess
+ * events are dropped. ok is set to false if any check fails. */
+QStringList KonfytJackEngine::runMidiOutQueueBenchmark(int cycleCount, bool* ok)
+{
+    QStringList ret;
+    *ok = true;
+    const jack_nframes_t nframes = 256;
+    const int maxEvents = KONFYT_JACK_MIDI_OUT_QUEUE_EVENTS;
+
+    KfJackMidiOutQueue q;
+    q.allocate();
+    std::vector<jack_nframes_t> writtenTimes(maxEvents * 2);
+
+    uint32_t seed = 0x12345678;
+    auto nextRand = [&seed]()
+    {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        return seed;
+    };
+
+    quint64 written = 0;
+    quint64 dropped = 0;
+    quint64 expectedDropped = 0;
+    int orderErrors = 0;
+    int dataErrors = 0;
+    qint64 nsecs = 0;
+    QElapsedTimer timer;
+
+    for (int cycle = 0; cycle < cycleCount; cycle++) {
+        bool overflow = (cycle % 16) == 15;
+        int passthrough = overflow ? maxEvents : nextRand() % 32;
+        int scripted = overflow ? maxEvents / 4 : nextRand() % 16;
+        int closure = nextRand() % 4;
+        int total = passthrough + scripted + closure;
+        int reserved = 0;
+
+        // Write events. The first bytes hold the write index for the checks.
+        timer.start();
+        jack_nframes_t time = 0;
+        for (int i = 0; i < total; i++) {
+            if (i < passthrough) {
+                time = qMin(time + nextRand() % 3, nframes - 1);
+            } else if (i < passthrough + scripted) {
+                time = (nextRand() % 2) ? 0 : nextRand() % nframes;
+            } else {
+                time = 0;
+            }
+            size_t size = (nextRand() % 8) ? 3 : 6;
+            jack_midi_data_t* data = q.reserve(time, size);
+            if (data == NULL) {
+                dropped++;
+                continue;
+            }
+            data[0] = 0x90;
+            data[1] = (i >> 7) & 0x7F;
+            data[2] = i & 0x7F;
+            for (size_t j = 3; j < size; j++) {
+                data[j] = i & 0x7F;
+            }
+            writtenTimes[i] = time;
+            reserved++;
+        }
+        nsecs += timer.nsecsElapsed();
+        written += reserved;
+        expectedDropped += qMax(total - maxEvents, 0);
+
+        // Check order as written to the JACK port buffer in flushMidiOutQueue()
+        int prevIndex = -1;
+        jack_nframes_t prevTime = 0;
+        if (q.events.count() != reserved) { dataErrors++; }
+        for (int e = 0; e < q.events.count(); e++) {
+            const KfJackMidiOutQueue::Event& ev = q.events[e];
+            const jack_midi_data_t* data = &q.data[ev.offset];
+            int index = (data[1] << 7) | data[2];
+            if ( (index >= total) || (writtenTimes[index] != ev.time) ) {
+                dataErrors++;
+                continue;
+            }
+            if ( (ev.time < prevTime)
+                 || ((ev.time == prevTime) && (index < prevIndex)) ) {
+                orderErrors++;
+            }
+            prevTime = ev.time;
+            prevIndex = index;
+        }
+        q.clear();
+    }
+
+    if ( orderErrors || dataErrors || (dropped != expectedDropped) ) {
+        *ok = false;
+    }
+    ret.append(QString("Cycles: %1, events written: %2, dropped: %3 (expected %4)")
+               .arg(cycleCount).arg(written).arg(dropped).arg(expectedDropped));
+    ret.append(QString("Order errors: %1, data errors: %2")
+               .arg(orderErrors).arg(dataErrors));
+    ret.append(QString("Queue insert rate: %1 events/us")
+               .arg((written + dropped) * 1000.0 / qMax(nsecs, (qint64)1), 0, 'f', 2));
+    ret.append(*ok ? "PASSED" : "FAILED");
+
+    return ret;
+}
+
 void KonfytJackEngine::updateAudioBufferSumCycleCount()
 {
     /* This determines the refresh rate of the audio peak indicator in the GUI,
@@ -22,11 +22,11 @@
 #ifndef KONFYT_JACK_ENGINE_H
 #define KONFYT_JACK_ENGINE_H
 
-#include "konfytArrayList.h"
 #include "konfytUtils.h"
 #include "konfytFluidsynthEngine.h"
 #include "konfytJackStructs.h"
 #include "konfytStructs.h"
+#include "lockfreeRingBuffer.h"
 #include "ringbufferqmutex.h"
 #include "sleepyRingBuffer.h"
 
@@ -34,11 +34,16 @@
 #include <jack/midiport.h>
 
 #include <QBasicTimer>
+#include <QElapsedTimer>
+#include <QJsonObject>
 #include <QObject>
 #include <QSet>
 #include <QStringList>
 #include <QTimerEvent>
 
+#include <atomic>
+#include <functional>
+
 
 // Default client name. Actual name is set in the JACK client.
 #define KONFYT_JACK_DEFAULT_CLIENT_NAME "Konfyt"
@@ -46,6 +51,12 @@
 #define KONFYT_JACK_SYSTEM_OUT_RIGHT "system:playback_2"
 
 #define KONFYT_JACK_SUSTAIN_THRESH 63
+#define KONFYT_JACK_MIRRORED_VALUES 64
+#define KONFYT_JACK_PARAM_COMMANDS 1024
+#define KONFYT_JACK_PARAM_SMOOTHING_SECS 0.01
+#define KONFYT_JACK_PROCESS_LOAD_DECAY 0.99f // Per cycle
+#define KONFYT_JACK_FX_LOAD_SMOOTHING 0.01f // Per cycle
+#define KONFYT_JACK_STATISTICS_INTERVAL_MS 1000
 
 class KonfytJackEngine : public QObject
 {
@@ -79,9 +90,19 @@ public:
     bool clientIsActive();
     QString clientName(); // Actual client name as assigned by JACK
     QString clientBaseName(); // Client name requested from JACK, before change for uniqueness
-    void pauseJackProcessing(bool pause);
     uint32_t getSampleRate();
+    uint32_t getFrameTime();
     uint32_t getBufferSize();
+    float getDspLoad();
+    float getProcessLoad();
+    QString getStatisticsInfo();
+    QJsonObject getStatusJson();
+    uint32_t droppedMidiOutEventCount();
+    uint32_t droppedScheduledEventCount();
+    uint32_t droppedScheduledEventCount(KfJackMidiRoute* route);
+    uint32_t droppedScheduledEventCount(KfJackMidiPort* port);
+    uint32_t droppedSysexEventCount();
+    QString getDroppedEventsInfo();
 
     // JACK helper functions (Not specific to our client)
     QStringList getMidiInputPortsList();
@@ -109,7 +130,9 @@ public:
     void setPortFilter(KfJackMidiPort *port, MidiFilter filter);
     void setPortGain(KfJackAudioPort *port, float gain);
     bool sendMidiEventsOnPort(KfJackMidiPort* port, QList<KonfytMidiEvent> events);
+    bool sendMidiEventsOnPort(KfJackMidiPort* port, QList<KfJackMidiTxEvent> events);
     void setMidiPortBlockMidiDirectThrough(KfJackMidiPort* port, bool block);
+    void setMidiPortScriptTransform(KfJackMidiPort* port, KonfytMidiTransformProgram program);
 
     // Audio routes
     KfJackAudioRoute* addAudioRoute(KfJackAudioPort* sourcePort, KfJackAudioPort* destPort);
@@ -118,6 +141,12 @@ public:
     void removeAudioRoute(KfJackAudioRoute *route);
     void setAudioRouteActive(KfJackAudioRoute *route, bool active);
     void setAudioRouteGain(KfJackAudioRoute *route, float gain);
+    void setAudioRouteSends(KfJackAudioRoute *route, float reverb, float chorus);
+
+    // Shared send effects of buses
+    KfJackFxBus* addFxBus(KfJackAudioPort* left, KfJackAudioPort* right);
+    void removeFxBus(KfJackFxBus* bus);
+    QList<KfJackFxLoad> getFxLoads();
 
     // MIDI routes
     KfJackMidiRoute* addMidiRoute(KfJackMidiPort *sourcePort, KfJackMidiPort *destPort);
@@ -128,7 +157,9 @@ public:
     void setRouteMidiFilter(KfJackMidiRoute *route, MidiFilter filter);
     void setRouteMidiPreFilter(KfJackMidiRoute *route, MidiFilter filter);
     bool sendMidiEventsOnRoute(KfJackMidiRoute *route, QList<KonfytMidiEvent> events);
+    bool sendMidiEventsOnRoute(KfJackMidiRoute *route, QList<KfJackMidiTxEvent> events);
     void setRouteBlockMidiDirectThrough(KfJackMidiRoute* route, bool block);
+    void setRouteScriptTransform(KfJackMidiRoute* route, KonfytMidiTransformProgram program);
 
     // SFZ plugins
     KfJackPluginPorts* addPluginPortsAndConnect(const KonfytJackPortsSpec &spec);
@@ -143,6 +174,9 @@ public:
     KfJackMidiRoute* getPluginMidiRoute(KfJackPluginPorts* p);
     QList<KfJackAudioRoute*> getPluginAudioRoutes(KfJackPluginPorts* p);
     void setPluginBlockMidiDirectThrough(KfJackPluginPorts* p, bool block);
+    KfJackPluginPorts* addBridgePlugin(KonfytBridgeShm* bridge, MidiFilter filter);
+    KfJackPluginPorts* addSfzInstrument(KonfytSfzInstrument* instrument, MidiFilter filter);
+    void deleteWhenUnused(std::function<void()> free);
 
     // Fluidsynth
     KfJackPluginPorts* addSoundfont(KfFluidSynth* fluidSynth);
@@ -162,7 +196,22 @@ public:
 
     void setGlobalTranspose(int transpose);
 
-    QSharedPointer<SleepyRingBuffer<KfJackMidiRxEvent>> getMidiRxBufferForJs();
+    QSharedPointer<KfJackMidiRxBufferForJs> getMidiRxBufferForJs();
+
+    // Values mirrored from the scripts' shared store. Lock-free, read-only in
+    // the JACK thread.
+    void setMirroredValue(int slot, float value);
+    float mirroredValue(int slot) const;
+
+    // Realtime parameter changes, e.g. from scripts. May be called from any
+    // thread, bypassing the GUI thread. See KfJackParamCommand.
+    bool sendParamCommands(const QList<KfJackParamCommand>& commands);
+    uint32_t objectId(KfJackMidiRoute* route);
+    uint32_t objectId(KfJackAudioRoute* route);
+    uint32_t objectId(KfJackPort* port);
+
+    static QStringList runFilterBenchmark(int eventCount);
+    static QStringList runMidiOutQueueBenchmark(int cycleCount, bool* ok);
 
 signals:
     void print(QString msg);
@@ -170,6 +219,10 @@ signals:
     void midiEventsReceived();
     void audioEventsReceived();
     void xrunOccurred();
+    void statisticsInfo(QString msg);
+    // Emitted when the number of dropped MIDI events changes, with a
+    // description of the totals (see getDroppedEventsInfo()).
+    void midiEventsDropped(QString info);
 
     void newMidiEventsAvailable();
 
@@ -181,14 +234,22 @@ private:
     bool mConnectCallback = false;
     bool mRegisterCallback = false;
     bool mBufferSizeCallback = false;
-    uint32_t mLastSentMidiEventTime = 0;
-
-    // MIDI data received from JACK thread
-    RingbufferQMutex<KfJackMidiRxEvent> midiRxBuffer{1000};
+    uint32_t mCycleStartFrame = 0; // JACK frame time of current process cycle
+    float mRtProcessLoad = 0; // JACK thread
+    std::atomic<float> mProcessLoad {0};
+    std::atomic<uint32_t> mDroppedMidiOutEvents {0};
+    std::atomic<uint32_t> mDroppedScheduledEvents {0};
+    quint64 mReportedDroppedEvents = 0; // GUI thread, sum of the counts
+
+    // MIDI data received from JACK thread. Long data (SysEx) of the events in
+    // midiRxBuffer is in midiRxSysex, released as the events are extracted.
+    RingbufferQMutex<KfJackRtMidiRxEvent> midiRxBuffer{1000};
+    KonfytRtSysexRing midiRxSysex;
+    void stashMidiRx(const KfJackRtMidiRxEvent& ev);
     QList<KfJackMidiRxEvent> extractedMidiRx;
 
-    QSharedPointer<SleepyRingBuffer<KfJackMidiRxEvent>> midiRxBufferForJs {
-        new SleepyRingBuffer<KfJackMidiRxEvent>(1000) };
+    QSharedPointer<KfJackMidiRxBufferForJs> midiRxBufferForJs {
+        new KfJackMidiRxBufferForJs(1000) };
     bool midiForJsWritten = false;
 
     // Audio data received from JACK thread
@@ -210,15 +271,51 @@ private:
     unsigned int fadeOutValuesCount = 0;
     float fadeOutSecs = 1.0;
 
-    KonfytMidiEvent evAllNotesOff;
-    KonfytMidiEvent evSustainZero;
-    KonfytMidiEvent evPitchbendZero;
+    KonfytRtMidiEvent evAllNotesOff;
+    KonfytRtMidiEvent evSustainZero;
+    KonfytRtMidiEvent evPitchbendZero;
     void initMidiClosureEvents();
 
-    QMutex jackProcessMutex;
-    int jackProcessLocks = 0;
-
-    // General input and output ports
+    // Long data (SysEx) of events from scripts for the current JACK cycle
+    KonfytRtSysexArena sysexArena;
+
+    // Graph published to the JACK thread. Changes to ports, routes and their
+    // configurations are made in the GUI thread between beginGraphUpdate() and
+    // endGraphUpdate(), which publishes a new graph when the outermost update
+    // ends.
+    std::atomic<KfJackGraph*> mGraph {nullptr};
+    int mGraphUpdateDepth = 0;
+    quint64 mFilterVersion = 0;
+    void beginGraphUpdate();
+    void endGraphUpdate();
+    void publishGraph();
+    QList<KfJackMidiRoute*> midiRoutesFromSource(KfJackMidiPort* port);
+    void setRouteConfigFilter(KfJackMidiRouteConfig* config, const MidiFilter& filter);
+
+    // Deferred reclamation of graphs, ports and routes the JACK thread may
+    // still be using. An item retired before publishing a graph is freed once
+    // all graph reads started before the publish have finished.
+    struct KfJackRetired
+    {
+        std::function<void()> free;
+        quint64 ticket = 0;
+        bool published = false;
+    };
+    QList<KfJackRetired> retiredList;
+    std::atomic<quint64> mGraphReadsStarted {0};
+    std::atomic<quint64> mGraphReadsFinished {0};
+    void retire(std::function<void()> free);
+    void retirePublished(std::function<void()> free);
+    void reclaimRetired(bool all = false);
+
+    // JACK thread
+    const KfJackGraph* rtGraph = nullptr;
+    const KfJackGraph* rtBoundGraph = nullptr;
+    const KfJackGraph* beginGraphRead();
+    void endGraphRead();
+    void bindGraph(const KfJackGraph* g);
+
+    // General input and output ports (GUI thread, see KfJackGraph)
     QList<KfJackMidiPort*> midiInPorts;
     QList<KfJackMidiPort*> midiOutPorts;
     QList<KfJackAudioPort*> audioOutPorts;
@@ -228,11 +325,18 @@ private:
 
     QList<KfJackPluginPorts*> pluginPorts;
     QList<KfJackPluginPorts*> fluidsynthPorts;
+    QList<KfJackPluginPorts*> bridgePorts;
+    QList<KfJackPluginPorts*> sfzInstrumentPorts;
 
     // MIDI and audio routes
     QList<KfJackMidiRoute*> midiRoutes;
     QList<KfJackAudioRoute*> audioRoutes;
 
+    // Shared send effects of buses
+    QList<KfJackFxBus*> fxBuses;
+    void allocateFxBusBuffers(KfJackFxBus* bus);
+    void setRouteConfigFxBus(KfJackAudioRouteConfig* config);
+
     jack_port_t* registerJackMidiPort(QString name, KfJackPort::Direction direction);
     jack_port_t* registerJackAudioPort(QString name, KfJackPort::Direction direction);
 
@@ -245,6 +349,7 @@ private:
     // Timer for communicating data from JACK process to the rest of the app as
     // well as restoring JACK port connections.
     QBasicTimer timer;
+    QElapsedTimer statisticsTimer;
     void timerEvent(QTimerEvent *event);
     void startTimer();
     void refreshAllPortsConnections();
@@ -253,30 +358,54 @@ private:
     void disconnectClientsFromPort(KfJackPort* port, QStringList clients);
 
     int mGlobalTranspose = 0;
+    std::atomic<float> mirroredValues[KONFYT_JACK_MIRRORED_VALUES];
+
+    // Parameter commands to the JACK thread. Writers are serialised with the
+    // mutex, the JACK thread reads without locking.
+    LockfreeRingBuffer<KfJackParamCommand> paramCommands{KONFYT_JACK_PARAM_COMMANDS};
+    QMutex paramCommandsWriteMutex;
+    float mParamSmoothingCoeff = 1; // One-pole coefficient for script gains
+    int mScriptSoloCount = 0;       // MIDI routes soloed by scripts
+    void applyParamCommand(const KfJackParamCommand& cmd);
+    static int* zoneFieldValue(MidiFilterCompiled* filter, int field);
+    void applyScriptZone(KfJackMidiRoute* route, int field, int value);
+    void resetScriptZone(KfJackMidiRoute* route);
+    void setScriptSolo(KfJackMidiRoute* route, bool solo);
+    void rebindScriptZone(KfJackMidiRoute* route);
+    bool isScriptMuted(bool mute, bool solo) const;
 
     QStringList getJackPorts(QString typePattern, unsigned long flags);
 
     // JACK process callback helper functions
-    void writeRouteMidi(KfJackMidiRoute* route, KonfytMidiEvent &ev, jack_nframes_t time);
-    bool handleNoteoffEvent(const KonfytMidiEvent& ev, KfJackMidiRoute* route, jack_nframes_t time);
+    void writeRouteMidi(KfJackMidiRoute* route, const KonfytRtMidiEvent &ev, jack_nframes_t time);
+    void writeBridgeMidi(KonfytBridgeShm* bridge, const KonfytRtMidiEvent &ev, jack_nframes_t time);
+    void writeRouteTxEvent(KfJackMidiRoute* route, const KonfytRtMidiEvent& txEvent, jack_nframes_t time);
+    bool stashTxEvent(RingbufferQMutex<KfJackRtMidiTxEvent>* buffer,
+                      KonfytRtSysexRing* sysex, const KfJackMidiTxEvent& event);
+    bool handleNoteoffEvent(const KonfytRtMidiEvent& ev, KfJackMidiRoute* route, jack_nframes_t time);
     void mixBufferToDestinationPort(KfJackAudioRoute* route, jack_nframes_t nframes, bool applyGain);
     void sendMidiClosureEvents(KfJackMidiPort* port, int channel);
     void sendMidiClosureEvents_chanZeroOnly(KfJackMidiPort* port);
     void sendMidiClosureEvents_allChannels(KfJackMidiPort* port);
-    void handleBankSelect(int bankMSB[16], int bankLSB[16], KonfytMidiEvent* ev);
+    template<typename Event>
+    static void handleBankSelect(int bankMSB[16], int bankLSB[16], Event* ev);
     void* getJackPortBuffer(jack_port_t *port, jack_nframes_t nframes) const;
-    jack_midi_data_t* reserveJackMidiEvent(void *portBuffer,
+    jack_midi_data_t* reserveJackMidiEvent(KfJackMidiPort* port,
                                            jack_nframes_t time,
                                            size_t size);
+    void flushMidiOutQueue(KfJackMidiPort* port, jack_nframes_t nframes);
+    void jackProcess_applyParamCommands();
     void jackProcess_prepareAudioPortBuffers(jack_nframes_t nframes);
     void jackProcess_processAudioRoutes(jack_nframes_t nframes);
+    void jackProcess_processFxBuses(jack_nframes_t nframes);
     void jackProcess_prepareMidiOutBuffers(jack_nframes_t nframes);
     void jackProcess_midiPanicOutput();
     void jackProcess_processMidiInPorts(jack_nframes_t nframes);
     void jackProcess_processMidiInPortEvent(KfJackMidiPort* sourcePort,
-                                            KonfytMidiEvent ev,
+                                            const KonfytRtMidiEvent& ev,
                                             jack_nframes_t time);
     void jackProcess_sendMidiRouteTxEvents(jack_nframes_t nframes);
+    void jackProcess_flushMidiOutQueues(jack_nframes_t nframes);
 };
 
 
@@ -22,12 +22,25 @@
 #ifndef KONFYTJACKSTRUCTS_H
 #define KONFYTJACKSTRUCTS_H
 
-#include "konfytArrayList.h"
+#include "konfytBridgeShm.h"
+#include "konfytEffects.h"
 #include "konfytMidiFilter.h"
+#include "konfytMidiScheduler.h"
+#include "konfytRtList.h"
+#include "konfytSfzInstrument.h"
 #include "ringbufferqmutex.h"
+#include "sleepyRingBuffer.h"
 #include "konfytFluidsynthEngine.h"
 
 #include <jack/jack.h>
+#include <jack/midiport.h>
+
+#include <QHash>
+
+#include <string.h>
+
+#include <atomic>
+#include <vector>
 
 
 struct KonfytJackPortsSpec
@@ -39,6 +52,15 @@ struct KonfytJackPortsSpec
     QString audioInRightConnectTo;
 };
 
+/* Returns a new id for a JACK engine object (port or route). Ids are never
+ * reused, so an id of a removed object can't refer to a new one, unlike its
+ * pointer. */
+inline uint32_t kfJackNewId()
+{
+    static std::atomic<uint32_t> lastId {0};
+    return ++lastId;
+}
+
 struct KfJackPort
 {
     friend class KonfytJackEngine;
@@ -46,6 +68,7 @@ struct KfJackPort
     KfJackPort(Direction direction) : direction(direction) {}
     virtual ~KfJackPort() {}
 protected:
+    const uint32_t id = kfJackNewId();
     Direction direction = INPUT;
     jack_port_t* jackPointer = nullptr;
     void* buffer;
@@ -59,18 +82,119 @@ struct KfJackAudioPort : public KfJackPort
     KfJackAudioPort(Direction direction) : KfJackPort(direction) {}
 protected:
     float gain = 1;
+    // Bus gain set by scripts, applied on top of gain and smoothed per frame
+    float scriptGainTarget = 1;
+    float scriptGain = 1;
+};
+
+#define KONFYT_JACK_MIDI_OUT_QUEUE_EVENTS 512
+#define KONFYT_JACK_MIDI_OUT_QUEUE_BYTES 8192
+
+/* Events written to a MIDI output port during a JACK cycle, from different
+ * sources (passthrough, scripts, closure events). Kept sorted by time and
+ * written to the JACK port buffer at the end of MIDI processing. Events that do
+ * not fit are dropped and counted by the engine (droppedMidiOutEventCount()).
+ * Has no capacity until allocate() is called, which is only done for output
+ * ports. */
+struct KfJackMidiOutQueue
+{
+    struct Event
+    {
+        jack_nframes_t time;
+        uint32_t offset; // In data
+        uint32_t size;
+    };
+    KonfytRtList<Event, 0> events;
+    KonfytRtList<jack_midi_data_t, 0> data;
+
+    // Not realtime safe
+    void allocate()
+    {
+        events.setCapacity(KONFYT_JACK_MIDI_OUT_QUEUE_EVENTS);
+        data.setCapacity(KONFYT_JACK_MIDI_OUT_QUEUE_BYTES);
+    }
+
+    /* Reserve size bytes for an event at time, inserted after all events with
+     * a time up to and including time. Returns NULL if the queue is full. */
+    jack_midi_data_t* reserve(jack_nframes_t time, size_t size)
+    {
+        jack_midi_data_t* ret = NULL;
+        if (!events.isFull()) {
+            ret = data.grow(size);
+        }
+        if (ret == NULL) { return NULL; }
+
+        // Insert sorted. Events mostly arrive in order.
+        int i = events.count();
+        while ( (i > 0) && (events[i-1].time > time) ) {
+            i--;
+        }
+        Event ev;
+        ev.time = time;
+        ev.offset = ret - data.data();
+        ev.size = size;
+        events.insert(i, ev);
+
+        return ret;
+    }
+
+    void clear()
+    {
+        events.clear();
+        data.clear();
+    }
+};
+
+/* MIDI event sent to the JACK engine from outside the JACK thread, e.g. from
+ * scripts. If scheduled, the event is output at the absolute JACK frame time
+ * frame (or as soon as possible if that has passed), otherwise as soon as
+ * possible. */
+struct KfJackMidiTxEvent
+{
+    KonfytMidiEvent midiEvent;
+    bool scheduled = false;
+    uint32_t frame = 0;
+};
+
+/* KfJackMidiTxEvent as passed to the JACK thread in the eventsTxBuffer of a
+ * port or route, converted outside the JACK thread. Long data is in the txSysex
+ * ring next to the buffer. */
+struct KfJackRtMidiTxEvent
+{
+    KonfytRtMidiEvent midiEvent;
+    bool scheduled = false;
+    uint32_t frame = 0;
 };
 
+/* MIDI input port configuration, set in the GUI thread. A copy is published to
+ * the JACK thread with each KfJackGraph. */
+struct KfJackMidiPortConfig
+{
+    MidiFilterCompiled filter;
+    KonfytMidiTransformProgram transform; // Of the filter
+    // True to block events from being sent through, for when events need to be
+    // diverted solely to scripting.
+    bool blockDirectThrough = false;
+    // Transform pipeline declared by the port script. Events pass through it
+    // even if blockDirectThrough is set.
+    KonfytMidiTransformProgram scriptTransform;
+};
+
+struct KfJackMidiRoute;
+
 struct KfJackMidiPort : public KfJackPort
 {
     friend class KonfytJackEngine;
     KfJackMidiPort(Direction direction) : KfJackPort(direction) {}
 protected:
-    MidiFilter filter;
-    // True to block events from being sent through, for when events need to be
-    // diverted solely to scripting.
-    bool blockDirectThrough = false;
-    RingbufferQMutex<KonfytMidiEvent> eventsTxBuffer{100};
+    KfJackMidiPortConfig config; // GUI thread
+    KfJackMidiPortConfig* rtConfig = nullptr; // JACK thread, from current graph
+    // JACK thread, routes with this port as source from current graph
+    const QList<KfJackMidiRoute*>* rtRoutes = nullptr;
+    KfJackMidiOutQueue outQueue;
+    RingbufferQMutex<KfJackRtMidiTxEvent> eventsTxBuffer{100};
+    KonfytRtSysexRing txSysex; // Allocated on first long tx event
+    KonfytMidiScheduler scheduler; // Scheduled tx events for future cycles
     int noteOns = 0;
     bool sustainNonZero = false;
     bool pitchbendNonZero = false;
@@ -78,47 +202,247 @@ protected:
     int bankLSB[16] = {-1};
 };
 
-struct KonfytJackNoteOnRecord
+struct KfJackAudioRoute;
+
+/* Realtime parameter change sent to the JACK engine from outside the JACK
+ * thread, e.g. from scripts. Commands are queued lock-free and applied at the
+ * start of the next JACK cycle. Layer commands apply to the MIDI route and/or
+ * audio routes of a layer, bus commands to the bus ports. Targets are given by
+ * id (see KonfytJackEngine::objectId(), zero for none) and looked up in the
+ * graph when applied, so targets removed in the meantime are skipped. */
+struct KfJackParamCommand
 {
-    int note;
-    int globalTranspose;
-    int channel;
+    enum Type { LayerGain, LayerMute, LayerSolo, LayerZone, LayerReset, BusGain };
+    enum ZoneField { ZoneLowNote, ZoneHighNote, ZoneAdd, ZoneLowVel,
+                     ZoneHighVel, ZonePitchDownMax, ZonePitchUpMax,
+                     ZoneFieldCount };
+
+    Type type = LayerGain;
+    uint32_t midiRoute = 0;
+    uint32_t audioLeftRoute = 0;
+    uint32_t audioRightRoute = 0;
+    uint32_t busLeft = 0;
+    uint32_t busRight = 0;
+    float value = 0;
+    int zoneField = 0; // ZoneField for LayerZone
 };
 
-struct KfJackMidiRoute
+#define KONFYT_JACK_ACTIVE_NOTE_OUTPUTS 1024 // Recorded output notes per route
+
+/* Note-ons held by a MIDI route, used to send note-offs that match the
+ * note-ons that were sent. Indexed by channel and note after the route filters,
+ * before global transpose and the transform pipelines.
+ * The channel and note of each note-on the pipelines output for a held key are
+ * recorded in a preallocated pool, so the note-offs go to exactly those notes
+ * even if the pipelines change while the key is held. If the pool is full, the
+ * entry is marked as overflowed and the note-offs of the unrecorded notes have
+ * to be derived with the current pipelines. */
+struct KfJackActiveNotes
+{
+    static const uint16_t NoOutput = 0xFFFF;
+
+    struct Entry
+    {
+        uint8_t count = 0;     // Note-ons held
+        int8_t transpose = 0;  // Global transpose applied to the note-ons
+        bool overflow = false; // Not all output notes could be recorded
+        uint16_t outputs = NoOutput; // First recorded output note
+    };
+
+    struct Output
+    {
+        uint8_t channel;
+        uint8_t note;
+        uint16_t next; // Next output of the same entry, or NoOutput
+    };
+
+    KfJackActiveNotes() { resetOutputs(); }
+
+    Entry& at(int channel, int note) { return notes[channel & 0x0F][note & 0x7F]; }
+    const Output& output(uint16_t index) const { return outputs[index]; }
+
+    void noteOn(int channel, int note, int transpose)
+    {
+        Entry& e = at(channel, note);
+        if (e.count == 0) { heldKeys++; }
+        if (e.count < 255) { e.count++; }
+        e.transpose = transpose;
+    }
+
+    // Record a note-on output by the pipelines for the held key of entry e
+    void addOutput(Entry& e, int channel, int note)
+    {
+        if (freeOutputs == NoOutput) {
+            e.overflow = true;
+            return;
+        }
+        uint16_t i = freeOutputs;
+        freeOutputs = outputs[i].next;
+        outputs[i].channel = channel & 0x0F;
+        outputs[i].note = note & 0x7F;
+        outputs[i].next = e.outputs;
+        e.outputs = i;
+    }
+
+    void release(int channel, int note)
+    {
+        Entry& e = at(channel, note);
+        if (e.count) { heldKeys--; }
+        // Return the outputs to the pool
+        uint16_t i = e.outputs;
+        while (i != NoOutput) {
+            uint16_t next = outputs[i].next;
+            outputs[i].next = freeOutputs;
+            freeOutputs = i;
+            i = next;
+        }
+        e = Entry();
+    }
+
+    void clear()
+    {
+        if (heldKeys == 0) { return; }
+        for (int c = 0; c < 16; c++) {
+            for (int n = 0; n < 128; n++) {
+                notes[c][n] = Entry();
+            }
+        }
+        resetOutputs();
+        heldKeys = 0;
+    }
+
+private:
+    Entry notes[16][128];
+    int heldKeys = 0;
+    Output outputs[KONFYT_JACK_ACTIVE_NOTE_OUTPUTS];
+    uint16_t freeOutputs = NoOutput;
+
+    void resetOutputs()
+    {
+        for (int i = 0; i < KONFYT_JACK_ACTIVE_NOTE_OUTPUTS; i++) {
+            outputs[i].next = (i + 1 < KONFYT_JACK_ACTIVE_NOTE_OUTPUTS) ? i + 1 : NoOutput;
+        }
+        freeOutputs = 0;
+    }
+};
+
+/* MIDI route configuration, set in the GUI thread. A copy is published to the
+ * JACK thread with each KfJackGraph. */
+struct KfJackMidiRouteConfig
 {
-    friend class KonfytJackEngine;
-protected:
-    bool active = false;
-    bool prevActive = false;
     // True to block events from being sent through, for when events need to be
     // diverted solely to scripting.
     bool blockDirectThrough = false;
-    MidiFilter preFilter;
-    MidiFilter filter;
+    MidiFilterCompiled preFilter;
+    MidiFilterCompiled filter;
+    quint64 filterVersion = 0; // Changed whenever filter is set
+    // Transform pipelines of the filters
+    KonfytMidiTransformProgram preTransform;
+    KonfytMidiTransformProgram transform;
+    // Transform pipeline declared by the layer script. Events pass through it
+    // even if blockDirectThrough is set.
+    KonfytMidiTransformProgram scriptTransform;
     KfJackMidiPort* source = nullptr;
     KfJackMidiPort* destPort = nullptr;
     KfFluidSynth* destFluidsynthID = nullptr;
+    KonfytBridgeShm* destBridge = nullptr;
+    KonfytSfzInstrument* destSfzInstrument = nullptr;
     bool destIsJackPort = true;
-    RingbufferQMutex<KonfytMidiEvent> eventsTxBuffer{100};
+};
+
+struct KfJackMidiRoute
+{
+    friend class KonfytJackEngine;
+protected:
+    const uint32_t id = kfJackNewId();
+    bool active = false;
+    bool prevActive = false;
+    KfJackMidiRouteConfig config; // GUI thread
+    KfJackMidiRouteConfig* rtConfig = nullptr; // JACK thread, from current graph
+    RingbufferQMutex<KfJackRtMidiTxEvent> eventsTxBuffer{100};
+    KonfytRtSysexRing txSysex; // Allocated on first long tx event
+    KonfytMidiScheduler scheduler; // Scheduled tx events for future cycles
     uint16_t sustain = 0;
     uint16_t pitchbend = 0;
-    KonfytArrayList<KonfytJackNoteOnRecord> noteOnList;
+    KfJackActiveNotes activeNotes;
     int bankMSB[16] = {-1};
     int bankLSB[16] = {-1};
+    // Layer parameters set by scripts, see KfJackParamCommand
+    bool scriptMute = false;
+    bool scriptSolo = false;
+    int scriptZoneOverrides = 0; // Bit per KfJackParamCommand::ZoneField
+    int scriptZoneValues[KfJackParamCommand::ZoneFieldCount];
+    int scriptZoneSaved[KfJackParamCommand::ZoneFieldCount]; // Before override
+    quint64 scriptZoneFilterVersion = 0; // Filter the overrides apply to
+};
+
+/* Shared send effects of a bus: one reverb and one chorus, fed by the send
+ * levels of the audio routes to the bus ports. The effect outputs are mixed
+ * into the bus before the bus gain is applied. An effect is only processed
+ * while it has input and for its tail after that. */
+struct KfJackFxBus
+{
+    friend class KonfytJackEngine;
+protected:
+    KfJackAudioPort* left = nullptr;
+    KfJackAudioPort* right = nullptr;
+    KonfytReverb reverb;
+    KonfytChorus chorus;
+    // Send buffers of the JACK buffer size, left and right (JACK thread)
+    std::vector<float> reverbIn[2];
+    std::vector<float> chorusIn[2];
+    bool reverbSent = false; // Input was sent in this cycle
+    bool chorusSent = false;
+    uint32_t reverbTailLeft = 0; // Frames to process after the input stopped
+    uint32_t chorusTailLeft = 0;
+    // Average processing time in percent of the cycle period
+    float rtReverbLoad = 0; // JACK thread
+    float rtChorusLoad = 0;
+    std::atomic<float> reverbLoad {0};
+    std::atomic<float> chorusLoad {0};
+};
+
+/* Processing load of the send effects of a bus, in percent of the JACK cycle
+ * period. */
+struct KfJackFxLoad
+{
+    QString bus; // Name of the bus's left port
+    float reverbPercent = 0;
+    float chorusPercent = 0;
+};
+
+/* Audio route configuration, set in the GUI thread. A copy is published to the
+ * JACK thread with each KfJackGraph. */
+struct KfJackAudioRouteConfig
+{
+    KfJackAudioPort* source = nullptr;
+    KfJackAudioPort* dest = nullptr;
+    // Send effects of the destination bus, if any. Set when publishing.
+    KfJackFxBus* fxBus = nullptr;
+    int fxSide = 0; // 0 = left, 1 = right
 };
 
 struct KfJackAudioRoute
 {
     friend class KonfytJackEngine;
 protected:
+    const uint32_t id = kfJackNewId();
     bool active = false;
     bool prevActive = false;
+    KfJackAudioRouteConfig config; // GUI thread
+    KfJackAudioRouteConfig* rtConfig = nullptr; // JACK thread, from current graph
     float gain = 1;
+    // Post-gain send levels to the destination bus's send effects
+    float reverbSend = 0;
+    float chorusSend = 0;
+    // Layer parameters set by scripts. The script gain is applied on top of
+    // gain and smoothed per frame towards the target.
+    float scriptGainTarget = 1;
+    float scriptGain = 1;
+    bool scriptMute = false;
+    bool scriptSolo = false;
     unsigned int fadeoutCounter = 0;
     bool fadingOut = false;
-    KfJackAudioPort* source = nullptr;
-    KfJackAudioPort* dest = nullptr;
     float rxBufferSum = 0;
     int rxCycleCount = 0;
 };
@@ -128,6 +452,8 @@ struct KfJackPluginPorts
     friend class KonfytJackEngine;
 protected:
     KfFluidSynth* fluidSynthInEngine; // Id in plugin's respective engine (used for Fluidsynth)
+    KonfytBridgeShm* bridge = nullptr; // Shared memory transport (used for bridge plugins)
+    KonfytSfzInstrument* sfzInstrument = nullptr; // Used for native SFZ plugins
     KfJackMidiPort* midi;        // Send midi output to plugin
     KfJackAudioPort* audioInLeft;  // Receive plugin audio
     KfJackAudioPort* audioInRight;
@@ -136,6 +462,50 @@ protected:
     KfJackAudioRoute* audioRightRoute = nullptr;
 };
 
+/* Snapshot of the ports and routes processed in the JACK thread, with copies of
+ * their configurations.
+ *
+ * Graphs are built in the GUI thread and published to the JACK thread by
+ * atomic pointer swap, so the JACK thread never waits for the GUI. A graph is
+ * not changed after publishing, except for the configuration copies which then
+ * belong to the JACK thread (e.g. for zone values set by scripts). Replaced
+ * graphs and removed ports and routes are freed once the JACK thread is done
+ * with them. */
+struct KfJackGraph
+{
+    QList<KfJackMidiPort*> midiInPorts;
+    QList<KfJackMidiPort*> midiOutPorts;
+    QList<KfJackAudioPort*> audioInPorts;
+    QList<KfJackAudioPort*> audioOutPorts;
+    QList<KfJackPluginPorts*> pluginPorts;
+    QList<KfJackPluginPorts*> fluidsynthPorts;
+    QList<KfJackPluginPorts*> bridgePorts;
+    QList<KfJackPluginPorts*> sfzInstrumentPorts;
+    QList<KfJackMidiRoute*> midiRoutes;
+    QList<KfJackAudioRoute*> audioRoutes;
+    QList<KfJackFxBus*> fxBuses;
+
+    // Configuration copies in the same order as the lists above
+    QList<KfJackMidiPortConfig*> midiInPortConfigs;
+    // For each MIDI input port, the routes with the port as source. Routes are
+    // grouped by destination, in order of the first route to each destination.
+    QList<QList<KfJackMidiRoute*>> midiInPortRoutes;
+    QList<KfJackMidiRouteConfig*> midiRouteConfigs;
+    QList<KfJackAudioRouteConfig*> audioRouteConfigs;
+
+    // Targets of parameter commands by id, see KfJackParamCommand
+    QHash<uint32_t, KfJackMidiRoute*> midiRouteById;
+    QHash<uint32_t, KfJackAudioRoute*> audioRouteById;
+    QHash<uint32_t, KfJackAudioPort*> audioOutPortById;
+
+    ~KfJackGraph()
+    {
+        qDeleteAll(midiInPortConfigs);
+        qDeleteAll(midiRouteConfigs);
+        qDeleteAll(audioRouteConfigs);
+    }
+};
+
 struct KonfytJackConPair
 {
     QString srcPort;
@@ -164,6 +534,68 @@ struct KfJackMidiRxEvent
     KfJackMidiPort* sourcePort = nullptr;
     KfJackMidiRoute* midiRoute = nullptr;
     KonfytMidiEvent midiEvent;
+    uint32_t frame = 0; // Absolute JACK frame time the event was received
+};
+
+/* KfJackMidiRxEvent as passed from the JACK thread, converted by the receiving
+ * thread. Long data is in the SysEx ring of the buffer it is passed in. */
+struct KfJackRtMidiRxEvent
+{
+    KfJackMidiPort* sourcePort = nullptr;
+    KfJackMidiRoute* midiRoute = nullptr;
+    KonfytRtMidiEvent midiEvent;
+    uint32_t frame = 0;
+
+    KfJackMidiRxEvent toMidiRxEvent() const
+    {
+        KfJackMidiRxEvent ret;
+        ret.sourcePort = sourcePort;
+        ret.midiRoute = midiRoute;
+        ret.midiEvent = midiEvent.toMidiEvent();
+        ret.frame = frame;
+        return ret;
+    }
+};
+
+/* MIDI events received in the JACK thread for scripts. Written in the JACK
+ * thread and read in the script thread, where read() sleeps until an event is
+ * available. Long data is copied to a SysEx ring owned by the buffer and
+ * released when the event is read. */
+class KfJackMidiRxBufferForJs
+{
+public:
+    KfJackMidiRxBufferForJs(int size) : events(size)
+    {
+        sysex.allocate(KONFYT_RT_SYSEX_RING_BYTES);
+    }
+
+    /* JACK thread. Returns false if the buffer or SysEx ring is full. */
+    bool tryWrite(KfJackRtMidiRxEvent ev)
+    {
+        if (!ev.midiEvent.storeLongData(&sysex)) { return false; }
+        if (!events.tryWrite(ev)) {
+            if (ev.midiEvent.longData()) { sysex.unstore(); }
+            return false;
+        }
+        return true;
+    }
+
+    /* Script thread. Blocks until an event is available. */
+    KfJackMidiRxEvent read()
+    {
+        KfJackRtMidiRxEvent ev = events.read();
+        KfJackMidiRxEvent ret = ev.toMidiRxEvent();
+        sysex.release(ev.midiEvent);
+        return ret;
+    }
+
+    int availableToRead() { return events.availableToRead(); }
+
+    uint32_t droppedSysexCount() const { return sysex.droppedCount(); }
+
+private:
+    SleepyRingBuffer<KfJackRtMidiRxEvent> events;
+    KonfytRtSysexRing sysex;
 };
 
 struct KfJackAudioRxEvent
@@ -21,15 +21,24 @@
 
 #include "konfytJs.h"
 
+#include <QFile>
+#include <QJsonArray>
+#include <QJSValueIterator>
+
+#include <unistd.h>
+
 
 void AverageTimer::start()
 {
     elapsedTimer.start();
 }
 
-void AverageTimer::recordTime()
+/* Record the time since start(). If the time was spent on multiple items,
+ * the time per item is recorded. Returns the recorded time. */
+qint64 AverageTimer::recordTime(int items)
 {
     qint64 elapsedNs = elapsedTimer.nsecsElapsed();
+    if (items > 1) { elapsedNs /= items; }
 
     qint64 sum = sumProcessTimesNs;
     sum -= processTimesNs[iProcessTimes];
@@ -38,6 +47,7 @@ void AverageTimer::recordTime()
     iProcessTimes = (iProcessTimes + 1) % processTimesSize;
     if (processTimesCount < processTimesSize) { processTimesCount++; }
     sumProcessTimesNs = sum;
+    return elapsedNs;
 }
 
 float AverageTimer::getAverageProcessTimeMs()
@@ -49,6 +59,254 @@ float AverageTimer::getAverageProcessTimeMs()
     }
 }
 
+/* In detailed mode, garbage collection pauses are measured and the slowest
+ * calls are kept. */
+void KonfytJSProfiler::setDetailed(bool detailed)
+{
+    mDetailed = detailed;
+}
+
+bool KonfytJSProfiler::isDetailed() const
+{
+    return mDetailed;
+}
+
+void KonfytJSProfiler::reset()
+{
+    events.reset();
+    queueDelay.reset();
+    gc.reset();
+    functions.clear();
+    sections.clear();
+    openSections.clear();
+    mQueueDepth = 0;
+    mMaxQueueDepth = 0;
+    slowCalls.clear();
+}
+
+/* Record the duration of a call to a script function (init, midiEvent or
+ * midiEvents). */
+void KonfytJSProfiler::recordFunction(const QString &function, qint64 ns)
+{
+    functions[function].record(ns);
+}
+
+void KonfytJSProfiler::recordEvents(qint64 nsPerEvent, int count)
+{
+    events.record(nsPerEvent, count);
+}
+
+/* Record the number of events waiting for the script when it is run. */
+void KonfytJSProfiler::recordQueue(int depth)
+{
+    mQueueDepth = depth;
+    mMaxQueueDepth = qMax(mMaxQueueDepth, depth);
+}
+
+void KonfytJSProfiler::recordQueueDelay(qint64 ns)
+{
+    queueDelay.record(ns);
+}
+
+void KonfytJSProfiler::recordGc(qint64 ns)
+{
+    gc.record(ns);
+}
+
+/* Detailed mode: keep the call if it is one of the slowest so far. */
+void KonfytJSProfiler::recordSlowCall(const QString &function,
+                                      const QString &detail, qint64 ns)
+{
+    if (!mDetailed) { return; }
+    if ( (slowCalls.count() >= SLOW_CALLS_MAX) && (ns <= slowCalls.last().ns) ) {
+        return;
+    }
+    int i = 0;
+    while ( (i < slowCalls.count()) && (slowCalls[i].ns >= ns) ) { i++; }
+    slowCalls.insert(i, {function, detail, ns});
+    while (slowCalls.count() > SLOW_CALLS_MAX) { slowCalls.removeLast(); }
+}
+
+void KonfytJSProfiler::beginSection(const QString &name)
+{
+    openSections[name].start();
+}
+
+/* Record the time since beginSection() was called with the same name. Returns
+ * false if the section was not started. */
+bool KonfytJSProfiler::endSection(const QString &name)
+{
+    auto it = openSections.find(name);
+    if (it == openSections.end()) { return false; }
+    sections[name].record(it->nsecsElapsed());
+    openSections.erase(it);
+    return true;
+}
+
+QJsonObject KonfytJSProfiler::toJson() const
+{
+    QJsonObject j;
+    j["detailed"] = mDetailed;
+    j["events"] = events.toJson();
+    j["queueDelay"] = queueDelay.toJson();
+    j["queueDepth"] = mQueueDepth;
+    j["maxQueueDepth"] = mMaxQueueDepth;
+    j["gc"] = gc.toJson();
+
+    QJsonObject f;
+    for (auto it = functions.constBegin(); it != functions.constEnd(); it++) {
+        f[it.key()] = it.value().toJson();
+    }
+    j["functions"] = f;
+
+    QJsonObject sec;
+    for (auto it = sections.constBegin(); it != sections.constEnd(); it++) {
+        sec[it.key()] = it.value().toJson();
+    }
+    j["sections"] = sec;
+
+    QJsonArray slow;
+    foreach (const SlowCall& c, slowCalls) {
+        QJsonObject o;
+        o["function"] = c.function;
+        o["detail"] = c.detail;
+        o["ns"] = (double)c.ns;
+        slow.append(o);
+    }
+    j["slowestCalls"] = slow;
+
+    return j;
+}
+
+QJSEngine* KonfytJSSharedEngine::jsEngine()
+{
+    return &js;
+}
+
+int KonfytJSSharedEngine::contextCount() const
+{
+    return mContextCount;
+}
+
+bool KonfytJSSharedEngine::hasFactory(const QString &script) const
+{
+    return factories.contains(script);
+}
+
+/* Returns the compiled factory function for the script, compiling it if it is
+ * not cached yet. Returns the error value if compilation failed, in which case
+ * the factory is not acquired. */
+QJSValue KonfytJSSharedEngine::acquireFactory(const QString &script,
+                                              const QStringList &argNames,
+                                              bool *fromCache)
+{
+    auto it = factories.find(script);
+    if (it != factories.end()) {
+        it->users++;
+        if (fromCache) { *fromCache = true; }
+        return it->function;
+    }
+    if (fromCache) { *fromCache = false; }
+
+    // The script starts on the first line of the wrapper so that error line
+    // numbers match the script. init is referenced directly so that a missing
+    // init() results in an error, as when each script has its own engine.
+    QString wrapper = QString("(function (%1) {").arg(argNames.join(", "))
+            + script
+            + "\n;return { init: init,"
+              " midiEvent: (typeof midiEvent === \"function\") ? midiEvent : undefined,"
+              " midiEvents: (typeof midiEvents === \"function\") ? midiEvents : undefined,"
+              " pipeline: function () { return (typeof pipeline !== \"undefined\") ? pipeline : undefined; }"
+              " };\n})";
+    QJSValue f = js.evaluate(wrapper);
+    if (!f.isError()) {
+        Factory factory;
+        factory.function = f;
+        factory.users = 1;
+        factories.insert(script, factory);
+    }
+    return f;
+}
+
+void KonfytJSSharedEngine::releaseFactory(const QString &script)
+{
+    auto it = factories.find(script);
+    if (it == factories.end()) { return; }
+    it->users--;
+    if (it->users <= 0) {
+        factories.erase(it);
+    }
+}
+
+void KonfytJSSharedEngine::addContext()
+{
+    mContextCount++;
+}
+
+void KonfytJSSharedEngine::removeContext()
+{
+    mContextCount--;
+}
+
+void KonfytJSSharedStore::setJackEngine(KonfytJackEngine *jackEngine)
+{
+    QMutexLocker locker(&mutex);
+    jack = jackEngine;
+}
+
+quint64 KonfytJSSharedStore::version() const
+{
+    return mVersion.load(std::memory_order_acquire);
+}
+
+KonfytJSSharedStore::Snapshot KonfytJSSharedStore::snapshot()
+{
+    QMutexLocker locker(&mutex);
+    return mSnapshot;
+}
+
+/* Apply the changes and removals as a new snapshot. */
+void KonfytJSSharedStore::publish(const Map &changes, const QSet<QString> &removed)
+{
+    if (changes.isEmpty() && removed.isEmpty()) { return; }
+
+    QMutexLocker locker(&mutex);
+
+    Map* map = new Map(*mSnapshot);
+    foreach (const QString& key, removed) {
+        map->remove(key);
+        if (mirrorSlots.contains(key)) { mirror(mirrorSlots.value(key), QVariant()); }
+    }
+    for (auto it = changes.constBegin(); it != changes.constEnd(); it++) {
+        map->insert(it.key(), it.value());
+        if (mirrorSlots.contains(it.key())) { mirror(mirrorSlots.value(it.key()), it.value()); }
+    }
+    mSnapshot = Snapshot(map);
+    mVersion.fetch_add(1, std::memory_order_release);
+}
+
+/* Mirror the numeric value of the key to a JACK engine slot. Returns the slot,
+ * or -1 if all slots are in use. */
+int KonfytJSSharedStore::mirrorSlot(QString key)
+{
+    QMutexLocker locker(&mutex);
+
+    if (mirrorSlots.contains(key)) { return mirrorSlots.value(key); }
+    if (mirrorSlots.count() >= KONFYT_JACK_MIRRORED_VALUES) { return -1; }
+    int slot = mirrorSlots.count();
+    mirrorSlots.insert(key, slot);
+    mirror(slot, mSnapshot->value(key));
+    return slot;
+}
+
+void KonfytJSSharedStore::mirror(int slot, const QVariant &value)
+{
+    if (!jack) { return; }
+    bool ok = false;
+    float f = value.toFloat(&ok);
+    jack->setMirroredValue(slot, ok ? f : 0);
+}
+
 KonfytJSMidi::KonfytJSMidi(KonfytJSEnv* parent) : QObject(parent)
 {
     jsEnv = parent;
@@ -112,44 +370,97 @@ KonfytMidiEvent KonfytJSMidi::jsObjectToMidiEvent(QJSValue j)
     KonfytMidiEvent ev;
 
     // Scripting channels are 1-16, KonfytMidiEvent uses 0-15
-    ev.channel = value(j, "channel", 0).toInt() - 1;
-    QString type = value(j, "type", "noteon").toString();
-    if (type == "noteon") {
-        int note = value(j, "note", 0).toInt();
-        int velocity = value(j, "velocity", 0).toInt();
-        ev.setNoteOn(note, velocity);
-    } else if (type == "noteoff") {
-        int note = value(j, "note", 0).toInt();
-        int velocity = value(j, "velocity", 0).toInt();
-        ev.setNoteOff(note, velocity);
-    } else if (type == "cc") {
-        int cc = value(j, "cc", 0).toInt();
-        int val = value(j, "value", 0).toInt();
-        ev.setCC(cc, val);
-    } else if (type == "program") {
-        int program = value(j, "program", 0).toInt();
-        ev.setProgram(program);
-        ev.bankLSB = value(j, "banklsb", -1).toInt();
-        ev.bankMSB = value(j, "bankmsb", -1).toInt();
-    } else if (type == "pitchbend") {
-        int pb = value(j, "value", MIDI_PITCHBEND_ZERO).toInt();
-        ev.setPitchbend(pb);
-    } else if (type == "polyaftertouch") {
-        int note = value(j, "note", 0).toInt();
-        int pres = value(j, "pressure", 0).toInt();
-        ev.setPolyAftertouch(note, pres);
-    } else if (type == "aftertouch") {
-        int pres = value(j, "pressure", 0).toInt();
-        ev.setAftertouch(pres);
-    } else if (type == "sysex") {
-        QString data = value(j, "data", "").toString();
-        ev.setDataFromHexString(data);
+    ev.channel = intValue(j, "channel", 0) - 1;
+
+    // The type may be a string (e.g. NOTEON) or an integer (e.g. MIDI_NOTEON)
+    int type = MIDI_EVENT_TYPE_NOTEON;
+    QJSValue jtype = j.property("type");
+    if (jtype.isNumber()) {
+        type = jtype.toInt();
+    } else if (!jtype.isUndefined()) {
+        type = typeFromString(jtype.toString());
+    }
+
+    switch (type) {
+    case MIDI_EVENT_TYPE_NOTEON:
+        ev.setNoteOn(intValue(j, "note", 0), intValue(j, "velocity", 0));
+        break;
+    case MIDI_EVENT_TYPE_NOTEOFF:
+        ev.setNoteOff(intValue(j, "note", 0), intValue(j, "velocity", 0));
+        break;
+    case MIDI_EVENT_TYPE_CC:
+        ev.setCC(intValue(j, "cc", 0), intValue(j, "value", 0));
+        break;
+    case MIDI_EVENT_TYPE_PROGRAM:
+        ev.setProgram(intValue(j, "program", 0));
+        ev.bankLSB = intValue(j, "banklsb", -1);
+        ev.bankMSB = intValue(j, "bankmsb", -1);
+        break;
+    case MIDI_EVENT_TYPE_PITCHBEND:
+        ev.setPitchbend(intValue(j, "value", MIDI_PITCHBEND_ZERO));
+        break;
+    case MIDI_EVENT_TYPE_POLY_AFTERTOUCH:
+        ev.setPolyAftertouch(intValue(j, "note", 0), intValue(j, "pressure", 0));
+        break;
+    case MIDI_EVENT_TYPE_AFTERTOUCH:
+        ev.setAftertouch(intValue(j, "pressure", 0));
+        break;
+    case MIDI_EVENT_TYPE_SYSTEM:
+        ev.setDataFromHexString(value(j, "data", "").toString());
         ev.setType(MIDI_EVENT_TYPE_SYSTEM);
+        break;
     }
 
     return ev;
 }
 
+/* Create a MIDI event from the integer fields used in the event buffer of
+ * midiEvents(). Channel is 1-16. Returns false for unsupported types. */
+bool KonfytJSMidi::rawToMidiEvent(int type, int channel, int data1, int data2,
+                                  KonfytMidiEvent *ev)
+{
+    ev->channel = channel - 1;
+    switch (type) {
+    case MIDI_EVENT_TYPE_NOTEON:
+        ev->setNoteOn(data1, data2);
+        break;
+    case MIDI_EVENT_TYPE_NOTEOFF:
+        ev->setNoteOff(data1, data2);
+        break;
+    case MIDI_EVENT_TYPE_CC:
+        ev->setCC(data1, data2);
+        break;
+    case MIDI_EVENT_TYPE_PROGRAM:
+        ev->setProgram(data1);
+        break;
+    case MIDI_EVENT_TYPE_PITCHBEND:
+        ev->setPitchbend(data1);
+        break;
+    case MIDI_EVENT_TYPE_POLY_AFTERTOUCH:
+        ev->setPolyAftertouch(data1, data2);
+        break;
+    case MIDI_EVENT_TYPE_AFTERTOUCH:
+        ev->setAftertouch(data1);
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+int KonfytJSMidi::typeFromString(const QString &type)
+{
+    if (type == "noteon") { return MIDI_EVENT_TYPE_NOTEON; }
+    if (type == "noteoff") { return MIDI_EVENT_TYPE_NOTEOFF; }
+    if (type == "cc") { return MIDI_EVENT_TYPE_CC; }
+    if (type == "program") { return MIDI_EVENT_TYPE_PROGRAM; }
+    if (type == "pitchbend") { return MIDI_EVENT_TYPE_PITCHBEND; }
+    if (type == "polyaftertouch") { return MIDI_EVENT_TYPE_POLY_AFTERTOUCH; }
+    if (type == "aftertouch") { return MIDI_EVENT_TYPE_AFTERTOUCH; }
+    if (type == "sysex") { return MIDI_EVENT_TYPE_SYSTEM; }
+    return -1;
+}
+
 QJSValue KonfytJSMidi::noteon(int channel, int note, int velocity)
 {
     KonfytMidiEvent ev;
@@ -192,6 +503,42 @@ QJSValue KonfytJSMidi::pitchbend(int channel, int value)
     return midiEventToJSObject(ev);
 }
 
+/* Send MIDI event. If delayMs is larger than zero, the event is scheduled at
+ * delayMs after the time of the event currently being processed by the script
+ * (or after the current time outside of midiEvent()). */
+void KonfytJSMidi::send(QJSValue event, double delayMs)
+{
+    jsEnv->sendMidi(event, delayMs);
+}
+
+/* Send a MIDI event specified by integer fields, without creating an event
+ * object. See rawToMidiEvent(). */
+void KonfytJSMidi::sendRaw(int type, int channel, int data1, int data2, double delayMs)
+{
+    KonfytMidiEvent ev;
+    if (!rawToMidiEvent(type, channel, data1, data2, &ev)) {
+        jsEnv->print(QString("Midi.sendRaw: unsupported type %1").arg(type));
+        return;
+    }
+    jsEnv->sendMidiEvent(ev, delayMs);
+}
+
+/* Send the event at the specified index of the current midiEvents() buffer
+ * unchanged. A delay is relative to the time the event was received. */
+void KonfytJSMidi::forward(int index, double delayMs)
+{
+    if (!jsEnv->forwardMidi(index, delayMs)) {
+        jsEnv->print(QString("Midi.forward: invalid index %1").arg(index));
+    }
+}
+
+int KonfytJSMidi::intValue(const QJSValue &j, QString key, int defaultValue)
+{
+    QJSValue jv = j.property(key);
+    if (jv.isUndefined()) { return defaultValue; }
+    else { return jv.toInt(); }
+}
+
 QVariant KonfytJSMidi::value(const QJSValue& j, QString key, QVariant defaultValue)
 {
     QJSValue jv = j.property(key);
@@ -199,26 +546,178 @@ QVariant KonfytJSMidi::value(const QJSValue& j, QString key, QVariant defaultVal
     else { return jv.toVariant(); }
 }
 
+KonfytJSSharedState::KonfytJSSharedState(KonfytJSEnv *parent) : QObject(parent)
+{
+    jsEnv = parent;
+}
+
+QJSValue KonfytJSSharedState::get(QString key, QJSValue defaultValue)
+{
+    return jsEnv->sharedValue(key, defaultValue);
+}
+
+/* The value is visible to the script immediately and to other scripts after
+ * the current script run. */
+void KonfytJSSharedState::set(QString key, QJSValue value)
+{
+    jsEnv->setSharedValue(key, value);
+}
+
+void KonfytJSSharedState::remove(QString key)
+{
+    jsEnv->removeSharedValue(key);
+}
+
+QStringList KonfytJSSharedState::keys()
+{
+    return jsEnv->sharedKeys();
+}
+
+int KonfytJSSharedState::mirror(QString key)
+{
+    return jsEnv->mirrorSharedValue(key);
+}
+
+void KonfytJSSharedState::publish(QString topic, QJSValue value)
+{
+    jsEnv->publishMessage(topic, value);
+}
+
+void KonfytJSSharedState::subscribe(QString topic, QJSValue callback)
+{
+    jsEnv->subscribe(topic, callback);
+}
+
+void KonfytJSSharedState::unsubscribe(QString topic)
+{
+    jsEnv->unsubscribe(topic);
+}
+
+KonfytJSParams::KonfytJSParams(KonfytJSEnv *parent) : QObject(parent)
+{
+    jsEnv = parent;
+}
+
+/* Linear gain of the layer, applied on top of the layer gain set in the GUI. */
+void KonfytJSParams::setGain(double gain)
+{
+    jsEnv->setParam(KfJackParamCommand::LayerGain, qBound(0.0, gain, 4.0));
+}
+
+void KonfytJSParams::setMute(bool mute)
+{
+    jsEnv->setParam(KfJackParamCommand::LayerMute, mute ? 1 : 0);
+}
+
+void KonfytJSParams::setSolo(bool solo)
+{
+    jsEnv->setParam(KfJackParamCommand::LayerSolo, solo ? 1 : 0);
+}
+
+/* Set the layer MIDI filter zone values present in the zone object. */
+void KonfytJSParams::setZone(QJSValue zone)
+{
+    struct Field {
+        const char* name;
+        int field;
+        int min;
+        int max;
+    };
+    const Field fields[] = {
+        {"lowNote", KfJackParamCommand::ZoneLowNote, 0, 127},
+        {"highNote", KfJackParamCommand::ZoneHighNote, 0, 127},
+        {"add", KfJackParamCommand::ZoneAdd, -127, 127},
+        {"lowVel", KfJackParamCommand::ZoneLowVel, 0, 127},
+        {"highVel", KfJackParamCommand::ZoneHighVel, 0, 127},
+        {"pitchDownMax", KfJackParamCommand::ZonePitchDownMax,
+         MIDI_PITCHBEND_SIGNED_MIN, 0},
+        {"pitchUpMax", KfJackParamCommand::ZonePitchUpMax,
+         0, MIDI_PITCHBEND_SIGNED_MAX},
+    };
+
+    for (const Field& f : fields) {
+        QJSValue value = zone.property(f.name);
+        if (value.isUndefined()) { continue; }
+        if (!value.isNumber()) {
+            jsEnv->print(QString("Params.setZone: %1 must be a number.").arg(f.name));
+            continue;
+        }
+        jsEnv->setParam(KfJackParamCommand::LayerZone,
+                        qBound(f.min, value.toInt(), f.max), f.field);
+    }
+}
+
+/* Undo all layer parameter changes made by the script. */
+void KonfytJSParams::reset()
+{
+    jsEnv->setParam(KfJackParamCommand::LayerReset, 0);
+}
+
+void KonfytJSParams::setBusGain(int busId, double gain)
+{
+    jsEnv->setParam(KfJackParamCommand::BusGain, qBound(0.0, gain, 4.0), 0, busId);
+}
+
 KonfytJSEnv::KonfytJSEnv(QObject* parent) : QObject{parent}
 {
-    connect(&midi, &KonfytJSMidi::send, this, &KonfytJSEnv::sendMidi);
 }
 
-void KonfytJSEnv::setScriptAndInitIfEnabled(QString script, bool enable)
+KonfytJSEnv::~KonfytJSEnv()
+{
+    releaseSharedContext();
+}
+
+/* Move the environment to the thread it will be used in. Must be called
+ * before the script is set. */
+void KonfytJSEnv::moveEnvToThread(QThread *thread)
+{
+    tempParent.moveToThread(thread);
+    moveToThread(thread);
+}
+
+/* Use the specified shared engine for this environment, or a separate engine
+ * if null. Takes effect when the script is set. */
+void KonfytJSEnv::setSharedEngine(KonfytJSSharedEngine *engine)
+{
+    if (engine == shared) { return; }
+    releaseSharedContext();
+    shared = engine;
+}
+
+/* Set the script and reset the environment. The script is initialised when
+ * the environment is enabled with setEnabledAndInitIfNeeded(). */
+void KonfytJSEnv::setScript(QString script)
 {
     scriptInitialisationDone = false;
+
+    mInitStats = InitStats();
+    mInitStats.sharedEngine = (shared != nullptr);
+    QElapsedTimer t;
+    t.start();
+    qint64 mem = residentMemoryBytes();
+
     resetEnvironment();
     mScript = script;
+    profiler.reset();
 
-    setEnabledAndInitIfNeeded(enable);
+    mInitStats.timeMs = t.nsecsElapsed() / 1000000.0;
+    mInitStats.memoryBytes = residentMemoryBytes() - mem;
 }
 
 void KonfytJSEnv::setEnabledAndInitIfNeeded(bool enable)
 {
     if (enable) {
-        if (js && !scriptInitialisationDone) {
+        if (jsEngine() && !scriptInitialisationDone) {
+            QElapsedTimer t;
+            t.start();
+            qint64 mem = residentMemoryBytes();
+
             runScriptInitialisation();
             scriptInitialisationDone = true;
+            profiler.recordFunction("init", t.nsecsElapsed());
+
+            mInitStats.timeMs += t.nsecsElapsed() / 1000000.0;
+            mInitStats.memoryBytes += residentMemoryBytes() - mem;
         }
     }
 
@@ -235,19 +734,179 @@ void KonfytJSEnv::runProcess()
 {
     if (!mEnabled) { return; }
 
+    if (!jsMidiEventFunction.isCallable() && !jsMidiEventsFunction.isCallable()) {
+        // Script only declares a transform pipeline, which is applied in JACK
+        midiEvents.clear();
+        return;
+    }
+
     totalProcessTimer.start();
+    profileQueue();
+
+    if (jsMidiEventsFunction.isCallable()) {
+        // Script handles events in batches
+        runProcessBatch();
+        midiEvents.clear();
+        totalProcessTimer.recordTime();
+        measureGarbageCollectionIfDue();
+        return;
+    }
 
-    foreach (const KonfytMidiEvent& ev, midiEvents) {
+    foreach (const KfJackMidiRxEvent& ev, midiEvents) {
         eventProcessTimer.start();
-        QJSValue j = midi.midiEventToJSObject(ev);
-        if (!handleJsResult( jsMidiEventFunction.call({j}) )) {
-            break;
+        QJSValue j = midi.midiEventToJSObject(ev.midiEvent);
+        // JACK frame time at which the event was received
+        j.setProperty("frame", (double)ev.frame);
+        mProcessingEvent = true;
+        mCurrentEventFrame = ev.frame;
+        bool ok = handleJsResult( jsMidiEventFunction.callWithInstance(jsContext, {j}) );
+        mProcessingEvent = false;
+        if (!ok) { break; }
+        qint64 ns = eventProcessTimer.recordTime();
+        profiler.recordFunction("midiEvent", ns);
+        profiler.recordEvents(ns, 1);
+        if (profiler.isDetailed()) {
+            profiler.recordSlowCall("midiEvent", ev.midiEvent.toString(), ns);
         }
-        eventProcessTimer.recordTime();
     }
     midiEvents.clear();
 
     totalProcessTimer.recordTime();
+    measureGarbageCollectionIfDue();
+}
+
+/* Record the number of events waiting to be processed and how long they have
+ * been waiting since they were received by JACK. */
+void KonfytJSEnv::profileQueue()
+{
+    profiler.recordQueue(midiEvents.count());
+    foreach (const KfJackMidiRxEvent& ev, midiEvents) {
+        int32_t frames = mNowFrame - ev.frame;
+        if (frames >= 0) {
+            profiler.recordQueueDelay((qint64)(frames * 1000000000.0 / mSampleRate));
+        }
+    }
+}
+
+/* In detailed profiling mode, periodically run the garbage collector and
+ * record the pause. QJSEngine does not report its own collections, so this
+ * measures the pause a collection of the script's heap causes. With shared
+ * engines, this includes the heaps of the other scripts in the engine. */
+void KonfytJSEnv::measureGarbageCollectionIfDue()
+{
+    if (!profiler.isDetailed()) { return; }
+    if (gcTimer.isValid() && (gcTimer.elapsed() < GC_MEASURE_INTERVAL_MS)) { return; }
+    gcTimer.start();
+
+    QElapsedTimer t;
+    t.start();
+    jsEngine()->collectGarbage();
+    profiler.recordGc(t.nsecsElapsed());
+}
+
+void KonfytJSEnv::setDetailedProfiling(bool detailed)
+{
+    profiler.setDetailed(detailed);
+}
+
+QJsonObject KonfytJSEnv::profile()
+{
+    QJsonObject j = profiler.toJson();
+    j["enabled"] = mEnabled;
+    j["sharedEngine"] = (shared != nullptr);
+    j["batch"] = jsMidiEventsFunction.isCallable();
+    j["pipeline"] = mPipeline;
+    return j;
+}
+
+void KonfytJSEnv::profileBegin(QString name)
+{
+    profiler.beginSection(name);
+}
+
+void KonfytJSEnv::profileEnd(QString name)
+{
+    if (!profiler.endSection(name)) {
+        print("profileEnd: section not started: " + name);
+    }
+}
+
+/* Pass all received events to the script's midiEvents() function in a single
+ * call. The events are written to a reusable Float64Array as integer fields
+ * (BATCH_STRIDE values per event), so no objects are created per event. */
+void KonfytJSEnv::runProcessBatch()
+{
+    int count = midiEvents.count();
+    if (count == 0) { return; }
+    ensureBatchCapacity(count);
+
+    for (int i = 0; i < count; i++) {
+        const KfJackMidiRxEvent& rxev = midiEvents[i];
+        const KonfytMidiEvent& ev = rxev.midiEvent;
+        int data1 = 0;
+        int data2 = 0;
+        int data3 = 0;
+        switch (ev.type()) {
+        case MIDI_EVENT_TYPE_PITCHBEND:
+            data1 = ev.pitchbendValueSigned();
+            break;
+        case MIDI_EVENT_TYPE_PROGRAM:
+            data1 = ev.data1();
+            data2 = ev.bankMSB;
+            data3 = ev.bankLSB;
+            break;
+        case MIDI_EVENT_TYPE_AFTERTOUCH:
+            data1 = ev.data1();
+            break;
+        case MIDI_EVENT_TYPE_SYSTEM:
+            // Sysex is rare, pass data as hex string in separate array
+            data1 = ev.dataSize();
+            jsBatchSysex.setProperty(i, ev.dataToHexString());
+            break;
+        default:
+            data1 = ev.data1();
+            data2 = ev.data2();
+        }
+        quint32 base = i * BATCH_STRIDE;
+        jsBatchBuffer.setProperty(base + BATCH_TYPE, ev.type());
+        // Scripting channels are 1-16, KonfytMidiEvent uses 0-15
+        jsBatchBuffer.setProperty(base + BATCH_CHANNEL, ev.channel + 1);
+        jsBatchBuffer.setProperty(base + BATCH_DATA1, data1);
+        jsBatchBuffer.setProperty(base + BATCH_DATA2, data2);
+        jsBatchBuffer.setProperty(base + BATCH_DATA3, data3);
+        jsBatchBuffer.setProperty(base + BATCH_FRAME, (double)rxev.frame);
+    }
+
+    // Delays of events sent by the script are relative to the last received
+    // event, except for forwarded events which use their own receive time.
+    mProcessingEvent = true;
+    mCurrentEventFrame = midiEvents.last().frame;
+    eventProcessTimer.start();
+    bool ok = handleJsResult( jsMidiEventsFunction.callWithInstance(jsContext,
+                                    {jsBatchBuffer, count, jsBatchSysex}) );
+    mProcessingEvent = false;
+    if (!ok) { return; }
+    qint64 ns = eventProcessTimer.recordTime(count);
+    profiler.recordFunction("midiEvents", ns * count);
+    profiler.recordEvents(ns, count);
+    if (profiler.isDetailed()) {
+        profiler.recordSlowCall("midiEvents", QString("%1 events").arg(count),
+                                ns * count);
+    }
+}
+
+void KonfytJSEnv::ensureBatchCapacity(int count)
+{
+    if ( (count <= batchCapacity) && !jsBatchBuffer.isUndefined() ) { return; }
+
+    int capacity = qMax(count, qMax(batchCapacity * 2, (int)BATCH_MIN_CAPACITY));
+    QJSEngine* engine = jsEngine();
+    jsBatchBuffer = engine->globalObject().property("Float64Array")
+            .callAsConstructor({capacity * BATCH_STRIDE});
+    if (jsBatchSysex.isUndefined()) {
+        jsBatchSysex = engine->newArray();
+    }
+    batchCapacity = capacity;
 }
 
 QString KonfytJSEnv::script()
@@ -255,11 +914,19 @@ QString KonfytJSEnv::script()
     return mScript;
 }
 
-void KonfytJSEnv::addEvent(KonfytMidiEvent ev)
+void KonfytJSEnv::addEvent(const KfJackMidiRxEvent &ev)
 {
     midiEvents.append(ev);
 }
 
+/* Set the current JACK frame time and sample rate, used to schedule MIDI
+ * events sent with a delay. */
+void KonfytJSEnv::setTimeReference(uint32_t nowFrame, double sampleRate)
+{
+    mNowFrame = nowFrame;
+    if (sampleRate > 0) { mSampleRate = sampleRate; }
+}
+
 int KonfytJSEnv::eventCount()
 {
     return midiEvents.count();
@@ -267,48 +934,264 @@ int KonfytJSEnv::eventCount()
 
 QJSEngine* KonfytJSEnv::jsEngine()
 {
+    if (shared) { return shared->jsEngine(); }
     return js.data();
 }
 
-float KonfytJSEnv::getAverageTotalProcessTimeMs()
-{
-    return totalProcessTimer.getAverageProcessTimeMs();
+float KonfytJSEnv::getAverageTotalProcessTimeMs()
+{
+    return totalProcessTimer.getAverageProcessTimeMs();
+}
+
+float KonfytJSEnv::getAveragePerEventProcessTimeMs()
+{
+    return eventProcessTimer.getAverageProcessTimeMs();
+}
+
+QString KonfytJSEnv::errorString()
+{
+    return mErrorString;
+}
+
+KonfytJSEnv::InitStats KonfytJSEnv::initStats()
+{
+    return mInitStats;
+}
+
+QStringList KonfytJSEnv::takePrints()
+{
+    QStringList ret = mToPrint;
+    mToPrint.clear();
+    return ret;
+}
+
+QList<KfJackMidiTxEvent> KonfytJSEnv::takeMidiToSend()
+{
+    QList<KfJackMidiTxEvent> ret = mMidiToSend;
+    mMidiToSend.clear();
+    return ret;
+}
+
+void KonfytJSEnv::setSharedStore(KonfytJSSharedStore *store)
+{
+    this->store = store;
+    storeSnapshot.reset();
+}
+
+/* Latest snapshot of the shared store, only fetched if it changed. */
+const KonfytJSSharedStore::Map &KonfytJSEnv::currentSharedSnapshot()
+{
+    static const KonfytJSSharedStore::Map empty;
+    if (!store) { return empty; }
+
+    quint64 version = store->version();
+    if (!storeSnapshot || (version != storeVersion)) {
+        storeSnapshot = store->snapshot();
+        storeVersion = version;
+    }
+    return *storeSnapshot;
+}
+
+QJSValue KonfytJSEnv::sharedValue(QString key, QJSValue defaultValue)
+{
+    if (pendingSharedRemoved.contains(key)) { return defaultValue; }
+
+    auto it = pendingShared.constFind(key);
+    if (it == pendingShared.constEnd()) {
+        const KonfytJSSharedStore::Map& map = currentSharedSnapshot();
+        it = map.constFind(key);
+        if (it == map.constEnd()) { return defaultValue; }
+    }
+    return jsEngine()->toScriptValue(it.value());
+}
+
+void KonfytJSEnv::setSharedValue(QString key, QJSValue value)
+{
+    pendingSharedRemoved.remove(key);
+    pendingShared.insert(key, value.toVariant());
+}
+
+void KonfytJSEnv::removeSharedValue(QString key)
+{
+    pendingShared.remove(key);
+    pendingSharedRemoved.insert(key);
+}
+
+QStringList KonfytJSEnv::sharedKeys()
+{
+    QSet<QString> keys = currentSharedSnapshot().keys().toSet();
+    keys += pendingShared.keys().toSet();
+    keys -= pendingSharedRemoved;
+    QStringList ret = keys.toList();
+    ret.sort();
+    return ret;
+}
+
+int KonfytJSEnv::mirrorSharedValue(QString key)
+{
+    if (!store) { return -1; }
+    int slot = store->mirrorSlot(key);
+    if (slot < 0) {
+        print(QString("Shared.mirror: all %1 mirror slots are in use.")
+              .arg(KONFYT_JACK_MIRRORED_VALUES));
+    }
+    return slot;
+}
+
+/* Take the shared values written during this run, to be published to the
+ * store. Returns false if there are none. */
+bool KonfytJSEnv::takeSharedChanges(KonfytJSSharedStore::Map *changes,
+                                    QSet<QString> *removed)
+{
+    if (pendingShared.isEmpty() && pendingSharedRemoved.isEmpty()) { return false; }
+    *changes = pendingShared;
+    *removed = pendingSharedRemoved;
+    pendingShared.clear();
+    pendingSharedRemoved.clear();
+    return true;
+}
+
+void KonfytJSEnv::publishMessage(QString topic, QJSValue value)
+{
+    // Limited like sent MIDI, to prevent scripts from flooding each other
+    if (mPublished.count() < MESSAGES_MAX) {
+        mPublished.append({topic, value.toVariant()});
+        if (mPublished.count() == MESSAGES_MAX) {
+            mToPrint.append(QString("Maximum published message count of %1 reached.")
+                            .arg(MESSAGES_MAX));
+        }
+    }
+}
+
+void KonfytJSEnv::subscribe(QString topic, QJSValue callback)
+{
+    if (!callback.isCallable()) {
+        print("Shared.subscribe: callback is not a function");
+        return;
+    }
+    subscriptions.insert(topic, callback);
+}
+
+void KonfytJSEnv::unsubscribe(QString topic)
+{
+    subscriptions.remove(topic);
+}
+
+QList<KonfytJSMessage> KonfytJSEnv::takePublishedMessages()
+{
+    QList<KonfytJSMessage> ret = mPublished;
+    mPublished.clear();
+    return ret;
+}
+
+bool KonfytJSEnv::isSubscribedToAny(const QList<KonfytJSMessage> &messages)
+{
+    if (!mEnabled || subscriptions.isEmpty()) { return false; }
+    foreach (const KonfytJSMessage& msg, messages) {
+        if (subscriptions.contains(msg.topic)) { return true; }
+    }
+    return false;
+}
+
+/* Call the subscribed callback of each message, with the value and topic. */
+void KonfytJSEnv::deliverMessages(const QList<KonfytJSMessage> &messages)
+{
+    foreach (const KonfytJSMessage& msg, messages) {
+        if (!mEnabled) { break; }
+        QJSValue callback = subscriptions.value(msg.topic);
+        if (!callback.isCallable()) { continue; }
+        QElapsedTimer t;
+        t.start();
+        bool ok = handleJsResult( callback.callWithInstance(jsContext,
+                        {jsEngine()->toScriptValue(msg.value), msg.topic}) );
+        if (!ok) { break; }
+        profiler.recordFunction("subscription:" + msg.topic, t.nsecsElapsed());
+    }
+}
+
+/* Queue a parameter change, to be obtained with takeParamChanges(). Only the
+ * last value of a parameter during a script call is kept. */
+void KonfytJSEnv::setParam(KfJackParamCommand::Type type, float value,
+                           int zoneField, int busId)
+{
+    if (type == KfJackParamCommand::LayerReset) {
+        // Earlier layer changes are undone by the reset anyway
+        for (int i = mParamChanges.count() - 1; i >= 0; i--) {
+            if (mParamChanges[i].type != KfJackParamCommand::BusGain) {
+                mParamChanges.removeAt(i);
+            }
+        }
+    } else {
+        for (int i = 0; i < mParamChanges.count(); i++) {
+            KonfytJSParamChange& change = mParamChanges[i];
+            if ( (change.type == type) && (change.zoneField == zoneField)
+                 && (change.busId == busId) ) {
+                change.value = value;
+                return;
+            }
+        }
+    }
+
+    if (mParamChanges.count() >= PARAM_CHANGES_MAX) { return; }
+
+    KonfytJSParamChange change;
+    change.type = type;
+    change.value = value;
+    change.zoneField = zoneField;
+    change.busId = busId;
+    mParamChanges.append(change);
+    if (mParamChanges.count() == PARAM_CHANGES_MAX) {
+        print(QString("Maximum parameter change count of %1 reached.")
+              .arg(PARAM_CHANGES_MAX));
+    }
 }
 
-float KonfytJSEnv::getAveragePerEventProcessTimeMs()
+QList<KonfytJSParamChange> KonfytJSEnv::takeParamChanges()
 {
-    return eventProcessTimer.getAverageProcessTimeMs();
+    QList<KonfytJSParamChange> ret = mParamChanges;
+    mParamChanges.clear();
+    return ret;
 }
 
-QString KonfytJSEnv::errorString()
+void KonfytJSEnv::sendMidi(QJSValue j, double delayMs)
 {
-    return mErrorString;
+    sendMidiEvent(midi.jsObjectToMidiEvent(j), delayMs);
 }
 
-QStringList KonfytJSEnv::takePrints()
+void KonfytJSEnv::sendMidiEvent(const KonfytMidiEvent &ev, double delayMs)
 {
-    QStringList ret = mToPrint;
-    mToPrint.clear();
-    return ret;
+    // Schedule relative to the event being processed, so that the timing
+    // of the input is preserved.
+    uint32_t base = mProcessingEvent ? mCurrentEventFrame : mNowFrame;
+    queueMidiToSend(ev, delayMs, base);
 }
 
-QList<KonfytMidiEvent> KonfytJSEnv::takeMidiToSend()
+/* Send the received event at the specified index of the current batch (see
+ * runProcessBatch()). Returns false if the index is invalid. */
+bool KonfytJSEnv::forwardMidi(int index, double delayMs)
 {
-    QList<KonfytMidiEvent> ret = mMidiToSend;
-    mMidiToSend.clear();
-    return ret;
+    if ( (index < 0) || (index >= midiEvents.count()) ) { return false; }
+    const KfJackMidiRxEvent& rxev = midiEvents[index];
+    queueMidiToSend(rxev.midiEvent, delayMs, rxev.frame);
+    return true;
 }
 
-void KonfytJSEnv::sendMidi(QJSValue j)
+void KonfytJSEnv::queueMidiToSend(const KonfytMidiEvent &ev, double delayMs,
+                                  uint32_t baseFrame)
 {
     // Add MIDI message to the queue, to be handled later outside this class,
     // obtained with takeMidiToSend().
     // A queue with a max limit is used to prevent infinite loops clogging up
     // the signals system and stalling the application.
 
-    KonfytMidiEvent ev = midi.jsObjectToMidiEvent(j);
+    KfJackMidiTxEvent tx;
+    tx.midiEvent = ev;
+    if (delayMs > 0) {
+        tx.scheduled = true;
+        tx.frame = baseFrame + (uint32_t)(delayMs * mSampleRate / 1000.0);
+    }
     if (mMidiToSend.count() < MIDI_SEND_MAX) {
-        mMidiToSend.append(ev);
+        mMidiToSend.append(tx);
         if (mMidiToSend.count() == MIDI_SEND_MAX) {
             mToPrint.append(QString("Maximum MIDI send count of %1 reached.")
                             .arg(MIDI_SEND_MAX));
@@ -340,32 +1223,109 @@ void KonfytJSEnv::resetEnvironment()
     // NB: Destroying QJSEngine destroys all children. Ensure all objects passed
     // to it using newQObject had parents already so QJSEngine doesn't destroy them.
 
-    js.reset(new QJSEngine());
+    releaseSharedContext();
+    jsMidiEventFunction = QJSValue();
+    jsMidiEventsFunction = QJSValue();
+    mPipeline.clear();
+    subscriptions.clear();
+    jsBatchBuffer = QJSValue();
+    jsBatchSysex = QJSValue();
+    batchCapacity = 0;
+
+    if (shared) {
+        // Script globals are held by a separate context object in the shared
+        // engine and passed to the script as arguments of its factory function.
+        js.reset();
+        jsContext = shared->jsEngine()->newObject();
+        shared->addContext();
+        mHasSharedContext = true;
+    } else {
+        js.reset(new QJSEngine());
+        jsContext = js->globalObject();
+    }
+    QJSEngine* engine = jsEngine();
 
     // Add this class as global system object
     // NB: Ensure object passed to newQObject has a parent so QJSEngine doesn't
     // take ownership.
     tempParent.makeTemporaryChildIfParentless(this);
-    jsSys = js->newQObject(this);
-    js->globalObject().setProperty("Sys", jsSys);
-    js->globalObject().setProperty("print", jsSys.property("print"));
+    jsSys = engine->newQObject(this);
+    setContextProperty("Sys", jsSys);
+    setContextProperty("print", jsSys.property("print"));
 
-    jsMidi = js->newQObject(&midi);
-    js->globalObject().setProperty("Midi", jsMidi);
+    jsMidi = engine->newQObject(&midi);
+    setContextProperty("Midi", jsMidi);
+
+    jsShared = engine->newQObject(&sharedState);
+    setContextProperty("Shared", jsShared);
+
+    jsParams = engine->newQObject(&params);
+    setContextProperty("Params", jsParams);
 
     // Add MIDI event type constants as global objects
-    js->globalObject().setProperty("NOTEON", TYPE_NOTEON);
-    js->globalObject().setProperty("NOTEOFF", TYPE_NOTEOFF);
-    js->globalObject().setProperty("POLYAFTERTOUCH", TYPE_POLY_AFTERTOUCH);
-    js->globalObject().setProperty("CC", TYPE_CC);
-    js->globalObject().setProperty("PROGRAM", TYPE_PROGRAM);
-    js->globalObject().setProperty("AFTERTOUCH", TYPE_AFTERTOUCH);
-    js->globalObject().setProperty("PITCHBEND", TYPE_PITCHBEND);
-    js->globalObject().setProperty("SYSEX", TYPE_SYSEX);
+    setContextProperty("NOTEON", TYPE_NOTEON);
+    setContextProperty("NOTEOFF", TYPE_NOTEOFF);
+    setContextProperty("POLYAFTERTOUCH", TYPE_POLY_AFTERTOUCH);
+    setContextProperty("CC", TYPE_CC);
+    setContextProperty("PROGRAM", TYPE_PROGRAM);
+    setContextProperty("AFTERTOUCH", TYPE_AFTERTOUCH);
+    setContextProperty("PITCHBEND", TYPE_PITCHBEND);
+    setContextProperty("SYSEX", TYPE_SYSEX);
+
+    // Integer MIDI event type constants, used in midiEvents() buffers and
+    // Midi.sendRaw()
+    setContextProperty("MIDI_NOTEON", MIDI_EVENT_TYPE_NOTEON);
+    setContextProperty("MIDI_NOTEOFF", MIDI_EVENT_TYPE_NOTEOFF);
+    setContextProperty("MIDI_POLYAFTERTOUCH", MIDI_EVENT_TYPE_POLY_AFTERTOUCH);
+    setContextProperty("MIDI_CC", MIDI_EVENT_TYPE_CC);
+    setContextProperty("MIDI_PROGRAM", MIDI_EVENT_TYPE_PROGRAM);
+    setContextProperty("MIDI_AFTERTOUCH", MIDI_EVENT_TYPE_AFTERTOUCH);
+    setContextProperty("MIDI_PITCHBEND", MIDI_EVENT_TYPE_PITCHBEND);
+    setContextProperty("MIDI_SYSEX", MIDI_EVENT_TYPE_SYSTEM);
+
+    // Layout of events in midiEvents() buffers
+    setContextProperty("EV_STRIDE", BATCH_STRIDE);
+    setContextProperty("EV_TYPE", BATCH_TYPE);
+    setContextProperty("EV_CHANNEL", BATCH_CHANNEL);
+    setContextProperty("EV_DATA1", BATCH_DATA1);
+    setContextProperty("EV_DATA2", BATCH_DATA2);
+    setContextProperty("EV_DATA3", BATCH_DATA3);
+    setContextProperty("EV_FRAME", BATCH_FRAME);
 
     // Other constants
-    js->globalObject().setProperty("PITCHBEND_MAX", MIDI_PITCHBEND_SIGNED_MAX);
-    js->globalObject().setProperty("PITCHBEND_MIN", MIDI_PITCHBEND_SIGNED_MIN);
+    setContextProperty("PITCHBEND_MAX", MIDI_PITCHBEND_SIGNED_MAX);
+    setContextProperty("PITCHBEND_MIN", MIDI_PITCHBEND_SIGNED_MIN);
+}
+
+/* Release the context and compiled script of this environment in the shared
+ * engine, if any. */
+void KonfytJSEnv::releaseSharedContext()
+{
+    if (!shared) { return; }
+    if (mHasSharedFactory) {
+        shared->releaseFactory(mSharedFactoryScript);
+        mHasSharedFactory = false;
+    }
+    if (mHasSharedContext) {
+        shared->removeContext();
+        mHasSharedContext = false;
+    }
+    jsMidiEventFunction = QJSValue();
+    jsMidiEventsFunction = QJSValue();
+    jsBatchBuffer = QJSValue();
+    jsBatchSysex = QJSValue();
+    batchCapacity = 0;
+    subscriptions.clear();
+    jsContext = QJSValue();
+    jsSys = QJSValue();
+    jsMidi = QJSValue();
+    jsShared = QJSValue();
+    jsParams = QJSValue();
+}
+
+void KonfytJSEnv::setContextProperty(QString name, QJSValue value)
+{
+    jsContext.setProperty(name, value);
 }
 
 bool KonfytJSEnv::evaluate(QString script)
@@ -377,8 +1337,11 @@ bool KonfytJSEnv::handleJsResult(QJSValue result)
 {
     if (result.isError()) {
 
-        if (js->isInterrupted()) {
+        if (jsEngine()->isInterrupted()) {
             mErrorString = "Script took too long to execute";
+            // Clear so the engine can be used again, also by other scripts
+            // if it is shared.
+            jsEngine()->setInterrupted(false);
         } else {
             mErrorString = QString("Line %1: %2")
                     .arg(result.property("lineNumber").toInt())
@@ -407,11 +1370,158 @@ bool KonfytJSEnv::handleJsResult(QJSValue result)
 
 void KonfytJSEnv::runScriptInitialisation()
 {
+    if (shared) {
+        runSharedScriptInitialisation();
+        return;
+    }
+
     evaluate(mScript);
     jsMidiEventFunction = js->globalObject().property("midiEvent");
+    jsMidiEventsFunction = js->globalObject().property("midiEvents");
     if (evaluate("init()")) {
         print("Script initialised.");
     }
+    mPipeline = pipelineFromJsValue(js->globalObject().property("pipeline"));
+}
+
+void KonfytJSEnv::runSharedScriptInitialisation()
+{
+    // Arguments of the factory function are the properties of the context
+    QStringList names;
+    QJSValueList args;
+    QJSValueIterator it(jsContext);
+    while (it.hasNext()) {
+        it.next();
+        names.append(it.name());
+        args.append(it.value());
+    }
+
+    bool fromCache = false;
+    QJSValue factory = shared->acquireFactory(mScript, names, &fromCache);
+    if (!handleJsResult(factory)) { return; }
+    mSharedFactoryScript = mScript;
+    mHasSharedFactory = true;
+    mInitStats.compiledFromCache = fromCache;
+
+    QJSValue functions = factory.callWithInstance(jsContext, args);
+    if (!handleJsResult(functions)) { return; }
+    jsMidiEventFunction = functions.property("midiEvent");
+    jsMidiEventsFunction = functions.property("midiEvents");
+    if (handleJsResult( functions.property("init").callWithInstance(jsContext) )) {
+        print("Script initialised.");
+    }
+    mPipeline = pipelineFromJsValue(
+                functions.property("pipeline").callWithInstance(jsContext));
+}
+
+/* Transform pipeline text from the script's pipeline global: a string or an
+ * array of strings (one operation each). See KonfytMidiTransform. */
+QString KonfytJSEnv::pipelineFromJsValue(QJSValue value)
+{
+    if (value.isString()) { return value.toString(); }
+    if (!value.isArray()) { return ""; }
+    QStringList lines;
+    int length = value.property("length").toInt();
+    for (int i = 0; i < length; i++) {
+        lines.append(value.property(i).toString());
+    }
+    return lines.join("\n");
+}
+
+/* Transform pipeline declared by the script after initialisation. */
+QString KonfytJSEnv::pipeline()
+{
+    return mPipeline;
+}
+
+/* Run the script offline with a generated stream of MIDI events, resembling
+ * an MPE/aftertouch stream, at different batch sizes (number of events passed
+ * to the script per process run) and return a report of the events processed
+ * per second. */
+QStringList KonfytJSEnv::runBenchmark(QString script, int eventCount)
+{
+    QStringList report;
+
+    KonfytJSSharedStore store;
+    KonfytJSEnv env;
+    env.setSharedStore(&store);
+    env.setScript(script);
+    env.setEnabledAndInitIfNeeded(true);
+    env.takePrints();
+    if (!env.errorString().isEmpty()) {
+        report.append("Script error: " + env.errorString());
+        return report;
+    }
+    report.append(QString("Script handles events with %1")
+                  .arg(env.jsMidiEventsFunction.isCallable() ?
+                           "midiEvents() (batch)" : "midiEvent()"));
+    report.append(QString("%1 %2 %3 %4")
+                  .arg("Batch", 6).arg("Events", 10)
+                  .arg("Events/s", 12).arg("Sent", 10));
+
+    // Cycle through note on, pressure and pitchbend on each channel, and note off
+    QList<KfJackMidiRxEvent> stream;
+    for (int i = 0; i < 1024; i++) {
+        KfJackMidiRxEvent rxev;
+        rxev.midiEvent.channel = i % 16;
+        rxev.frame = i * 8;
+        int note = 36 + (i / 16) % 48;
+        switch ((i / 16) % 8) {
+        case 0: rxev.midiEvent.setNoteOn(note, 100); break;
+        case 7: rxev.midiEvent.setNoteOff(note, 0); break;
+        case 3: rxev.midiEvent.setCC(74, i % 128); break;
+        case 4:
+        case 5: rxev.midiEvent.setPitchbend((i * 37) % 8192 - 4096); break;
+        default: rxev.midiEvent.setPolyAftertouch(note, i % 128);
+        }
+        stream.append(rxev);
+    }
+
+    QList<int> batchSizes({1, 16, 128});
+    foreach (int batchSize, batchSizes) {
+        int processed = 0;
+        int sent = 0;
+        QElapsedTimer t;
+        t.start();
+        while (processed < eventCount) {
+            for (int i = 0; i < batchSize; i++) {
+                env.addEvent(stream[(processed + i) % stream.count()]);
+            }
+            env.runProcess();
+            sent += env.takeMidiToSend().count();
+            env.takePrints();
+            KonfytJSSharedStore::Map changes;
+            QSet<QString> removed;
+            if (env.takeSharedChanges(&changes, &removed)) {
+                store.publish(changes, removed);
+            }
+            env.takePublishedMessages();
+            processed += batchSize;
+            if (!env.isEnabled()) { break; }
+        }
+        double secs = t.nsecsElapsed() / 1e9;
+
+        if (!env.isEnabled()) {
+            report.append("Script error: " + env.errorString());
+            break;
+        }
+        report.append(QString("%1 %2 %3 %4")
+                      .arg(batchSize, 6).arg(processed, 10)
+                      .arg(secs > 0 ? processed / secs : 0, 12, 'f', 0)
+                      .arg(sent, 10));
+    }
+
+    return report;
+}
+
+/* Resident memory of the process in bytes, or zero if unknown. */
+qint64 KonfytJSEnv::residentMemoryBytes()
+{
+    QFile f("/proc/self/statm");
+    if (!f.open(QIODevice::ReadOnly)) { return 0; }
+    QList<QByteArray> fields = f.readAll().split(' ');
+    if (fields.count() < 2) { return 0; }
+    return fields[1].toLongLong() * sysconf(_SC_PAGESIZE);
 }
 
 TempParent::~TempParent()
@@ -441,33 +1551,159 @@ void TempParent::removeTemporaryChildren()
     }
 }
 
+KonfytJSWorker::KonfytJSWorker(int index) : mIndex(index)
+{
+    thread.setObjectName(QString("KonfytJSWorker%1").arg(index));
+    moveToThread(&thread);
+    thread.start();
+}
+
+KonfytJSWorker::~KonfytJSWorker()
+{
+    // Stop a script that may still be running
+    watchdogMutex.lock();
+    if (runningEngine) { runningEngine->setInterrupted(true); }
+    watchdogMutex.unlock();
+
+    // Queued after all pending functions (e.g. deletion of script
+    // environments), so QJSEngines are destroyed in the worker thread.
+    run([this]()
+    {
+        sharedEngines.clear();
+        thread.quit();
+    });
+    thread.wait(5000);
+}
+
+int KonfytJSWorker::index() const
+{
+    return mIndex;
+}
+
+QThread *KonfytJSWorker::workerThread()
+{
+    return &thread;
+}
+
+/* Run the function in the worker thread. Functions are run in the order they
+ * were queued. */
+void KonfytJSWorker::run(std::function<void()> func)
+{
+    mPending++;
+    QMetaObject::invokeMethod(this, [=]()
+    {
+        mPending--;
+        func();
+    }, Qt::QueuedConnection);
+}
+
+/* Number of functions waiting to run in the worker thread. */
+int KonfytJSWorker::pendingCount() const
+{
+    return mPending;
+}
+
+/* Set the engine of the script that is about to run, or null when the script
+ * is done. The watchdog interrupts the engine if the script runs too long. */
+void KonfytJSWorker::setRunningEngine(QJSEngine *engine)
+{
+    QMutexLocker locker(&watchdogMutex);
+    if (runningEngine && !engine) {
+        // The watchdog may have struck just after the script finished.
+        runningEngine->setInterrupted(false);
+    }
+    runningEngine = engine;
+    watchdog = watchdogMax;
+}
+
+/* Returns the shared engine to use for the script, or null if scripts don't
+ * share engines (count is zero). An engine that already has the script
+ * compiled is preferred, otherwise the engine with the fewest scripts is
+ * used. */
+KonfytJSSharedEngine *KonfytJSWorker::sharedEngineForScript(QString script, int count)
+{
+    if (count <= 0) { return nullptr; }
+
+    // Engines are created in this thread as needed
+    while (sharedEngines.count() < count) {
+        sharedEngines.append(QSharedPointer<KonfytJSSharedEngine>(
+                                 new KonfytJSSharedEngine()));
+    }
+
+    KonfytJSSharedEngine* ret = nullptr;
+    for (int i = 0; i < count; i++) {
+        KonfytJSSharedEngine* e = sharedEngines[i].data();
+        if (e->hasFactory(script)) { return e; }
+        if (!ret || (e->contextCount() < ret->contextCount())) { ret = e; }
+    }
+    return ret;
+}
+
+/* Called periodically from the watchdog timer. Returns the strike count if a
+ * script is running, otherwise zero. The running script is interrupted when
+ * the strike count reaches watchdogMax. */
+int KonfytJSWorker::watchdogStrike()
+{
+    QMutexLocker locker(&watchdogMutex);
+    if (!runningEngine) { return 0; }
+    watchdog--;
+    if (watchdog <= 0) {
+        runningEngine->setInterrupted(true);
+    }
+    return watchdogMax - watchdog;
+}
+
 KonfytJSEngine::KonfytJSEngine(QObject *parent) : QObject(parent)
 {
     // For signal scriptErrorStatusChanged()
     qRegisterMetaType<PatchLayerPtr>("PatchLayerPtr");
     qRegisterMetaType<Project::MidiPortPtr>("Project::MidiPortPtr");
 
+    // Leave a core for the GUI and JACK threads
+    int nWorkers = QThread::idealThreadCount() - 1;
+    if (nWorkers > maxWorkers) { nWorkers = maxWorkers; }
+    if (nWorkers < 1) { nWorkers = 1; }
+    for (int i = 0; i < nWorkers; i++) {
+        workers.append(new KonfytJSWorker(i));
+    }
+
     // Start script watchdog timer in calling thread (i.e. before this
     // object has been moved to another thread, so not the scripting thread).
 
-    QTimer* t = new QTimer();
-    connect(t, &QTimer::timeout, [=]()
+    watchdogTimer = new QTimer();
+    connect(watchdogTimer, &QTimer::timeout, [=]()
     {
-        if (runningScript) {
-            watchdog--;
-            print(QString("Watchdog strike %1").arg(watchdogMax - watchdog));
-            if (watchdog <= 0) {
-                runningScript->env.jsEngine()->setInterrupted(true);
-                print("Watchdog stopping script");
+        foreach (KonfytJSWorker* w, workers) {
+            int strike = w->watchdogStrike();
+            if (strike == 0) { continue; }
+            print(QString("Worker %1 watchdog strike %2").arg(w->index()).arg(strike));
+            if (strike >= KonfytJSWorker::watchdogMax) {
+                print(QString("Worker %1 watchdog stopping script").arg(w->index()));
             }
         }
     });
-    t->start(500);
+    watchdogTimer->start(500);
+}
+
+KonfytJSEngine::~KonfytJSEngine()
+{
+    delete watchdogTimer;
+
+    // Environments are deleted in their workers' threads, so clear them before
+    // the workers are stopped.
+    routeEnvMap.clear();
+    layerEnvMap.clear();
+    jackPortEnvMap.clear();
+    prjPortEnvMap.clear();
+
+    qDeleteAll(workers);
+    workers.clear();
 }
 
 void KonfytJSEngine::setJackEngine(KonfytJackEngine *jackEngine)
 {
     jack = jackEngine;
+    sharedStore.setJackEngine(jack);
     mRxBuffer = jack->getMidiRxBufferForJs();
 
     connect(jack, &KonfytJackEngine::newMidiEventsAvailable,
@@ -475,6 +1711,44 @@ void KonfytJSEngine::setJackEngine(KonfytJackEngine *jackEngine)
             Qt::QueuedConnection);
 }
 
+/* Set the JACK ports of a project bus, so scripts can set its parameters by
+ * bus id. */
+void KonfytJSEngine::setAudioBus(int busId, KfJackAudioPort *left, KfJackAudioPort *right)
+{
+    QMutexLocker locker(&audioBusesMutex);
+    audioBuses.insert(busId, qMakePair(jack->objectId(left), jack->objectId(right)));
+}
+
+void KonfytJSEngine::removeAudioBus(int busId)
+{
+    QMutexLocker locker(&audioBusesMutex);
+    audioBuses.remove(busId);
+}
+
+/* Set the number of QJSEngines shared between scripts in each worker. Zero
+ * (default) gives each script its own engine. Applies to scripts added or
+ * updated afterwards. */
+void KonfytJSEngine::setSharedEngineCount(int count)
+{
+    runInThread(this, [=]()
+    {
+        mSharedEngineCount = qMax(0, count);
+    });
+}
+
+/* Enable detailed profiling of all scripts. See KonfytJSProfiler. */
+void KonfytJSEngine::setDetailedProfiling(bool detailed)
+{
+    runInThread(this, [=]()
+    {
+        mDetailedProfiling = detailed;
+        QList<ScriptEnvPtr> envs = layerEnvMap.values() + prjPortEnvMap.values();
+        foreach (ScriptEnvPtr s, envs) {
+            s->worker->run([=]() { s->env.setDetailedProfiling(detailed); });
+        }
+    });
+}
+
 void KonfytJSEngine::addOrUpdateLayerScript(PatchLayerPtr patchLayer)
 {
     if (!patchLayer) {
@@ -491,6 +1765,11 @@ void KonfytJSEngine::addOrUpdateLayerScript(PatchLayerPtr patchLayer)
         print("Error: addLayerScript: null JACK MIDI route");
         return;
     }
+    QList<KfJackAudioRoute*> audioRoutes = jackAudioRoutesFromLayer(patchLayer);
+    // Parameter commands target routes by id, see KfJackParamCommand
+    uint32_t routeId = jack->objectId(route);
+    uint32_t audioLeftRouteId = jack->objectId(audioRoutes.value(0));
+    uint32_t audioRightRouteId = jack->objectId(audioRoutes.value(1));
 
     // Cache script in GUI (caller) thread for quick access
     layerScriptMap_guiThread.insert(patchLayer, patchLayer->script());
@@ -499,9 +1778,13 @@ void KonfytJSEngine::addOrUpdateLayerScript(PatchLayerPtr patchLayer)
     {
         ScriptEnvPtr s = layerEnvMap.value(patchLayer);
         if (!s) {
-            s.reset(new ScriptEnv());
+            s = newScriptEnv();
             s->patchLayer = patchLayer;
             s->route = route;
+            s->scheduledDropped = jack->droppedScheduledEventCount(route);
+            s->routeId = routeId;
+            s->audioLeftRouteId = audioLeftRouteId;
+            s->audioRightRouteId = audioRightRouteId;
 
             connect(&(s->env), &KonfytJSEnv::errorStatusChanged,
                     this, [=](QString errorString)
@@ -513,9 +1796,19 @@ void KonfytJSEngine::addOrUpdateLayerScript(PatchLayerPtr patchLayer)
             layerEnvMap.insert(patchLayer, s);
         }
 
-        beforeScriptRun(s);
-        s->env.setScriptAndInitIfEnabled(script, isScriptEnabled);
-        afterScriptRun(s);
+        int sharedEngineCount = mSharedEngineCount;
+        bool detailedProfiling = mDetailedProfiling;
+        s->worker->run([=]()
+        {
+            s->env.setDetailedProfiling(detailedProfiling);
+            s->env.setSharedEngine(
+                        s->worker->sharedEngineForScript(script, sharedEngineCount));
+            resetLayerParams(s);
+            s->env.setScript(script);
+            beforeScriptRun(s);
+            s->env.setEnabledAndInitIfNeeded(isScriptEnabled);
+            afterScriptRun(s);
+        });
     });
 }
 
@@ -539,8 +1832,9 @@ void KonfytJSEngine::addOrUpdateJackPortScript(Project::MidiPortPtr prjPort)
     {
         ScriptEnvPtr s = prjPortEnvMap.value(prjPort);
         if (!s) {
-            s.reset(new ScriptEnv());
+            s = newScriptEnv();
             s->prjPort = prjPort;
+            s->scheduledDropped = jack->droppedScheduledEventCount(jackPort);
 
             connect(&(s->env), &KonfytJSEnv::errorStatusChanged,
                     this, [=](QString errorString)
@@ -552,9 +1846,18 @@ void KonfytJSEngine::addOrUpdateJackPortScript(Project::MidiPortPtr prjPort)
             prjPortEnvMap.insert(prjPort, s);
         }
 
-        beforeScriptRun(s);
-        s->env.setScriptAndInitIfEnabled(script, isScriptEnabled);
-        afterScriptRun(s);
+        int sharedEngineCount = mSharedEngineCount;
+        bool detailedProfiling = mDetailedProfiling;
+        s->worker->run([=]()
+        {
+            s->env.setDetailedProfiling(detailedProfiling);
+            s->env.setSharedEngine(
+                        s->worker->sharedEngineForScript(script, sharedEngineCount));
+            s->env.setScript(script);
+            beforeScriptRun(s);
+            s->env.setEnabledAndInitIfNeeded(isScriptEnabled);
+            afterScriptRun(s);
+        });
     });
 }
 
@@ -572,6 +1875,12 @@ void KonfytJSEngine::removeLayerScript(PatchLayerPtr patchLayer)
 
         routeEnvMap.remove(routeEnvMap.key(s));
         layerEnvMap.remove(patchLayer);
+        s->worker->run([=]()
+        {
+            applyScriptPipeline(s, "");
+            resetLayerParams(s);
+        });
+        releaseScriptEnv(s);
     });
 }
 
@@ -589,6 +1898,8 @@ void KonfytJSEngine::removeJackPortScript(Project::MidiPortPtr prjPort)
 
         jackPortEnvMap.remove(jackPortEnvMap.key(s));
         prjPortEnvMap.remove(prjPort);
+        s->worker->run([=]() { applyScriptPipeline(s, ""); });
+        releaseScriptEnv(s);
     });
 }
 
@@ -627,9 +1938,13 @@ void KonfytJSEngine::setScriptEnabled(PatchLayerPtr patchLayer,
             return;
         }
 
-        beforeScriptRun(s);
-        s->env.setEnabledAndInitIfNeeded(enable);
-        afterScriptRun(s);
+        s->worker->run([=]()
+        {
+            if (!enable) { resetLayerParams(s); }
+            beforeScriptRun(s);
+            s->env.setEnabledAndInitIfNeeded(enable);
+            afterScriptRun(s);
+        });
     });
 }
 
@@ -643,9 +1958,12 @@ void KonfytJSEngine::setScriptEnabled(Project::MidiPortPtr prjPort, bool enable)
             return;
         }
 
-        beforeScriptRun(s);
-        s->env.setEnabledAndInitIfNeeded(enable);
-        afterScriptRun(s);
+        s->worker->run([=]()
+        {
+            beforeScriptRun(s);
+            s->env.setEnabledAndInitIfNeeded(enable);
+            afterScriptRun(s);
+        });
     });
 }
 
@@ -655,17 +1973,20 @@ void KonfytJSEngine::scriptAverageProcessTimeMs(PatchLayerPtr patchLayer,
     runInThread(this, [=]()
     {
         ScriptEnvPtr s = layerEnvMap.value(patchLayer);
-        float perEventTime = 0;
-        float totalProcessTime = 0;
-        if (s) {
-            perEventTime = s->env.getAveragePerEventProcessTimeMs();
-            totalProcessTime = s->env.getAverageTotalProcessTimeMs();
-        } else {
+        if (!s) {
             print("Error: scriptAverageProcessTimeMs: invalid patch layer");
+            runInThread(context, [=]() { callback(0, 0); });
+            return;
         }
 
-        // Call callback with result in original caller's thread
-        runInThread(context, [=]() { callback(perEventTime, totalProcessTime); });
+        s->worker->run([=]()
+        {
+            float perEventTime = s->env.getAveragePerEventProcessTimeMs();
+            float totalProcessTime = s->env.getAverageTotalProcessTimeMs();
+
+            // Call callback with result in original caller's thread
+            runInThread(context, [=]() { callback(perEventTime, totalProcessTime); });
+        });
     });
 }
 
@@ -677,17 +1998,112 @@ void KonfytJSEngine::scriptAverageProcessTimeMs(
     runInThread(this, [=]()
     {
         ScriptEnvPtr s = prjPortEnvMap.value(prjPort);
-        float perEventTime = 0;
-        float totalProcessTime = 0;
-        if (s) {
-            perEventTime = s->env.getAveragePerEventProcessTimeMs();
-            totalProcessTime = s->env.getAverageTotalProcessTimeMs();
-        } else {
+        if (!s) {
             print("Error: scriptAverageProcessTimeMs: invalid project port");
+            runInThread(context, [=]() { callback(0, 0); });
+            return;
+        }
+
+        s->worker->run([=]()
+        {
+            float perEventTime = s->env.getAveragePerEventProcessTimeMs();
+            float totalProcessTime = s->env.getAverageTotalProcessTimeMs();
+
+            // Call callback with result in original caller's thread
+            runInThread(context, [=]() { callback(perEventTime, totalProcessTime); });
+        });
+    });
+}
+
+void KonfytJSEngine::scriptInitStats(PatchLayerPtr patchLayer, QObject *context,
+                            std::function<void(KonfytJSEnv::InitStats)> callback)
+{
+    runInThread(this, [=]()
+    {
+        ScriptEnvPtr s = layerEnvMap.value(patchLayer);
+        if (!s) {
+            print("Error: scriptInitStats: invalid patch layer");
+            runInThread(context, [=]() { callback(KonfytJSEnv::InitStats()); });
+            return;
+        }
+
+        s->worker->run([=]()
+        {
+            KonfytJSEnv::InitStats stats = s->env.initStats();
+
+            // Call callback with result in original caller's thread
+            runInThread(context, [=]() { callback(stats); });
+        });
+    });
+}
+
+void KonfytJSEngine::scriptInitStats(Project::MidiPortPtr prjPort, QObject *context,
+                            std::function<void(KonfytJSEnv::InitStats)> callback)
+{
+    runInThread(this, [=]()
+    {
+        ScriptEnvPtr s = prjPortEnvMap.value(prjPort);
+        if (!s) {
+            print("Error: scriptInitStats: invalid project port");
+            runInThread(context, [=]() { callback(KonfytJSEnv::InitStats()); });
+            return;
         }
 
-        // Call callback with result in original caller's thread
-        runInThread(context, [=]() { callback(perEventTime, totalProcessTime); });
+        s->worker->run([=]()
+        {
+            KonfytJSEnv::InitStats stats = s->env.initStats();
+
+            // Call callback with result in original caller's thread
+            runInThread(context, [=]() { callback(stats); });
+        });
+    });
+}
+
+void KonfytJSEngine::scriptProfile(PatchLayerPtr patchLayer, QObject *context,
+                                   std::function<void (QJsonObject)> callback)
+{
+    runInThread(this, [=]()
+    {
+        ScriptEnvPtr s = layerEnvMap.value(patchLayer);
+        if (!s) {
+            print("Error: scriptProfile: invalid patch layer");
+            runInThread(context, [=]() { callback(QJsonObject()); });
+            return;
+        }
+
+        s->worker->run([=]()
+        {
+            QJsonObject profile = s->env.profile();
+            profile["worker"] = s->worker->index();
+            profile["workerQueueDepth"] = s->worker->pendingCount();
+
+            // Call callback with result in original caller's thread
+            runInThread(context, [=]() { callback(profile); });
+        });
+    });
+}
+
+void KonfytJSEngine::scriptProfile(Project::MidiPortPtr prjPort, QObject *context,
+                                   std::function<void (QJsonObject)> callback)
+{
+    runInThread(this, [=]()
+    {
+        ScriptEnvPtr s = prjPortEnvMap.value(prjPort);
+        if (!s) {
+            print("Error: scriptProfile: invalid project port");
+            runInThread(context, [=]() { callback(QJsonObject()); });
+            return;
+        }
+
+        s->worker->run([=]()
+        {
+            QJsonObject profile = s->env.profile();
+            profile["worker"] = s->worker->index();
+            profile["workerQueueDepth"] = s->worker->pendingCount();
+
+            // Call callback with result in original caller's thread
+            runInThread(context, [=]() { callback(profile); });
+        });
     });
 }
 
@@ -698,16 +2114,20 @@ void KonfytJSEngine::scriptErrorString(PatchLayerPtr patchLayer,
     runInThread(this, [=]()
     {
         ScriptEnvPtr s = layerEnvMap.value(patchLayer);
-        QString ret;
-        if (s) {
-            ret = s->env.errorString();
-        } else {
+        if (!s) {
             print("Error: scriptErrorString: invalid patch layer");
-            ret = "KonfytJSEngine error: invalid patch layer";
+            QString ret = "KonfytJSEngine error: invalid patch layer";
+            runInThread(context, [=]() { callback(ret); });
+            return;
         }
 
-        // Call callback with result in original caller's thread
-        runInThread(context, [=]() { callback(ret); });
+        s->worker->run([=]()
+        {
+            QString ret = s->env.errorString();
+
+            // Call callback with result in original caller's thread
+            runInThread(context, [=]() { callback(ret); });
+        });
     });
 }
 
@@ -718,16 +2138,20 @@ void KonfytJSEngine::scriptErrorString(Project::MidiPortPtr prjPort,
     runInThread(this, [=]()
     {
         ScriptEnvPtr s = prjPortEnvMap.value(prjPort);
-        QString ret;
-        if (s) {
-            ret = s->env.errorString();
-        } else {
+        if (!s) {
             print("Error: scriptErrorString: invalid project port");
-            ret = "KonfytJSEngine error: invalid project port";
+            QString ret = "KonfytJSEngine error: invalid project port";
+            runInThread(context, [=]() { callback(ret); });
+            return;
         }
 
-        // Call callback with result in original caller's thread
-        runInThread(context, [=]() { callback(ret); });
+        s->worker->run([=]()
+        {
+            QString ret = s->env.errorString();
+
+            // Call callback with result in original caller's thread
+            runInThread(context, [=]() { callback(ret); });
+        });
     });
 }
 
@@ -736,22 +2160,87 @@ void KonfytJSEngine::runInThread(QObject* context, std::function<void()> func)
     QMetaObject::invokeMethod(context, func, Qt::QueuedConnection);
 }
 
+/* Create a script environment and assign it to the worker with the fewest
+ * environments. The environment is deleted in the worker thread. */
+KonfytJSEngine::ScriptEnvPtr KonfytJSEngine::newScriptEnv()
+{
+    KonfytJSWorker* worker = workers.value(0);
+    foreach (KonfytJSWorker* w, workers) {
+        if (w->envCount < worker->envCount) { worker = w; }
+    }
+
+    ScriptEnv* s = new ScriptEnv();
+    s->worker = worker;
+    s->env.setSharedStore(&sharedStore);
+    s->env.moveEnvToThread(worker->workerThread());
+    worker->envCount++;
+
+    return ScriptEnvPtr(s, [](ScriptEnv* s)
+    {
+        s->worker->run([s]() { delete s; });
+    });
+}
+
+void KonfytJSEngine::releaseScriptEnv(ScriptEnvPtr s)
+{
+    s->worker->envCount--;
+}
+
+/* Worker thread */
 void KonfytJSEngine::beforeScriptRun(ScriptEnvPtr s)
 {
-    watchdog = watchdogMax;
-    runningScript = s;
+    s->worker->setRunningEngine(s->env.jsEngine());
+    if (jack) {
+        s->env.setTimeReference(jack->getFrameTime(), jack->getSampleRate());
+    }
 }
 
+/* Worker thread */
 void KonfytJSEngine::afterScriptRun(ScriptEnvPtr s)
 {
-    runningScript.reset();
-    watchdog = watchdogMax;
+    s->worker->setRunningEngine(nullptr);
 
     // Send all queued MIDI events
+    bool sent = true;
     if (s->prjPort) {
-        jack->sendMidiEventsOnPort(s->prjPort->jackPort, s->env.takeMidiToSend());
+        sent = jack->sendMidiEventsOnPort(s->prjPort->jackPort, s->env.takeMidiToSend());
     } else if (s->route) {
-        jack->sendMidiEventsOnRoute(s->route, s->env.takeMidiToSend());
+        sent = jack->sendMidiEventsOnRoute(s->route, s->env.takeMidiToSend());
+    }
+    if (!sent) {
+        s->env.print("Midi.send: send buffer full, events dropped.");
+    }
+
+    // Delayed events are scheduled in the JACK thread, so events dropped there
+    // since the previous run are reported now.
+    uint32_t dropped = scheduledDroppedCount(s);
+    if (dropped != s->scheduledDropped) {
+        s->env.print(QString("Midi.send: %1 delayed events dropped, more than "
+                             "%2 events or %3 SysEx bytes were pending.")
+                     .arg(dropped - s->scheduledDropped)
+                     .arg(KONFYT_MIDI_SCHEDULER_SIZE)
+                     .arg(KONFYT_MIDI_SCHEDULER_SYSEX_BYTES));
+        s->scheduledDropped = dropped;
+    }
+
+    applyScriptPipeline(s, s->env.isEnabled() ? s->env.pipeline() : "");
+
+    // Parameter changes go to JACK directly, bypassing the GUI thread
+    QList<KonfytJSParamChange> paramChanges = s->env.takeParamChanges();
+    if (!paramChanges.isEmpty()) {
+        sendParamChanges(s, paramChanges);
+    }
+
+    // Publish shared values written by the script and pass on its messages
+    KonfytJSSharedStore::Map changes;
+    QSet<QString> removed;
+    if (s->env.takeSharedChanges(&changes, &removed)) {
+        sharedStore.publish(changes, removed);
+    }
+    QList<KonfytJSMessage> messages = s->env.takePublishedMessages();
+    if (!messages.isEmpty()) {
+        ScriptEnv* sender = s.data();
+        runInThread(this, [=]() { deliverMessages(sender, messages); });
     }
 
     // Print all queued messages
@@ -764,6 +2253,114 @@ void KonfytJSEngine::afterScriptRun(ScriptEnvPtr s)
     }
 }
 
+/* Worker thread. Compile the transform pipeline declared by the script and set
+ * it in JACK if it changed. An empty pipeline clears it. */
+void KonfytJSEngine::applyScriptPipeline(ScriptEnvPtr s, QString pipeline)
+{
+    if (pipeline == s->appliedPipeline) { return; }
+    s->appliedPipeline = pipeline;
+
+    KonfytMidiTransformProgram program;
+    QString error;
+    if (!KonfytMidiTransform::compile(pipeline, &program, &error)) {
+        s->env.print("Pipeline error: " + error);
+    } else if (!pipeline.isEmpty()) {
+        s->env.print(QString("Pipeline active (%1 operations).").arg(program.opCount()));
+    }
+
+    // Set in the GUI thread, which publishes JACK engine changes
+    KfJackMidiPort* port = s->prjPort ? s->prjPort->jackPort : nullptr;
+    KfJackMidiRoute* route = s->route;
+    runInThread(jack, [=]()
+    {
+        if (port) {
+            jack->setMidiPortScriptTransform(port, program);
+        } else if (route) {
+            jack->setRouteScriptTransform(route, program);
+        }
+    });
+}
+
+/* Pass messages published by a script to the other scripts that subscribed to
+ * the topics. */
+void KonfytJSEngine::deliverMessages(ScriptEnv *sender, QList<KonfytJSMessage> messages)
+{
+    QList<ScriptEnvPtr> envs = layerEnvMap.values() + prjPortEnvMap.values();
+    foreach (ScriptEnvPtr s, envs) {
+        if (s.data() == sender) { continue; }
+        s->worker->run([=]()
+        {
+            if (!s->env.isSubscribedToAny(messages)) { return; }
+            beforeScriptRun(s);
+            s->env.deliverMessages(messages);
+            afterScriptRun(s);
+        });
+    }
+}
+
+/* Worker thread. Resolve the targets of parameter changes made by the script
+ * and send them to the JACK engine. */
+void KonfytJSEngine::sendParamChanges(ScriptEnvPtr s, QList<KonfytJSParamChange> changes)
+{
+    QList<KfJackParamCommand> commands;
+    bool layerChangeIgnored = false;
+    foreach (const KonfytJSParamChange& change, changes) {
+        KfJackParamCommand cmd;
+        cmd.type = change.type;
+        cmd.value = change.value;
+        cmd.zoneField = change.zoneField;
+        if (change.type == KfJackParamCommand::BusGain) {
+            QMutexLocker locker(&audioBusesMutex);
+            if (!audioBuses.contains(change.busId)) {
+                s->env.print("Params: invalid bus " + n2s(change.busId));
+                continue;
+            }
+            cmd.busLeft = audioBuses.value(change.busId).first;
+            cmd.busRight = audioBuses.value(change.busId).second;
+        } else if (s->patchLayer) {
+            cmd.midiRoute = s->routeId;
+            cmd.audioLeftRoute = s->audioLeftRouteId;
+            cmd.audioRightRoute = s->audioRightRouteId;
+        } else {
+            layerChangeIgnored = true;
+            continue;
+        }
+        commands.append(cmd);
+    }
+
+    if (layerChangeIgnored) {
+        s->env.print("Params: layer parameters may only be set in layer scripts.");
+    }
+    if (!jack->sendParamCommands(commands)) {
+        s->env.print("Params: parameter queue full, changes dropped.");
+    }
+}
+
+/* Worker thread. Number of delayed events sent by the script's port or route
+ * that were dropped because its JACK scheduler was full. */
+uint32_t KonfytJSEngine::scheduledDroppedCount(ScriptEnvPtr s)
+{
+    if (s->prjPort) {
+        return jack->droppedScheduledEventCount(s->prjPort->jackPort);
+    } else if (s->route) {
+        return jack->droppedScheduledEventCount(s->route);
+    }
+    return 0;
+}
+
+/* Worker thread. Undo the layer parameter changes made by the script. */
+void KonfytJSEngine::resetLayerParams(ScriptEnvPtr s)
+{
+    if (!s->patchLayer) { return; }
+
+    KfJackParamCommand cmd;
+    cmd.type = KfJackParamCommand::LayerReset;
+    cmd.midiRoute = s->routeId;
+    cmd.audioLeftRoute = s->audioLeftRouteId;
+    cmd.audioRightRoute = s->audioRightRouteId;
+    jack->sendParamCommands({cmd});
+}
+
 KfJackMidiRoute *KonfytJSEngine::jackMidiRouteFromLayer(PatchLayerPtr layer)
 {
     KfJackMidiRoute* ret = nullptr;
@@ -777,10 +2374,25 @@ KfJackMidiRoute *KonfytJSEngine::jackMidiRouteFromLayer(PatchLayerPtr layer)
     return ret;
 }
 
+/* Returns the left and right audio routes of the layer, or an empty list if
+ * the layer has no audio. */
+QList<KfJackAudioRoute *> KonfytJSEngine::jackAudioRoutesFromLayer(PatchLayerPtr layer)
+{
+    QList<KfJackAudioRoute*> ret;
+    if (layer->layerType() == PatchLayer::TypeSfz) {
+        ret = jack->getPluginAudioRoutes(layer->sfzData.portsInJackEngine);
+    } else if (layer->layerType() == PatchLayer::TypeSoundfontProgram) {
+        ret = jack->getPluginAudioRoutes(layer->soundfontData.portsInJackEngine);
+    }
+    return ret;
+}
+
 void KonfytJSEngine::onNewMidiEventsAvailable()
 {
-    // Read MIDI rx events from inter-thread buffer, and distribute to script
-    // environments based on the route or port
+    // Read MIDI rx events from inter-thread buffer, and group them per script
+    // environment based on the route or port, keeping the received order.
+    QList<ScriptEnvPtr> envs;
+    QHash<ScriptEnv*, QList<KfJackMidiRxEvent>> envEvents;
     int n = mRxBuffer->availableToRead();
     for (int i=0; i < n; i++) {
         KfJackMidiRxEvent rxev = mRxBuffer->read();
@@ -791,24 +2403,23 @@ void KonfytJSEngine::onNewMidiEventsAvailable()
             s = jackPortEnvMap.value(rxev.sourcePort);
         }
         if (!s) { continue; }
-        if (!s->env.isEnabled()) { continue; }
-        s->env.addEvent(rxev.midiEvent);
-    }
-
-    // Run all script environment process functions if enabled and they have
-    // MIDI events to process.
-    foreach (ScriptEnvPtr s, routeEnvMap.values()) {
-        if (!s->env.isEnabled()) { continue; }
-        if (s->env.eventCount() == 0) { continue; }
-        beforeScriptRun(s);
-        s->env.runProcess();
-        afterScriptRun(s);
-    }
-    foreach (ScriptEnvPtr s, jackPortEnvMap.values()) {
-        if (!s->env.isEnabled()) { continue; }
-        if (s->env.eventCount() == 0) { continue; }
-        beforeScriptRun(s);
-        s->env.runProcess();
-        afterScriptRun(s);
+        if (!envEvents.contains(s.data())) { envs.append(s); }
+        envEvents[s.data()].append(rxev);
+    }
+
+    // Run the script environments in their workers. Environments in different
+    // workers run in parallel.
+    foreach (ScriptEnvPtr s, envs) {
+        QList<KfJackMidiRxEvent> events = envEvents.value(s.data());
+        s->worker->run([=]()
+        {
+            if (!s->env.isEnabled()) { return; }
+            foreach (const KfJackMidiRxEvent& ev, events) {
+                s->env.addEvent(ev);
+            }
+            beforeScriptRun(s);
+            s->env.runProcess();
+            afterScriptRun(s);
+        });
     }
 }
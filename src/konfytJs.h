@@ -24,16 +24,24 @@
 
 #include "sleepyRingBuffer.h"
 #include "konfytJackEngine.h"
+#include "konfytLatencyHistogram.h"
 #include "konfytProject.h"
 
 #include <QElapsedTimer>
+#include <QHash>
 #include <QJSEngine>
 #include <QJsonObject>
+#include <QMap>
+#include <QMutex>
 #include <QObject>
 #include <QScopedPointer>
+#include <QSet>
 #include <QSharedPointer>
+#include <QThread>
 #include <QTimer>
+#include <QVariant>
 
+#include <atomic>
 #include <functional>
 
 
@@ -68,6 +76,12 @@
  *   which the object is also a parent (i.e. two objects are each other's
  *   parents), QJSEngine hangs during garbage collection.
  *
+ * - QJSEngine::setInterrupted() interrupts whatever script runs in the engine.
+ *
+ *   When engines are shared between scripts, the interrupted flag has to be
+ *   cleared again after the interrupted script has been stopped, otherwise the
+ *   other scripts in the engine fail as well.
+ *
  * - Destroying a QJSEngine destroys all children.
  *
  *   If an object passed to QJSEngine with newQObject() should outlive QJSEngine,
@@ -102,7 +116,7 @@ class AverageTimer
 {
 public:
     void start();
-    void recordTime();
+    qint64 recordTime(int items = 1);
     float getAverageProcessTimeMs();
 
 private:
@@ -116,6 +130,125 @@ private:
 
 // =============================================================================
 
+/* Profile of a script, recorded in its worker thread: latency histograms of
+ * the script functions and of sections marked by the script with
+ * Sys.profileBegin() and Sys.profileEnd(), the depth and delay of the received
+ * event queue and measured garbage collection pauses. In detailed mode, the
+ * slowest calls are kept together with the events that caused them. */
+class KonfytJSProfiler
+{
+public:
+    void setDetailed(bool detailed);
+    bool isDetailed() const;
+    void reset();
+
+    void recordFunction(const QString& function, qint64 ns);
+    void recordEvents(qint64 nsPerEvent, int count);
+    void recordQueue(int depth);
+    void recordQueueDelay(qint64 ns);
+    void recordGc(qint64 ns);
+    void recordSlowCall(const QString& function, const QString& detail, qint64 ns);
+
+    void beginSection(const QString& name);
+    bool endSection(const QString& name);
+
+    QJsonObject toJson() const;
+
+    static const int SLOW_CALLS_MAX = 8;
+
+private:
+    bool mDetailed = false;
+    KonfytLatencyHistogram events; // Processing time per event
+    KonfytLatencyHistogram queueDelay; // From JACK receive to processing
+    KonfytLatencyHistogram gc;
+    QMap<QString, KonfytLatencyHistogram> functions;
+    QMap<QString, KonfytLatencyHistogram> sections;
+    QHash<QString, QElapsedTimer> openSections;
+    int mQueueDepth = 0;
+    int mMaxQueueDepth = 0;
+
+    struct SlowCall {
+        QString function;
+        QString detail;
+        qint64 ns;
+    };
+    QList<SlowCall> slowCalls; // Slowest first
+};
+
+// =============================================================================
+
+/* A QJSEngine shared by the environments of multiple scripts.
+ *
+ * Each script text is compiled once into a factory function that takes the
+ * scripting globals (Sys, Midi, print, constants) as arguments and returns the
+ * script's init() and midiEvent() functions. The factory is called once for
+ * every environment using the script, so each environment gets its own closure
+ * with its own variables, while the compiled code is shared. */
+class KonfytJSSharedEngine
+{
+public:
+    QJSEngine* jsEngine();
+    int contextCount() const;
+    bool hasFactory(const QString& script) const;
+
+    QJSValue acquireFactory(const QString& script, const QStringList& argNames,
+                            bool* fromCache);
+    void releaseFactory(const QString& script);
+    void addContext();
+    void removeContext();
+
+private:
+    QJSEngine js;
+    struct Factory {
+        QJSValue function;
+        int users = 0;
+    };
+    QHash<QString, Factory> factories;
+    int mContextCount = 0;
+};
+
+// =============================================================================
+
+/* Key/value store shared by all script environments.
+ *
+ * Values are published as immutable snapshots. A writer copies the current
+ * snapshot, applies its changes and replaces it under a mutex. Readers keep a
+ * reference to a snapshot and only fetch the new one when the version changes,
+ * so a read is a single atomic load while nothing changed.
+ *
+ * Numeric values of keys marked for mirroring are also written to lock-free
+ * slots in the JACK engine, where they may be read in the JACK thread. */
+class KonfytJSSharedStore
+{
+public:
+    typedef QHash<QString, QVariant> Map;
+    typedef QSharedPointer<const Map> Snapshot;
+
+    void setJackEngine(KonfytJackEngine* jackEngine);
+    quint64 version() const;
+    Snapshot snapshot();
+    void publish(const Map& changes, const QSet<QString>& removed);
+    int mirrorSlot(QString key);
+
+private:
+    QMutex mutex;
+    Snapshot mSnapshot {new Map()};
+    std::atomic<quint64> mVersion {0};
+    QHash<QString, int> mirrorSlots;
+    KonfytJackEngine* jack = nullptr;
+
+    void mirror(int slot, const QVariant& value);
+};
+
+/* Message published by a script to the scripts subscribed to the topic. */
+struct KonfytJSMessage
+{
+    QString topic;
+    QVariant value;
+};
+
+// =============================================================================
+
 class KonfytJSEnv; // Forward declaration for use in KonfytJSMidi
 
 /* This is used as the global Midi object in the scripting environment.
@@ -128,11 +261,14 @@ public:
 
     QJSValue midiEventToJSObject(const KonfytMidiEvent& ev);
     KonfytMidiEvent jsObjectToMidiEvent(QJSValue j);
-
-signals:
-    void send(QJSValue event);
+    static bool rawToMidiEvent(int type, int channel, int data1, int data2,
+                               KonfytMidiEvent* ev);
+    static int typeFromString(const QString& type);
 
 public slots:
+    void send(QJSValue event, double delayMs = 0);
+    void sendRaw(int type, int channel, int data1, int data2 = 0, double delayMs = 0);
+    void forward(int index, double delayMs = 0);
     QJSValue noteon(int channel, int note, int velocity);
     QJSValue noteoff(int channel, int note, int velocity = 0);
     QJSValue cc(int channel, int cc, int value);
@@ -145,6 +281,63 @@ private:
     /* Convenience function to get a property of a QJSValue or a default value
      * if the property does not exist (or is undefined). */
     QVariant value(const QJSValue& j, QString key, QVariant defaultValue);
+    int intValue(const QJSValue& j, QString key, int defaultValue);
+};
+
+// =============================================================================
+
+/* This is used as the global Shared object in the scripting environment, for
+ * state and messages shared between scripts. */
+class KonfytJSSharedState : public QObject
+{
+    Q_OBJECT
+public:
+    KonfytJSSharedState(KonfytJSEnv* parent = nullptr);
+
+public slots:
+    QJSValue get(QString key, QJSValue defaultValue = QJSValue());
+    void set(QString key, QJSValue value);
+    void remove(QString key);
+    QStringList keys();
+    int mirror(QString key);
+    void publish(QString topic, QJSValue value = QJSValue());
+    void subscribe(QString topic, QJSValue callback);
+    void unsubscribe(QString topic);
+
+private:
+    KonfytJSEnv* jsEnv;
+};
+
+// =============================================================================
+
+/* Parameter change requested by a script, see KonfytJSParams. */
+struct KonfytJSParamChange
+{
+    KfJackParamCommand::Type type = KfJackParamCommand::LayerGain;
+    float value = 0;
+    int zoneField = 0;
+    int busId = -1;
+};
+
+/* This is used as the global Params object in the scripting environment, for
+ * realtime control of the layer and bus parameters. Changes are sent to the
+ * JACK engine after the current script call returns. */
+class KonfytJSParams : public QObject
+{
+    Q_OBJECT
+public:
+    KonfytJSParams(KonfytJSEnv* parent = nullptr);
+
+public slots:
+    void setGain(double gain);
+    void setMute(bool mute);
+    void setSolo(bool solo);
+    void setZone(QJSValue zone);
+    void reset();
+    void setBusGain(int busId, double gain);
+
+private:
+    KonfytJSEnv* jsEnv;
 };
 
 // =============================================================================
@@ -155,31 +348,75 @@ class KonfytJSEnv : public QObject
     Q_OBJECT
 public:
     explicit KonfytJSEnv(QObject* parent = nullptr);
+    ~KonfytJSEnv();
+
+    /* Resources used to set up and initialise the script. Memory is the
+     * growth of the process resident memory and is approximate. */
+    struct InitStats {
+        float timeMs = 0;
+        qint64 memoryBytes = 0;
+        bool sharedEngine = false;
+        bool compiledFromCache = false;
+    };
 
-    void setScriptAndInitIfEnabled(QString script, bool enable);
+    void moveEnvToThread(QThread* thread);
+    void setSharedEngine(KonfytJSSharedEngine* engine);
+    void setScript(QString script);
     void setEnabledAndInitIfNeeded(bool enable);
     bool isEnabled();
     void runProcess();
     QString script();
+    QString pipeline();
 
-    void addEvent(KonfytMidiEvent ev);
+    void addEvent(const KfJackMidiRxEvent& ev);
+    void sendMidiEvent(const KonfytMidiEvent& ev, double delayMs = 0);
+    bool forwardMidi(int index, double delayMs = 0);
     int eventCount();
+    void setTimeReference(uint32_t nowFrame, double sampleRate);
 
     QJSEngine* jsEngine();
     float getAverageTotalProcessTimeMs();
     float getAveragePerEventProcessTimeMs();
     QString errorString();
+    InitStats initStats();
 
     QStringList takePrints();
-    QList<KonfytMidiEvent> takeMidiToSend();
+    QList<KfJackMidiTxEvent> takeMidiToSend();
+
+    static QStringList runBenchmark(QString script, int eventCount);
+
+    void setDetailedProfiling(bool detailed);
+    QJsonObject profile();
+
+    // Shared state and messages, see KonfytJSSharedState
+    void setSharedStore(KonfytJSSharedStore* store);
+    QJSValue sharedValue(QString key, QJSValue defaultValue);
+    void setSharedValue(QString key, QJSValue value);
+    void removeSharedValue(QString key);
+    QStringList sharedKeys();
+    int mirrorSharedValue(QString key);
+    bool takeSharedChanges(KonfytJSSharedStore::Map* changes, QSet<QString>* removed);
+    void publishMessage(QString topic, QJSValue value);
+    void subscribe(QString topic, QJSValue callback);
+    void unsubscribe(QString topic);
+    QList<KonfytJSMessage> takePublishedMessages();
+    bool isSubscribedToAny(const QList<KonfytJSMessage>& messages);
+    void deliverMessages(const QList<KonfytJSMessage>& messages);
+
+    // Layer and bus parameters, see KonfytJSParams
+    void setParam(KfJackParamCommand::Type type, float value,
+                  int zoneField = 0, int busId = -1);
+    QList<KonfytJSParamChange> takeParamChanges();
 
 signals:
     void errorStatusChanged(QString errorString);
 
 public slots:
-    void sendMidi(QJSValue j);
+    void sendMidi(QJSValue j, double delayMs = 0);
     // For use from script:
     void print(QString msg);
+    void profileBegin(QString name);
+    void profileEnd(QString name);
 
 private:
     // NB: JS garbage collector doesn't like it if tempParent's parent is this
@@ -187,32 +424,88 @@ private:
     TempParent tempParent;
 
     KonfytJSMidi midi {this};
-    QScopedPointer<QJSEngine> js;
+    KonfytJSSharedState sharedState {this};
+    KonfytJSParams params {this};
+    QScopedPointer<QJSEngine> js; // Own engine, if not using a shared engine
+    KonfytJSSharedEngine* shared = nullptr;
+    QString mSharedFactoryScript; // Script of factory acquired from shared engine
+    bool mHasSharedFactory = false;
+    bool mHasSharedContext = false;
+    QJSValue jsContext; // Object holding the script globals, used as "this"
     QJSValue jsSys; // "Sys" object in script environment
     QJSValue jsMidi; // "Midi" object in script environment
+    QJSValue jsShared; // "Shared" object in script environment
+    QJSValue jsParams; // "Params" object in script environment
     QJSValue jsMidiEventFunction;
+    QJSValue jsMidiEventsFunction; // Optional batch function
+
+    // Reusable buffer for midiEvents(). Each event has BATCH_STRIDE values.
+    enum BatchField { BATCH_TYPE, BATCH_CHANNEL, BATCH_DATA1, BATCH_DATA2,
+                      BATCH_DATA3, BATCH_FRAME, BATCH_STRIDE };
+    static const int BATCH_MIN_CAPACITY = 64;
+    QJSValue jsBatchBuffer; // Float64Array
+    QJSValue jsBatchSysex;  // Hex strings of sysex events by index
+    int batchCapacity = 0;
+    void runProcessBatch();
+    void ensureBatchCapacity(int count);
+    void queueMidiToSend(const KonfytMidiEvent& ev, double delayMs,
+                         uint32_t baseFrame);
 
     AverageTimer eventProcessTimer;
     AverageTimer totalProcessTimer;
 
+    KonfytJSProfiler profiler;
+    static const int GC_MEASURE_INTERVAL_MS = 5000;
+    QElapsedTimer gcTimer;
+    void profileQueue();
+    void measureGarbageCollectionIfDue();
+
     bool mEnabled = false;
     QString mErrorString;
 
     void resetEnvironment();
+    void releaseSharedContext();
+    void setContextProperty(QString name, QJSValue value);
     bool evaluate(QString script);
     bool handleJsResult(QJSValue result);
 
     QString mScript;
     bool scriptInitialisationDone = false;
     void runScriptInitialisation();
+    void runSharedScriptInitialisation();
 
-    QList<KonfytMidiEvent> midiEvents;
+    QString mPipeline; // Declared transform pipeline text
+    static QString pipelineFromJsValue(QJSValue value);
+
+    InitStats mInitStats;
+    static qint64 residentMemoryBytes();
+
+    QList<KfJackMidiRxEvent> midiEvents;
     QJSValue jsMidiRxArray;
 
+    // Time reference for scheduling sent MIDI events
+    uint32_t mNowFrame = 0;
+    double mSampleRate = 48000;
+    bool mProcessingEvent = false;
+    uint32_t mCurrentEventFrame = 0;
+
     static const int PRINT_MAX = 1000;
     QStringList mToPrint;
     static const int MIDI_SEND_MAX = 1000;
-    QList<KonfytMidiEvent> mMidiToSend;
+    QList<KfJackMidiTxEvent> mMidiToSend;
+
+    KonfytJSSharedStore* store = nullptr;
+    KonfytJSSharedStore::Snapshot storeSnapshot;
+    quint64 storeVersion = 0;
+    KonfytJSSharedStore::Map pendingShared; // Written during this run
+    QSet<QString> pendingSharedRemoved;
+    const KonfytJSSharedStore::Map& currentSharedSnapshot();
+    static const int MESSAGES_MAX = 1000;
+    QList<KonfytJSMessage> mPublished;
+    QHash<QString, QJSValue> subscriptions;
+
+    static const int PARAM_CHANGES_MAX = 1000;
+    QList<KonfytJSParamChange> mParamChanges;
 
     // Constants
     const QString TYPE_NOTEON = "noteon";
@@ -227,19 +520,71 @@ private:
 
 // =============================================================================
 
+/* Thread in which script environments are run.
+ *
+ * A script environment is assigned to a worker when it is created and is only
+ * used in the worker's thread after that. Its QJSEngine is therefore created
+ * and used in the same thread, and its MIDI events are processed in the order
+ * they were received since the worker runs functions in the order they were
+ * queued. Each worker has its own watchdog. */
+class KonfytJSWorker : public QObject
+{
+    Q_OBJECT
+public:
+    KonfytJSWorker(int index);
+    ~KonfytJSWorker();
+
+    int index() const;
+    QThread* workerThread();
+    void run(std::function<void()> func);
+    int pendingCount() const;
+
+    // Worker thread
+    void setRunningEngine(QJSEngine* engine);
+    KonfytJSSharedEngine* sharedEngineForScript(QString script, int count);
+
+    // Watchdog timer thread
+    int watchdogStrike();
+
+    // KonfytJSEngine thread
+    int envCount = 0;
+
+    static const int watchdogMax = 4;
+
+private:
+    int mIndex = 0;
+    QThread thread;
+    std::atomic<int> mPending {0}; // Functions queued to run
+
+    QMutex watchdogMutex;
+    QJSEngine* runningEngine = nullptr;
+    int watchdog = watchdogMax;
+
+    QList<QSharedPointer<KonfytJSSharedEngine>> sharedEngines;
+};
+
+// =============================================================================
+
 /* Engine that manages all the scripts and routes MIDI events between scripts
  * and the JackEngine.
  * Patch layers (and their scripts) are added from the GUI. The JackEngine
  * communicates received MIDI events through a shared thread-safe ringbuffer and
  * wakes this thread up with a signal. The received MIDI events are paired up
  * with the patch layers using the JackEngine routes. For each received MIDI
- * event, the appropriate patch layer script is then run. */
+ * event, the appropriate patch layer script is then run.
+ * Scripts are distributed over a small pool of worker threads so that a slow
+ * script does not delay the scripts of other layers and ports. */
 class KonfytJSEngine : public QObject
 {
     Q_OBJECT
 public:
     KonfytJSEngine(QObject* parent= nullptr);
+    ~KonfytJSEngine();
     void setJackEngine(KonfytJackEngine* jackEngine);
+    void setSharedEngineCount(int count);
+    void setDetailedProfiling(bool detailed);
+    void setAudioBus(int busId, KfJackAudioPort* left, KfJackAudioPort* right);
+    void removeAudioBus(int busId);
 
     void addOrUpdateLayerScript(PatchLayerPtr patchLayer);
     void addOrUpdateJackPortScript(Project::MidiPortPtr prjPort);
@@ -255,6 +600,14 @@ public:
     void scriptAverageProcessTimeMs(Project::MidiPortPtr prjPort,
                                     QObject* context,
                                     std::function<void(float, float)> callback);
+    void scriptInitStats(PatchLayerPtr patchLayer, QObject* context,
+                         std::function<void(KonfytJSEnv::InitStats)> callback);
+    void scriptInitStats(Project::MidiPortPtr prjPort, QObject* context,
+                         std::function<void(KonfytJSEnv::InitStats)> callback);
+    void scriptProfile(PatchLayerPtr patchLayer, QObject* context,
+                       std::function<void(QJsonObject)> callback);
+    void scriptProfile(Project::MidiPortPtr prjPort, QObject* context,
+                       std::function<void(QJsonObject)> callback);
     void scriptErrorString(PatchLayerPtr patchLayer, QObject* context,
                            std::function<void(QString)> callback);
     void scriptErrorString(Project::MidiPortPtr prjPort,
@@ -279,7 +632,7 @@ private:
     void runInThread(QObject* context, std::function<void()> func);
 
     KonfytJackEngine* jack = nullptr;
-    QSharedPointer<SleepyRingBuffer<KfJackMidiRxEvent>> mRxBuffer;
+    QSharedPointer<KfJackMidiRxBufferForJs> mRxBuffer;
 
     struct ScriptEnv {
         KonfytJSEnv env;
@@ -288,22 +641,51 @@ private:
         Project::MidiPortPtr prjPort;
         PatchLayerPtr patchLayer;
         KfJackMidiRoute* route = nullptr;
+        // Ids of the layer's routes for parameter commands (audio routes are
+        // zero for layers without audio). See KfJackParamCommand.
+        uint32_t routeId = 0;
+        uint32_t audioLeftRouteId = 0;
+        uint32_t audioRightRouteId = 0;
+        KonfytJSWorker* worker = nullptr;
+        QString appliedPipeline; // Transform pipeline set in JACK (worker thread)
+        uint32_t scheduledDropped = 0; // Reported delayed events dropped by JACK
     };
     typedef QSharedPointer<ScriptEnv> ScriptEnvPtr;
 
+    // Workers are created in the constructor and not changed afterwards, so
+    // the list may be used from the watchdog timer thread.
+    static const int maxWorkers = 4;
+    QList<KonfytJSWorker*> workers;
+    QTimer* watchdogTimer = nullptr;
+    ScriptEnvPtr newScriptEnv();
+    void releaseScriptEnv(ScriptEnvPtr s);
+
+    int mSharedEngineCount = 0; // Zero: each script has its own engine
+    bool mDetailedProfiling = false;
+
     QMap<KfJackMidiRoute*, ScriptEnvPtr> routeEnvMap;
     QMap<PatchLayerPtr, ScriptEnvPtr> layerEnvMap;
 
     QMap<KfJackMidiPort*, ScriptEnvPtr> jackPortEnvMap;
     QMap<Project::MidiPortPtr, ScriptEnvPtr> prjPortEnvMap;
 
-    ScriptEnvPtr runningScript;
-    const int watchdogMax = 4;
-    int watchdog = watchdogMax;
     void beforeScriptRun(ScriptEnvPtr s);
     void afterScriptRun(ScriptEnvPtr s);
+    void applyScriptPipeline(ScriptEnvPtr s, QString pipeline);
+    void sendParamChanges(ScriptEnvPtr s, QList<KonfytJSParamChange> changes);
+    void resetLayerParams(ScriptEnvPtr s);
+    uint32_t scheduledDroppedCount(ScriptEnvPtr s);
+
+    // Bus port ids (see KfJackParamCommand) by project bus id, for scripts
+    // setting bus parameters. Used from the GUI and worker threads.
+    QMap<int, QPair<uint32_t, uint32_t>> audioBuses;
+    QMutex audioBusesMutex;
+
+    KonfytJSSharedStore sharedStore;
+    void deliverMessages(ScriptEnv* sender, QList<KonfytJSMessage> messages);
 
     KfJackMidiRoute* jackMidiRouteFromLayer(PatchLayerPtr layer);
+    QList<KfJackAudioRoute*> jackAudioRoutesFromLayer(PatchLayerPtr layer);
 
 private slots:
     void onNewMidiEventsAvailable();
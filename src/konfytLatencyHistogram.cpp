@@ -0,0 +1,133 @@
+/******************************************************************************
+ *
+ * Copyright 2026 Gideon van der Kolf
+ *
+ * This file is part of Konfyt.
+ *
+ *     Konfyt is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     Konfyt is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with Konfyt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+
+#include "konfytLatencyHistogram.h"
+
+#include <string.h>
+
+
+KonfytLatencyHistogram::KonfytLatencyHistogram()
+{
+    reset();
+}
+
+void KonfytLatencyHistogram::record(int64_t ns, uint32_t count)
+{
+    if (count == 0) { return; }
+    if (ns < 0) { ns = 0; }
+
+    counts[indexOf(ns)] += count;
+    if ( (mCount == 0) || (ns < mMin) ) { mMin = ns; }
+    if (ns > mMax) { mMax = ns; }
+    mCount += count;
+    mSum += (double)ns * count;
+}
+
+void KonfytLatencyHistogram::reset()
+{
+    memset(counts, 0, sizeof(counts));
+    mCount = 0;
+    mMin = 0;
+    mMax = 0;
+    mSum = 0;
+}
+
+uint64_t KonfytLatencyHistogram::count() const
+{
+    return mCount;
+}
+
+int64_t KonfytLatencyHistogram::min() const
+{
+    return mMin;
+}
+
+int64_t KonfytLatencyHistogram::max() const
+{
+    return mMax;
+}
+
+double KonfytLatencyHistogram::mean() const
+{
+    if (mCount == 0) { return 0; }
+    return mSum / mCount;
+}
+
+/* Returns the value below which p percent (0 to 100) of the recorded values
+ * fall, within the precision of the histogram. */
+int64_t KonfytLatencyHistogram::percentile(double p) const
+{
+    if (mCount == 0) { return 0; }
+
+    uint64_t target = (uint64_t)(p / 100.0 * mCount + 0.5);
+    if (target < 1) { target = 1; }
+    if (target > mCount) { target = mCount; }
+
+    uint64_t total = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        total += counts[i];
+        if (total >= target) {
+            // Never report beyond the exact extremes
+            int64_t value = highestValueOf(i);
+            if (value > mMax) { value = mMax; }
+            if (value < mMin) { value = mMin; }
+            return value;
+        }
+    }
+    return mMax;
+}
+
+QJsonObject KonfytLatencyHistogram::toJson() const
+{
+    QJsonObject j;
+    j["count"] = (double)mCount;
+    j["minNs"] = (double)mMin;
+    j["meanNs"] = mean();
+    j["p50Ns"] = (double)percentile(50);
+    j["p90Ns"] = (double)percentile(90);
+    j["p99Ns"] = (double)percentile(99);
+    j["p999Ns"] = (double)percentile(99.9);
+    j["maxNs"] = (double)mMax;
+    return j;
+}
+
+/* Values below SUB_BUCKETS have their own bucket. Larger values are divided
+ * in HALF_SUB_BUCKETS linear buckets for each power of two. */
+int KonfytLatencyHistogram::indexOf(int64_t ns)
+{
+    if (ns < SUB_BUCKETS) { return ns; }
+
+    int msb = 63 - __builtin_clzll((uint64_t)ns);
+    int shift = msb - (SUB_BUCKET_BITS - 1);
+    if (shift > MAX_SHIFT) { return BUCKETS - 1; }
+    int top = ns >> shift; // HALF_SUB_BUCKETS to SUB_BUCKETS - 1
+    return SUB_BUCKETS + (shift - 1) * HALF_SUB_BUCKETS + (top - HALF_SUB_BUCKETS);
+}
+
+int64_t KonfytLatencyHistogram::highestValueOf(int index)
+{
+    if (index < SUB_BUCKETS) { return index; }
+
+    int shift = (index - SUB_BUCKETS) / HALF_SUB_BUCKETS + 1;
+    int64_t top = (index - SUB_BUCKETS) % HALF_SUB_BUCKETS + HALF_SUB_BUCKETS;
+    return ((top + 1) << shift) - 1;
+}
@@ -0,0 +1,67 @@
+/******************************************************************************
+ *
+ * Copyright 2026 Gideon van der Kolf
+ *
+ * This file is part of Konfyt.
+ *
+ *     Konfyt is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     Konfyt is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with Konfyt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+
+#ifndef KONFYT_LATENCY_HISTOGRAM_H
+#define KONFYT_LATENCY_HISTOGRAM_H
+
+#include <QJsonObject>
+
+#include <stdint.h>
+
+/* High dynamic range histogram of durations in nanoseconds, from 1 ns to about
+ * half an hour, with a fixed relative precision of about 3% (32 linear
+ * sub-buckets per power of two). Recording is constant time and does not
+ * allocate. */
+class KonfytLatencyHistogram
+{
+public:
+    KonfytLatencyHistogram();
+
+    void record(int64_t ns, uint32_t count = 1);
+    void reset();
+
+    uint64_t count() const;
+    int64_t min() const;
+    int64_t max() const;
+    double mean() const;
+    int64_t percentile(double p) const;
+
+    QJsonObject toJson() const;
+
+private:
+    static const int SUB_BUCKET_BITS = 6;
+    static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static const int HALF_SUB_BUCKETS = SUB_BUCKETS / 2;
+    static const int MAX_SHIFT = 35;
+    static const int BUCKETS = SUB_BUCKETS + MAX_SHIFT * HALF_SUB_BUCKETS;
+
+    uint32_t counts[BUCKETS];
+    uint64_t mCount = 0;
+    int64_t mMin = 0;
+    int64_t mMax = 0;
+    double mSum = 0;
+
+    static int indexOf(int64_t ns);
+    static int64_t highestValueOf(int index);
+};
+
+#endif // KONFYT_LATENCY_HISTOGRAM_H
@@ -502,6 +502,24 @@ void KonfytLscp::removeSfzChannel(int id)
     }
 }
 
+/* Sets the volume of the channel (sfz instrument) in Linuxsampler, where 1.0 is
+ * unity gain. Returns false on error. */
+bool KonfytLscp::setSfzChannelVolume(int id, float volume)
+{
+    if (!chans.contains(id)) {
+        print("setSfzChannelVolume: invalid channel " + i2s(id));
+        return false;
+    }
+
+    lscp_status_t status = lscp_set_channel_volume(client, id, volume);
+    if (status != LSCP_OK) {
+        print(QString("Failed setting volume of channel %1.").arg(id));
+        print("Result: " + QString( lscp_client_get_result(client) ));
+        return false;
+    }
+    return true;
+}
+
 QString KonfytLscp::escapeString(QString s)
 {
     s.replace("\\", "\\\\"); // Must be first to not interfere with rest.
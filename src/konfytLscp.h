@@ -124,6 +124,7 @@ public:
     int addSfzChannelAndPorts(QString file);
     LsChannel getSfzChannelInfo(int id);
     void removeSfzChannel(int id);
+    bool setSfzChannelVolume(int id, float volume);
 
     static QString escapeString(QString s);
     static QString i2s(int value);
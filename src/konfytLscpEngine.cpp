@@ -82,7 +82,12 @@ void KonfytLscpEngine::removeSfz(int id)
 
 void KonfytLscpEngine::setGain(int id, float newGain)
 {
-    print("TODO: setGain " + n2s(id) + " to " + n2s(newGain));
+    ls.setSfzChannelVolume(id, newGain);
+}
+
+bool KonfytLscpEngine::hasNativeGain()
+{
+    return true;
 }
 
 void KonfytLscpEngine::onLsInitialised(bool error, QString errMsg)
@@ -42,6 +42,7 @@ public:
     QStringList audioOutJackPortNames(int id) override;
     void removeSfz(int id) override;
     void setGain(int id, float newGain) override;
+    bool hasNativeGain() override;
 
 private:
     KonfytLscp ls;
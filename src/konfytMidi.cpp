@@ -158,8 +158,21 @@ KonfytMidiEvent::KonfytMidiEvent(const unsigned char *buffer, int size)
 {
     mType = MIDI_TYPE_FROM_BUFFER(buffer);
     channel = MIDI_CHANNEL_FROM_BUFFER(buffer);
-    mDatasize = size - 1;
-    memcpy(mData, buffer+1, size-1);
+    setDataBytes(buffer + 1, size - 1);
+}
+
+/* Data longer than MIDI_DATA_MAX_SIZE is held in mLongData, with the first
+ * MIDI_DATA_MAX_SIZE bytes also in mData so the short accessors work. Data
+ * longer than MIDI_SYSEX_MAX_SIZE is truncated. */
+void KonfytMidiEvent::setDataBytes(const unsigned char *bytes, int size)
+{
+    mDatasize = qBound(0, size, MIDI_SYSEX_MAX_SIZE);
+    memcpy(mData, bytes, qMin(mDatasize, MIDI_DATA_MAX_SIZE));
+    if (mDatasize > MIDI_DATA_MAX_SIZE) {
+        mLongData = QByteArray((const char*)bytes, mDatasize);
+    } else {
+        mLongData.clear();
+    }
 }
 
 int KonfytMidiEvent::dataSize() const
@@ -169,6 +182,17 @@ int KonfytMidiEvent::dataSize() const
 
 unsigned char *KonfytMidiEvent::data()
 {
+    if (mDatasize > MIDI_DATA_MAX_SIZE) {
+        return (unsigned char*)mLongData.data();
+    }
+    return mData;
+}
+
+const unsigned char *KonfytMidiEvent::data() const
+{
+    if (mDatasize > MIDI_DATA_MAX_SIZE) {
+        return (const unsigned char*)mLongData.constData();
+    }
     return mData;
 }
 
@@ -195,21 +219,22 @@ void KonfytMidiEvent::setData2(unsigned char value)
 void KonfytMidiEvent::setDataFromHexString(QString hexString)
 {
     hexString = hexString.replace(" ", "");
-    mDatasize = 0;
+    QByteArray bytes;
     for (int i=1; i < hexString.count(); i += 2) {
-        if (mDatasize >= MIDI_DATA_MAX_SIZE) { break; }
+        if (bytes.count() >= MIDI_SYSEX_MAX_SIZE) { break; }
         uint8_t hexVal = hexString.mid(i-1, 2).toInt(nullptr, 16);
-        mData[mDatasize] = hexVal;
-        mDatasize++;
+        bytes.append(hexVal);
     }
+    setDataBytes((const unsigned char*)bytes.constData(), bytes.count());
 }
 
 QString KonfytMidiEvent::dataToHexString() const
 {
     QString ret;
+    const unsigned char* bytes = data();
     for (int i=0; i < mDatasize; i++) {
         if (i > 0) { ret += " "; }
-        ret += QString("%1").arg(mData[i], 2, 16, QChar('0'));
+        ret += QString("%1").arg(bytes[i], 2, 16, QChar('0'));
     }
     return ret.toUpper();
 }
@@ -270,8 +295,7 @@ void KonfytMidiEvent::setSysEx(const unsigned char *bytes, int size)
 {
     mType = MIDI_EVENT_TYPE_SYSTEM;
     channel = 0;
-    memcpy(mData, bytes, size);
-    mDatasize = size;
+    setDataBytes(bytes, size);
 }
 
 void KonfytMidiEvent::setPolyAftertouch(uint8_t note, uint8_t pressure)
@@ -305,7 +329,7 @@ int KonfytMidiEvent::bufferSizeRequired() const {
 
 int KonfytMidiEvent::toBuffer(unsigned char *buffer) const {
     buffer[0] = mType | channel;
-    memcpy(buffer+1, mData, mDatasize);
+    memcpy(buffer+1, data(), mDatasize);
     return mDatasize + 1;
 }
 
@@ -25,6 +25,7 @@
 #include "konfytUtils.h"
 #include "xml.h"
 
+#include <QByteArray>
 #include <QString>
 
 // ===========================================================================
@@ -42,7 +43,9 @@
 #define MIDI_MSG_ALL_NOTES_OFF 0x7B
 
 #define MIDI_CC_BANK_MSB 0
+#define MIDI_CC_VOLUME 7
 #define MIDI_CC_BANK_LSB 32
+#define MIDI_CC_RESET_ALL_CONTROLLERS 121
 #define MIDI_CC_ALL_NOTES_OFF 123
 
 #define MIDI_PITCHBEND_ZERO 8192
@@ -56,7 +59,8 @@
 #define MIDI_DATA1_FROM_BUFFER(x) x[1]
 #define MIDI_DATA2_FROM_BUFFER(x) x[2]
 
-#define MIDI_DATA_MAX_SIZE 64
+#define MIDI_DATA_MAX_SIZE 64 // Held inline, longer SysEx data on the heap
+#define MIDI_SYSEX_MAX_SIZE 65535
 
 #define MIDI_SUSTAIN_THRESH 63
 
@@ -82,6 +86,9 @@ private:
     int mType = MIDI_EVENT_TYPE_NOTEON; // Status byte without channel (i.e. same as channel=0)
     int mDatasize = 0;
     unsigned char mData[MIDI_DATA_MAX_SIZE] = {0};
+    QByteArray mLongData; // If data size > MIDI_DATA_MAX_SIZE
+
+    void setDataBytes(const unsigned char* bytes, int size);
 
 public:
     int channel = 0;
@@ -95,6 +102,7 @@ public:
     int dataSize() const;
     /* Returns buffer of data bytes, excluding type/channel byte. */
     unsigned char* data();
+    const unsigned char* data() const;
 
     /* Sets first data byte, but does not change dataSize. */
     void setData1(unsigned char value);
@@ -23,6 +23,8 @@
 
 #include <QRegularExpression>
 
+#include <string.h>
+
 
 MidiFilter MidiFilter::allPassFilter()
 {
@@ -184,6 +186,11 @@ Xml MidiFilter::toXml() const
     xml.addTextChild(XML_INCHAN, n2s(this->inChan));
     xml.addTextChild(XML_OUTCHAN, n2s(this->outChan));
 
+    // Transform pipeline
+    if (!transform.text().trimmed().isEmpty()) {
+        xml.addTextChild(XML_TRANSFORM, transform.text());
+    }
+
     return xml;
 }
 
@@ -230,6 +237,9 @@ void MidiFilter::readFromXml(Xml xml)
     }
     xml.setIntFromChild(XML_INCHAN, &this->inChan);
     xml.setIntFromChild(XML_OUTCHAN, &this->outChan);
+
+    Xml transformXml = xml.child(XML_TRANSFORM);
+    transform.setText(transformXml.isValid() ? transformXml.text() : "");
 }
 
 /* Translate the old deprecated velocity min/max and limits to a velocity map. */
@@ -282,7 +292,113 @@ Xml MidiFilter::boolToXml(QString name, bool value) const
     return Xml(name, value ? "1" : "0");
 }
 
-int MidiFilterMapping::map(int inValue)
+MidiFilterCompiled::MidiFilterCompiled()
+{
+    compile(MidiFilter());
+}
+
+void MidiFilterCompiled::compile(const MidiFilter &filter)
+{
+    lowNote = filter.zone.lowNote;
+    highNote = filter.zone.highNote;
+    add = filter.zone.add;
+    lowVel = 0;
+    highVel = 127;
+    pitchDownMax = filter.zone.pitchDownMax;
+    pitchUpMax = filter.zone.pitchUpMax;
+
+    memset(ccPass, filter.passAllCC ? 0xFF : 0, sizeof(ccPass));
+    if (!filter.passAllCC) {
+        foreach (int cc, filter.passCC) {
+            if ((cc >= 0) && (cc <= 127)) { ccPass[cc >> 5] |= 1u << (cc & 31); }
+        }
+    }
+    foreach (int cc, filter.blockCC) {
+        if ((cc >= 0) && (cc <= 127)) { ccPass[cc >> 5] &= ~(1u << (cc & 31)); }
+    }
+
+    if ((filter.inChan >= 0) && (filter.inChan <= 15)) {
+        channelMask = 1 << filter.inChan;
+    } else if (filter.inChan < 0) {
+        channelMask = 0xFFFF;
+    } else {
+        channelMask = 0;
+    }
+    outChan = filter.outChan;
+    passProg = filter.passProg;
+    passPitchbend = filter.passPitchbend;
+    ignoreGlobalTranspose = filter.ignoreGlobalTranspose;
+
+    for (int v = 0; v < 128; v++) {
+        velocityCurve[v] = filter.zone.velocityMap.map(v);
+    }
+
+    updateZone();
+}
+
+/* Rebuild the lookup tables from the zone values. Does not allocate, so may be
+ * called in the JACK thread. */
+void MidiFilterCompiled::updateZone()
+{
+    for (int note = 0; note < 128; note++) {
+        int out = note + add;
+        bool pass = (note >= lowNote) && (note <= highNote)
+                    && (out >= 0) && (out <= 127);
+        noteTable[note] = pass ? out : -1;
+    }
+    for (int v = 0; v < 128; v++) {
+        bool pass = (v >= lowVel) && (v <= highVel);
+        velocityTable[v] = pass ? velocityCurve[v] : 0;
+    }
+    pitchDownScale = (float)pitchDownMax / MIDI_PITCHBEND_SIGNED_MIN;
+    pitchUpScale = (float)pitchUpMax / MIDI_PITCHBEND_SIGNED_MAX;
+}
+
+/* Apply the filter rules to the event in place. Returns false if the event
+ * does not pass, in which case the event may have been partly modified.
+ * Equivalent to MidiFilter::passFilter() followed by MidiFilter::modify(). */
+bool MidiFilterCompiled::process(KonfytRtMidiEvent *ev) const
+{
+    if (!(channelMask & (1 << (ev->channel & 0xF)))) { return false; }
+
+    switch (ev->type()) {
+    case MIDI_EVENT_TYPE_CC: {
+        int cc = ev->data1() & 0x7F;
+        if (!(ccPass[cc >> 5] & (1u << (cc & 31)))) { return false; }
+        break;
+    }
+    case MIDI_EVENT_TYPE_PROGRAM:
+        if (!passProg) { return false; }
+        break;
+    case MIDI_EVENT_TYPE_PITCHBEND: {
+        if (!passPitchbend) { return false; }
+        int in = ev->pitchbendValueSigned();
+        ev->setPitchbend( (int)(in * (in < 0 ? pitchDownScale : pitchUpScale)) );
+        break;
+    }
+    case MIDI_EVENT_TYPE_NOTEON: {
+        int note = noteTable[ev->note() & 0x7F];
+        int velocity = velocityTable[ev->velocity() & 0x7F];
+        if ((note < 0) || (velocity == 0)) { return false; }
+        ev->setNote(note);
+        ev->setVelocity(velocity);
+        break;
+    }
+    case MIDI_EVENT_TYPE_NOTEOFF: {
+        int note = noteTable[ev->note() & 0x7F];
+        if (note < 0) { return false; }
+        ev->setNote(note);
+        break;
+    }
+    default:
+        return false;
+    }
+
+    if (outChan >= 0) { ev->channel = outChan; }
+    return true;
+}
+
+int MidiFilterMapping::map(int inValue) const
 {
     if ((inValue < 0) || (inValue > 127)) {
         return 0;
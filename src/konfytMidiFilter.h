@@ -25,6 +25,7 @@
 #include "konfytUtils.h"
 #include "konfytStructs.h"
 #include "konfytMidi.h"
+#include "konfytMidiTransform.h"
 #include "xml.h"
 
 #include <QList>
@@ -34,7 +35,7 @@
 struct MidiFilterMapping {
     QList<int> inNodes;
     QList<int> outNodes;
-    int map(int inValue);
+    int map(int inValue) const;
     MidiFilterMapping();
     void update();
     int clamp(int value, int min, int max);
@@ -82,6 +83,8 @@ public:
     int inChan = -1; // -1 = any
     int outChan = -1; // -1 = original
     bool ignoreGlobalTranspose = false;
+    // Applied after the filter rules, see KonfytMidiTransform
+    KonfytMidiTransform transform;
 
     Xml toXml() const;
     void readFromXml(Xml xml);
@@ -110,6 +113,48 @@ public:
     static constexpr const char* XML_BLOCK_CC = "blockcc";
     static constexpr const char* XML_INCHAN = "inChan";
     static constexpr const char* XML_OUTCHAN = "outChan";
+    static constexpr const char* XML_TRANSFORM = "transform";
+};
+
+// ============================================================================
+
+/* MidiFilter rules compiled to plain data with lookup tables, for evaluating
+ * in the JACK thread without allocating, refcounting or copying events.
+ * Compiled from a MidiFilter in the GUI thread with compile(). The transform
+ * pipeline of the filter is not included. */
+struct MidiFilterCompiled
+{
+    MidiFilterCompiled();
+
+    // Zone values the note, velocity and pitchbend tables are built from. May
+    // be changed (e.g. by scripts) followed by updateZone(). The velocity
+    // range of the filter itself is part of its velocity map, so lowVel and
+    // highVel are compiled as 0 and 127.
+    int lowNote = 0;
+    int highNote = 127;
+    int add = 0;
+    int lowVel = 0;
+    int highVel = 127;
+    int pitchDownMax = MIDI_PITCHBEND_SIGNED_MIN;
+    int pitchUpMax = MIDI_PITCHBEND_SIGNED_MAX;
+
+    uint32_t ccPass[4];          // Bit per CC number (128 bits)
+    uint16_t channelMask = 0xFFFF; // Bit per input channel that passes
+    int outChan = -1;            // -1 = original
+    bool passProg = false;
+    bool passPitchbend = true;
+    bool ignoreGlobalTranspose = false;
+    uint8_t velocityCurve[128];  // Velocity map of the zone
+
+    // Built by updateZone()
+    int16_t noteTable[128];      // Output note, -1 if blocked
+    uint8_t velocityTable[128];  // Output velocity, 0 if blocked
+    float pitchDownScale = 1;
+    float pitchUpScale = 1;
+
+    void compile(const MidiFilter& filter);
+    void updateZone();
+    bool process(KonfytRtMidiEvent* ev) const;
 };
 
 #endif // KONFYT_MIDI_FILTER_H
@@ -0,0 +1,161 @@
+/******************************************************************************
+ *
+ * Copyright 2026 Gideon van der Kolf
+ *
+ * This file is part of Konfyt.
+ *
+ *     Konfyt is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     Konfyt is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with Konfyt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+
+#include "konfytMidiScheduler.h"
+
+#include <string.h>
+#include <utility>
+
+KonfytMidiScheduler::~KonfytMidiScheduler()
+{
+    delete[] sysexPool;
+}
+
+/* Set the maximum number of scheduled events and clear the queue. Not
+ * realtime safe. */
+void KonfytMidiScheduler::setCapacity(int capacity)
+{
+    items.setCapacity(capacity);
+    if (!sysexPool) {
+        sysexPool = new unsigned char[KONFYT_MIDI_SCHEDULER_SYSEX_BYTES];
+    }
+    sysexUsed = 0;
+}
+
+/* Schedule event at the absolute frame time. Long data is copied. Returns false
+ * if the queue or SysEx pool is full, in which case the event is dropped. */
+bool KonfytMidiScheduler::push(const KonfytRtMidiEvent &ev, uint32_t frame)
+{
+    int sysexOffset = -1;
+    if (ev.longData()) {
+        if ( !sysexPool || (items.isFull())
+             || (sysexUsed + ev.dataSize() > KONFYT_MIDI_SCHEDULER_SYSEX_BYTES) )
+        {
+            mDropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        sysexOffset = sysexUsed;
+    }
+    Item* item = items.grow(1);
+    if (!item) {
+        mDropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    item->frame = frame;
+    item->seq = seqCounter++;
+    item->ev = ev;
+    item->sysexOffset = sysexOffset;
+    if (sysexOffset >= 0) {
+        memcpy(sysexPool + sysexOffset, ev.longData(), ev.dataSize());
+        sysexUsed += ev.dataSize();
+        item->ev.setLongData(nullptr); // Pool may be compacted, see popDue()
+    }
+
+    int i = items.count() - 1;
+
+    // Sift up
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!before(items[i], items[parent])) { break; }
+        std::swap(items[i], items[parent]);
+        i = parent;
+    }
+    return true;
+}
+
+/* If the earliest event is due before endFrame, remove it from the queue,
+ * return it in ev and frame and return true. Otherwise return false. Long data
+ * is copied to the arena; if the arena is full the returned event is
+ * invalid. */
+bool KonfytMidiScheduler::popDue(uint32_t endFrame, KonfytRtMidiEvent *ev,
+                                 uint32_t *frame, KonfytRtSysexArena *arena)
+{
+    if (items.isEmpty()) { return false; }
+    if ((int32_t)(items[0].frame - endFrame) >= 0) { return false; }
+
+    *ev = items[0].ev;
+    *frame = items[0].frame;
+
+    int sysexOffset = items[0].sysexOffset;
+    if (sysexOffset >= 0) {
+        ev->setLongData(sysexPool + sysexOffset);
+        ev->storeLongData(arena);
+        // Compact the pool
+        int size = ev->dataSize();
+        memmove(sysexPool + sysexOffset, sysexPool + sysexOffset + size,
+                sysexUsed - sysexOffset - size);
+        sysexUsed -= size;
+        for (int i = 1; i < items.count(); i++) {
+            if (items[i].sysexOffset > sysexOffset) {
+                items[i].sysexOffset -= size;
+            }
+        }
+    }
+
+    items[0] = items[items.count() - 1];
+    items.removeLast();
+    int count = items.count();
+    if (count > 0) {
+        // Sift down
+        int i = 0;
+        while (true) {
+            int left = 2*i + 1;
+            int right = left + 1;
+            int smallest = i;
+            if ( (left < count) && before(items[left], items[smallest]) ) {
+                smallest = left;
+            }
+            if ( (right < count) && before(items[right], items[smallest]) ) {
+                smallest = right;
+            }
+            if (smallest == i) { break; }
+            std::swap(items[i], items[smallest]);
+            i = smallest;
+        }
+    }
+    return true;
+}
+
+void KonfytMidiScheduler::clear()
+{
+    items.clear();
+    sysexUsed = 0;
+}
+
+int KonfytMidiScheduler::count() const
+{
+    return items.count();
+}
+
+/* Number of events dropped by push() because the queue or SysEx pool was
+ * full. */
+uint32_t KonfytMidiScheduler::droppedCount() const
+{
+    return mDropped.load(std::memory_order_relaxed);
+}
+
+bool KonfytMidiScheduler::before(const Item &a, const Item &b)
+{
+    int32_t diff = (int32_t)(a.frame - b.frame);
+    if (diff != 0) { return diff < 0; }
+    return (int32_t)(a.seq - b.seq) < 0;
+}
@@ -0,0 +1,78 @@
+/******************************************************************************
+ *
+ * Copyright 2026 Gideon van der Kolf
+ *
+ * This file is part of Konfyt.
+ *
+ *     Konfyt is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     Konfyt is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with Konfyt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+
+#ifndef KONFYT_MIDI_SCHEDULER_H
+#define KONFYT_MIDI_SCHEDULER_H
+
+#include "konfytRtList.h"
+#include "konfytRtMidiEvent.h"
+
+#include <atomic>
+#include <stdint.h>
+
+#define KONFYT_MIDI_SCHEDULER_SIZE 256
+#define KONFYT_MIDI_SCHEDULER_INLINE 4
+#define KONFYT_MIDI_SCHEDULER_SYSEX_BYTES 16384
+
+/* Preallocated priority queue (binary min-heap) of MIDI events scheduled at
+ * absolute JACK frame times in future cycles. Events with the same frame time
+ * are output in the order they were scheduled. Frame time comparisons allow
+ * for wrap-around of the 32-bit JACK frame counter.
+ * The long data (SysEx) of scheduled events is copied to a preallocated pool of
+ * KONFYT_MIDI_SCHEDULER_SYSEX_BYTES, and to the cycle's arena when due.
+ * The capacity is set with setCapacity() outside the JACK thread and
+ * droppedCount() may be read from any thread; otherwise for use in the JACK
+ * thread only. */
+class KonfytMidiScheduler
+{
+public:
+    KonfytMidiScheduler() {}
+    KonfytMidiScheduler(const KonfytMidiScheduler&) = delete;
+    KonfytMidiScheduler& operator=(const KonfytMidiScheduler&) = delete;
+    ~KonfytMidiScheduler();
+
+    void setCapacity(int capacity);
+    bool push(const KonfytRtMidiEvent& ev, uint32_t frame);
+    bool popDue(uint32_t endFrame, KonfytRtMidiEvent* ev, uint32_t* frame,
+                KonfytRtSysexArena* arena);
+    void clear();
+    int count() const;
+    uint32_t droppedCount() const;
+
+private:
+    struct Item
+    {
+        uint32_t frame;
+        uint32_t seq;
+        KonfytRtMidiEvent ev; // Long data in pool, see sysexOffset
+        int sysexOffset;
+    };
+    KonfytRtList<Item, KONFYT_MIDI_SCHEDULER_INLINE> items;
+    unsigned char* sysexPool = nullptr;
+    int sysexUsed = 0;
+    uint32_t seqCounter = 0;
+    std::atomic<uint32_t> mDropped {0};
+
+    static bool before(const Item& a, const Item& b);
+};
+
+#endif // KONFYT_MIDI_SCHEDULER_H
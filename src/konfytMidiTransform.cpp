@@ -0,0 +1,427 @@
+/******************************************************************************
+ *
+ * Copyright 2026 Gideon van der Kolf
+ *
+ * This file is part of Konfyt.
+ *
+ *     Konfyt is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     Konfyt is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with Konfyt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+
+#include "konfytMidiTransform.h"
+
+#include <QRegularExpression>
+
+
+bool KonfytMidiTransformProgram::isEmpty() const
+{
+    return mOpCount == 0;
+}
+
+int KonfytMidiTransformProgram::opCount() const
+{
+    return mOpCount;
+}
+
+void KonfytMidiTransformProgram::clear()
+{
+    mOpCount = 0;
+    mTableCount = 0;
+}
+
+bool KonfytMidiTransformProgram::addOp(const Op &op)
+{
+    if (mOpCount >= KONFYT_TRANSFORM_MAX_OPS) { return false; }
+    ops[mOpCount++] = op;
+    return true;
+}
+
+/* Add a 128-value lookup table. Returns the table index, or -1 if the maximum
+ * number of tables has been reached. */
+int KonfytMidiTransformProgram::addTable(const uint8_t *values)
+{
+    if (mTableCount >= KONFYT_TRANSFORM_MAX_TABLES) { return -1; }
+    for (int i = 0; i < 128; i++) {
+        tables[mTableCount][i] = values[i];
+    }
+    return mTableCount++;
+}
+
+/* Apply the operations to the first count events of the array, which has space
+ * for maxCount events. Events added by operations beyond maxCount are dropped.
+ * Returns the resulting number of events. */
+int KonfytMidiTransformProgram::process(KonfytRtMidiEvent *events, int count,
+                                        int maxCount) const
+{
+    for (int o = 0; o < mOpCount; o++) {
+        const Op& op = ops[o];
+        // Events added by this operation are not processed by it again
+        int n = count;
+
+        switch (op.type) {
+
+        case OpNotes:
+            for (int i = 0; i < count; ) {
+                int note = events[i].note();
+                if ( isNoteEvent(events[i]) && ((note < op.args[0]) || (note > op.args[1])) ) {
+                    count = remove(events, count, i);
+                } else {
+                    i++;
+                }
+            }
+            break;
+
+        case OpVelocities:
+            for (int i = 0; i < count; ) {
+                int vel = events[i].velocity();
+                if ( (events[i].type() == MIDI_EVENT_TYPE_NOTEON)
+                     && ((vel < op.args[0]) || (vel > op.args[1])) ) {
+                    count = remove(events, count, i);
+                } else {
+                    i++;
+                }
+            }
+            break;
+
+        case OpTranspose:
+            for (int i = 0; i < count; ) {
+                if (!isNoteEvent(events[i])) { i++; continue; }
+                int note = events[i].note() + op.args[0];
+                if ( (note < 0) || (note > 127) ) {
+                    count = remove(events, count, i);
+                } else {
+                    events[i].setNote(note);
+                    i++;
+                }
+            }
+            break;
+
+        case OpVelocityMap:
+            for (int i = 0; i < count; i++) {
+                if (events[i].type() != MIDI_EVENT_TYPE_NOTEON) { continue; }
+                events[i].setVelocity(tables[op.table][events[i].velocity() & 0x7F]);
+            }
+            break;
+
+        case OpCcRemap:
+            for (int i = 0; i < count; i++) {
+                if ( (events[i].type() == MIDI_EVENT_TYPE_CC)
+                     && (events[i].data1() == op.args[0]) ) {
+                    events[i].setData1(op.args[1]);
+                }
+            }
+            break;
+
+        case OpCcValueMap:
+            for (int i = 0; i < count; i++) {
+                if (events[i].type() != MIDI_EVENT_TYPE_CC) { continue; }
+                if ( (op.args[0] >= 0) && (events[i].data1() != op.args[0]) ) { continue; }
+                events[i].setData2(tables[op.table][events[i].data2() & 0x7F]);
+            }
+            break;
+
+        case OpChannel:
+            for (int i = 0; i < count; i++) {
+                events[i].channel = op.args[0];
+            }
+            break;
+
+        case OpChord:
+            for (int i = 0; i < n; i++) {
+                if (!isNoteEvent(events[i])) { continue; }
+                for (int a = 0; a < op.argCount; a++) {
+                    int note = events[i].note() + op.args[a];
+                    if ( (note < 0) || (note > 127) ) { continue; }
+                    if (count >= maxCount) { break; }
+                    events[count] = events[i];
+                    events[count].setNote(note);
+                    count++;
+                }
+            }
+            break;
+
+        case OpFanout:
+            for (int i = 0; i < n; i++) {
+                for (int a = 1; a < op.argCount; a++) {
+                    if (count >= maxCount) { break; }
+                    events[count] = events[i];
+                    events[count].channel = op.args[a];
+                    count++;
+                }
+                events[i].channel = op.args[0];
+            }
+            break;
+
+        case OpDrop:
+            for (int i = 0; i < count; ) {
+                bool drop = (events[i].type() == op.args[0]);
+                if ( drop && (op.args[0] == MIDI_EVENT_TYPE_CC) && (op.args[1] >= 0) ) {
+                    drop = (events[i].data1() == op.args[1]);
+                }
+                if (drop) {
+                    count = remove(events, count, i);
+                } else {
+                    i++;
+                }
+            }
+            break;
+        }
+    }
+
+    return count;
+}
+
+bool KonfytMidiTransformProgram::isNoteEvent(const KonfytRtMidiEvent &ev)
+{
+    int t = ev.type();
+    return (t == MIDI_EVENT_TYPE_NOTEON) || (t == MIDI_EVENT_TYPE_NOTEOFF)
+            || (t == MIDI_EVENT_TYPE_POLY_AFTERTOUCH);
+}
+
+/* Remove the event at index, keeping the order of the rest. Returns the new
+ * count. */
+int KonfytMidiTransformProgram::remove(KonfytRtMidiEvent *events, int count, int index)
+{
+    for (int i = index; i < count - 1; i++) {
+        events[i] = events[i + 1];
+    }
+    return count - 1;
+}
+
+// ============================================================================
+
+/* Set and compile the pipeline text. If compilation fails, the previous
+ * pipeline is kept, false is returned and error is set. */
+bool KonfytMidiTransform::setText(QString text, QString *error)
+{
+    KonfytMidiTransformProgram program;
+    if (!compile(text, &program, error)) { return false; }
+    mText = text;
+    mProgram = program;
+    return true;
+}
+
+QString KonfytMidiTransform::text() const
+{
+    return mText;
+}
+
+bool KonfytMidiTransform::isEmpty() const
+{
+    return mProgram.isEmpty();
+}
+
+const KonfytMidiTransformProgram &KonfytMidiTransform::program() const
+{
+    return mProgram;
+}
+
+bool KonfytMidiTransform::compile(QString text, KonfytMidiTransformProgram *program,
+                                  QString *error)
+{
+    program->clear();
+
+    QString err;
+    QStringList lines = text.split(QRegularExpression("[\\n;]"));
+    for (int iLine = 0; iLine < lines.count(); iLine++) {
+
+        QString line = lines[iLine];
+        int comment = line.indexOf('#');
+        if (comment >= 0) { line = line.left(comment); }
+        QStringList tokens = line.split(QRegularExpression("\\s+"),
+                                        QString::SkipEmptyParts);
+        if (tokens.isEmpty()) { continue; }
+
+        QString name = tokens.takeFirst().toLower();
+        KonfytMidiTransformProgram::Op op;
+        op.argCount = 0;
+        op.table = -1;
+
+        // Parse integer arguments, except for curves
+        QList<int> args;
+        bool numeric = true;
+        if ( (name != "velocity") && (name != "ccvalue") && (name != "drop") ) {
+            foreach (QString t, tokens) {
+                bool ok = false;
+                args.append(t.toInt(&ok));
+                if (!ok) { numeric = false; }
+            }
+        }
+        if (!numeric) {
+            err = "Invalid number";
+        } else if (args.count() > KONFYT_TRANSFORM_MAX_ARGS) {
+            err = QString("Too many arguments (max %1)").arg(KONFYT_TRANSFORM_MAX_ARGS);
+        }
+
+        if (!err.isEmpty()) {
+            // Argument error
+        } else if ( (name == "notes") || (name == "velocities") ) {
+            if (args.count() != 2) {
+                err = "Expected low and high values";
+            } else {
+                op.type = (name == "notes") ? KonfytMidiTransformProgram::OpNotes
+                                            : KonfytMidiTransformProgram::OpVelocities;
+            }
+        } else if (name == "transpose") {
+            if (args.count() != 1) {
+                err = "Expected number of semitones";
+            } else {
+                op.type = KonfytMidiTransformProgram::OpTranspose;
+            }
+        } else if (name == "velocity") {
+            uint8_t table[128];
+            if (parseCurve(tokens, table, 1, &err)) {
+                op.type = KonfytMidiTransformProgram::OpVelocityMap;
+                op.table = program->addTable(table);
+                if (op.table < 0) { err = "Too many curves"; }
+            }
+        } else if (name == "cc") {
+            if ( (args.count() != 2) || (args[0] < 0) || (args[0] > 127)
+                 || (args[1] < 0) || (args[1] > 127) ) {
+                err = "Expected CC numbers (0-127) to remap from and to";
+            } else {
+                op.type = KonfytMidiTransformProgram::OpCcRemap;
+            }
+        } else if (name == "ccvalue") {
+            bool ok = false;
+            int cc = tokens.value(0).toInt(&ok);
+            ok = ok && (cc >= 0) && (cc <= 127);
+            if (tokens.value(0) == "all") {
+                cc = -1;
+                ok = true;
+            }
+            if (!ok) {
+                err = "Expected CC number or \"all\"";
+            } else {
+                uint8_t table[128];
+                if (parseCurve(tokens.mid(1), table, 0, &err)) {
+                    op.type = KonfytMidiTransformProgram::OpCcValueMap;
+                    args = {cc};
+                    op.table = program->addTable(table);
+                    if (op.table < 0) { err = "Too many curves"; }
+                }
+            }
+        } else if ( (name == "channel") || (name == "fanout") ) {
+            if (args.isEmpty() || ((name == "channel") && (args.count() != 1))) {
+                err = "Expected channel (1-16)";
+            }
+            for (int i = 0; i < args.count(); i++) {
+                if ( (args[i] < 1) || (args[i] > 16) ) {
+                    err = "Channels must be 1-16";
+                }
+                // Scripting and GUI channels are 1-16, KonfytMidiEvent uses 0-15
+                args[i] -= 1;
+            }
+            op.type = (name == "channel") ? KonfytMidiTransformProgram::OpChannel
+                                          : KonfytMidiTransformProgram::OpFanout;
+        } else if (name == "chord") {
+            if (args.isEmpty()) {
+                err = "Expected intervals";
+            } else {
+                op.type = KonfytMidiTransformProgram::OpChord;
+            }
+        } else if (name == "drop") {
+            QString type = tokens.value(0).toLower();
+            int cc = -1;
+            if (tokens.count() > 1) {
+                bool ok = false;
+                cc = tokens[1].toInt(&ok);
+                if (!ok || (type != "cc")) { err = "Invalid CC number"; }
+            }
+            int typeValue = -1;
+            if (type == "cc") { typeValue = MIDI_EVENT_TYPE_CC; }
+            else if (type == "pitchbend") { typeValue = MIDI_EVENT_TYPE_PITCHBEND; }
+            else if (type == "program") { typeValue = MIDI_EVENT_TYPE_PROGRAM; }
+            else if (type == "aftertouch") { typeValue = MIDI_EVENT_TYPE_AFTERTOUCH; }
+            else if (type == "polyaftertouch") { typeValue = MIDI_EVENT_TYPE_POLY_AFTERTOUCH; }
+            else if (type == "sysex") { typeValue = MIDI_EVENT_TYPE_SYSTEM; }
+            if (typeValue < 0) {
+                err = "Unknown event type: " + type;
+            } else {
+                op.type = KonfytMidiTransformProgram::OpDrop;
+                args = {typeValue, cc};
+            }
+        } else {
+            err = "Unknown operation: " + name;
+        }
+
+        if (err.isEmpty()) {
+            op.argCount = args.count();
+            for (int i = 0; i < args.count(); i++) {
+                op.args[i] = args[i];
+            }
+            if (!program->addOp(op)) {
+                err = QString("Too many operations (max %1)").arg(KONFYT_TRANSFORM_MAX_OPS);
+            }
+        }
+
+        if (!err.isEmpty()) {
+            if (error) { *error = QString("Line %1: %2").arg(iLine + 1).arg(err); }
+            program->clear();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* Build a lookup table from "in:out" points, linear between points and
+ * constant beyond the first and last points. */
+bool KonfytMidiTransform::parseCurve(const QStringList &points, uint8_t *table,
+                                     int minOut, QString *error)
+{
+    QList<int> ins;
+    QList<int> outs;
+    foreach (QString p, points) {
+        QStringList parts = p.split(':');
+        bool ok1 = false;
+        bool ok2 = false;
+        int in = parts.value(0).toInt(&ok1);
+        int out = parts.value(1).toInt(&ok2);
+        if ( (parts.count() != 2) || !ok1 || !ok2 || (in < 0) || (in > 127)
+             || (out < 0) || (out > 127) ) {
+            *error = "Invalid curve point " + p + " (expected in:out, 0-127)";
+            return false;
+        }
+        // Insert sorted by input value
+        int i = 0;
+        while ( (i < ins.count()) && (ins[i] < in) ) { i++; }
+        ins.insert(i, in);
+        outs.insert(i, out);
+    }
+    if (ins.isEmpty()) {
+        *error = "Expected curve points (in:out)";
+        return false;
+    }
+
+    int seg = 0;
+    for (int x = 0; x < 128; x++) {
+        while ( (seg < ins.count() - 1) && (x > ins[seg + 1]) ) { seg++; }
+        int y;
+        if (x <= ins.first()) {
+            y = outs.first();
+        } else if (x >= ins.last()) {
+            y = outs.last();
+        } else {
+            int x0 = ins[seg];
+            int x1 = ins[seg + 1];
+            int y0 = outs[seg];
+            int y1 = outs[seg + 1];
+            y = (x1 == x0) ? y1 : y0 + (y1 - y0) * (x - x0) / (x1 - x0);
+        }
+        table[x] = qBound(minOut, y, 127);
+    }
+    return true;
+}
@@ -0,0 +1,121 @@
+/******************************************************************************
+ *
+ * Copyright 2026 Gideon van der Kolf
+ *
+ * This file is part of Konfyt.
+ *
+ *     Konfyt is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     Konfyt is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with Konfyt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+
+#ifndef KONFYT_MIDI_TRANSFORM_H
+#define KONFYT_MIDI_TRANSFORM_H
+
+#include "konfytRtMidiEvent.h"
+
+#include <QString>
+#include <QStringList>
+
+#include <stdint.h>
+
+#define KONFYT_TRANSFORM_MAX_OPS 32
+#define KONFYT_TRANSFORM_MAX_TABLES 8
+#define KONFYT_TRANSFORM_MAX_ARGS 16
+#define KONFYT_TRANSFORM_MAX_EVENTS 32
+
+/* Compiled MIDI transform pipeline: a flat array of operations applied in
+ * order to a fixed-size array of events. An event may be modified, dropped or
+ * expanded into multiple events. Realtime safe: no allocation or locking, for
+ * use in the JACK thread. */
+class KonfytMidiTransformProgram
+{
+public:
+    enum OpType {
+        OpNotes,        // Keep note events in note range [lo, hi]
+        OpVelocities,   // Keep note-ons in velocity range [lo, hi]
+        OpTranspose,    // Transpose note events, drop if out of range
+        OpVelocityMap,  // Map note-on velocity through table
+        OpCcRemap,      // Change CC number
+        OpCcValueMap,   // Map value of CC (or all CCs if -1) through table
+        OpChannel,      // Set channel
+        OpChord,        // Add note-ons/poly aftertouch at intervals
+        OpFanout,       // Copy events to each of a list of channels
+        OpDrop          // Drop events of type (and CC number)
+    };
+
+    struct Op {
+        OpType type;
+        int16_t args[KONFYT_TRANSFORM_MAX_ARGS];
+        uint8_t argCount;
+        int8_t table; // Index in tables, -1 if none
+    };
+
+    bool isEmpty() const;
+    int opCount() const;
+    void clear();
+    bool addOp(const Op& op);
+    int addTable(const uint8_t* values);
+
+    int process(KonfytRtMidiEvent* events, int count, int maxCount) const;
+
+private:
+    Op ops[KONFYT_TRANSFORM_MAX_OPS];
+    int mOpCount = 0;
+    uint8_t tables[KONFYT_TRANSFORM_MAX_TABLES][128];
+    int mTableCount = 0;
+
+    static bool isNoteEvent(const KonfytRtMidiEvent& ev);
+    static int remove(KonfytRtMidiEvent* events, int count, int index);
+};
+
+// ============================================================================
+
+/* Declarative MIDI transform pipeline, as stored in the project. The text has
+ * one operation per line (or separated by ';'). Text after '#' is ignored.
+ *
+ *   notes <lo> <hi>            Keep notes in range (split)
+ *   velocities <lo> <hi>       Keep note-ons with velocity in range
+ *   transpose <semitones>
+ *   velocity <in>:<out> ...    Velocity curve, linear between points
+ *   cc <from> <to>             Remap CC number
+ *   ccvalue <cc|all> <in>:<out> ...
+ *                              CC value curve
+ *   channel <1-16>             Set channel
+ *   chord <interval> ...       Add notes at intervals (semitones)
+ *   fanout <1-16> ...          Send events to each of the channels
+ *   drop <type> [cc]           Drop cc, pitchbend, program, aftertouch,
+ *                              polyaftertouch or sysex events
+ *
+ * The text is compiled into a KonfytMidiTransformProgram when it is set. */
+class KonfytMidiTransform
+{
+public:
+    bool setText(QString text, QString* error = nullptr);
+    QString text() const;
+    bool isEmpty() const;
+    const KonfytMidiTransformProgram& program() const;
+
+    static bool compile(QString text, KonfytMidiTransformProgram* program,
+                        QString* error);
+
+private:
+    QString mText;
+    KonfytMidiTransformProgram mProgram;
+
+    static bool parseCurve(const QStringList& points, uint8_t* table,
+                           int minOut, QString* error);
+};
+
+#endif // KONFYT_MIDI_TRANSFORM_H
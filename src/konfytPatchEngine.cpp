@@ -39,7 +39,7 @@ void KonfytPatchEngine::initPatchEngine(KonfytJackEngine* jackEngine,
     this->jack = jackEngine;
     this->scriptEngine = scriptEngine;
 
-    setupAndInitFluidsynthEngine();
+    setupAndInitFluidsynthEngine(appInfo);
     setupAndInitSfzEngine(appInfo);
 }
 
@@ -64,6 +64,10 @@ void KonfytPatchEngine::setProject(ProjectPtr project)
             this, &KonfytPatchEngine::onProjectPatchURIsNeedUdating);
     connect(project.data(), &Project::projectModifiedStateChanged,
             this, &KonfytPatchEngine::onProjectModifiedStateChanged);
+    connect(project.data(), &Project::fluidsynthSettingsChanged,
+            this, &KonfytPatchEngine::onProjectFluidsynthSettingsChanged);
+
+    onProjectFluidsynthSettingsChanged();
 
     onProjectPatchURIsNeedUdating();
 }
@@ -188,6 +192,7 @@ void KonfytPatchEngine::loadPatch(PatchPtr patch)
     foreach (PatchLayerPtr layer, patch->layers()) {
         updateLayerRouting(layer);
         updateLayerGain(layer);
+        updateLayerSends(layer);
         updateLayerPatchMidiFilterInJackEngine(patch, layer);
     }
 
@@ -491,9 +496,16 @@ void KonfytPatchEngine::updateLayerGain(PatchLayerPtr layer)
 
         PatchLayer::SfzData pluginData = layer->sfzData;
         if (pluginData.indexInEngine == -1) { return; } // Layer not loaded yet
-        // Set gain of JACK ports instead of sfzEngine->setGain() since this
-        // isn't implemented for all engine types yet.
-        jack->setPluginGain(pluginData.portsInJackEngine, konfytConvertGain(layer->gain()) );
+        float gain = konfytConvertGain(layer->gain());
+        if (sfzEngine->hasNativeGain()) {
+            // Gain is applied at the source. Audio received in JACK engine is
+            // then mixed at unity gain.
+            sfzEngine->setGain(pluginData.indexInEngine, gain);
+            jack->setPluginGain(pluginData.portsInJackEngine, 1.0);
+        } else {
+            // Engine can't apply gain itself. Set gain of JACK ports instead.
+            jack->setPluginGain(pluginData.portsInJackEngine, gain);
+        }
 
     } else if (layerType == PatchLayer::TypeAudioIn) {
 
@@ -521,6 +533,29 @@ void KonfytPatchEngine::updateLayerGain(PatchLayerPtr layer)
     }
 }
 
+/* Set the layer's send levels on its audio routes, which feed the shared send
+ * effects of the layer's bus. */
+void KonfytPatchEngine::updateLayerSends(PatchLayerPtr layer)
+{
+    if (layer->hasError()) { return; }
+
+    QList<KfJackAudioRoute*> routes;
+    PatchLayer::LayerType layerType = layer->layerType();
+    if (layerType == PatchLayer::TypeSoundfontProgram) {
+        routes = jack->getPluginAudioRoutes(layer->soundfontData.portsInJackEngine);
+    } else if (layerType == PatchLayer::TypeSfz) {
+        routes = jack->getPluginAudioRoutes(layer->sfzData.portsInJackEngine);
+    } else if (layerType == PatchLayer::TypeAudioIn) {
+        routes.append(layer->audioInPortData.jackRouteLeft);
+        routes.append(layer->audioInPortData.jackRouteRight);
+    }
+
+    foreach (KfJackAudioRoute* route, routes) {
+        if (route == nullptr) { continue; } // Layer not loaded yet
+        jack->setAudioRouteSends(route, layer->reverbSend(), layer->chorusSend());
+    }
+}
+
 void KonfytPatchEngine::activatePatchLayerRoutesForSoloMute(PatchPtr patch)
 {
     if (!patch) { return; }
@@ -635,7 +670,7 @@ void KonfytPatchEngine::updateLayerBlockMidiDirectThroughInJack(PatchLayerPtr pa
     }
 }
 
-void KonfytPatchEngine::setupAndInitFluidsynthEngine()
+void KonfytPatchEngine::setupAndInitFluidsynthEngine(KonfytAppInfo appInfo)
 {
     connect(&fluidsynthEngine, &KonfytFluidsynthEngine::print,
             this, [=](QString msg)
@@ -643,6 +678,7 @@ void KonfytPatchEngine::setupAndInitFluidsynthEngine()
         print("Fluidsynth: " + msg);
     });
     fluidsynthEngine.initFluidsynth(jack->getSampleRate());
+    fluidsynthEngine.setSharedSynths(appInfo.sharedFluidsynth);
     jack->setFluidsynthEngine(&fluidsynthEngine);
 }
 
@@ -653,6 +689,16 @@ void KonfytPatchEngine::setupAndInitSfzEngine(KonfytAppInfo appInfo)
         sfzEngine = new KonfytBridgeEngine();
         static_cast<KonfytBridgeEngine*>(sfzEngine)->setKonfytExePath(
                     appInfo.exePath);
+        static_cast<KonfytBridgeEngine*>(sfzEngine)->setStatusFilePath(
+                    appInfo.bridgeStatusFile);
+        static_cast<KonfytBridgeEngine*>(sfzEngine)->setStatusFileHook([=]()
+        {
+            return jack->getStatusJson();
+        });
+    }
+    else if (appInfo.nativeSfz) {
+        // Use built-in sampler
+        sfzEngine = new KonfytSfzEngine();
     }
 #ifdef KONFYT_USE_CARLA
     else if (appInfo.carla) {
@@ -725,6 +771,18 @@ void KonfytPatchEngine::setLayerGain(PatchLayerPtr patchLayer, float newGain)
     updateLayerGain(patchLayer);
 }
 
+void KonfytPatchEngine::setLayerSends(PatchLayerPtr patchLayer, float reverb,
+                                      float chorus)
+{
+    KONFYT_ASSERT_RETURN(mCurrentPatch);
+    KONFYT_ASSERT_RETURN(!patchLayer.isNull());
+
+    patchLayer->setReverbSend(reverb);
+    patchLayer->setChorusSend(chorus);
+
+    updateLayerSends(patchLayer);
+}
+
 void KonfytPatchEngine::setLayerGain(int layerIndex, float newGain)
 {
     KONFYT_ASSERT_RETURN(mCurrentPatch);
@@ -916,18 +974,29 @@ void KonfytPatchEngine::loadSfzLayer(PatchLayerPtr layer)
 
     layer->sfzData.indexInEngine = ID;
 
-    // Give port details to JACK which will:
-    // - create a midi output port and connect it to the plugin midi input port,
-    // - create audio input ports and connect it to the plugin audio output ports.
-    // - assign the midi filter
-    KonfytJackPortsSpec spec;
-    spec.name = sfzEngine->pluginName(ID);;
-    spec.midiOutConnectTo = sfzEngine->midiInJackPortName(ID);
-    spec.midiFilter = layer->midiFilter();
-    QStringList audioLR = sfzEngine->audioOutJackPortNames(ID);
-    spec.audioInLeftConnectTo = audioLR.value(0);
-    spec.audioInRightConnectTo = audioLR.value(1);
-    KfJackPluginPorts* jackPorts = jack->addPluginPortsAndConnect( spec );
+    KfJackPluginPorts* jackPorts = nullptr;
+    KonfytBridgeShm* bridge = sfzEngine->bridgeTransport(ID);
+    KonfytSfzInstrument* instrument = sfzEngine->nativeInstrument(ID);
+    if (bridge) {
+        // Engine renders through shared memory instead of JACK ports.
+        jackPorts = jack->addBridgePlugin(bridge, layer->midiFilter());
+    } else if (instrument) {
+        // Instrument is rendered in the JACK process callback.
+        jackPorts = jack->addSfzInstrument(instrument, layer->midiFilter());
+    } else {
+        // Give port details to JACK which will:
+        // - create a midi output port and connect it to the plugin midi input port,
+        // - create audio input ports and connect it to the plugin audio output ports.
+        // - assign the midi filter
+        KonfytJackPortsSpec spec;
+        spec.name = sfzEngine->pluginName(ID);;
+        spec.midiOutConnectTo = sfzEngine->midiInJackPortName(ID);
+        spec.midiFilter = layer->midiFilter();
+        QStringList audioLR = sfzEngine->audioOutJackPortNames(ID);
+        spec.audioInLeftConnectTo = audioLR.value(0);
+        spec.audioInRightConnectTo = audioLR.value(1);
+        jackPorts = jack->addPluginPortsAndConnect( spec );
+    }
     layer->sfzData.portsInJackEngine = jackPorts;
 
     // Add to script engine
@@ -943,7 +1012,8 @@ void KonfytPatchEngine::loadSoundfontLayer(PatchLayerPtr layer)
     layer->soundfontData.synthInEngine =
             fluidsynthEngine.addSoundfontProgram(
                 layer->soundfontData.soundfontFilePath,
-                layer->soundfontData.program);
+                layer->soundfontData.program,
+                layer->soundfontData.settings);
     if (!layer->soundfontData.synthInEngine) {
         layer->setErrorMessage("Failed to load soundfont.");
         return;
@@ -1071,3 +1141,11 @@ void KonfytPatchEngine::onProjectModifiedStateChanged(bool modified)
     }
 }
 
+/* Project-wide Fluidsynth settings also apply to loaded layers that do not
+ * set them themselves. */
+void KonfytPatchEngine::onProjectFluidsynthSettingsChanged()
+{
+    fluidsynthEngine.setDefaultSettings(mCurrentProject->getFluidsynthSettings());
+    fluidsynthEngine.setVoiceBudget(mCurrentProject->getFluidsynthVoiceBudget());
+}
+
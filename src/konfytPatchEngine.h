@@ -30,6 +30,7 @@
 #include "konfytLscpEngine.h"
 #include "konfytPatch.h"
 #include "konfytProject.h"
+#include "konfytSfzEngine.h"
 #ifdef KONFYT_USE_CARLA
     #include "konfytCarlaEngine.h"
 #endif
@@ -79,6 +80,7 @@ public:
     void setLayerGain(int layerIndex, float newGain);
     void setLayerGainByMidi(int layerIndex, int midiValue);
     void setLayerGainByMidiRelative(int layerIndex, int midiValue);
+    void setLayerSends(PatchLayerPtr patchLayer, float reverb, float chorus);
     void setLayerSolo(PatchLayerPtr patchLayer, bool solo);
     void setLayerSolo(int layerIndex, bool solo);
     void setLayerMute(PatchLayerPtr patchLayer, bool mute);
@@ -125,6 +127,7 @@ private:
     void loadMidiOutputPort(PatchLayerPtr layer);
     void updateLayerRouting(PatchLayerPtr layer);
     void updateLayerGain(PatchLayerPtr layer);
+    void updateLayerSends(PatchLayerPtr layer);
     void activatePatchLayerRoutesForSoloMute(PatchPtr patch);
     void setLayerActive(PatchLayerPtr layer, bool active);
     void updateLayerPatchMidiFilterInJackEngine(PatchPtr patch,
@@ -133,7 +136,7 @@ private:
     void updateLayerBlockMidiDirectThroughInJack(PatchLayerPtr patchLayer);
 
     KonfytFluidsynthEngine fluidsynthEngine;
-    void setupAndInitFluidsynthEngine();
+    void setupAndInitFluidsynthEngine(KonfytAppInfo appInfo);
 
     KonfytBaseSoundEngine* sfzEngine;
     void setupAndInitSfzEngine(KonfytAppInfo appInfo);
@@ -148,6 +151,7 @@ private slots:
     void onSfzEngineInitDone(QString error);
     void onProjectPatchURIsNeedUdating();
     void onProjectModifiedStateChanged(bool modified);
+    void onProjectFluidsynthSettingsChanged();
 };
 
 #endif // KONFYT_PATCH_ENGINE_H
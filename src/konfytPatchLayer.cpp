@@ -164,6 +164,9 @@ Xml PatchLayer::soundfontDataToXml() const
     xml.addTextChild(XML_SF_BANK, n2s(p.bank));
     xml.addTextChild(XML_SF_PROGRAM, n2s(p.program));
     xml.addTextChild(XML_SF_PROGRAM_NAME, soundfontData.program.name);
+    if (soundfontData.settings != KfFluidsynthSettings()) {
+        xml.addChild(soundfontData.settings.toXml());
+    }
 
     addCommonDataToXml(&xml);
 
@@ -177,6 +180,10 @@ void PatchLayer::readSoundfontDataFromXml(Xml xml)
     xml.setIntFromChild(XML_SF_BANK, &sfData.program.bank);
     xml.setIntFromChild(XML_SF_PROGRAM, &sfData.program.program);
     sfData.program.name = xml.childText(XML_SF_PROGRAM_NAME);
+    Xml settingsXml = xml.child(KfFluidsynthSettings::XML_FS_SETTINGS);
+    if (settingsXml.isValid()) {
+        sfData.settings.readFromXml(settingsXml);
+    }
     initLayer(sfData);
 
     readCommonDataFromXml(xml);
@@ -268,6 +275,8 @@ void PatchLayer::addCommonDataToXml(Xml *xml) const
 
     if (hasAudioOutput()) {
         xml->addTextChild(XML_GAIN, n2s(mGain));
+        xml->addTextChild(XML_REVERB_SEND, n2s(mReverbSend));
+        xml->addTextChild(XML_CHORUS_SEND, n2s(mChorusSend));
         xml->addTextChild(XML_BUS, n2s(mBusIdInProject));
     }
 
@@ -292,6 +301,8 @@ void PatchLayer::addCommonDataToXml(Xml *xml) const
 void PatchLayer::readCommonDataFromXml(Xml xml)
 {
     xml.setFloatFromChild(XML_GAIN, &mGain);
+    xml.setFloatFromChild(XML_REVERB_SEND, &mReverbSend);
+    xml.setFloatFromChild(XML_CHORUS_SEND, &mChorusSend);
     xml.setBoolFromChild(XML_SOLO, &mSolo);
     xml.setBoolFromChild(XML_MUTE, &mMute);
     mMidiFilter.readFromXml(xml.child(MidiFilter::XML_MIDIFILTER));
@@ -403,6 +414,26 @@ int PatchLayer::gainMidiPickupRange()
     return gainMidiCtrl.pickupRange;
 }
 
+float PatchLayer::reverbSend() const
+{
+    return mReverbSend;
+}
+
+void PatchLayer::setReverbSend(float level)
+{
+    mReverbSend = level;
+}
+
+float PatchLayer::chorusSend() const
+{
+    return mChorusSend;
+}
+
+void PatchLayer::setChorusSend(float level)
+{
+    mChorusSend = level;
+}
+
 void PatchLayer::setSolo(bool isSolo)
 {
     mSolo = isSolo;
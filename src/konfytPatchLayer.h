@@ -46,6 +46,7 @@ public:
     {
         QString soundfontFilePath;
         KonfytSoundPreset program;
+        KfFluidsynthSettings settings;
         // Runtime variables:
         KfFluidSynth* synthInEngine = nullptr;
         KfJackPluginPorts* portsInJackEngine = nullptr;
@@ -99,6 +100,10 @@ public:
     void setGainByMidi(int value);
     void setGainMidiPickupRange(int range);
     int gainMidiPickupRange();
+    float reverbSend() const;
+    void setReverbSend(float level);
+    float chorusSend() const;
+    void setChorusSend(float level);
     void setSolo(bool isSolo);
     void setMute(bool isMute);
     bool isSolo() const;
@@ -150,6 +155,9 @@ private:
     LayerType mLayerType = TypeUninitialized;
     QString mErrorMessage;
     float mGain = 1.0;
+    // Levels sent to the shared send effects of the bus
+    float mReverbSend = 0;
+    float mChorusSend = 0;
     bool mSolo = false;
     bool mMute = false;
     MidiFilter mMidiFilter;
@@ -215,6 +223,8 @@ public:
     static constexpr const char* XML_AUDIOIN_PORT = "port";
 
     static constexpr const char* XML_GAIN = "gain";
+    static constexpr const char* XML_REVERB_SEND = "reverbSend";
+    static constexpr const char* XML_CHORUS_SEND = "chorusSend";
     static constexpr const char* XML_SOLO = "solo";
     static constexpr const char* XML_MUTE = "mute";
     static constexpr const char* XML_BUS = "bus";
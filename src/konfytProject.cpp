@@ -182,6 +182,16 @@ Result Project::loadProject(QString filepath)
                 projectXml.childText(XML_RESET_OPTION),
                 KonfytReset::Inherit);
     setMidiPickupRange(projectXml.childInt(XML_MIDI_PICKUP_RANGE));
+    mFluidsynthSettings = KfFluidsynthSettings();
+    Xml fsXml = projectXml.child(KfFluidsynthSettings::XML_FS_SETTINGS);
+    if (fsXml.isValid()) {
+        mFluidsynthSettings.readFromXml(fsXml);
+    }
+    mFluidsynthVoiceBudget = KfFluidsynthVoiceBudget();
+    Xml budgetXml = projectXml.child(KfFluidsynthVoiceBudget::XML_FS_VOICE_BUDGET);
+    if (budgetXml.isValid()) {
+        mFluidsynthVoiceBudget.readFromXml(budgetXml);
+    }
 
     // Patches
     readPatchesFromProjectXml(projectXml);
@@ -286,6 +296,34 @@ void Project::setResetOption(KonfytReset option)
     }
 }
 
+KfFluidsynthSettings Project::getFluidsynthSettings()
+{
+    return mFluidsynthSettings;
+}
+
+void Project::setFluidsynthSettings(KfFluidsynthSettings settings)
+{
+    if (settings != mFluidsynthSettings) {
+        mFluidsynthSettings = settings;
+        setModified(true);
+        emit fluidsynthSettingsChanged();
+    }
+}
+
+KfFluidsynthVoiceBudget Project::getFluidsynthVoiceBudget()
+{
+    return mFluidsynthVoiceBudget;
+}
+
+void Project::setFluidsynthVoiceBudget(KfFluidsynthVoiceBudget budget)
+{
+    if (budget != mFluidsynthVoiceBudget) {
+        mFluidsynthVoiceBudget = budget;
+        setModified(true);
+        emit fluidsynthSettingsChanged();
+    }
+}
+
 void Project::addPatch(PatchPtr newPatch)
 {
     mPatches.append(newPatch);
@@ -1712,6 +1750,8 @@ Xml Project::toXml() const
     projectXml.addTextChild(XML_PATCH_LIST_NOTES, bool2str(mShowPatchListNotes));
     projectXml.addTextChild(XML_MIDI_PICKUP_RANGE, n2s(mMidiPickupRange));
     projectXml.addTextChild(XML_RESET_OPTION, konfytResetToString(mResetOption));
+    projectXml.addChild(mFluidsynthSettings.toXml());
+    projectXml.addChild(mFluidsynthVoiceBudget.toXml());
 
     // Patches
     addPatchesToProjectXml(&projectXml);
@@ -150,6 +150,10 @@ public:
     int getMidiPickupRange();
     KonfytReset getResetOption();
     void setResetOption(KonfytReset option);
+    KfFluidsynthSettings getFluidsynthSettings();
+    void setFluidsynthSettings(KfFluidsynthSettings settings);
+    KfFluidsynthVoiceBudget getFluidsynthVoiceBudget();
+    void setFluidsynthVoiceBudget(KfFluidsynthVoiceBudget budget);
 
     // -----------------------------------------------------------------------
     // MIDI input ports
@@ -294,6 +298,7 @@ signals:
     void audioInPortConnectRegexRemoved(AudioPortPtr port, int index, PortLeftRight leftRight);
 
     void midiPickupRangeChanged(int range);
+    void fluidsynthSettingsChanged();
 
     void externalAppAdded(int id);
     void externalAppRemoved(int id);
@@ -354,6 +359,8 @@ private:
     bool mShowPatchListNumbers = true;
     bool mShowPatchListNotes = false;
     int mMidiPickupRange = 127;
+    KfFluidsynthSettings mFluidsynthSettings;
+    KfFluidsynthVoiceBudget mFluidsynthVoiceBudget;
     void readTriggersFromProjectXml(Xml projectXml);
     void addTriggersToProjectXml(Xml* projectXml) const;
 
@@ -0,0 +1,113 @@
+/******************************************************************************
+ *
+ * Copyright 2026 Gideon van der Kolf
+ *
+ * This file is part of Konfyt.
+ *
+ *     Konfyt is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     Konfyt is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with Konfyt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#ifndef KONFYT_RT_LIST_CPP
+#define KONFYT_RT_LIST_CPP
+
+#include "konfytRtList.h"
+
+template <typename T, int InlineCapacity>
+KonfytRtList<T, InlineCapacity>::KonfytRtList(int capacity)
+{
+    setCapacity(capacity);
+}
+
+template <typename T, int InlineCapacity>
+KonfytRtList<T, InlineCapacity>::~KonfytRtList()
+{
+    if (mItems != mInline) { delete[] mItems; }
+}
+
+/* Set the maximum number of items and clear the list. Allocates if capacity
+ * is larger than InlineCapacity, thus not for use in the JACK thread. */
+template <typename T, int InlineCapacity>
+void KonfytRtList<T, InlineCapacity>::setCapacity(int capacity)
+{
+    if (mItems != mInline) { delete[] mItems; }
+    if (capacity > InlineCapacity) {
+        mItems = new T[capacity];
+        mCapacity = capacity;
+    } else {
+        mItems = mInline;
+        mCapacity = (capacity > 0) ? capacity : 0;
+    }
+    mCount = 0;
+}
+
+/* Returns false if the list is full. */
+template <typename T, int InlineCapacity>
+bool KonfytRtList<T, InlineCapacity>::add(const T &item)
+{
+    if (mCount >= mCapacity) { return false; }
+    mItems[mCount++] = item;
+    return true;
+}
+
+/* Add n items to the end of the list and return a pointer to the first of
+ * them, or null if there is not enough space. */
+template <typename T, int InlineCapacity>
+T *KonfytRtList<T, InlineCapacity>::grow(int n)
+{
+    if ( (n < 0) || (mCount + n > mCapacity) ) { return nullptr; }
+    T* ret = &mItems[mCount];
+    mCount += n;
+    return ret;
+}
+
+/* Insert item at index, keeping the order of the items after it. Returns false
+ * if the list is full or index is invalid. */
+template <typename T, int InlineCapacity>
+bool KonfytRtList<T, InlineCapacity>::insert(int index, const T &item)
+{
+    if ( (index < 0) || (index > mCount) || (mCount >= mCapacity) ) { return false; }
+    for (int i = mCount; i > index; i--) {
+        mItems[i] = mItems[i-1];
+    }
+    mItems[index] = item;
+    mCount++;
+    return true;
+}
+
+/* Remove the item at index, keeping the order of the rest. */
+template <typename T, int InlineCapacity>
+void KonfytRtList<T, InlineCapacity>::removeAt(int index)
+{
+    if ( (index < 0) || (index >= mCount) ) { return; }
+    for (int i = index; i < mCount - 1; i++) {
+        mItems[i] = mItems[i+1];
+    }
+    mCount--;
+}
+
+template <typename T, int InlineCapacity>
+void KonfytRtList<T, InlineCapacity>::removeLast()
+{
+    if (mCount > 0) { mCount--; }
+}
+
+template <typename T, int InlineCapacity>
+T *KonfytRtList<T, InlineCapacity>::at_ptr(int index)
+{
+    if ( (index < 0) || (index >= mCount) ) { return nullptr; }
+    return &mItems[index];
+}
+
+#endif // KONFYT_RT_LIST_CPP
@@ -0,0 +1,67 @@
+/******************************************************************************
+ *
+ * Copyright 2026 Gideon van der Kolf
+ *
+ * This file is part of Konfyt.
+ *
+ *     Konfyt is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     Konfyt is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with Konfyt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#ifndef KONFYT_RT_LIST_H
+#define KONFYT_RT_LIST_H
+
+/* Fixed-capacity list for the JACK thread. Items are contiguous. Up to
+ * InlineCapacity items are stored in the object itself. A larger capacity is
+ * allocated once when it is set (not realtime safe), after which the list never
+ * allocates. Adding to a full list fails instead of growing it.
+ * Indexes are not checked by operator[]; at_ptr() returns null for invalid
+ * indexes. */
+template <typename T, int InlineCapacity>
+class KonfytRtList
+{
+public:
+    explicit KonfytRtList(int capacity = InlineCapacity);
+    ~KonfytRtList();
+    KonfytRtList(const KonfytRtList&) = delete;
+    KonfytRtList& operator=(const KonfytRtList&) = delete;
+
+    void setCapacity(int capacity);
+    int capacity() const { return mCapacity; }
+    int count() const { return mCount; }
+    bool isEmpty() const { return mCount == 0; }
+    bool isFull() const { return mCount >= mCapacity; }
+
+    bool add(const T& item);
+    T* grow(int n);
+    bool insert(int index, const T& item);
+    void removeAt(int index);
+    void removeLast();
+    void clear() { mCount = 0; }
+
+    T& operator[](int index) { return mItems[index]; }
+    const T& operator[](int index) const { return mItems[index]; }
+    T* at_ptr(int index);
+    T* data() { return mItems; }
+
+private:
+    T mInline[InlineCapacity > 0 ? InlineCapacity : 1];
+    T* mItems = mInline;
+    int mCount = 0;
+    int mCapacity = InlineCapacity;
+};
+
+#include "konfytRtList.cpp"
+
+#endif // KONFYT_RT_LIST_H
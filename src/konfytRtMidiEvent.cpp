@@ -0,0 +1,276 @@
+/******************************************************************************
+ *
+ * Copyright 2026 Gideon van der Kolf
+ *
+ * This file is part of Konfyt.
+ *
+ *     Konfyt is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     Konfyt is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with Konfyt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include "konfytRtMidiEvent.h"
+
+#include <string.h>
+
+
+/* Event from a raw MIDI buffer, e.g. a JACK input port buffer. Data longer than
+ * two bytes is referenced in the buffer and not copied. The event is invalid if
+ * the buffer is empty or the data is longer than KONFYT_RT_MIDI_DATA_MAX. */
+KonfytRtMidiEvent::KonfytRtMidiEvent(const unsigned char *buffer, int size)
+{
+    int dataSize = size - 1;
+    if ( (size < 1) || (dataSize > KONFYT_RT_MIDI_DATA_MAX) ) {
+        setInvalid();
+        return;
+    }
+    mType = MIDI_TYPE_FROM_BUFFER(buffer);
+    channel = MIDI_CHANNEL_FROM_BUFFER(buffer);
+    mDataSize = dataSize;
+    if (dataSize > 0) { mData[0] = buffer[1]; }
+    if (dataSize > 1) { mData[1] = buffer[2]; }
+    if (dataSize > 2) { mLongData = buffer + 1; }
+}
+
+/* Set from a KonfytMidiEvent outside the JACK thread, e.g. sent by a script.
+ * Long data is copied to the ring, which must be allocated. Returns false and
+ * the event is invalid if the ring is full. */
+bool KonfytRtMidiEvent::setFromMidiEvent(const KonfytMidiEvent &ev,
+                                         KonfytRtSysexRing *ring)
+{
+    mType = ev.type();
+    channel = ev.channel;
+    bankMSB = ev.bankMSB;
+    bankLSB = ev.bankLSB;
+    mDataSize = ev.dataSize();
+    mData[0] = ev.data1();
+    mData[1] = ev.data2();
+    mLongData = (mDataSize > 2) ? ev.data() : nullptr;
+    return storeLongData(ring);
+}
+
+/* Not realtime safe for long data, which is copied to the heap. */
+KonfytMidiEvent KonfytRtMidiEvent::toMidiEvent() const
+{
+    KonfytMidiEvent ev;
+    if (mLongData) {
+        ev.setSysEx(mLongData, mDataSize);
+        ev.setType(mType);
+        ev.channel = channel;
+    } else {
+        unsigned char buffer[3] = { (unsigned char)(mType | channel),
+                                    mData[0], mData[1] };
+        ev = KonfytMidiEvent(buffer, bufferSizeRequired());
+    }
+    ev.bankMSB = bankMSB;
+    ev.bankLSB = bankLSB;
+    return ev;
+}
+
+/* Copy the long data, if any, to the arena so it stays valid for the rest of
+ * the JACK cycle. Returns false and the event is invalid if the arena is
+ * full. */
+bool KonfytRtMidiEvent::storeLongData(KonfytRtSysexArena *arena)
+{
+    if (!mLongData) { return true; }
+    mLongData = arena->store(mLongData, mDataSize);
+    if (!mLongData) {
+        setInvalid();
+        return false;
+    }
+    return true;
+}
+
+/* Copy the long data, if any, to the ring so it stays valid until released by
+ * the consumer. Returns false and the event is invalid if the ring is full. */
+bool KonfytRtMidiEvent::storeLongData(KonfytRtSysexRing *ring)
+{
+    if (!mLongData) { return true; }
+    mLongData = ring->store(mLongData, mDataSize);
+    if (!mLongData) {
+        setInvalid();
+        return false;
+    }
+    return true;
+}
+
+void KonfytRtMidiEvent::setShort(int type, uint8_t data1, uint8_t data2, int size)
+{
+    mType = type;
+    mData[0] = data1;
+    mData[1] = data2;
+    mDataSize = size;
+    mLongData = nullptr;
+}
+
+void KonfytRtMidiEvent::setNoteOn(uint8_t note, uint8_t velocity)
+{
+    setShort(MIDI_EVENT_TYPE_NOTEON, note, velocity, 2);
+}
+
+void KonfytRtMidiEvent::setNoteOff(uint8_t note, uint8_t velocity)
+{
+    setShort(MIDI_EVENT_TYPE_NOTEOFF, note, velocity, 2);
+}
+
+void KonfytRtMidiEvent::setCC(uint8_t cc, uint8_t value)
+{
+    setShort(MIDI_EVENT_TYPE_CC, cc, value, 2);
+}
+
+void KonfytRtMidiEvent::setProgram(uint8_t program)
+{
+    setShort(MIDI_EVENT_TYPE_PROGRAM, program, 0, 1);
+}
+
+int KonfytRtMidiEvent::pitchbendValueSigned() const
+{
+    return pitchbendDataToSignedInt(mData[0], mData[1]);
+}
+
+void KonfytRtMidiEvent::setPitchbend(int value)
+{
+    unsigned char data[2];
+    pitchbendSignedIntToData(value, data);
+    setShort(MIDI_EVENT_TYPE_PITCHBEND, data[0], data[1], 2);
+}
+
+int KonfytRtMidiEvent::toBuffer(unsigned char *buffer) const
+{
+    buffer[0] = mType | channel;
+    if (mLongData) {
+        memcpy(buffer + 1, mLongData, mDataSize);
+    } else {
+        memcpy(buffer + 1, mData, mDataSize);
+    }
+    return mDataSize + 1;
+}
+
+void KonfytRtMidiEvent::msbToBuffer(unsigned char *buffer) const
+{
+    buffer[0] = MIDI_EVENT_TYPE_CC | channel;
+    buffer[1] = MIDI_CC_BANK_MSB;
+    buffer[2] = bankMSB;
+}
+
+void KonfytRtMidiEvent::lsbToBuffer(unsigned char *buffer) const
+{
+    buffer[0] = MIDI_EVENT_TYPE_CC | channel;
+    buffer[1] = MIDI_CC_BANK_LSB;
+    buffer[2] = bankLSB;
+}
+
+// ============================================================================
+
+/* Copy data to the arena. Returns the copy, or null if the arena is full. */
+const unsigned char *KonfytRtSysexArena::store(const unsigned char *data, int size)
+{
+    if ( (size < 0) || (mUsed + size > KONFYT_RT_SYSEX_ARENA_BYTES) ) {
+        mDropped.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    unsigned char* ret = &mData[mUsed];
+    memcpy(ret, data, size);
+    mUsed += size;
+    return ret;
+}
+
+void KonfytRtSysexArena::reset()
+{
+    mUsed = 0;
+}
+
+/* Number of events dropped because the arena was full. */
+uint32_t KonfytRtSysexArena::droppedCount() const
+{
+    return mDropped.load(std::memory_order_relaxed);
+}
+
+// ============================================================================
+
+KonfytRtSysexRing::~KonfytRtSysexRing()
+{
+    delete[] mData;
+}
+
+/* Allocate storage of size bytes. Not realtime safe. Only call once, before the
+ * first store(). */
+void KonfytRtSysexRing::allocate(int size)
+{
+    KONFYT_ASSERT_RETURN(!mData);
+    mData = new unsigned char[size];
+    mSize = size;
+}
+
+bool KonfytRtSysexRing::isAllocated() const
+{
+    return mData != nullptr;
+}
+
+/* Copy data to the ring. Returns the copy, or null if the ring is full or not
+ * allocated. The copy is contiguous: if it doesn't fit at the end of the ring
+ * it is stored at the start and the end is skipped. */
+const unsigned char *KonfytRtSysexRing::store(const unsigned char *data, int size)
+{
+    int w = mWrite.load(std::memory_order_relaxed);
+    int r = mRead.load(std::memory_order_acquire);
+    int pos = -1;
+    if (!mData || (size <= 0) || (size >= mSize)) {
+        // Doesn't fit
+    } else if (w >= r) {
+        // Free space at the end and before the read position. A gap is kept
+        // between the write and read positions so full != empty.
+        if ( (mSize - w > size) || ((mSize - w == size) && (r > 0)) ) {
+            pos = w;
+        } else if (size < r) {
+            pos = 0;
+        }
+    } else if (r - w > size) {
+        pos = w;
+    }
+    if (pos < 0) {
+        mDropped.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    memcpy(mData + pos, data, size);
+    int next = pos + size;
+    if (next == mSize) { next = 0; }
+    mPrevWrite = w;
+    mWrite.store(next, std::memory_order_release);
+    return mData + pos;
+}
+
+/* Undo the last store(), for when its event could not be written. Producer
+ * only, before the next store(). */
+void KonfytRtSysexRing::unstore()
+{
+    mWrite.store(mPrevWrite, std::memory_order_release);
+}
+
+/* Release the long data of the event, if any, which was stored in this ring.
+ * Events have to be released in the order their data was stored. */
+void KonfytRtSysexRing::release(const KonfytRtMidiEvent &ev)
+{
+    const unsigned char* data = ev.longData();
+    if (!data) { return; }
+    int next = (data - mData) + ev.dataSize();
+    if (next == mSize) { next = 0; }
+    mRead.store(next, std::memory_order_release);
+}
+
+/* Number of events dropped because the ring was full. */
+uint32_t KonfytRtSysexRing::droppedCount() const
+{
+    return mDropped.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,163 @@
+/******************************************************************************
+ *
+ * Copyright 2026 Gideon van der Kolf
+ *
+ * This file is part of Konfyt.
+ *
+ *     Konfyt is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     Konfyt is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with Konfyt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#ifndef KONFYT_RT_MIDI_EVENT_H
+#define KONFYT_RT_MIDI_EVENT_H
+
+#include "konfytMidi.h"
+
+#include <atomic>
+#include <stdint.h>
+
+#define KONFYT_RT_MIDI_DATA_MAX MIDI_SYSEX_MAX_SIZE
+#define KONFYT_RT_SYSEX_ARENA_BYTES 65536
+// Fits the longest SysEx wherever the ring is when it is empty
+#define KONFYT_RT_SYSEX_RING_BYTES (2 * (KONFYT_RT_MIDI_DATA_MAX + 1))
+
+struct KonfytRtSysexArena;
+struct KonfytRtSysexRing;
+
+/* Compact MIDI event for the JACK thread (16 bytes, compared to
+ * KonfytMidiEvent which holds its data inline).
+ *
+ * The first two data bytes are held inline, which covers channel messages.
+ * Longer data, i.e. SysEx, is held by reference and is not copied with the
+ * event. It has to stay valid for the JACK cycle: either the JACK input port
+ * buffer the event was read from, or a KonfytRtSysexArena that is reset at
+ * the start of each cycle. Events passed between threads hold their long data
+ * in a KonfytRtSysexRing, copied in with storeLongData().
+ *
+ * An event is invalid (see isValid()) if its data could not be held, e.g. SysEx
+ * longer than KONFYT_RT_MIDI_DATA_MAX or a full arena, and must be skipped.
+ *
+ * Converted from and to KonfytMidiEvent outside the JACK thread. */
+struct KonfytRtMidiEvent
+{
+private:
+    const unsigned char* mLongData = nullptr; // If data size > 2
+    uint16_t mDataSize = 0;
+    uint8_t mType = MIDI_EVENT_TYPE_NOTEON; // Status byte without channel
+    uint8_t mData[2] = {0, 0};
+
+public:
+    uint8_t channel = 0;
+    int8_t bankMSB = -1;
+    int8_t bankLSB = -1;
+
+    KonfytRtMidiEvent() {}
+    KonfytRtMidiEvent(const unsigned char* buffer, int size);
+
+    bool setFromMidiEvent(const KonfytMidiEvent& ev, KonfytRtSysexRing* ring);
+    KonfytMidiEvent toMidiEvent() const;
+
+    bool storeLongData(KonfytRtSysexArena* arena);
+    bool storeLongData(KonfytRtSysexRing* ring);
+    /* Long data (data size > 2), held by reference. Null for short events. */
+    const unsigned char* longData() const { return mLongData; }
+    void setLongData(const unsigned char* data) { mLongData = data; }
+
+    bool isValid() const { return mType & 0x80; }
+    void setInvalid() { mType = 0; mDataSize = 0; mLongData = nullptr; }
+
+    int type() const { return mType; }
+    int dataSize() const { return mDataSize; }
+    int note() const { return mData[0]; }
+    int velocity() const { return mData[1]; }
+    int data1() const { return mData[0]; }
+    int data2() const { return mData[1]; }
+
+    void setData1(uint8_t value) { mData[0] = value; }
+    void setData2(uint8_t value) { mData[1] = value; }
+    void setNote(uint8_t note) { mData[0] = note; }
+    void setVelocity(uint8_t vel) { mData[1] = vel; }
+    void setNoteOn(uint8_t note, uint8_t velocity);
+    void setNoteOff(uint8_t note, uint8_t velocity);
+    void setCC(uint8_t cc, uint8_t value);
+    void setProgram(uint8_t program);
+
+    // Return pitchbend value between -8192 and 8191
+    int pitchbendValueSigned() const;
+    void setPitchbend(int value);
+
+    /* Returns the number of bytes required to write this MIDI event to a buffer,
+     * which includes the type/channel byte plus the data bytes. */
+    int bufferSizeRequired() const { return mDataSize + 1; }
+    int toBuffer(unsigned char* buffer) const;
+    void msbToBuffer(unsigned char* buffer) const;
+    void lsbToBuffer(unsigned char* buffer) const;
+
+private:
+    void setShort(int type, uint8_t data1, uint8_t data2, int size);
+};
+
+// ============================================================================
+
+/* Preallocated storage for the long data of KonfytRtMidiEvents during a JACK
+ * cycle. Reset at the start of each cycle. For use in the JACK thread only,
+ * except droppedCount() which may be read from any thread. */
+struct KonfytRtSysexArena
+{
+    const unsigned char* store(const unsigned char* data, int size);
+    void reset();
+    uint32_t droppedCount() const;
+
+private:
+    unsigned char mData[KONFYT_RT_SYSEX_ARENA_BYTES];
+    int mUsed = 0;
+    std::atomic<uint32_t> mDropped {0};
+};
+
+// ============================================================================
+
+/* Single producer, single consumer ring of the long data of KonfytRtMidiEvents
+ * passed between threads in an event ring buffer. The producer copies the data
+ * in with store() before writing the event, and the consumer releases it with
+ * release() once done with the event, in the same order as the events.
+ * Storage is allocated with allocate() outside the JACK thread, before the
+ * first store(). droppedCount() may be read from any thread. */
+struct KonfytRtSysexRing
+{
+    KonfytRtSysexRing() {}
+    KonfytRtSysexRing(const KonfytRtSysexRing&) = delete;
+    KonfytRtSysexRing& operator=(const KonfytRtSysexRing&) = delete;
+    ~KonfytRtSysexRing();
+
+    void allocate(int size);
+    bool isAllocated() const;
+
+    // Producer
+    const unsigned char* store(const unsigned char* data, int size);
+    void unstore();
+    // Consumer
+    void release(const KonfytRtMidiEvent& ev);
+
+    uint32_t droppedCount() const;
+
+private:
+    unsigned char* mData = nullptr;
+    int mSize = 0;
+    std::atomic<int> mRead {0};
+    std::atomic<int> mWrite {0};
+    int mPrevWrite = 0; // Producer, for unstore()
+    std::atomic<uint32_t> mDropped {0};
+};
+
+#endif // KONFYT_RT_MIDI_EVENT_H
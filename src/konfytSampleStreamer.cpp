@@ -0,0 +1,257 @@
+/******************************************************************************
+ *
+ * Copyright 2026 Gideon van der Kolf
+ *
+ * This file is part of Konfyt.
+ *
+ *     Konfyt is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     Konfyt is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with Konfyt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include "konfytSampleStreamer.h"
+
+#include <chrono>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+KonfytSampleStreamer::KonfytSampleStreamer()
+{
+    for (int i = 0; i < KONFYT_STREAM_SLOTS; i++) {
+        slots[i].buffer = new float[KONFYT_STREAM_SLOT_FRAMES * KONFYT_STREAM_MAX_CHANNELS];
+    }
+    chunk.resize(KONFYT_STREAM_CHUNK_FRAMES * KONFYT_STREAM_MAX_CHANNELS);
+}
+
+KonfytSampleStreamer::~KonfytSampleStreamer()
+{
+    stop();
+    for (int i = 0; i < KONFYT_STREAM_SLOTS; i++) {
+        if (slots[i].fd >= 0) { ::close(slots[i].fd); }
+        delete[] slots[i].buffer;
+    }
+}
+
+void KonfytSampleStreamer::start()
+{
+    if (running) { return; }
+    running = true;
+    ioThread = std::thread(&KonfytSampleStreamer::ioThreadLoop, this);
+}
+
+void KonfytSampleStreamer::stop()
+{
+    if (!running) { return; }
+    running = false;
+    wakeup.release();
+    ioThread.join();
+}
+
+/* JACK thread: start streaming the specified sample from startFrame. Returns
+ * the slot index, or -1 if no slot is available. */
+int KonfytSampleStreamer::startStream(const KonfytStreamSample *sample, uint32_t startFrame)
+{
+    for (int i = 0; i < KONFYT_STREAM_SLOTS; i++) {
+        Slot& slot = slots[i];
+        if (slot.state.load(std::memory_order_acquire) != SlotFree) { continue; }
+        slot.sample = sample;
+        slot.startFrame = startFrame;
+        slot.written.store(0, std::memory_order_relaxed);
+        slot.read.store(0, std::memory_order_relaxed);
+        slot.state.store(SlotStarting, std::memory_order_release);
+        activeStreams++;
+        wakeup.release();
+        return i;
+    }
+    return -1;
+}
+
+/* JACK thread: the slot may not be used after this. */
+void KonfytSampleStreamer::stopStream(int slot)
+{
+    if ( (slot < 0) || (slot >= KONFYT_STREAM_SLOTS) ) { return; }
+    slots[slot].state.store(SlotStopping, std::memory_order_release);
+    activeStreams--;
+    wakeup.release();
+}
+
+/* JACK thread: returns pointer to the interleaved frame, or nullptr if it has
+ * not been streamed yet. */
+const float *KonfytSampleStreamer::frame(int slot, uint32_t frameInSample)
+{
+    Slot& s = slots[slot];
+    uint32_t i = frameInSample - s.startFrame;
+    if (i >= s.written.load(std::memory_order_acquire)) { return nullptr; }
+    if (i < s.read.load(std::memory_order_relaxed)) { return nullptr; }
+    return s.buffer + (i % KONFYT_STREAM_SLOT_FRAMES) * KONFYT_STREAM_MAX_CHANNELS;
+}
+
+/* JACK thread: frames before frameInSample are no longer needed. */
+void KonfytSampleStreamer::setReadPosition(int slot, uint32_t frameInSample)
+{
+    Slot& s = slots[slot];
+    if (frameInSample < s.startFrame) { return; }
+    uint32_t i = frameInSample - s.startFrame;
+    if (i > s.written.load(std::memory_order_acquire)) {
+        i = s.written.load(std::memory_order_acquire);
+    }
+    if (i > s.read.load(std::memory_order_relaxed)) {
+        s.read.store(i, std::memory_order_release);
+        wakeup.release();
+    }
+}
+
+void KonfytSampleStreamer::countUnderrun()
+{
+    underruns.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint32_t KonfytSampleStreamer::underrunCount() const
+{
+    return underruns.load(std::memory_order_relaxed);
+}
+
+int KonfytSampleStreamer::activeStreamCount() const
+{
+    return activeStreams.load(std::memory_order_relaxed);
+}
+
+/* Blocks until no slot references the sample anymore, i.e. until the I/O
+ * thread has closed all streams of it. The streams must already have been
+ * stopped. */
+void KonfytSampleStreamer::waitForSampleReleased(const KonfytStreamSample *sample)
+{
+    for (int i = 0; i < KONFYT_STREAM_SLOTS; i++) {
+        Slot& slot = slots[i];
+        while ( running && (slot.sample == sample)
+                && (slot.state.load(std::memory_order_acquire) != SlotFree) ) {
+            wakeup.release();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+}
+
+void KonfytSampleStreamer::ioThreadLoop()
+{
+    while (running) {
+        // Wake up when streams are started/consumed, or periodically.
+        wakeup.tryAcquire(1, 10);
+        wakeup.tryAcquire(wakeup.available());
+
+        while (running) {
+            // Fill the slot with the least buffered frames first, so voices
+            // close to an underrun get data before voices that are well ahead.
+            Slot* urgent = nullptr;
+            uint32_t leastBuffered = KONFYT_STREAM_SLOT_FRAMES;
+            for (int i = 0; i < KONFYT_STREAM_SLOTS; i++) {
+                Slot& slot = slots[i];
+                if (!updateSlotState(slot)) { continue; }
+                if (!slotNeedsData(slot)) { continue; }
+                uint32_t buffered = slot.written.load(std::memory_order_relaxed)
+                        - slot.read.load(std::memory_order_acquire);
+                if (buffered < leastBuffered) {
+                    leastBuffered = buffered;
+                    urgent = &slot;
+                }
+            }
+            if (!urgent) { break; }
+            if (!fillSlot(*urgent)) { break; }
+        }
+    }
+}
+
+/* I/O thread: open or close the slot depending on its state. Returns true if
+ * the slot is active with an open file. */
+bool KonfytSampleStreamer::updateSlotState(Slot &slot)
+{
+    int state = slot.state.load(std::memory_order_acquire);
+
+    if (state == SlotFree) { return false; }
+
+    if (state == SlotStopping) {
+        if (slot.fd >= 0) {
+            ::close(slot.fd);
+            slot.fd = -1;
+        }
+        slot.state.store(SlotFree, std::memory_order_release);
+        return false;
+    }
+
+    if (state == SlotStarting) {
+        if (slot.fd >= 0) { ::close(slot.fd); }
+        slot.fd = ::open(slot.sample->path.toLocal8Bit().constData(), O_RDONLY);
+        if (slot.fd >= 0) {
+            // Let the kernel start reading ahead while the slot is filled.
+            slot.sample->adviseWillNeed(slot.fd, slot.startFrame,
+                                        KONFYT_STREAM_SLOT_FRAMES);
+        }
+        int expected = SlotStarting;
+        if (!slot.state.compare_exchange_strong(expected, SlotActive)) {
+            // Stopped in the meantime, closed in the next pass.
+            return false;
+        }
+    }
+
+    return slot.fd >= 0;
+}
+
+/* I/O thread: returns true if there is enough free space in the slot to read
+ * a reasonable amount of data and the sample has not been fully streamed. */
+bool KonfytSampleStreamer::slotNeedsData(Slot &slot)
+{
+    const KonfytStreamSample* sample = slot.sample;
+    uint32_t written = slot.written.load(std::memory_order_relaxed);
+    uint32_t read = slot.read.load(std::memory_order_acquire);
+    uint32_t space = KONFYT_STREAM_SLOT_FRAMES - (written - read);
+    uint32_t next = slot.startFrame + written;
+    if (next >= sample->frames) { return false; }
+    uint32_t remaining = sample->frames - next;
+    return (space >= KONFYT_STREAM_CHUNK_FRAMES / 4) || (space >= remaining);
+}
+
+/* I/O thread: read the next chunk from disk into the slot. Returns false if
+ * nothing could be read. */
+bool KonfytSampleStreamer::fillSlot(Slot &slot)
+{
+    const KonfytStreamSample* sample = slot.sample;
+    uint32_t written = slot.written.load(std::memory_order_relaxed);
+    uint32_t read = slot.read.load(std::memory_order_acquire);
+    uint32_t space = KONFYT_STREAM_SLOT_FRAMES - (written - read);
+    uint32_t next = slot.startFrame + written;
+    uint32_t count = sample->frames - next;
+    if (count > space) { count = space; }
+    if (count > KONFYT_STREAM_CHUNK_FRAMES) { count = KONFYT_STREAM_CHUNK_FRAMES; }
+
+    uint32_t n = sample->readFrames(slot.fd, next, count, chunk.data(), scratch);
+    if (n == 0) {
+        // Read error or truncated file. Stop streaming from this file.
+        ::close(slot.fd);
+        slot.fd = -1;
+        return false;
+    }
+
+    for (uint32_t f = 0; f < n; f++) {
+        float* dest = slot.buffer + ((written + f) % KONFYT_STREAM_SLOT_FRAMES)
+                * KONFYT_STREAM_MAX_CHANNELS;
+        memcpy(dest, &chunk[f * sample->channels], sizeof(float) * sample->channels);
+    }
+    slot.written.store(written + n, std::memory_order_release);
+
+    // Prefetch the following data for the next read
+    if (next + n < sample->frames) {
+        sample->adviseWillNeed(slot.fd, next + n, KONFYT_STREAM_CHUNK_FRAMES);
+    }
+
+    return true;
+}
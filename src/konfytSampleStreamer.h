@@ -0,0 +1,114 @@
+/******************************************************************************
+ *
+ * Copyright 2026 Gideon van der Kolf
+ *
+ * This file is part of Konfyt.
+ *
+ *     Konfyt is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     Konfyt is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with Konfyt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#ifndef KONFYT_SAMPLE_STREAMER_H
+#define KONFYT_SAMPLE_STREAMER_H
+
+#include <QSemaphore>
+#include <QString>
+
+#include <atomic>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+#define KONFYT_STREAM_SLOTS 128
+#define KONFYT_STREAM_SLOT_FRAMES 16384 // Ring buffer size per slot
+#define KONFYT_STREAM_CHUNK_FRAMES 4096 // Frames read from disk at a time
+#define KONFYT_STREAM_MAX_CHANNELS 2
+
+/* A sample of which the head is kept in memory and the tail can be streamed
+ * from disk by KonfytSampleStreamer. */
+struct KonfytStreamSample
+{
+    virtual ~KonfytStreamSample() {}
+
+    QString path;
+    int channels = 0;           // Channels in memory (max KONFYT_STREAM_MAX_CHANNELS)
+    uint32_t sampleRate = 0;
+    uint32_t frames = 0;        // Total frames of the sample
+    std::vector<float> preload; // Interleaved head of the sample
+    uint32_t preloadFrames = 0; // Equal to frames if fully loaded
+
+    /* Read frames from the opened file into dest (interleaved, channels wide).
+     * Called from the streamer I/O thread. Returns the number of frames read. */
+    virtual uint32_t readFrames(int fd, uint32_t startFrame, uint32_t count,
+                                float* dest, std::vector<char>& scratch) const = 0;
+    /* Hint that the specified frames will be read soon from the opened file,
+     * so the kernel can read them into the page cache in advance. */
+    virtual void adviseWillNeed(int /*fd*/, uint32_t /*startFrame*/,
+                                uint32_t /*count*/) const {}
+};
+
+/* Streams the tails of samples from disk into per-voice ring buffers in an I/O
+ * thread. Streams are started and stopped from the JACK thread without
+ * blocking. If data is not available in time, the voice plays silence and an
+ * underrun is counted. */
+class KonfytSampleStreamer
+{
+public:
+    KonfytSampleStreamer();
+    ~KonfytSampleStreamer();
+
+    void start();
+    void stop();
+
+    // JACK thread
+    int startStream(const KonfytStreamSample* sample, uint32_t startFrame);
+    void stopStream(int slot);
+    const float* frame(int slot, uint32_t frameInSample);
+    void setReadPosition(int slot, uint32_t frameInSample);
+    void countUnderrun();
+
+    uint32_t underrunCount() const;
+    int activeStreamCount() const;
+    void waitForSampleReleased(const KonfytStreamSample* sample);
+
+private:
+    enum SlotState { SlotFree, SlotStarting, SlotActive, SlotStopping };
+
+    struct Slot
+    {
+        std::atomic<int> state {SlotFree};
+        const KonfytStreamSample* sample = nullptr;
+        uint32_t startFrame = 0;         // First frame in sample that is streamed
+        std::atomic<uint32_t> written {0}; // Frames written by I/O thread
+        std::atomic<uint32_t> read {0};    // Frames consumed by JACK thread
+        int fd = -1;                     // I/O thread only
+        float* buffer = nullptr;
+    };
+
+    Slot slots[KONFYT_STREAM_SLOTS];
+    std::atomic<bool> running {false};
+    std::atomic<uint32_t> underruns {0};
+    std::atomic<int> activeStreams {0};
+    QSemaphore wakeup;
+    std::thread ioThread;
+    std::vector<char> scratch;
+    std::vector<float> chunk;
+
+    void ioThreadLoop();
+    bool updateSlotState(Slot& slot);
+    bool slotNeedsData(Slot& slot);
+    bool fillSlot(Slot& slot);
+};
+
+#endif // KONFYT_SAMPLE_STREAMER_H
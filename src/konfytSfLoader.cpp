@@ -0,0 +1,138 @@
+/******************************************************************************
+ *
+ * Copyright 2026 Gideon van der Kolf
+ *
+ * This file is part of Konfyt.
+ *
+ *     Konfyt is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     Konfyt is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with Konfyt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+
+#include "konfytSfLoader.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Returns a new default soundfont loader using the memory mapped file
+ * callbacks, or nullptr on failure. To be added to a synth with
+ * fluid_synth_add_sfloader(), which takes ownership. */
+fluid_sfloader_t *KonfytSfLoader::create(fluid_settings_t *settings)
+{
+#if FLUIDSYNTH_VERSION_MAJOR >= 2
+    fluid_sfloader_t* loader = new_fluid_defsfloader(settings);
+    if (!loader) { return nullptr; }
+    if (fluid_sfloader_set_callbacks(loader, open, read, seek, tell, close)
+            != FLUID_OK) {
+        delete_fluid_sfloader(loader);
+        return nullptr;
+    }
+    return loader;
+#else
+    // File callbacks are not supported by Fluidsynth 1
+    (void)settings;
+    return nullptr;
+#endif
+}
+
+void *KonfytSfLoader::open(const char *filename)
+{
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0) { return nullptr; }
+
+    struct stat st;
+    if ( (fstat(fd, &st) != 0) || (st.st_size <= 0) ) {
+        ::close(fd);
+        return nullptr;
+    }
+
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        ::close(fd);
+        return nullptr;
+    }
+    // Chunks are read by seeking around the file
+    madvise(data, st.st_size, MADV_RANDOM);
+
+    Handle* h = new Handle();
+    h->fd = fd;
+    h->data = (const char*)data;
+    h->size = st.st_size;
+    return h;
+}
+
+int KonfytSfLoader::read(void *buf, KfSfCount count, void *handle)
+{
+    Handle* h = (Handle*)handle;
+    if ( (count < 0) || ((size_t)count > h->size - h->pos) ) {
+        return FLUID_FAILED;
+    }
+
+    const char* src = h->data + h->pos;
+    if (count >= KONFYT_SF_LOADER_BULK_READ) {
+        // Sample data: prefetch, copy and drop the pages from the mapping.
+        // The page aligned range is used since madvise requires it.
+        long page = sysconf(_SC_PAGESIZE);
+        size_t start = h->pos - (h->pos % page);
+        size_t len = h->pos + count - start;
+        madvise((void*)(h->data + start), len, MADV_WILLNEED);
+        memcpy(buf, src, count);
+        madvise((void*)(h->data + start), len, MADV_DONTNEED);
+    } else {
+        memcpy(buf, src, count);
+    }
+    h->pos += count;
+
+    return FLUID_OK;
+}
+
+int KonfytSfLoader::seek(void *handle, KfSfOffset offset, int origin)
+{
+    Handle* h = (Handle*)handle;
+    KfSfOffset pos;
+    switch (origin) {
+    case SEEK_SET:
+        pos = offset;
+        break;
+    case SEEK_CUR:
+        pos = (KfSfOffset)h->pos + offset;
+        break;
+    case SEEK_END:
+        pos = (KfSfOffset)h->size + offset;
+        break;
+    default:
+        return FLUID_FAILED;
+    }
+    if ( (pos < 0) || ((size_t)pos > h->size) ) { return FLUID_FAILED; }
+    h->pos = pos;
+    return FLUID_OK;
+}
+
+KfSfOffset KonfytSfLoader::tell(void *handle)
+{
+    return ((Handle*)handle)->pos;
+}
+
+int KonfytSfLoader::close(void *handle)
+{
+    Handle* h = (Handle*)handle;
+    munmap((void*)h->data, h->size);
+    ::close(h->fd);
+    delete h;
+    return FLUID_OK;
+}
@@ -0,0 +1,70 @@
+/******************************************************************************
+ *
+ * Copyright 2026 Gideon van der Kolf
+ *
+ * This file is part of Konfyt.
+ *
+ *     Konfyt is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     Konfyt is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with Konfyt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+
+#ifndef KONFYT_SF_LOADER_H
+#define KONFYT_SF_LOADER_H
+
+#include <fluidsynth.h>
+
+#include <stddef.h>
+
+#if (FLUIDSYNTH_VERSION_MAJOR > 2) || \
+    ((FLUIDSYNTH_VERSION_MAJOR == 2) && (FLUIDSYNTH_VERSION_MINOR >= 2))
+    typedef fluid_long_long_t KfSfOffset;
+    typedef fluid_long_long_t KfSfCount;
+#else
+    typedef long KfSfOffset;
+    typedef int KfSfCount;
+#endif
+
+#define KONFYT_SF_LOADER_BULK_READ 16384 // Reads at least this size are sample data
+
+/* Soundfont loader for Fluidsynth that reads soundfont files through a
+ * read-only memory map instead of stdio.
+ *
+ * Fluidsynth copies the sample data it needs into its own memory. Combined
+ * with dynamic sample loading, only the samples of the selected preset are
+ * copied. Large (sample data) reads are prefetched with MADV_WILLNEED and
+ * dropped from the mapping afterwards with MADV_DONTNEED, so the rest of the
+ * file only occupies the page cache and not the resident set of Konfyt. */
+class KonfytSfLoader
+{
+public:
+    static fluid_sfloader_t* create(fluid_settings_t* settings);
+
+private:
+    struct Handle
+    {
+        int fd = -1;
+        const char* data = nullptr;
+        size_t size = 0;
+        size_t pos = 0;
+    };
+
+    static void* open(const char* filename);
+    static int read(void* buf, KfSfCount count, void* handle);
+    static int seek(void* handle, KfSfOffset offset, int origin);
+    static KfSfOffset tell(void* handle);
+    static int close(void* handle);
+};
+
+#endif // KONFYT_SF_LOADER_H
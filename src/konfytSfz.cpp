@@ -0,0 +1,469 @@
+/******************************************************************************
+ *
+ * Copyright 2026 Gideon van der Kolf
+ *
+ * This file is part of Konfyt.
+ *
+ *     Konfyt is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     Konfyt is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with Konfyt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include "konfytSfz.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QRegularExpression>
+
+#include <algorithm>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#define KONFYT_SFZ_MAX_INCLUDE_DEPTH 10
+
+static uint32_t readLE32(const char* p)
+{
+    const unsigned char* u = (const unsigned char*)p;
+    return u[0] | (u[1] << 8) | (u[2] << 16) | ((uint32_t)u[3] << 24);
+}
+
+static uint16_t readLE16(const char* p)
+{
+    const unsigned char* u = (const unsigned char*)p;
+    return u[0] | (u[1] << 8);
+}
+
+/* Read the WAV header and preload the head of the sample. */
+bool KonfytSfzSample::load(QString filename, uint32_t preloadFrames, QString *error)
+{
+    path = filename;
+
+    QFile f(filename);
+    if (!f.open(QIODevice::ReadOnly)) {
+        *error = "Could not open sample " + filename;
+        return false;
+    }
+    QByteArray hdr = f.read(12);
+    if ( (hdr.size() < 12) || !hdr.startsWith("RIFF") || (hdr.mid(8, 4) != "WAVE") ) {
+        *error = "Not a WAV file (only WAV samples are supported): " + filename;
+        return false;
+    }
+
+    bool fmtFound = false;
+    bool dataFound = false;
+    int bits = 0;
+    uint32_t dataSize = 0;
+    while (!f.atEnd()) {
+        QByteArray chunkHdr = f.read(8);
+        if (chunkHdr.size() < 8) { break; }
+        QByteArray id = chunkHdr.left(4);
+        uint32_t size = readLE32(chunkHdr.constData() + 4);
+        qint64 chunkStart = f.pos();
+
+        if (id == "fmt ") {
+            QByteArray fmt = f.read(qMin(size, (uint32_t)40));
+            if (fmt.size() < 16) { break; }
+            int audioFormat = readLE16(fmt.constData());
+            fileChannels = readLE16(fmt.constData() + 2);
+            sampleRate = readLE32(fmt.constData() + 4);
+            bytesPerFrame = readLE16(fmt.constData() + 12);
+            bits = readLE16(fmt.constData() + 14);
+            if ( (audioFormat == 0xFFFE) && (fmt.size() >= 26) ) {
+                // WAVE_FORMAT_EXTENSIBLE: format is in first two bytes of GUID
+                audioFormat = readLE16(fmt.constData() + 24);
+            }
+            if ( (audioFormat == 1) && (bits == 16) ) {
+                format = FormatPcm16;
+            } else if ( (audioFormat == 1) && (bits == 24) ) {
+                format = FormatPcm24;
+            } else if ( (audioFormat == 1) && (bits == 32) ) {
+                format = FormatPcm32;
+            } else if ( (audioFormat == 3) && (bits == 32) ) {
+                format = FormatFloat32;
+            } else {
+                *error = QString("Unsupported WAV format %1 (%2 bits): %3")
+                        .arg(audioFormat).arg(bits).arg(filename);
+                return false;
+            }
+            fmtFound = true;
+        } else if (id == "data") {
+            dataOffset = chunkStart;
+            dataSize = size;
+            dataFound = true;
+        } else if (id == "smpl") {
+            QByteArray smpl = f.read(qMin(size, (uint32_t)60));
+            if ( (smpl.size() >= 60) && (readLE32(smpl.constData() + 28) > 0) ) {
+                hasLoop = true;
+                loopStart = readLE32(smpl.constData() + 44);
+                loopEnd = readLE32(smpl.constData() + 48);
+            }
+        }
+        // Chunks are padded to even sizes
+        if (!f.seek(chunkStart + size + (size & 1))) { break; }
+    }
+
+    if (!fmtFound || !dataFound || (fileChannels < 1) || (bytesPerFrame < 1)) {
+        *error = "Invalid WAV file: " + filename;
+        return false;
+    }
+
+    channels = qMin(fileChannels, KONFYT_STREAM_MAX_CHANNELS);
+    frames = dataSize / bytesPerFrame;
+    if (hasLoop && (loopEnd >= frames)) {
+        hasLoop = false;
+    }
+
+    preloadFrames = qMin(preloadFrames, frames);
+    this->preloadFrames = 0;
+    preload.resize((size_t)preloadFrames * channels);
+    int fd = ::open(filename.toLocal8Bit().constData(), O_RDONLY);
+    if (fd < 0) {
+        *error = "Could not open sample " + filename;
+        return false;
+    }
+    std::vector<char> scratch;
+    this->preloadFrames = readFrames(fd, 0, preloadFrames, preload.data(), scratch);
+    ::close(fd);
+
+    return true;
+}
+
+/* Load the whole sample into memory, e.g. for looped samples. */
+bool KonfytSfzSample::loadFully()
+{
+    if (preloadFrames >= frames) { return true; }
+
+    int fd = ::open(path.toLocal8Bit().constData(), O_RDONLY);
+    if (fd < 0) { return false; }
+    preload.resize((size_t)frames * channels);
+    std::vector<char> scratch;
+    uint32_t n = readFrames(fd, preloadFrames, frames - preloadFrames,
+                            preload.data() + (size_t)preloadFrames * channels,
+                            scratch);
+    ::close(fd);
+    preloadFrames += n;
+    return preloadFrames == frames;
+}
+
+uint32_t KonfytSfzSample::readFrames(int fd, uint32_t startFrame, uint32_t count,
+                                     float *dest, std::vector<char> &scratch) const
+{
+    if (startFrame >= frames) { return 0; }
+    if (count > frames - startFrame) { count = frames - startFrame; }
+
+    size_t bytes = (size_t)count * bytesPerFrame;
+    if (scratch.size() < bytes) { scratch.resize(bytes); }
+    ssize_t got = pread(fd, scratch.data(), bytes,
+                        dataOffset + (qint64)startFrame * bytesPerFrame);
+    if (got <= 0) { return 0; }
+
+    uint32_t n = got / bytesPerFrame;
+    convert(scratch.data(), dest, n);
+    return n;
+}
+
+void KonfytSfzSample::adviseWillNeed(int fd, uint32_t startFrame, uint32_t count) const
+{
+    if (startFrame >= frames) { return; }
+    if (count > frames - startFrame) { count = frames - startFrame; }
+    posix_fadvise(fd, dataOffset + (qint64)startFrame * bytesPerFrame,
+                  (qint64)count * bytesPerFrame, POSIX_FADV_WILLNEED);
+}
+
+/* Convert frames from file format to interleaved float, keeping only the
+ * first channels. */
+void KonfytSfzSample::convert(const char *src, float *dest, uint32_t count) const
+{
+    int bytesPerSample = bytesPerFrame / fileChannels;
+    for (uint32_t f = 0; f < count; f++) {
+        const char* frame = src + (size_t)f * bytesPerFrame;
+        for (int c = 0; c < channels; c++) {
+            const char* s = frame + c * bytesPerSample;
+            float v = 0;
+            switch (format) {
+            case FormatPcm16:
+                v = (int16_t)readLE16(s) / 32768.0f;
+                break;
+            case FormatPcm24: {
+                const unsigned char* u = (const unsigned char*)s;
+                int32_t i = (u[0] << 8) | (u[1] << 16) | ((uint32_t)u[2] << 24);
+                v = (i >> 8) / 8388608.0f;
+                break; }
+            case FormatPcm32:
+                v = (int32_t)readLE32(s) / 2147483648.0f;
+                break;
+            case FormatFloat32:
+                memcpy(&v, s, sizeof(float));
+                break;
+            }
+            dest[(size_t)f * channels + c] = v;
+        }
+    }
+}
+
+// ============================================================================
+
+bool KonfytSfzRegion::matches(int note, int velocity, int channel, Trigger t) const
+{
+    return (trigger == t)
+            && (note >= lokey) && (note <= hikey)
+            && (velocity >= lovel) && (velocity <= hivel)
+            && (channel + 1 >= lochan) && (channel + 1 <= hichan);
+}
+
+// ============================================================================
+
+bool KonfytSfzParser::parseFile(QString filename)
+{
+    regions.clear();
+    errorString.clear();
+    unsupportedOpcodes.clear();
+    defines.clear();
+    defaultPath.clear();
+    sfzDir = QFileInfo(filename).absolutePath();
+
+    QString text = readWithIncludes(filename, 0);
+    if (!errorString.isEmpty()) { return false; }
+
+    // Block comments
+    text.remove(QRegularExpression("/\\*.*?\\*/",
+                                   QRegularExpression::DotMatchesEverythingOption));
+
+    KonfytSfzRegion defaults;
+    KonfytSfzRegion global = defaults;
+    KonfytSfzRegion master = defaults;
+    KonfytSfzRegion group = defaults;
+    KonfytSfzRegion region = defaults;
+    KonfytSfzRegion ignored;
+    KonfytSfzRegion* current = &global;
+    bool inRegion = false;
+    bool inControl = false;
+
+    QRegularExpression re("<(\\w+)>|([A-Za-z0-9_]+)=");
+    QRegularExpressionMatchIterator it = re.globalMatch(text);
+    QList<QRegularExpressionMatch> matches;
+    while (it.hasNext()) { matches.append(it.next()); }
+
+    for (int i = 0; i < matches.count(); i++) {
+        const QRegularExpressionMatch& m = matches[i];
+        if (!m.captured(1).isEmpty()) {
+            // Header
+            if (inRegion) {
+                regions.append(region);
+                inRegion = false;
+            }
+            inControl = false;
+            QString header = m.captured(1).toLower();
+            if (header == "control") {
+                inControl = true;
+            } else if (header == "global") {
+                global = defaults;
+                master = global;
+                group = global;
+                current = &global;
+            } else if (header == "master") {
+                master = global;
+                group = master;
+                current = &master;
+            } else if (header == "group") {
+                group = master;
+                current = &group;
+            } else if (header == "region") {
+                region = group;
+                current = &region;
+                inRegion = true;
+            } else {
+                // Unsupported header (e.g. <curve>, <effect>). Ignore its opcodes.
+                current = &ignored;
+            }
+            continue;
+        }
+
+        // Opcode: value runs until the next header or opcode.
+        QString name = m.captured(2).toLower();
+        int valueStart = m.capturedEnd();
+        int valueEnd = (i + 1 < matches.count()) ? matches[i+1].capturedStart()
+                                                 : text.length();
+        QString value = text.mid(valueStart, valueEnd - valueStart).trimmed();
+        if (name != "sample") {
+            // Only sample values may contain spaces
+            value = value.section(QRegularExpression("\\s"), 0, 0);
+        }
+
+        if (inControl) {
+            if (name == "default_path") {
+                defaultPath = value.replace('\\', '/');
+            }
+            continue;
+        }
+        applyOpcode(*current, name, value);
+    }
+    if (inRegion) {
+        regions.append(region);
+    }
+
+    if (regions.isEmpty()) {
+        errorString = "No regions in SFZ file " + filename;
+        return false;
+    }
+    return true;
+}
+
+QString KonfytSfzParser::readWithIncludes(QString filename, int depth)
+{
+    if (depth > KONFYT_SFZ_MAX_INCLUDE_DEPTH) {
+        errorString = "Too many nested includes in " + filename;
+        return "";
+    }
+    QFile f(filename);
+    if (!f.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        errorString = "Could not open " + filename;
+        return "";
+    }
+
+    QRegularExpression reDefine("^\\s*#define\\s+(\\$\\w+)\\s+(.*)$");
+    QRegularExpression reInclude("^\\s*#include\\s+\"([^\"]+)\"");
+
+    QString ret;
+    QStringList lines = QString::fromUtf8(f.readAll()).split('\n');
+    foreach (QString line, lines) {
+        // Line comments
+        int comment = line.indexOf("//");
+        if (comment >= 0) { line = line.left(comment); }
+
+        QRegularExpressionMatch m = reDefine.match(line);
+        if (m.hasMatch()) {
+            defines.insert(m.captured(1), m.captured(2).trimmed());
+            continue;
+        }
+        // Apply defines (longest names first so $AB is not replaced by $A)
+        QStringList names = defines.keys();
+        std::sort(names.begin(), names.end(), [](const QString& a, const QString& b) {
+            return a.length() > b.length();
+        });
+        foreach (QString name, names) {
+            line.replace(name, defines.value(name));
+        }
+        m = reInclude.match(line);
+        if (m.hasMatch()) {
+            QString inc = m.captured(1).replace('\\', '/');
+            ret += readWithIncludes(sfzDir + "/" + inc, depth + 1) + "\n";
+            continue;
+        }
+        ret += line + "\n";
+    }
+    return ret;
+}
+
+void KonfytSfzParser::applyOpcode(KonfytSfzRegion &r, QString name, QString value)
+{
+    if (name == "sample") {
+        r.samplePath = QString(defaultPath + value).replace('\\', '/');
+        if (!r.samplePath.startsWith('*') && QFileInfo(r.samplePath).isRelative()) {
+            r.samplePath = sfzDir + "/" + r.samplePath;
+        }
+    } else if (name == "lokey") {
+        r.lokey = noteFromString(value);
+    } else if (name == "hikey") {
+        r.hikey = noteFromString(value);
+    } else if (name == "key") {
+        r.lokey = r.hikey = r.pitchKeycenter = noteFromString(value);
+    } else if (name == "lovel") {
+        r.lovel = value.toInt();
+    } else if (name == "hivel") {
+        r.hivel = value.toInt();
+    } else if (name == "lochan") {
+        r.lochan = value.toInt();
+    } else if (name == "hichan") {
+        r.hichan = value.toInt();
+    } else if (name == "trigger") {
+        r.trigger = (value == "release") ? KonfytSfzRegion::TriggerRelease
+                                         : KonfytSfzRegion::TriggerAttack;
+    } else if (name == "pitch_keycenter") {
+        r.pitchKeycenter = noteFromString(value);
+    } else if (name == "pitch_keytrack") {
+        r.pitchKeytrack = value.toFloat();
+    } else if ( (name == "tune") || (name == "pitch") ) {
+        r.tune = value.toFloat();
+    } else if (name == "transpose") {
+        r.transpose = value.toInt();
+    } else if (name == "bend_up") {
+        r.bendUp = value.toFloat();
+    } else if (name == "bend_down") {
+        r.bendDown = value.toFloat();
+    } else if (name == "volume") {
+        r.volume = value.toFloat();
+    } else if (name == "pan") {
+        r.pan = value.toFloat();
+    } else if (name == "amp_veltrack") {
+        r.ampVeltrack = value.toFloat();
+    } else if (name == "ampeg_attack") {
+        r.ampegAttack = value.toFloat();
+    } else if (name == "ampeg_hold") {
+        r.ampegHold = value.toFloat();
+    } else if (name == "ampeg_decay") {
+        r.ampegDecay = value.toFloat();
+    } else if (name == "ampeg_sustain") {
+        r.ampegSustain = value.toFloat();
+    } else if (name == "ampeg_release") {
+        r.ampegRelease = value.toFloat();
+    } else if ( (name == "loop_mode") || (name == "loopmode") ) {
+        r.loopModeSet = true;
+        if (value == "one_shot") {
+            r.loopMode = KonfytSfzRegion::OneShot;
+        } else if (value == "loop_continuous") {
+            r.loopMode = KonfytSfzRegion::LoopContinuous;
+        } else if (value == "loop_sustain") {
+            r.loopMode = KonfytSfzRegion::LoopSustain;
+        } else {
+            r.loopMode = KonfytSfzRegion::NoLoop;
+        }
+    } else if ( (name == "loop_start") || (name == "loopstart") ) {
+        r.loopStart = value.toLongLong();
+    } else if ( (name == "loop_end") || (name == "loopend") ) {
+        r.loopEnd = value.toLongLong();
+    } else if (name == "offset") {
+        r.offset = value.toUInt();
+    } else if (name == "end") {
+        r.end = value.toLongLong();
+    } else if (name == "group") {
+        r.group = value.toInt();
+    } else if (name == "off_by") {
+        r.offBy = value.toInt();
+    } else {
+        if (!unsupportedOpcodes.contains(name)) {
+            unsupportedOpcodes.append(name);
+        }
+    }
+}
+
+/* Returns MIDI note number from a number or a note name like c4, c#4 or db4,
+ * where c4 is 60. */
+int KonfytSfzParser::noteFromString(QString s)
+{
+    bool ok;
+    int note = s.toInt(&ok);
+    if (ok) { return note; }
+
+    static const int semitones[] = {9, 11, 0, 2, 4, 5, 7}; // a b c d e f g
+    s = s.toLower();
+    if (s.isEmpty() || (s[0] < 'a') || (s[0] > 'g')) { return 0; }
+    note = semitones[s[0].toLatin1() - 'a'];
+    int i = 1;
+    if (i < s.length() && s[i] == '#') { note++; i++; }
+    else if (i < s.length() && s[i] == 'b') { note--; i++; }
+    int octave = s.mid(i).toInt(&ok);
+    if (!ok) { return 0; }
+    return qBound(0, (octave + 1) * 12 + note, 127);
+}
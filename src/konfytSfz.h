@@ -0,0 +1,139 @@
+/******************************************************************************
+ *
+ * Copyright 2026 Gideon van der Kolf
+ *
+ * This file is part of Konfyt.
+ *
+ *     Konfyt is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     Konfyt is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with Konfyt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#ifndef KONFYT_SFZ_H
+#define KONFYT_SFZ_H
+
+#include "konfytSampleStreamer.h"
+
+#include <QList>
+#include <QMap>
+#include <QString>
+#include <QStringList>
+
+#define KONFYT_SFZ_PRELOAD_FRAMES 32768
+
+// ============================================================================
+
+/* WAV sample file used by SFZ regions. The head is preloaded and the tail is
+ * streamed from disk. */
+struct KonfytSfzSample : public KonfytStreamSample
+{
+    enum Format { FormatPcm16, FormatPcm24, FormatPcm32, FormatFloat32 };
+
+    Format format = FormatPcm16;
+    int fileChannels = 0;
+    int bytesPerFrame = 0;
+    qint64 dataOffset = 0;
+
+    // Loop points from the smpl chunk
+    bool hasLoop = false;
+    uint32_t loopStart = 0;
+    uint32_t loopEnd = 0;
+
+    bool load(QString filename, uint32_t preloadFrames, QString* error);
+    bool loadFully();
+
+    uint32_t readFrames(int fd, uint32_t startFrame, uint32_t count,
+                        float* dest, std::vector<char>& scratch) const;
+    void adviseWillNeed(int fd, uint32_t startFrame, uint32_t count) const;
+
+private:
+    void convert(const char* src, float* dest, uint32_t count) const;
+};
+
+// ============================================================================
+
+struct KonfytSfzRegion
+{
+    enum LoopMode { NoLoop, OneShot, LoopContinuous, LoopSustain };
+    enum Trigger { TriggerAttack, TriggerRelease };
+
+    QString samplePath;
+    KonfytSfzSample* sample = nullptr;
+
+    // Key, velocity and channel ranges
+    int lokey = 0;
+    int hikey = 127;
+    int lovel = 1;
+    int hivel = 127;
+    int lochan = 1;
+    int hichan = 16;
+    Trigger trigger = TriggerAttack;
+
+    // Pitch
+    int pitchKeycenter = 60;
+    float pitchKeytrack = 100; // Cents per key
+    float tune = 0;            // Cents
+    int transpose = 0;         // Semitones
+    float bendUp = 200;        // Cents
+    float bendDown = -200;     // Cents
+
+    // Amplitude
+    float volume = 0;          // dB
+    float pan = 0;             // -100 to 100
+    float ampVeltrack = 100;   // Percent
+    float ampegAttack = 0;     // Seconds
+    float ampegHold = 0;
+    float ampegDecay = 0;
+    float ampegSustain = 100;  // Percent
+    float ampegRelease = 0.001f;
+
+    // Sample playback
+    LoopMode loopMode = NoLoop;
+    bool loopModeSet = false;
+    int64_t loopStart = -1;    // -1: use sample loop points
+    int64_t loopEnd = -1;
+    uint32_t offset = 0;
+    int64_t end = -1;
+
+    // Exclusive groups
+    int group = 0;
+    int offBy = 0;
+
+    bool matches(int note, int velocity, int channel, Trigger t) const;
+};
+
+// ============================================================================
+
+/* Parses SFZ files into a list of regions with the <control>, <global>,
+ * <master> and <group> header opcodes applied. Supports #define and #include.
+ * Unsupported opcodes are ignored. */
+class KonfytSfzParser
+{
+public:
+    bool parseFile(QString filename);
+
+    QList<KonfytSfzRegion> regions;
+    QString errorString;
+    QStringList unsupportedOpcodes;
+
+private:
+    QString defaultPath;
+    QString sfzDir;
+    QMap<QString, QString> defines;
+
+    QString readWithIncludes(QString filename, int depth);
+    void applyOpcode(KonfytSfzRegion& r, QString name, QString value);
+    static int noteFromString(QString s);
+};
+
+#endif // KONFYT_SFZ_H
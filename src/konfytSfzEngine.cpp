@@ -0,0 +1,217 @@
+/******************************************************************************
+ *
+ * Copyright 2026 Gideon van der Kolf
+ *
+ * This file is part of Konfyt.
+ *
+ *     Konfyt is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     Konfyt is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with Konfyt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+
+#include "konfytSfzEngine.h"
+
+#include <QElapsedTimer>
+
+#include <vector>
+
+KonfytSfzEngine::KonfytSfzEngine(QObject *parent) :
+    KonfytBaseSoundEngine(parent)
+{
+
+}
+
+KonfytSfzEngine::~KonfytSfzEngine()
+{
+    // The JACK client has been stopped before the engines are destroyed
+    qDeleteAll(instruments);
+    instruments.clear();
+    streamer.stop();
+}
+
+QString KonfytSfzEngine::engineName()
+{
+    return "SfzEngine";
+}
+
+void KonfytSfzEngine::initEngine(KonfytJackEngine *jackEngine)
+{
+    jack = jackEngine;
+    streamer.start();
+    print("KonfytSfzEngine initialised.");
+    emit initDone("");
+}
+
+int KonfytSfzEngine::addSfz(QString soundfilePath)
+{
+    KONFYT_ASSERT_RETURN_VAL(jack, -1);
+
+    KonfytSfzInstrument* instrument = new KonfytSfzInstrument(&streamer);
+    QString error;
+    if (!instrument->load(soundfilePath, jack->getSampleRate(), &error)) {
+        print("Failed to load SFZ: " + error);
+        delete instrument;
+        return -1;
+    }
+    foreach (QString warning, instrument->warnings()) {
+        print(soundfilePath + ": " + warning);
+    }
+
+    int id = idCounter++;
+    instruments.insert(id, instrument);
+    print("Loaded " + soundfilePath + " ("
+          + n2s(instrument->sampleMemoryBytes() / (1024*1024)) + " MiB)");
+    emit statusInfo(getStatusInfo());
+
+    return id;
+}
+
+QString KonfytSfzEngine::pluginName(int id)
+{
+    return "sfz_" + n2s(id);
+}
+
+/* Instruments are rendered in the JACK process callback and have no JACK
+ * ports. See nativeInstrument(). */
+QString KonfytSfzEngine::midiInJackPortName(int /*id*/)
+{
+    return "";
+}
+
+QStringList KonfytSfzEngine::audioOutJackPortNames(int /*id*/)
+{
+    return QStringList();
+}
+
+/* The plugin must already have been removed from the JACK engine. The JACK
+ * thread may still be rendering the instrument from an earlier graph, so it is
+ * deleted once the JACK engine is done with it. */
+void KonfytSfzEngine::removeSfz(int id)
+{
+    KONFYT_ASSERT_RETURN(instruments.contains(id));
+
+    KonfytSfzInstrument* instrument = instruments.take(id);
+    jack->deleteWhenUnused([instrument]() { delete instrument; });
+    emit statusInfo(getStatusInfo());
+}
+
+void KonfytSfzEngine::setGain(int id, float newGain)
+{
+    KONFYT_ASSERT_RETURN(instruments.contains(id));
+
+    instruments[id]->setGain(newGain);
+}
+
+bool KonfytSfzEngine::hasNativeGain()
+{
+    return true;
+}
+
+KonfytSfzInstrument *KonfytSfzEngine::nativeInstrument(int id)
+{
+    KONFYT_ASSERT_RETURN_VAL(instruments.contains(id), nullptr);
+
+    return instruments[id];
+}
+
+QString KonfytSfzEngine::getStatusInfo()
+{
+    qint64 bytes = 0;
+    foreach (KonfytSfzInstrument* instrument, instruments) {
+        bytes += instrument->sampleMemoryBytes();
+    }
+    return QString("Native SFZ: %1 instruments, %2 MiB samples, %3 stream underruns")
+            .arg(instruments.count())
+            .arg(bytes / (1024*1024))
+            .arg(streamer.underrunCount());
+}
+
+/* Render the instrument offline at increasing polyphony levels and report the
+ * CPU load and the number of voices that can be rendered in realtime by one
+ * core. Notes are retriggered every block to keep the target voice count. */
+QStringList KonfytSfzEngine::runPolyphonyBenchmark(QString sfzPath, int nframes,
+                                                   double sampleRate)
+{
+    QStringList ret;
+
+    KonfytSampleStreamer streamer;
+    streamer.start();
+    KonfytSfzInstrument* instrument = new KonfytSfzInstrument(&streamer);
+    QString error;
+    if (!instrument->load(sfzPath, sampleRate, &error)) {
+        ret.append("Error: " + error);
+        delete instrument;
+        return ret;
+    }
+
+    ret.append(QString("%1: %2 frames per block, %3 Hz")
+               .arg(sfzPath).arg(nframes).arg(sampleRate));
+    ret.append("target  voices  load%   voices/core  underruns");
+
+    std::vector<float> left(nframes);
+    std::vector<float> right(nframes);
+    int blocksPerLevel = qMax(1, (int)(sampleRate * 2 / nframes));
+    int note = 0;
+    int channel = 0;
+    QElapsedTimer timer;
+
+    for (int target = 8; target <= KONFYT_SFZ_MAX_VOICES; target *= 2) {
+        uint32_t underrunsBefore = streamer.underrunCount();
+        qint64 renderNsecs = 0;
+        qint64 voiceSum = 0;
+
+        for (int block = 0; block < blocksPerLevel; block++) {
+            // Trigger notes to keep the target voice count. Events are applied
+            // by the next render().
+            int toStart = target - instrument->activeVoiceCount();
+            for (int i = 0; i < qMin(toStart, 16); i++) {
+                KonfytRtMidiEvent ev;
+                ev.channel = channel;
+                ev.setNoteOn(21 + note, 100);
+                instrument->processMidi(ev, 0);
+                note = (note + 1) % 88;
+                if (note == 0) { channel = (channel + 1) % 16; }
+            }
+
+            timer.start();
+            instrument->render(left.data(), right.data(), nframes);
+            renderNsecs += timer.nsecsElapsed();
+            voiceSum += instrument->activeVoiceCount();
+        }
+
+        // Release all voices before the next level
+        for (int c = 0; c < 16; c++) {
+            KonfytRtMidiEvent ev;
+            ev.channel = c;
+            ev.setCC(120, 0);
+            instrument->processMidi(ev, 0);
+        }
+        instrument->render(left.data(), right.data(), nframes);
+
+        double audioNsecs = blocksPerLevel * (double)nframes / sampleRate * 1e9;
+        double load = renderNsecs / audioNsecs;
+        double voices = (double)voiceSum / blocksPerLevel;
+        ret.append(QString("%1  %2  %3  %4  %5")
+                   .arg(target, 6)
+                   .arg(voices, 6, 'f', 1)
+                   .arg(load * 100, 6, 'f', 2)
+                   .arg(load > 0 ? voices / load : 0, 11, 'f', 0)
+                   .arg(streamer.underrunCount() - underrunsBefore, 9));
+    }
+
+    delete instrument;
+    streamer.stop();
+
+    return ret;
+}
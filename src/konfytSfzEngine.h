@@ -0,0 +1,65 @@
+/******************************************************************************
+ *
+ * Copyright 2026 Gideon van der Kolf
+ *
+ * This file is part of Konfyt.
+ *
+ *     Konfyt is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     Konfyt is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with Konfyt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+
+#ifndef KONFYTSFZENGINE_H
+#define KONFYTSFZENGINE_H
+
+#include "konfytBaseSoundEngine.h"
+#include "konfytSampleStreamer.h"
+#include "konfytSfzInstrument.h"
+
+#include <QMap>
+#include <QObject>
+
+/* Native SFZ engine. Instruments are rendered in-process in the JACK process
+ * callback without an external sampler or subprocess. */
+class KonfytSfzEngine : public KonfytBaseSoundEngine
+{
+    Q_OBJECT
+public:
+    explicit KonfytSfzEngine(QObject *parent = 0);
+    ~KonfytSfzEngine();
+
+    QString engineName();
+    void initEngine(KonfytJackEngine* jackEngine);
+    int addSfz(QString soundfilePath);
+    QString pluginName(int id);
+    QString midiInJackPortName(int id);
+    QStringList audioOutJackPortNames(int id);
+    void removeSfz(int id);
+    void setGain(int id, float newGain);
+    bool hasNativeGain();
+    KonfytSfzInstrument* nativeInstrument(int id);
+
+    static QStringList runPolyphonyBenchmark(QString sfzPath, int nframes,
+                                             double sampleRate);
+
+private:
+    KonfytJackEngine* jack = nullptr;
+    KonfytSampleStreamer streamer;
+    int idCounter = 400;
+    QMap<int, KonfytSfzInstrument*> instruments;
+
+    QString getStatusInfo();
+};
+
+#endif // KONFYTSFZENGINE_H
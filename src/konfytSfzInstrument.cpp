@@ -0,0 +1,526 @@
+/******************************************************************************
+ *
+ * Copyright 2026 Gideon van der Kolf
+ *
+ * This file is part of Konfyt.
+ *
+ *     Konfyt is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     Konfyt is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with Konfyt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include "konfytSfzInstrument.h"
+
+#include <QMap>
+
+#include <math.h>
+#include <string.h>
+
+KonfytSfzInstrument::KonfytSfzInstrument(KonfytSampleStreamer *streamer) :
+    streamer(streamer)
+{
+    memset(noteVelocity, 0, sizeof(noteVelocity));
+}
+
+KonfytSfzInstrument::~KonfytSfzInstrument()
+{
+    for (int i = 0; i < KONFYT_SFZ_MAX_VOICES; i++) {
+        if (voices[i].active) { stopVoice(voices[i]); }
+    }
+    foreach (KonfytSfzSample* sample, samples) {
+        // Wait for the streamer to be done with the sample before deleting it.
+        streamer->waitForSampleReleased(sample);
+        delete sample;
+    }
+}
+
+/* Parse the SFZ file and load its samples. */
+bool KonfytSfzInstrument::load(QString filename, double sampleRate, QString *error)
+{
+    mFilename = filename;
+    mSampleRate = sampleRate;
+
+    KonfytSfzParser parser;
+    if (!parser.parseFile(filename)) {
+        *error = parser.errorString;
+        return false;
+    }
+    if (!parser.unsupportedOpcodes.isEmpty()) {
+        mWarnings.append("Unsupported opcodes ignored: "
+                         + parser.unsupportedOpcodes.join(", "));
+    }
+
+    QMap<QString, KonfytSfzSample*> sampleMap;
+    foreach (KonfytSfzRegion region, parser.regions) {
+        if (region.samplePath.isEmpty()) { continue; }
+        if (region.samplePath.startsWith('*')) {
+            mWarnings.append("Generated sample not supported: " + region.samplePath);
+            continue;
+        }
+
+        KonfytSfzSample* sample = sampleMap.value(region.samplePath);
+        if (!sample) {
+            sample = new KonfytSfzSample();
+            QString sampleError;
+            if (!sample->load(region.samplePath, KONFYT_SFZ_PRELOAD_FRAMES, &sampleError)) {
+                mWarnings.append(sampleError);
+                delete sample;
+                continue;
+            }
+            sampleMap.insert(region.samplePath, sample);
+            samples.append(sample);
+        }
+        region.sample = sample;
+
+        // Looping is only done from memory, so load looped samples fully.
+        bool loop = region.loopModeSet ?
+                    ( (region.loopMode == KonfytSfzRegion::LoopContinuous)
+                      || (region.loopMode == KonfytSfzRegion::LoopSustain) )
+                  : sample->hasLoop;
+        if (loop && !sample->loadFully()) {
+            mWarnings.append("Failed to load looped sample " + region.samplePath);
+        }
+
+        regions.push_back(region);
+    }
+
+    if (regions.empty()) {
+        *error = "No playable regions in " + filename;
+        if (!mWarnings.isEmpty()) { *error += ": " + mWarnings.first(); }
+        return false;
+    }
+
+    for (int i = 0; i < (int)regions.size(); i++) {
+        const KonfytSfzRegion& r = regions[i];
+        for (int note = qMax(0, r.lokey); note <= qMin(127, r.hikey); note++) {
+            regionsByNote[note].push_back(i);
+        }
+    }
+
+    return true;
+}
+
+QString KonfytSfzInstrument::filename() const
+{
+    return mFilename;
+}
+
+QStringList KonfytSfzInstrument::warnings() const
+{
+    return mWarnings;
+}
+
+qint64 KonfytSfzInstrument::sampleMemoryBytes() const
+{
+    qint64 bytes = 0;
+    foreach (KonfytSfzSample* sample, samples) {
+        bytes += sample->preload.size() * sizeof(float);
+    }
+    return bytes;
+}
+
+void KonfytSfzInstrument::setGain(float gain)
+{
+    mGain = gain;
+}
+
+int KonfytSfzInstrument::activeVoiceCount() const
+{
+    return mActiveVoices;
+}
+
+/* JACK thread: queue event to be applied in the next render() call. */
+void KonfytSfzInstrument::processMidi(const KonfytRtMidiEvent &ev, uint32_t time)
+{
+    if (eventCount >= KONFYT_SFZ_MAX_EVENTS) { return; }
+
+    // Keep events sorted by time. Events mostly arrive in order.
+    int i = eventCount;
+    while ( (i > 0) && (events[i-1].time > time) ) {
+        events[i] = events[i-1];
+        i--;
+    }
+    events[i].time = time;
+    events[i].ev = ev;
+    eventCount++;
+}
+
+/* JACK thread: render nframes into left and right, applying events queued
+ * with processMidi() at their frame offsets. */
+void KonfytSfzInstrument::render(float *left, float *right, uint32_t nframes)
+{
+    memset(left, 0, sizeof(float) * nframes);
+    memset(right, 0, sizeof(float) * nframes);
+
+    uint32_t pos = 0;
+    for (int e = 0; e <= eventCount; e++) {
+        uint32_t until = nframes;
+        if (e < eventCount) {
+            until = qMin(events[e].time, nframes);
+        }
+        if (until > pos) {
+            for (int i = 0; i < KONFYT_SFZ_MAX_VOICES; i++) {
+                if (voices[i].active) {
+                    renderVoice(voices[i], left + pos, right + pos, until - pos);
+                }
+            }
+            pos = until;
+        }
+        if (e < eventCount) {
+            handleEvent(events[e].ev);
+        }
+    }
+    eventCount = 0;
+
+    float gain = mGain;
+    if (gain != 1.0f) {
+        for (uint32_t i = 0; i < nframes; i++) {
+            left[i] *= gain;
+            right[i] *= gain;
+        }
+    }
+
+    int active = 0;
+    for (int i = 0; i < KONFYT_SFZ_MAX_VOICES; i++) {
+        if (voices[i].active) { active++; }
+    }
+    mActiveVoices = active;
+}
+
+void KonfytSfzInstrument::handleEvent(const KonfytRtMidiEvent &ev)
+{
+    int channel = ev.channel & 0x0F;
+
+    switch (ev.type()) {
+    case MIDI_EVENT_TYPE_NOTEON:
+        if (ev.velocity() == 0) {
+            noteOff(channel, ev.note());
+        } else {
+            noteOn(channel, ev.note(), ev.velocity());
+        }
+        break;
+    case MIDI_EVENT_TYPE_NOTEOFF:
+        noteOff(channel, ev.note());
+        break;
+    case MIDI_EVENT_TYPE_PITCHBEND:
+        pitchbend[channel] = ev.pitchbendValueSigned();
+        break;
+    case MIDI_EVENT_TYPE_CC:
+        if (ev.data1() == 64) {
+            bool on = ev.data2() > MIDI_SUSTAIN_THRESH;
+            sustain[channel] = on;
+            if (!on) {
+                for (int i = 0; i < KONFYT_SFZ_MAX_VOICES; i++) {
+                    Voice& v = voices[i];
+                    if (v.active && v.heldBySustain && (v.channel == channel)) {
+                        v.heldBySustain = false;
+                        releaseVoice(v, v.region->ampegRelease);
+                    }
+                }
+            }
+        } else if (ev.data1() == 120) {
+            // All sound off
+            for (int i = 0; i < KONFYT_SFZ_MAX_VOICES; i++) {
+                if (voices[i].active && (voices[i].channel == channel)) {
+                    stopVoice(voices[i]);
+                }
+            }
+        } else if (ev.data1() == MIDI_CC_ALL_NOTES_OFF) {
+            for (int i = 0; i < KONFYT_SFZ_MAX_VOICES; i++) {
+                Voice& v = voices[i];
+                if (v.active && (v.channel == channel)) {
+                    v.heldBySustain = false;
+                    releaseVoice(v, v.region->ampegRelease);
+                }
+            }
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void KonfytSfzInstrument::noteOn(int channel, int note, int velocity)
+{
+    if ( (note < 0) || (note > 127) ) { return; }
+    noteVelocity[channel][note] = velocity;
+    startVoices(channel, note, velocity, KonfytSfzRegion::TriggerAttack);
+}
+
+void KonfytSfzInstrument::noteOff(int channel, int note)
+{
+    if ( (note < 0) || (note > 127) ) { return; }
+
+    for (int i = 0; i < KONFYT_SFZ_MAX_VOICES; i++) {
+        Voice& v = voices[i];
+        if (!v.active || v.released || (v.channel != channel) || (v.note != note)) {
+            continue;
+        }
+        if (v.region->trigger == KonfytSfzRegion::TriggerRelease) { continue; }
+        if (v.region->loopMode == KonfytSfzRegion::OneShot) { continue; }
+        if (sustain[channel]) {
+            v.heldBySustain = true;
+        } else {
+            releaseVoice(v, v.region->ampegRelease);
+        }
+    }
+
+    if (noteVelocity[channel][note] > 0) {
+        startVoices(channel, note, noteVelocity[channel][note],
+                    KonfytSfzRegion::TriggerRelease);
+        noteVelocity[channel][note] = 0;
+    }
+}
+
+void KonfytSfzInstrument::startVoices(int channel, int note, int velocity,
+                                      KonfytSfzRegion::Trigger trigger)
+{
+    const std::vector<int>& list = regionsByNote[note];
+    for (size_t i = 0; i < list.size(); i++) {
+        const KonfytSfzRegion* region = &regions[list[i]];
+        if (region->matches(note, velocity, channel, trigger)) {
+            startVoice(region, channel, note, velocity);
+        }
+    }
+}
+
+void KonfytSfzInstrument::startVoice(const KonfytSfzRegion *region, int channel,
+                                     int note, int velocity)
+{
+    // Exclusive groups: this region turns off voices that are off by its group.
+    if (region->group != 0) {
+        for (int i = 0; i < KONFYT_SFZ_MAX_VOICES; i++) {
+            Voice& v = voices[i];
+            if (v.active && !v.released && (v.region->offBy == region->group)) {
+                releaseVoice(v, KONFYT_SFZ_CHOKE_RELEASE_SECS);
+            }
+        }
+    }
+
+    Voice* v = findFreeVoice();
+    const KonfytSfzSample* sample = region->sample;
+
+    v->active = true;
+    v->region = region;
+    v->sample = sample;
+    v->channel = channel;
+    v->note = note;
+    v->age = ageCounter++;
+    v->released = false;
+    v->heldBySustain = false;
+
+    // Playback range
+    v->pos = region->offset;
+    v->endFrame = sample->frames;
+    if ( (region->end >= 0) && ((uint32_t)region->end + 1 < v->endFrame) ) {
+        v->endFrame = region->end + 1;
+    }
+    KonfytSfzRegion::LoopMode loopMode = region->loopMode;
+    if (!region->loopModeSet) {
+        loopMode = sample->hasLoop ? KonfytSfzRegion::LoopContinuous
+                                   : KonfytSfzRegion::NoLoop;
+    }
+    v->loopStart = (region->loopStart >= 0) ? region->loopStart : sample->loopStart;
+    v->loopEnd = (region->loopEnd >= 0) ? region->loopEnd : sample->loopEnd;
+    bool loopValid = (v->loopEnd > v->loopStart) && (v->loopEnd < sample->preloadFrames);
+    v->loopContinuous = loopValid && (loopMode == KonfytSfzRegion::LoopContinuous);
+    v->loopSustain = loopValid && (loopMode == KonfytSfzRegion::LoopSustain);
+
+    // Stream the part after the preloaded head from disk
+    v->streamSlot = -1;
+    if (!v->loopContinuous && !v->loopSustain && (v->endFrame > sample->preloadFrames)) {
+        v->streamSlot = streamer->startStream(sample, sample->preloadFrames);
+        if (v->streamSlot < 0) {
+            // No stream available. Play preloaded part only.
+            streamer->countUnderrun();
+            v->endFrame = sample->preloadFrames;
+        }
+    }
+
+    // Pitch
+    float cents = (note - region->pitchKeycenter) * region->pitchKeytrack
+            + region->tune + region->transpose * 100;
+    v->increment = pow(2.0, cents / 1200.0) * sample->sampleRate / mSampleRate;
+
+    // Amplitude
+    float vt = region->ampVeltrack / 100.0f;
+    float vel = velocity / 127.0f;
+    float gain = pow(10.0f, region->volume / 20.0f) * ((1.0f - vt) + vt * vel * vel);
+    float p = (qBound(-100.0f, region->pan, 100.0f) + 100.0f) / 200.0f;
+    v->gainL = gain * cosf(p * M_PI_2) * M_SQRT2;
+    v->gainR = gain * sinf(p * M_PI_2) * M_SQRT2;
+
+    // Envelope
+    v->sustainLevel = qBound(0.0f, region->ampegSustain / 100.0f, 1.0f);
+    v->envStage = EnvAttack;
+    v->envFramesLeft = region->ampegAttack * mSampleRate;
+    if (v->envFramesLeft > 0) {
+        v->env = 0;
+        v->envDelta = 1.0f / v->envFramesLeft;
+    } else {
+        v->env = 1;
+        v->envDelta = 0;
+    }
+}
+
+/* Returns a free voice, or steals the oldest voice, preferring released voices. */
+KonfytSfzInstrument::Voice *KonfytSfzInstrument::findFreeVoice()
+{
+    Voice* oldest = nullptr;
+    Voice* oldestReleased = nullptr;
+    for (int i = 0; i < KONFYT_SFZ_MAX_VOICES; i++) {
+        Voice& v = voices[i];
+        if (!v.active) { return &v; }
+        if (!oldest || (v.age < oldest->age)) { oldest = &v; }
+        if (v.released && (!oldestReleased || (v.age < oldestReleased->age))) {
+            oldestReleased = &v;
+        }
+    }
+    Voice* steal = oldestReleased ? oldestReleased : oldest;
+    stopVoice(*steal);
+    return steal;
+}
+
+void KonfytSfzInstrument::releaseVoice(Voice &v, float releaseSecs)
+{
+    v.released = true;
+    v.envStage = EnvRelease;
+    v.envFramesLeft = qMax(1.0f, releaseSecs * (float)mSampleRate);
+    v.envDelta = -v.env / v.envFramesLeft;
+}
+
+void KonfytSfzInstrument::stopVoice(Voice &v)
+{
+    if (v.streamSlot >= 0) {
+        streamer->stopStream(v.streamSlot);
+        v.streamSlot = -1;
+    }
+    v.active = false;
+}
+
+/* Returns the envelope value for the next frame and advances the envelope. */
+float KonfytSfzInstrument::nextEnvelope(Voice &v)
+{
+    float ret = v.env;
+    switch (v.envStage) {
+    case EnvAttack:
+        v.env += v.envDelta;
+        if (v.envFramesLeft == 0 || --v.envFramesLeft == 0) {
+            v.env = 1;
+            v.envStage = EnvHold;
+            v.envFramesLeft = v.region->ampegHold * mSampleRate;
+        }
+        break;
+    case EnvHold:
+        if (v.envFramesLeft == 0 || --v.envFramesLeft == 0) {
+            v.envStage = EnvDecay;
+            v.envFramesLeft = v.region->ampegDecay * mSampleRate * (1.0f - v.sustainLevel);
+            v.envDelta = v.envFramesLeft ? (v.sustainLevel - 1.0f) / v.envFramesLeft : 0;
+        }
+        break;
+    case EnvDecay:
+        v.env += v.envDelta;
+        if (v.envFramesLeft == 0 || --v.envFramesLeft == 0) {
+            v.env = v.sustainLevel;
+            v.envStage = EnvSustain;
+        }
+        break;
+    case EnvSustain:
+        if (v.env <= 0) { v.envStage = EnvDone; }
+        break;
+    case EnvRelease:
+        v.env += v.envDelta;
+        if (v.envFramesLeft == 0 || --v.envFramesLeft == 0) {
+            v.env = 0;
+            v.envStage = EnvDone;
+        }
+        break;
+    case EnvDone:
+        ret = 0;
+        break;
+    }
+    return ret;
+}
+
+/* Get frame from preloaded head or from the stream. Returns false if not
+ * available. */
+inline bool KonfytSfzInstrument::fetchFrame(Voice &v, uint32_t index, float &l, float &r)
+{
+    const KonfytSfzSample* s = v.sample;
+    const float* p;
+    if (index < s->preloadFrames) {
+        p = &s->preload[(size_t)index * s->channels];
+    } else if (v.streamSlot >= 0) {
+        p = streamer->frame(v.streamSlot, index);
+        if (!p) { return false; }
+    } else {
+        return false;
+    }
+    l = p[0];
+    r = (s->channels > 1) ? p[1] : p[0];
+    return true;
+}
+
+void KonfytSfzInstrument::renderVoice(Voice &v, float *left, float *right, uint32_t n)
+{
+    // Pitchbend
+    int bend = pitchbend[v.channel];
+    double increment = v.increment;
+    if (bend != 0) {
+        float cents = (bend > 0) ? bend / 8191.0f * v.region->bendUp
+                                 : bend / 8192.0f * -v.region->bendDown;
+        increment *= pow(2.0, cents / 1200.0);
+    }
+
+    bool underrun = false;
+    for (uint32_t i = 0; i < n; i++) {
+        float env = nextEnvelope(v);
+        if (v.envStage == EnvDone) {
+            stopVoice(v);
+            break;
+        }
+
+        bool looping = v.loopContinuous || (v.loopSustain && !v.released);
+        uint32_t index = (uint32_t)v.pos;
+        float frac = v.pos - index;
+        uint32_t next = index + 1;
+        if (looping && (next > v.loopEnd)) {
+            next = v.loopStart;
+        } else if (next >= v.endFrame) {
+            next = index;
+        }
+
+        float l0, r0, l1, r1;
+        if (fetchFrame(v, index, l0, r0) && fetchFrame(v, next, l1, r1)) {
+            left[i] += (l0 + (l1 - l0) * frac) * v.gainL * env;
+            right[i] += (r0 + (r1 - r0) * frac) * v.gainR * env;
+        } else {
+            underrun = true;
+        }
+
+        v.pos += increment;
+        if (looping && (v.pos >= v.loopEnd + 1)) {
+            v.pos -= (v.loopEnd + 1 - v.loopStart);
+        } else if (v.pos >= v.endFrame) {
+            stopVoice(v);
+            break;
+        }
+    }
+
+    if (underrun) {
+        streamer->countUnderrun();
+    }
+    if (v.active && (v.streamSlot >= 0)) {
+        streamer->setReadPosition(v.streamSlot, (uint32_t)v.pos);
+    }
+}
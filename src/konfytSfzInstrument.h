@@ -0,0 +1,136 @@
+/******************************************************************************
+ *
+ * Copyright 2026 Gideon van der Kolf
+ *
+ * This file is part of Konfyt.
+ *
+ *     Konfyt is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     Konfyt is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with Konfyt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#ifndef KONFYT_SFZ_INSTRUMENT_H
+#define KONFYT_SFZ_INSTRUMENT_H
+
+#include "konfytRtMidiEvent.h"
+#include "konfytSampleStreamer.h"
+#include "konfytSfz.h"
+
+#include <atomic>
+#include <vector>
+
+#define KONFYT_SFZ_MAX_VOICES 256
+#define KONFYT_SFZ_MAX_EVENTS 512
+#define KONFYT_SFZ_CHOKE_RELEASE_SECS 0.005f
+
+/* An SFZ instrument rendered in-process in the JACK thread.
+ *
+ * MIDI events received during a JACK cycle (processMidi()) are applied at
+ * their frame offsets when the instrument is rendered later in the same cycle
+ * (render()).
+ *
+ * Sample heads are preloaded and tails are streamed from disk by the shared
+ * KonfytSampleStreamer. Samples of looped regions are loaded fully. */
+class KonfytSfzInstrument
+{
+public:
+    KonfytSfzInstrument(KonfytSampleStreamer* streamer);
+    ~KonfytSfzInstrument();
+
+    bool load(QString filename, double sampleRate, QString* error);
+    QString filename() const;
+    QStringList warnings() const;
+    qint64 sampleMemoryBytes() const;
+
+    void setGain(float gain);
+    int activeVoiceCount() const;
+
+    // JACK thread
+    void processMidi(const KonfytRtMidiEvent& ev, uint32_t time);
+    void render(float* left, float* right, uint32_t nframes);
+
+private:
+    enum EnvStage { EnvAttack, EnvHold, EnvDecay, EnvSustain, EnvRelease, EnvDone };
+
+    struct Voice
+    {
+        bool active = false;
+        const KonfytSfzRegion* region = nullptr;
+        const KonfytSfzSample* sample = nullptr;
+        int channel = 0;
+        int note = 0;
+        uint32_t age = 0;
+
+        double pos = 0;
+        double increment = 1;
+        uint32_t endFrame = 0;
+        bool loopContinuous = false;
+        bool loopSustain = false;
+        uint32_t loopStart = 0;
+        uint32_t loopEnd = 0;
+        int streamSlot = -1;
+
+        float gainL = 1;
+        float gainR = 1;
+
+        EnvStage envStage = EnvDone;
+        float env = 0;
+        float envDelta = 0;
+        uint32_t envFramesLeft = 0;
+        float sustainLevel = 1;
+
+        bool released = false;
+        bool heldBySustain = false;
+    };
+
+    struct Event
+    {
+        uint32_t time;
+        KonfytRtMidiEvent ev;
+    };
+
+    KonfytSampleStreamer* streamer;
+    QString mFilename;
+    QStringList mWarnings;
+    double mSampleRate = 48000;
+
+    QList<KonfytSfzSample*> samples;
+    std::vector<KonfytSfzRegion> regions;
+    std::vector<int> regionsByNote[128];
+
+    std::atomic<float> mGain {1.0};
+    std::atomic<int> mActiveVoices {0};
+
+    // JACK thread state
+    Voice voices[KONFYT_SFZ_MAX_VOICES];
+    Event events[KONFYT_SFZ_MAX_EVENTS];
+    int eventCount = 0;
+    uint32_t ageCounter = 0;
+    bool sustain[16] = {false};
+    int pitchbend[16] = {0};
+    int noteVelocity[16][128];
+
+    void handleEvent(const KonfytRtMidiEvent& ev);
+    void noteOn(int channel, int note, int velocity);
+    void noteOff(int channel, int note);
+    void startVoices(int channel, int note, int velocity, KonfytSfzRegion::Trigger trigger);
+    void startVoice(const KonfytSfzRegion* region, int channel, int note, int velocity);
+    Voice* findFreeVoice();
+    void releaseVoice(Voice& v, float releaseSecs);
+    void stopVoice(Voice& v);
+    void renderVoice(Voice& v, float* left, float* right, uint32_t n);
+    float nextEnvelope(Voice& v);
+    bool fetchFrame(Voice& v, uint32_t index, float& l, float& r);
+};
+
+#endif // KONFYT_SFZ_INSTRUMENT_H
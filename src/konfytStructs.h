@@ -80,9 +80,14 @@ struct KonfytAppInfo
     bool bridge = false;
     bool headless = false;
     bool carla = false;
+    bool nativeSfz = false;
+    bool sharedFluidsynth = false;
+    int sharedJsEngines = 0;
+    bool profileScripts = false;
     bool startMinimized = false;
     QStringList filesToLoad;
     QString jackClientName;
+    QString bridgeStatusFile;
 };
 
 // ===========================================================================
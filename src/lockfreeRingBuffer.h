@@ -0,0 +1,81 @@
+/******************************************************************************
+ *
+ * Copyright 2023 Gideon van der Kolf
+ *
+ * This file is part of Konfyt.
+ *
+ *     Konfyt is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ *
+ *     Konfyt is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with Konfyt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#ifndef LOCKFREERINGBUFFER_H
+#define LOCKFREERINGBUFFER_H
+
+#include <QVector>
+
+#include <atomic>
+
+/* Single producer, single consumer ringbuffer that never locks or allocates
+ * after construction, for passing data to the JACK thread.
+ *
+ * Only one thread may write and one thread may read at a time. Multiple
+ * writers must be serialised by the caller (e.g. with a mutex on the
+ * non-realtime side). */
+template <typename T>
+class LockfreeRingBuffer
+{
+public:
+    LockfreeRingBuffer(int size)
+    {
+        // One slot is kept free to distinguish full from empty
+        mSize = size + 1;
+        buffer.resize(mSize);
+    }
+
+    /* Returns false if the buffer is full. */
+    bool write(const T& data)
+    {
+        int w = iwrite.load(std::memory_order_relaxed);
+        int next = incr(w);
+        if (next == iread.load(std::memory_order_acquire)) { return false; }
+        buffer[w] = data;
+        iwrite.store(next, std::memory_order_release);
+        return true;
+    }
+
+    /* Returns false if the buffer is empty. */
+    bool read(T* data)
+    {
+        int r = iread.load(std::memory_order_relaxed);
+        if (r == iwrite.load(std::memory_order_acquire)) { return false; }
+        *data = buffer.at(r);
+        iread.store(incr(r), std::memory_order_release);
+        return true;
+    }
+
+private:
+    int mSize;
+    QVector<T> buffer;
+    std::atomic<int> iwrite {0};
+    std::atomic<int> iread {0};
+
+    int incr(int val) const
+    {
+        val++;
+        if (val >= mSize) { val = 0; }
+        return val;
+    }
+};
+
+#endif // LOCKFREERINGBUFFER_H
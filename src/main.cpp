@@ -20,11 +20,19 @@
  *****************************************************************************/
 
 #include <QApplication>
+#include <QFile>
 
 #include "konfytUtils.h"
 #include "konfytStructs.h"
 #include "mainwindow.h"
+#include "konfytSfzEngine.h"
+#include "konfytBridgeEngine.h"
+#include "konfytJackEngine.h"
+#include "konfytJs.h"
 #include "remotescanner.h"
+#ifdef KONFYT_USE_CARLA
+    #include "konfytBridgeClient.h"
+#endif
 
 #include <iostream>
 
@@ -68,7 +76,44 @@ void printUsage()
     print("  --minimized            Start up with main window minimized");
     print("  -b, --bridge           Load sfz's in separate processes (experimental feature,");
     print("                           uses Carla)");
+    print("  --status-file <path>   In bridge mode, periodically write the status of the");
+    print("                           bridge subprocesses and the JACK engine as JSON to");
+    print("                           the specified file");
     print("  -c, --carla            Use Carla to load sfz's and not Linuxsampler");
+    print("  --native-sfz           Load sfz's in Konfyt's built-in sampler and not");
+    print("                           Linuxsampler (experimental feature, WAV samples only)");
+    print("  --benchmark-sfz <sfz>  Measure the polyphony of the built-in sampler for the");
+    print("                           specified sfz and exit");
+    print("  --benchmark-bridge <sfz>");
+    print("                         Count the missed cycles at 64 frames of the specified");
+    print("                           sfz in the built-in sampler, rendered in-process");
+    print("                           and through the bridge shared memory transport,");
+    print("                           and exit");
+    print("  --shared-fluidsynth    Render soundfont layers on the channels of a few shared");
+    print("                           Fluidsynth synths instead of a synth per layer, to");
+    print("                           reduce CPU usage of projects with many soundfont");
+    print("                           layers (reverb and chorus are disabled)");
+    print("  --benchmark-fluidsynth <sf2>");
+    print("                         Measure the CPU load of 1 to 64 layers of the");
+    print("                           specified soundfont with and without shared synths");
+    print("                           and the onset jitter of its notes and exit");
+    print("  --benchmark-script <js>");
+    print("                         Measure the number of MIDI events per second the");
+    print("                           specified script can process and exit");
+    print("  --benchmark-midi-filter");
+    print("                         Measure the number of MIDI events per microsecond");
+    print("                           through the MIDI filters of a number of layers and");
+    print("                           exit");
+    print("  --benchmark-midi-out   Check that events written to a MIDI output port from");
+    print("                           different sources are output in frame order,");
+    print("                           measure the event rate and exit");
+    print("  --shared-js-engines <n>");
+    print("                         Run scripts in n shared Javascript engines per script");
+    print("                           thread instead of a separate engine per script, to");
+    print("                           reduce memory usage and load time of projects with");
+    print("                           many scripts");
+    print("  --profile-scripts      Measure garbage collection pauses of scripts and keep");
+    print("                           their slowest calls in the script profiles");
 #ifndef KONFYT_USE_CARLA
     print("                           Note: This version of Konfyt was compiled without");
     print("                           Carla support.");
@@ -93,6 +138,18 @@ int main(int argc, char *argv[])
     QStringList argsNoXcbEv({"-x", "--noxcbev"});
     QStringList argsScan({"--scan"});
     QStringList argsMinimized({"--minimized"});
+    QStringList argsBridgeClient({"--bridge-client"});
+    QStringList argsStatusFile({"--status-file"});
+    QStringList argsNativeSfz({"--native-sfz"});
+    QStringList argsBenchmarkSfz({"--benchmark-sfz"});
+    QStringList argsBenchmarkBridge({"--benchmark-bridge"});
+    QStringList argsSharedFluidsynth({"--shared-fluidsynth"});
+    QStringList argsBenchmarkFluidsynth({"--benchmark-fluidsynth"});
+    QStringList argsSharedJsEngines({"--shared-js-engines"});
+    QStringList argsBenchmarkScript({"--benchmark-script"});
+    QStringList argsProfileScripts({"--profile-scripts"});
+    QStringList argsBenchmarkMidiFilter({"--benchmark-midi-filter"});
+    QStringList argsBenchmarkMidiOut({"--benchmark-midi-out"});
 
     // Handle arguments
 
@@ -101,6 +158,13 @@ int main(int argc, char *argv[])
     KonfytAppInfo appInfo;
     bool setXcbEv = true;
     bool scanMode = false;
+    QString bridgeClientShm;
+    QString benchmarkSfz;
+    QString benchmarkBridge;
+    QString benchmarkFluidsynth;
+    QString benchmarkScript;
+    bool benchmarkMidiFilter = false;
+    bool benchmarkMidiOut = false;
     appInfo.exePath = QString(argv[0]);
 
     for (int i=1; i < argc; i++) {
@@ -149,6 +213,64 @@ int main(int argc, char *argv[])
 
                 appInfo.startMinimized = true;
 
+            } else if (argsBridgeClient.contains(arg)) {
+
+                nextIsValue = true;
+                prevArg = arg;
+
+            } else if (argsStatusFile.contains(arg)) {
+
+                nextIsValue = true;
+                prevArg = arg;
+
+            } else if (argsNativeSfz.contains(arg)) {
+
+                appInfo.nativeSfz = true;
+                print("Native sfz mode.");
+
+            } else if (argsBenchmarkSfz.contains(arg)) {
+
+                nextIsValue = true;
+                prevArg = arg;
+
+            } else if (argsBenchmarkBridge.contains(arg)) {
+
+                nextIsValue = true;
+                prevArg = arg;
+
+            } else if (argsSharedFluidsynth.contains(arg)) {
+
+                appInfo.sharedFluidsynth = true;
+                print("Shared Fluidsynth mode.");
+
+            } else if (argsBenchmarkFluidsynth.contains(arg)) {
+
+                nextIsValue = true;
+                prevArg = arg;
+
+            } else if (argsSharedJsEngines.contains(arg)) {
+
+                nextIsValue = true;
+                prevArg = arg;
+
+            } else if (argsBenchmarkScript.contains(arg)) {
+
+                nextIsValue = true;
+                prevArg = arg;
+
+            } else if (argsProfileScripts.contains(arg)) {
+
+                appInfo.profileScripts = true;
+                print("Detailed script profiling enabled.");
+
+            } else if (argsBenchmarkMidiFilter.contains(arg)) {
+
+                benchmarkMidiFilter = true;
+
+            } else if (argsBenchmarkMidiOut.contains(arg)) {
+
+                benchmarkMidiOut = true;
+
             } else {
                 if (arg[0] == '-') {
                     print(QString("Invalid argument %1. Ignoring it.").arg(arg));
@@ -161,6 +283,22 @@ int main(int argc, char *argv[])
             if (argsJackname.contains(prevArg)) {
                 appInfo.jackClientName = arg;
                 print("JACK name specified: " + appInfo.jackClientName);
+            } else if (argsBridgeClient.contains(prevArg)) {
+                bridgeClientShm = arg;
+            } else if (argsStatusFile.contains(prevArg)) {
+                appInfo.bridgeStatusFile = arg;
+            } else if (argsBenchmarkSfz.contains(prevArg)) {
+                benchmarkSfz = arg;
+            } else if (argsBenchmarkBridge.contains(prevArg)) {
+                benchmarkBridge = arg;
+            } else if (argsBenchmarkFluidsynth.contains(prevArg)) {
+                benchmarkFluidsynth = arg;
+            } else if (argsBenchmarkScript.contains(prevArg)) {
+                benchmarkScript = arg;
+            } else if (argsSharedJsEngines.contains(prevArg)) {
+                appInfo.sharedJsEngines = qMax(0, arg.toInt());
+                print(QString("Shared Javascript engines: %1")
+                      .arg(appInfo.sharedJsEngines));
             }
             nextIsValue = false;
         }
@@ -168,7 +306,101 @@ int main(int argc, char *argv[])
 
 
 
-    if (scanMode) {
+    if (!bridgeClientShm.isEmpty()) {
+
+        // Bridge client mode: the program is started by another instance in
+        // bridge mode to load an sfz in a separate process to protect against
+        // crashes. Audio and MIDI are exchanged with the parent through shared
+        // memory.
+
+#ifdef KONFYT_USE_CARLA
+        KonfytBridgeClient c;
+        return c.run(bridgeClientShm, appInfo.filesToLoad.value(0));
+#else
+        print("Bridge client mode requires Carla support.");
+        return 1;
+#endif
+
+    } else if (!benchmarkSfz.isEmpty()) {
+
+        // Benchmark mode: render the sfz offline in the built-in sampler at
+        // increasing polyphony and print the results.
+
+        QStringList report = KonfytSfzEngine::runPolyphonyBenchmark(
+                    benchmarkSfz, 128, 48000);
+        foreach (QString line, report) {
+            print(line);
+        }
+        return 0;
+
+    } else if (!benchmarkBridge.isEmpty()) {
+
+        // Benchmark mode: play the sfz in real time at 64 frames in-process
+        // and through the bridge transport and print the missed cycles.
+
+        QStringList report = KonfytBridgeEngine::runTransportBenchmark(
+                    benchmarkBridge, 64, 48000, 10);
+        foreach (QString line, report) {
+            print(line);
+        }
+        return 0;
+
+    } else if (!benchmarkFluidsynth.isEmpty()) {
+
+        // Benchmark mode: render increasing numbers of soundfont layers
+        // offline with and without shared synths and print the results.
+
+        QStringList report = KonfytFluidsynthEngine::runLayerBenchmark(
+                    benchmarkFluidsynth, 128, 48000);
+        foreach (QString line, report) {
+            print(line);
+        }
+        return 0;
+
+    } else if (!benchmarkScript.isEmpty()) {
+
+        // Benchmark mode: run the script offline with generated MIDI events
+        // and print the event rate.
+
+        QCoreApplication a(argc, argv);
+
+        QFile f(benchmarkScript);
+        if (!f.open(QIODevice::ReadOnly)) {
+            print("Could not open script file " + benchmarkScript);
+            return 1;
+        }
+        QStringList report = KonfytJSEnv::runBenchmark(
+                    QString::fromUtf8(f.readAll()), 200000);
+        foreach (QString line, report) {
+            print(line);
+        }
+        return 0;
+
+    } else if (benchmarkMidiFilter) {
+
+        // Benchmark mode: pass generated MIDI events through MIDI filters and
+        // print the event rate.
+
+        QStringList report = KonfytJackEngine::runFilterBenchmark(10000000);
+        foreach (QString line, report) {
+            print(line);
+        }
+        return 0;
+
+    } else if (benchmarkMidiOut) {
+
+        // Benchmark mode: write generated events to a MIDI output queue, check
+        // their output order and print the event rate. Exits with 1 if a check
+        // failed.
+
+        bool ok = true;
+        QStringList report = KonfytJackEngine::runMidiOutQueueBenchmark(100000, &ok);
+        foreach (QString line, report) {
+            print(line);
+        }
+        return ok ? 0 : 1;
+
+    } else if (scanMode) {
 
         // Scan mode: the program is started in scan mode by another instance
         // in order to scan soundfonts in a separate process to protect against
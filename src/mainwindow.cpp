@@ -25,6 +25,7 @@
 #include "file.h"
 
 #include <QClipboard>
+#include <QJsonDocument>
 
 
 MainWindow::MainWindow(QWidget *parent, KonfytAppInfo appInfoArg) :
@@ -56,6 +57,7 @@ MainWindow::MainWindow(QWidget *parent, KonfytAppInfo appInfoArg) :
     setupPortConnectionWarnings();
     setupScriptingWarnings();
     setupSfzEngineWarnings();
+    setupJackEngineWarnings();
     // ----------------------------------------------------
     setupInitialProjectFromCmdLineArgs();
 
@@ -399,6 +401,8 @@ void MainWindow::setupScripting()
             this, &MainWindow::onPortScriptErrorStatusChanged);
 
     scriptEngine.setJackEngine(&jack);
+    scriptEngine.setSharedEngineCount(appInfo.sharedJsEngines);
+    scriptEngine.setDetailedProfiling(appInfo.profileScripts);
 
     // Setup timer that periodically gets script info from the engine
     connect(&scriptInfoTimer, &QTimer::timeout, this, &MainWindow::onScriptInfoTimer);
@@ -508,10 +512,57 @@ void MainWindow::updateScriptEditorScriptProcessTimeText(float perEventMs,
 {
     QString text = QString("%1 ms")
             .arg((double)perEventMs, 0, 'f', 3);
+    if (perEventMs > 0) {
+        text += QString(" (%1 events/s)").arg(1000.0 / perEventMs, 0, 'f', 0);
+    }
+    if (!mScriptInitStatsText.isEmpty()) {
+        text += "  |  " + mScriptInitStatsText;
+    }
 
     ui->label_script_processTime->setText(text);
 }
 
+void MainWindow::updateScriptEditorInitStatsText(KonfytJSEnv::InitStats stats)
+{
+    mScriptInitStatsText = QString("init %1 ms, ~%2 KiB%3")
+            .arg((double)stats.timeMs, 0, 'f', 1)
+            .arg(stats.memoryBytes / 1024)
+            .arg(stats.sharedEngine ? (stats.compiledFromCache ?
+                                           " (shared engine, cached)"
+                                         : " (shared engine)")
+                                    : "");
+}
+
+/* Show a summary of the script profile from KonfytJSEngine::scriptProfile(). */
+void MainWindow::updateScriptEditorProfileText(QJsonObject profile)
+{
+    auto ms = [](const QJsonValue& ns) {
+        return QString::number(ns.toDouble() / 1000000.0, 'f', 3);
+    };
+
+    QJsonObject events = profile.value("events").toObject();
+    QJsonObject delay = profile.value("queueDelay").toObject();
+    QString text = QString("Per event: p50 %1, p99 %2, max %3 ms (%4 events)")
+            .arg(ms(events.value("p50Ns")))
+            .arg(ms(events.value("p99Ns")))
+            .arg(ms(events.value("maxNs")))
+            .arg(events.value("count").toDouble(), 0, 'f', 0);
+    text += QString("  |  Queue: %1 events (max %2), delay p99 %3 ms, %4 pending runs")
+            .arg(profile.value("queueDepth").toInt())
+            .arg(profile.value("maxQueueDepth").toInt())
+            .arg(ms(delay.value("p99Ns")))
+            .arg(profile.value("workerQueueDepth").toInt());
+
+    QJsonObject gc = profile.value("gc").toObject();
+    if (gc.value("count").toDouble() > 0) {
+        text += QString("  |  GC: p99 %1, max %2 ms")
+                .arg(ms(gc.value("p99Ns")))
+                .arg(ms(gc.value("maxNs")));
+    }
+
+    ui->label_script_profile->setText(text);
+}
+
 void MainWindow::updateScriptEditorErrorText(QString errorString)
 {
     if (errorString.isEmpty()) {
@@ -530,6 +581,12 @@ void MainWindow::onScriptInfoTimer()
     if (mScriptEditLayer) {
 
         PatchLayerPtr layer = mScriptEditLayer;
+        scriptEngine.scriptInitStats(layer, this, [=](KonfytJSEnv::InitStats stats)
+        {
+            if (this->mScriptEditLayer == layer) {
+                updateScriptEditorInitStatsText(stats);
+            }
+        });
         scriptEngine.scriptAverageProcessTimeMs(layer, this,
                                     [=](float perEventMs, float totalProcessMs)
         {
@@ -537,10 +594,22 @@ void MainWindow::onScriptInfoTimer()
                 updateScriptEditorScriptProcessTimeText(perEventMs, totalProcessMs);
             }
         });
+        scriptEngine.scriptProfile(layer, this, [=](QJsonObject profile)
+        {
+            if (this->mScriptEditLayer == layer) {
+                updateScriptEditorProfileText(profile);
+            }
+        });
 
     } else if (mScriptEditPort) {
 
         Project::MidiPortPtr port = mScriptEditPort;
+        scriptEngine.scriptInitStats(port, this, [=](KonfytJSEnv::InitStats stats)
+        {
+            if (this->mScriptEditPort == port) {
+                updateScriptEditorInitStatsText(stats);
+            }
+        });
         scriptEngine.scriptAverageProcessTimeMs(port, this,
                                     [=](float perEventMs, float totalProcessMs)
         {
@@ -548,6 +617,12 @@ void MainWindow::onScriptInfoTimer()
                 updateScriptEditorScriptProcessTimeText(perEventMs, totalProcessMs);
             }
         });
+        scriptEngine.scriptProfile(port, this, [=](QJsonObject profile)
+        {
+            if (this->mScriptEditPort == port) {
+                updateScriptEditorProfileText(profile);
+            }
+        });
 
     }
 }
@@ -660,6 +735,36 @@ void MainWindow::on_checkBox_script_passMidiThrough_toggled(bool checked)
     }
 }
 
+/* Copy the profile of the script being edited to the clipboard as JSON, and
+ * print it to the console. */
+void MainWindow::on_pushButton_script_copyProfile_clicked()
+{
+    auto copy = [=](QString name, QJsonObject profile)
+    {
+        profile["script"] = name;
+        QString json = QJsonDocument(profile).toJson();
+        QGuiApplication::clipboard()->setText(json);
+        print("Script profile copied to clipboard:");
+        print(json);
+    };
+
+    if (mScriptEditLayer) {
+        PatchLayerPtr layer = mScriptEditLayer;
+        scriptEngine.scriptProfile(layer, this, [=](QJsonObject profile)
+        {
+            copy(layer->uri, profile);
+        });
+    } else if (mScriptEditPort) {
+        Project::MidiPortPtr port = mScriptEditPort;
+        scriptEngine.scriptProfile(port, this, [=](QJsonObject profile)
+        {
+            copy(port->name, profile);
+        });
+    } else {
+        print("Error: no script edit layer or port set");
+    }
+}
+
 void MainWindow::on_pushButton_scriptEditor_OK_clicked()
 {
     // Return to the previous screen that was stored when the script editor was shown
@@ -5433,6 +5538,31 @@ void MainWindow::sfzEngineWarnings_onItemDoubleClicked(QListWidgetItem* item)
     }
 }
 
+void MainWindow::setupJackEngineWarnings()
+{
+    connect(&jack, &KonfytJackEngine::midiEventsDropped,
+            this, &MainWindow::jackEngineWarnings_onMidiEventsDropped);
+}
+
+void MainWindow::jackEngineWarnings_onMidiEventsDropped(QString info)
+{
+    if (info.isEmpty()) {
+        // Remove warning item if it exists
+        if (jackEngineWarningItem) {
+            delete jackEngineWarningItem; // Removes item from QListWidget
+            jackEngineWarningItem = nullptr;
+        }
+    } else {
+        // Events were dropped. Create item if it doesn't exist.
+        if (!jackEngineWarningItem) {
+            jackEngineWarningItem = new QListWidgetItem();
+            ui->listWidget_Warnings->addItem(jackEngineWarningItem);
+        }
+        jackEngineWarningItem->setText(
+                    "JACK Engine: " + info.split("\n").join(", "));
+    }
+}
+
 void MainWindow::on_stackedWidget_currentChanged(int /*arg1*/)
 {
     QWidget* currentWidget = ui->stackedWidget->currentWidget();
@@ -6838,6 +6968,11 @@ void MainWindow::addAudioBusToJack(int busNo, KfJackAudioPort **leftPort, KfJack
 {
     *leftPort = jack.addAudioPort(QString("bus_%1_L").arg(busNo), KfJackPort::OUTPUT);
     *rightPort = jack.addAudioPort(QString("bus_%1_R").arg(busNo), KfJackPort::OUTPUT);
+    if (*leftPort && *rightPort) {
+        scriptEngine.setAudioBus(busNo, *leftPort, *rightPort);
+        // Shared reverb and chorus fed by the layer send levels
+        jack.addFxBus(*leftPort, *rightPort);
+    }
 }
 
 /* Adds an audio bus to the current project and Jack. Returns bus index.
@@ -6994,6 +7129,14 @@ void MainWindow::removeAudioBusFromEngines(Project::AudioPortPtr bus)
 {
     if (!bus) { return; }
 
+    if (mCurrentProject) {
+        foreach (int busId, mCurrentProject->audioBus_getAllBusIds()) {
+            if (mCurrentProject->audioBus_getBus(busId) == bus) {
+                scriptEngine.removeAudioBus(busId);
+            }
+        }
+    }
+
     jack.removeAudioPort(bus->leftJackPort);
     jack.removeAudioPort(bus->rightJackPort);
 
@@ -9584,6 +9727,10 @@ void MainWindow::setupJack()
             this, &MainWindow::onJackAudioEventsReceived);
 
     connect(&jack, &KonfytJackEngine::xrunOccurred, this, &MainWindow::onJackXrunOccurred);
+    connect(&jack, &KonfytJackEngine::statisticsInfo, this, [=](QString msg)
+    {
+        ui->textBrowser_EngineStatistics->setText(msg);
+    });
 
     QString jackClientName = appInfo.jackClientName;
     if (jackClientName.isEmpty()) {
@@ -898,6 +898,9 @@ private:
     QTimer scriptInfoTimer;
     void updateScriptEditorScriptProcessTimeText(float perEventMs, float totalProcessMs);
     void updateScriptEditorTotalProcessTimeText(float processTimeMs);
+    QString mScriptInitStatsText;
+    void updateScriptEditorInitStatsText(KonfytJSEnv::InitStats stats);
+    void updateScriptEditorProfileText(QJsonObject profile);
     void updateScriptEditorErrorText(QString errorString);
 private slots:
     void onScriptInfoTimer();
@@ -913,6 +916,7 @@ private slots:
     void on_checkBox_script_enable_toggled(bool checked);
     void on_checkBox_script_passMidiThrough_toggled(bool checked);
     void on_pushButton_scriptEditor_OK_clicked();
+    void on_pushButton_script_copyProfile_clicked();
     void on_plainTextEdit_script_textChanged();
 
     // Listing scripts from projects
@@ -1111,6 +1115,13 @@ private slots:
     void sfzEngineWarnings_onSfzEngineErrorChanged(QString error);
     void sfzEngineWarnings_onItemDoubleClicked(QListWidgetItem* item);
 
+    // JACK engine warnings
+private:
+    void setupJackEngineWarnings();
+    QListWidgetItem* jackEngineWarningItem = nullptr;
+private slots:
+    void jackEngineWarnings_onMidiEventsDropped(QString info);
+
     // -----------------------------------------------------------------------
     // Other
 